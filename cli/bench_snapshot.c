@@ -0,0 +1,180 @@
+#define _GNU_SOURCE
+
+/* C standard library */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* POSIX */
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+/* Linux */
+#include <bpf/bpf.h>
+
+// --------------------------------------------------------------------------------------------------------------------
+// Snapshot latency against the size of the counters array
+//
+// It compares the ways `bpfcov gen` can read a global data map holding the counters (.profc) and write it:
+// - copy: lookup into malloc'd buffers, copy, and fwrite (what `bpfcov gen` did)
+// - lookup: lookup into a reused buffer, and writev
+// - mmap: writev straight from the read-only mapping of the map (BPF_F_MMAPABLE)
+//
+// Usage: sudo ./bench_snapshot [output (defaults to /dev/null)] [iterations (defaults to 1000)]
+// --------------------------------------------------------------------------------------------------------------------
+
+#define MIN_COUNTERS (1 << 10)
+#define MAX_COUNTERS (1 << 19) // Array maps values can not exceed KMALLOC_MAX_SIZE (usually 4MiB)
+
+static char head[80];
+static char tail[8];
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static int snapshot_copy(int fd, size_t size, FILE *outfp)
+{
+    __u32 *k = malloc(sizeof(__u32));
+    void *v = malloc(size);
+    void *data = malloc(size);
+    int err = -1;
+    if (!k || !v || !data)
+    {
+        goto error_out;
+    }
+    if (bpf_map_get_next_key(fd, NULL, k) || bpf_map_lookup_elem(fd, k, v))
+    {
+        goto error_out;
+    }
+    memcpy(data, v, size);
+    fwrite(head, sizeof(head), 1, outfp);
+    fwrite(data, size, 1, outfp);
+    fwrite(tail, sizeof(tail), 1, outfp);
+    err = fflush(outfp);
+
+error_out:
+    free(k);
+    free(v);
+    free(data);
+    return err;
+}
+
+static int snapshot_writev(int outfd, const void *counters, size_t size)
+{
+    struct iovec iov[3] = {
+        {.iov_base = head, .iov_len = sizeof(head)},
+        {.iov_base = (void *)counters, .iov_len = size},
+        {.iov_base = tail, .iov_len = sizeof(tail)},
+    };
+    return writev(outfd, iov, 3) < 0 ? -1 : 0;
+}
+
+static int snapshot_lookup(int fd, void *buf, size_t size, int outfd)
+{
+    __u32 key = 0;
+    if (bpf_map_lookup_elem(fd, &key, buf))
+    {
+        return -1;
+    }
+    return snapshot_writev(outfd, buf, size);
+}
+
+int main(int argc, char **argv)
+{
+    const char *output = argc > 1 ? argv[1] : "/dev/null";
+    int iterations = argc > 2 ? atoi(argv[2]) : 1000;
+    if (iterations <= 0)
+    {
+        fprintf(stderr, "invalid number of iterations '%s'\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+
+    FILE *outfp = fopen(output, "wb");
+    if (!outfp)
+    {
+        fprintf(stderr, "could not open '%s': %s\n", output, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    int outfd = fileno(outfp);
+
+    double *samples = calloc(iterations, sizeof(double));
+    void *buf = malloc(MAX_COUNTERS * 8);
+    if (!samples || !buf)
+    {
+        fprintf(stderr, "%s\n", "could not allocate the buffers");
+        return EXIT_FAILURE;
+    }
+
+    printf("%10s %12s %12s %12s   (median us per snapshot, %d iterations)\n", "counters", "copy", "lookup", "mmap", iterations);
+    for (size_t num_counters = MIN_COUNTERS; num_counters <= MAX_COUNTERS; num_counters <<= 1)
+    {
+        size_t size = num_counters * 8;
+        LIBBPF_OPTS(bpf_map_create_opts, opts, .map_flags = BPF_F_MMAPABLE);
+        int fd = bpf_map_create(BPF_MAP_TYPE_ARRAY, NULL, sizeof(__u32), size, 1, &opts);
+        if (fd < 0)
+        {
+            fprintf(stderr, "could not create a map of %zu counters: %s\n", num_counters, strerror(errno));
+            return EXIT_FAILURE;
+        }
+        void *mapped = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED)
+        {
+            fprintf(stderr, "could not mmap a map of %zu counters: %s\n", num_counters, strerror(errno));
+            return EXIT_FAILURE;
+        }
+
+        double median[3];
+        for (int method = 0; method < 3; method++)
+        {
+            for (int i = 0; i < iterations; i++)
+            {
+                double start = now_us();
+                int err;
+                switch (method)
+                {
+                case 0:
+                    err = snapshot_copy(fd, size, outfp);
+                    break;
+                case 1:
+                    err = snapshot_lookup(fd, buf, size, outfd);
+                    break;
+                default:
+                    err = snapshot_writev(outfd, mapped, size);
+                    break;
+                }
+                if (err)
+                {
+                    fprintf(stderr, "could not take a snapshot: %s\n", strerror(errno));
+                    return EXIT_FAILURE;
+                }
+                samples[i] = now_us() - start;
+            }
+            qsort(samples, iterations, sizeof(double), cmp_double);
+            median[method] = samples[iterations / 2];
+        }
+        printf("%10zu %12.2f %12.2f %12.2f\n", num_counters, median[0], median[1], median[2]);
+
+        munmap(mapped, size);
+        close(fd);
+    }
+
+    fclose(outfp);
+    free(samples);
+    free(buf);
+
+    return 0;
+}
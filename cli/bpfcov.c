@@ -14,6 +14,7 @@
 #include <stdbool.h>
 #include <time.h>
 #include <string.h>
+#include <signal.h>
 
 /* POSIX */
 #include <unistd.h>
@@ -22,6 +23,12 @@
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <sys/vfs.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <dirent.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <elf.h>
 
 /* Linux */
 #include <syscall.h>
@@ -29,8 +36,17 @@
 #include <linux/limits.h>
 #include <linux/magic.h>
 #include <bpf/bpf.h>
+#include <bpf/libbpf.h>
 
 #include <argp.h>
+#include <zlib.h>
+
+#include "bpfprog.h"
+#include "covmap.h"
+#include "profdata.h"
+#include "report.h"
+#include "sweep.h"
+#include "sweep.skel.h"
 
 // --------------------------------------------------------------------------------------------------------------------
 // Global info
@@ -65,12 +81,60 @@ void out_cmd(struct argp_state *state);
 static error_t out_parse(int key, char *arg, struct argp_state *state);
 int out(struct root_args *args);
 
+void reset_cmd(struct argp_state *state);
+static error_t reset_parse(int key, char *arg, struct argp_state *state);
+int reset(struct root_args *args);
+
+void sweep_cmd(struct argp_state *state);
+static error_t sweep_parse(int key, char *arg, struct argp_state *state);
+int sweep(struct root_args *args);
+
+void merge_cmd(struct argp_state *state);
+static error_t merge_parse(int key, char *arg, struct argp_state *state);
+int merge(struct root_args *args);
+
+void densify_cmd(struct argp_state *state);
+static error_t densify_parse(int key, char *arg, struct argp_state *state);
+int densify(struct root_args *args);
+
+void top_cmd(struct argp_state *state);
+static error_t top_parse(int key, char *arg, struct argp_state *state);
+int top(struct root_args *args);
+
+void diff_cmd(struct argp_state *state);
+static error_t diff_parse(int key, char *arg, struct argp_state *state);
+int diff(struct root_args *args);
+
+void annotate_cmd(struct argp_state *state);
+static error_t annotate_parse(int key, char *arg, struct argp_state *state);
+int annotate(struct root_args *args);
+
+void cost_cmd(struct argp_state *state);
+static error_t cost_parse(int key, char *arg, struct argp_state *state);
+int cost(struct root_args *args);
+
 static bool is_bpffs(char *bpffs_path);
 static void strip_trailing_char(char *str, char c);
 static void replace_with(char *str, const char what, const char with);
 static void strip_extension(char *str);
 static void handle_map_pins(struct root_args *args, struct argp_state *state, bool unpin);
-static void wait_or_exit(struct root_args *args, pid_t pid, char *err);
+static char *default_output(struct argp_state *state, char *program, const char *extension);
+static void add_input(struct argp_state *state, struct root_args *args, char *path);
+static void add_input_files(struct argp_state *state, struct root_args *args, const char *list);
+
+struct cov_maps;
+static int open_pinned_maps(struct root_args *args, const char *object, int generation, struct cov_maps *maps);
+static int open_pinned_generations(struct root_args *args, const char *object, struct cov_maps **maps);
+static int write_profraw(struct root_args *args, struct cov_maps *maps, int num_maps, FILE *outfp);
+static FILE *open_output(struct root_args *args, const char *output, const char *object, bool append);
+static void list_pinned_objects(struct root_args *args);
+static void close_maps(struct cov_maps *maps);
+static int get_prog_pin_path(struct root_args *args, const char *object, const char *name, int generation, char *pin_path);
+static int parse_duration(const char *str, struct timespec *duration);
+static bool is_stdout(const char *output);
+static bool is_periodic(struct root_args *args);
+static bool is_offline(struct root_args *args);
+static int load_covmap(struct root_args *args, const char *path, struct covmap **cm);
 
 // --------------------------------------------------------------------------------------------------------------------
 // Logging
@@ -126,11 +190,19 @@ int main(int argc, char **argv)
 // --------------------------------------------------------------------------------------------------------------------
 
 #define NUM_PINNED_MAPS 4
+#define NUM_BANK_MAPS 2 // Only for double-buffered counters
+#define NUM_COV_MAPS (NUM_PINNED_MAPS + NUM_BANK_MAPS)
+#define GRACE_PERIOD_FALLBACK_MS 100
+#define MAX_GENERATIONS 4096
+#define PROG_PIN_PREFIX "prog_"
+#define RUNSTATS_EXTENSION "runstats"
 
 #define FOREACH_FORMAT(FORMAT) \
     FORMAT(FORMAT_, html)      \
     FORMAT(FORMAT_, json)      \
-    FORMAT(FORMAT_, lcov)
+    FORMAT(FORMAT_, lcov)      \
+    FORMAT(FORMAT_, folded)    \
+    FORMAT(FORMAT_, pprof)
 
 #define GEN_ENUM(PREFIX, ENUM) PREFIX##ENUM,
 #define GEN_STRING(PREFIX, STRING) #STRING,
@@ -144,18 +216,71 @@ static const char *format_string[] = {FOREACH_FORMAT(GEN_STRING)};
 
 typedef enum out_format out_format_t;
 
+#define FOREACH_PROFILE(PROFILE) \
+    PROFILE(PROFILE_, profraw)   \
+    PROFILE(PROFILE_, profdata)  \
+    PROFILE(PROFILE_, sparse)
+
+enum profile_format
+{
+    FOREACH_PROFILE(GEN_ENUM)
+};
+
+static const char *profile_string[] = {FOREACH_PROFILE(GEN_STRING)};
+
+typedef enum profile_format profile_format_t;
+
+static const char *pin_name[NUM_COV_MAPS] = {"profc", "profd", "profn", "covmap", "profb", "profs"};
+
+struct cov_maps
+{
+    char object[BPF_OBJ_NAME_LEN];
+    int fd[NUM_COV_MAPS];
+    struct bpf_map_info info[NUM_COV_MAPS];
+};
+
+// A program using the bpfcov maps of a BPF object, and its run time stats
+struct cov_prog
+{
+    char object[BPF_OBJ_NAME_LEN];
+    int fd;
+    struct bpf_prog_info info;
+};
+
 struct root_args
 {
     bool unpin;
+    bool gen_on_exit;
+    bool accumulate;
+    bool split;
+    bool gzip;
+    bool delta;
+    bool reset;
+    bool incremental;
+    bool jited;
+    struct timespec interval;
+    struct cov_maps *held;
+    int num_held;
+    struct cov_prog *held_progs;
+    int num_held_progs;
     char *output;
     char *bpffs;
     char *cov_root;
     char *prog_root;
-    char *pin[NUM_PINNED_MAPS];
+    char **objects;
+    int num_objects;
     char **profraw;
     char *report_path;
     int num_profraw;
+    int max_profraw;
+    char **bpfobj;
+    int num_bpfobj;
+    char *instrumented;
+    char *plain;
     out_format_t out_format;
+    profile_format_t gen_format;
+    int jobs;
+    int limit;
     int verbosity;
     callback_t command;
     char **program;
@@ -191,12 +316,20 @@ static char root_docs[] =
     "  EXAMPLES:\n"
     "  bpfcov run <program>\n"
     "  bpfcov gen <program>\n"
-    "  bpfcov out <program.profraw>+\n";
+    "  bpfcov out <program.profraw>+\n"
+    "  bpfcov reset <program>\n"
+    "  bpfcov sweep\n"
+    "  bpfcov merge <program.profraw>+\n"
+    "  bpfcov densify <program.sparse>+\n"
+    "  bpfcov top <program>|<program.profraw>+\n"
+    "  bpfcov diff <before.profraw> <after.profraw>\n"
+    "  bpfcov annotate <program>|<program.profraw>+\n"
+    "  bpfcov cost <program>\n";
 
 static struct argp root_argp = {
     .options = root_opts,
     .parser = root_parse,
-    .args_doc = "[run|gen|out] <arg(s)>",
+    .args_doc = "[run|gen|out|reset|sweep|merge|densify|top|diff|annotate|cost] <arg(s)>",
     .doc = root_docs,
 };
 
@@ -218,6 +351,17 @@ static error_t root_parse(int key, char *arg, struct argp_state *state)
         args->program = calloc(PATH_MAX, sizeof(char *));
         args->output = NULL;
         args->unpin = false;
+        args->gen_on_exit = false;
+        args->accumulate = false;
+        args->split = false;
+        args->delta = false;
+        args->reset = false;
+        args->interval.tv_sec = 0;
+        args->interval.tv_nsec = 0;
+        args->objects = NULL;
+        args->num_objects = 0;
+        args->held = NULL;
+        args->num_held = 0;
         break;
 
     case ROOT_BPFFS_OPT_KEY:
@@ -271,6 +415,46 @@ static error_t root_parse(int key, char *arg, struct argp_state *state)
             args->command = &out;
             out_cmd(state);
         }
+        else if (strncmp(arg, "reset", 5) == 0)
+        {
+            args->command = &reset;
+            reset_cmd(state);
+        }
+        else if (strncmp(arg, "sweep", 5) == 0)
+        {
+            args->command = &sweep;
+            sweep_cmd(state);
+        }
+        else if (strncmp(arg, "merge", 5) == 0)
+        {
+            args->command = &merge;
+            merge_cmd(state);
+        }
+        else if (strncmp(arg, "densify", 7) == 0)
+        {
+            args->command = &densify;
+            densify_cmd(state);
+        }
+        else if (strncmp(arg, "top", 3) == 0)
+        {
+            args->command = &top;
+            top_cmd(state);
+        }
+        else if (strncmp(arg, "diff", 4) == 0)
+        {
+            args->command = &diff;
+            diff_cmd(state);
+        }
+        else if (strncmp(arg, "annotate", 8) == 0)
+        {
+            args->command = &annotate;
+            annotate_cmd(state);
+        }
+        else if (strncmp(arg, "cost", 4) == 0)
+        {
+            args->command = &cost;
+            cost_cmd(state);
+        }
         else
         {
             args->program[state->arg_num] = arg;
@@ -284,7 +468,7 @@ static error_t root_parse(int key, char *arg, struct argp_state *state)
         {
             argp_state_help(state, state->err_stream, ARGP_HELP_STD_HELP);
         }
-        if (args->command != &out && args->program[0] == NULL)
+        if (args->command != &out && args->command != &sweep && args->command != &merge && args->command != &densify && args->command != &diff && args->command != &cost && !is_offline(args) && args->program[0] == NULL)
         {
             // This should never happen
             argp_error(state, "unexpected missing <program>");
@@ -295,11 +479,11 @@ static error_t root_parse(int key, char *arg, struct argp_state *state)
     case ARGP_KEY_FINI:
         bool is_run = args->command == &run;
 
-        // When the subcommand is <out>
+        // When the subcommand is <out>, <sweep>, <merge>, <densify>, <diff>, or <cost>, or <run> does not pin the maps, or <top> or <annotate> read profraw files
         // - do not validate BPF FS
         // - do not generate pinning paths
-        // - do not clean up (<run>) or check (<gen>) pinned maps
-        if (args->command == &out)
+        // - do not clean up (<run>) or check (<gen>, <top>, <annotate>) pinned maps
+        if (args->command == &out || args->command == &sweep || args->command == &merge || args->command == &densify || args->command == &diff || args->command == &cost || is_offline(args) || (is_run && args->gen_on_exit))
         {
             break;
         }
@@ -321,7 +505,7 @@ static error_t root_parse(int key, char *arg, struct argp_state *state)
         {
             argp_error(state, "could not create '%s'", cov_root);
         }
-        args->cov_root = cov_root;
+        args->cov_root = strdup(cov_root);
 
         // Obtain the program name and create a directory in the BPF filesystem for it
         char *prog_name = basename(args->program[0]);
@@ -340,46 +524,17 @@ static error_t root_parse(int key, char *arg, struct argp_state *state)
         args->prog_root = prog_root_sane;
         log_info(args, "root directory for map pins at '%s'\n", prog_root_sane);
 
-        // Create pinning path for the counters map
-        char pin_profc[PATH_MAX];
-        int pin_profc_len = snprintf(pin_profc, PATH_MAX, "%s/%s", prog_root_sane, "profc");
-        if (pin_profc_len >= PATH_MAX)
-        {
-            argp_error(state, "counters pinning path too long");
-        }
-        args->pin[0] = pin_profc;
-
-        // Create pinning path for the data map
-        char pin_profd[PATH_MAX];
-        int pin_profd_len = snprintf(pin_profd, PATH_MAX, "%s/%s", prog_root_sane, "profd");
-        if (pin_profd_len >= PATH_MAX)
-        {
-            argp_error(state, "data pinning path too long");
-        }
-        args->pin[1] = pin_profd;
-
-        // Create pinning path for the names map
-        char pin_profn[PATH_MAX];
-        int pin_profn_len = snprintf(pin_profn, PATH_MAX, "%s/%s", prog_root_sane, "profn");
-        if (pin_profn_len >= PATH_MAX)
-        {
-            argp_error(state, "names pinning path too long");
-        }
-        args->pin[2] = pin_profn;
-
-        // Create pinning path for the coverage mapping header
-        char pin_covmap[PATH_MAX];
-        int pin_covmap_len = snprintf(pin_covmap, PATH_MAX, "%s/%s", prog_root_sane, "covmap");
-        if (pin_covmap_len >= PATH_MAX)
-        {
-            argp_error(state, "coverage mapping header path too long");
-        }
-        args->pin[3] = pin_covmap;
+        // The pins of each BPF object live in their own directory (<prog_root>/<object>/<map>)
+        list_pinned_objects(args);
 
         // Check whether the map pinning paths already exist:
         // - unpin them in case they do exist and the current subcommand is `run`
+        // - keep them (when any) in case `run` accumulates, the first session starts without pins
         // - error out in case the do not exist and the current subcommand is `gen`
-        handle_map_pins(args, state, is_run);
+        if (!is_run || !args->accumulate)
+        {
+            handle_map_pins(args, state, is_run);
+        }
 
         break;
 
@@ -419,7 +574,23 @@ struct run_args
     struct root_args *parent;
 };
 
+const char GEN_SPLIT_OPT_KEY = 0x84;
+const char GEN_SPLIT_OPT_LONG[] = "split";
+const char RUN_GEN_ON_EXIT_OPT_KEY = 0x82;
+const char RUN_GEN_ON_EXIT_OPT_LONG[] = "gen-on-exit";
+const char RUN_ACCUMULATE_OPT_KEY = 0x83;
+const char RUN_ACCUMULATE_OPT_LONG[] = "accumulate";
+const char RUN_OUTPUT_OPT_KEY = 'o';
+const char RUN_OUTPUT_OPT_LONG[] = "output";
+const char RUN_OUTPUT_OPT_ARG[] = "path";
+
 static struct argp_option run_opts[] = {
+    {"OPTIONS:", 0, 0, OPTION_DOC, 0, 0},
+    {RUN_GEN_ON_EXIT_OPT_LONG, RUN_GEN_ON_EXIT_OPT_KEY, 0, 0, "Do not pin the maps, generate the profraw file when the program exits", 1},
+    {RUN_OUTPUT_OPT_LONG, RUN_OUTPUT_OPT_KEY, RUN_OUTPUT_OPT_ARG, 0, "Set the output path when generating on exit\n(defaults to <program>.profraw)", 1},
+    {RUN_ACCUMULATE_OPT_LONG, RUN_ACCUMULATE_OPT_KEY, 0, 0, "Keep the maps of previous runs and of reloaded programs as further generations", 1},
+    {GEN_SPLIT_OPT_LONG, GEN_SPLIT_OPT_KEY, 0, 0, "Write one profraw for each BPF object when generating on exit\n(<output>.<object>.profraw)", 1},
+    {"\n", 0, 0, OPTION_DOC, 0, 0},
     {"GLOBALS:", 0, 0, OPTION_DOC, 0, 0},
     {0} // .
 };
@@ -448,6 +619,27 @@ run_parse(int key, char *arg, struct argp_state *state)
 
     switch (key)
     {
+    case RUN_GEN_ON_EXIT_OPT_KEY:
+        args->parent->gen_on_exit = true;
+        break;
+
+    case RUN_ACCUMULATE_OPT_KEY:
+        args->parent->accumulate = true;
+        break;
+
+    case GEN_SPLIT_OPT_KEY:
+        args->parent->split = true;
+        break;
+
+    case RUN_OUTPUT_OPT_KEY:
+        if (strlen(arg) > 0)
+        {
+            args->parent->output = arg;
+            break;
+        }
+        argp_error(state, "option '--%s' requires a %s", RUN_OUTPUT_OPT_LONG, RUN_OUTPUT_OPT_ARG);
+        break;
+
     case ARGP_KEY_ARG:
         args->parent->program[state->arg_num] = arg;
         break;
@@ -461,6 +653,18 @@ run_parse(int key, char *arg, struct argp_state *state)
         {
             argp_error(state, "program '%s' does not actually exist", args->parent->program[0]);
         }
+        if (args->parent->output && !args->parent->gen_on_exit)
+        {
+            argp_error(state, "option '--%s' requires '--%s'", RUN_OUTPUT_OPT_LONG, RUN_GEN_ON_EXIT_OPT_LONG);
+        }
+        if (args->parent->split && !args->parent->gen_on_exit)
+        {
+            argp_error(state, "option '--%s' requires '--%s'", GEN_SPLIT_OPT_LONG, RUN_GEN_ON_EXIT_OPT_LONG);
+        }
+        if (args->parent->gen_on_exit && !args->parent->output)
+        {
+            args->parent->output = default_output(state, args->parent->program[0], profile_string[PROFILE_profraw]);
+        }
         break;
 
     default:
@@ -514,11 +718,29 @@ const char GEN_OUTPUT_OPT_LONG[] = "output";
 const char GEN_OUTPUT_OPT_ARG[] = "path";
 const char GEN_UNPIN_OPT_KEY = 0x81;
 const char GEN_UNPIN_OPT_LONG[] = "unpin";
+const char GEN_INTERVAL_OPT_KEY = 0x86;
+const char GEN_INTERVAL_OPT_LONG[] = "interval";
+const char GEN_INTERVAL_OPT_ARG[] = "duration";
+const char GEN_DELTA_OPT_KEY = 0x87;
+const char GEN_DELTA_OPT_LONG[] = "delta";
+const char GEN_RESET_OPT_KEY = 0x88;
+const char GEN_RESET_OPT_LONG[] = "reset";
+const char GEN_GZIP_OPT_KEY = 'z';
+const char GEN_GZIP_OPT_LONG[] = "gzip";
+const char GEN_FORMAT_OPT_KEY = 'f';
+const char GEN_FORMAT_OPT_LONG[] = "format";
+const char GEN_FORMAT_OPT_ARG[] = "profraw|profdata|sparse";
 
 static struct argp_option gen_opts[] = {
     {"OPTIONS:", 0, 0, OPTION_DOC, 0, 0},
-    {GEN_OUTPUT_OPT_LONG, GEN_OUTPUT_OPT_KEY, GEN_OUTPUT_OPT_ARG, 0, "Set the output path\n(defaults to <program>.profraw)", 1},
+    {GEN_OUTPUT_OPT_LONG, GEN_OUTPUT_OPT_KEY, GEN_OUTPUT_OPT_ARG, 0, "Set the output path, - for the standard output\n(defaults to <program>.<format>)", 1},
+    {GEN_GZIP_OPT_LONG, GEN_GZIP_OPT_KEY, 0, 0, "Compress the profraw (or sparse) with gzip\n(out, merge, and densify read it as is)", 1},
+    {GEN_FORMAT_OPT_LONG, GEN_FORMAT_OPT_KEY, GEN_FORMAT_OPT_ARG, 0, "Set the output format\n(defaults to profraw, profdata is what llvm-cov reads, sparse only holds the non-zero counters)", 1},
     {GEN_UNPIN_OPT_LONG, GEN_UNPIN_OPT_KEY, 0, 0, "Unpin the maps", 1},
+    {GEN_SPLIT_OPT_LONG, GEN_SPLIT_OPT_KEY, 0, 0, "Write one profraw for each BPF object\n(<output>.<object>.profraw)", 1},
+    {GEN_INTERVAL_OPT_LONG, GEN_INTERVAL_OPT_KEY, GEN_INTERVAL_OPT_ARG, 0, "Keep running and write a timestamped profraw every duration (eg. 500ms, 30s, 5m, 1h)\n(<output>.<timestamp>.profraw)", 1},
+    {GEN_DELTA_OPT_LONG, GEN_DELTA_OPT_KEY, 0, 0, "Only count what happened since the previous snapshot", 1},
+    {GEN_RESET_OPT_LONG, GEN_RESET_OPT_KEY, 0, 0, "Drain the double-buffered counters without losing increments\n(counts since the previous reset)", 1},
     {"\n", 0, 0, OPTION_DOC, 0, 0},
     {"GLOBALS:", 0, 0, OPTION_DOC, 0, 0},
     {0} // .
@@ -561,6 +783,54 @@ gen_parse(int key, char *arg, struct argp_state *state)
         args->parent->unpin = true;
         break;
 
+    case GEN_SPLIT_OPT_KEY:
+        args->parent->split = true;
+        break;
+
+    case GEN_INTERVAL_OPT_KEY:
+        if (parse_duration(arg, &args->parent->interval))
+        {
+            argp_error(state, "option '--%s' requires a %s (eg. 500ms, 30s, 5m, 1h)", GEN_INTERVAL_OPT_LONG, GEN_INTERVAL_OPT_ARG);
+        }
+        break;
+
+    case GEN_DELTA_OPT_KEY:
+        args->parent->delta = true;
+        break;
+
+    case GEN_RESET_OPT_KEY:
+        args->parent->reset = true;
+        break;
+
+    case GEN_GZIP_OPT_KEY:
+        args->parent->gzip = true;
+        break;
+
+    case GEN_FORMAT_OPT_KEY:
+        if (strlen(arg) > 0)
+        {
+            /**/ if (strcmp(arg, "profraw") == 0)
+            {
+                args->parent->gen_format = PROFILE_profraw;
+            }
+            else if (strcmp(arg, "profdata") == 0)
+            {
+                args->parent->gen_format = PROFILE_profdata;
+            }
+            else if (strcmp(arg, "sparse") == 0)
+            {
+                args->parent->gen_format = PROFILE_sparse;
+            }
+            /**/ else
+            {
+                goto gen_format_error;
+            }
+            break;
+        }
+    gen_format_error:
+        argp_error(state, "option '--%s' requires a value (%s)", GEN_FORMAT_OPT_LONG, GEN_FORMAT_OPT_ARG);
+        break;
+
     case ARGP_KEY_ARG:
         // NOTE > Collecting also other arguments/options even though they are not used to generate the pinning path
         args->parent->program[state->arg_num] = arg;
@@ -575,15 +845,25 @@ gen_parse(int key, char *arg, struct argp_state *state)
         {
             argp_error(state, "program '%s' does not actually exist", args->parent->program[0]);
         }
+        if (args->parent->delta && !is_periodic(args->parent))
+        {
+            argp_error(state, "option '--%s' requires '--%s'", GEN_DELTA_OPT_LONG, GEN_INTERVAL_OPT_LONG);
+        }
+        if (args->parent->delta && args->parent->reset)
+        {
+            argp_error(state, "options '--%s' and '--%s' are mutually exclusive", GEN_DELTA_OPT_LONG, GEN_RESET_OPT_LONG);
+        }
+        if (args->parent->gzip && args->parent->gen_format == PROFILE_profdata)
+        {
+            argp_error(state, "option '--%s' does not apply to profdata files", GEN_GZIP_OPT_LONG);
+        }
+        if (args->parent->split && args->parent->output && is_stdout(args->parent->output))
+        {
+            argp_error(state, "option '--%s' requires an output path", GEN_SPLIT_OPT_LONG);
+        }
         if (!args->parent->output)
         {
-            char output_path[PATH_MAX];
-            int output_path_len = snprintf(output_path, PATH_MAX, "%s.%s", args->parent->program[0], "profraw");
-            if (output_path_len >= PATH_MAX)
-            {
-                argp_error(state, "default output path too long");
-            }
-            args->parent->output = output_path;
+            args->parent->output = default_output(state, args->parent->program[0], profile_string[args->parent->gen_format]);
         }
         break;
 
@@ -636,14 +916,29 @@ struct out_args
 const char OUT_OUTPUT_OPT_KEY = 'o';
 const char OUT_OUTPUT_OPT_LONG[] = "output";
 const char OUT_OUTPUT_OPT_ARG[] = "path";
+const char OUT_OBJECT_OPT_KEY = 0x85;
+const char OUT_OBJECT_OPT_LONG[] = "object";
+const char OUT_OBJECT_OPT_ARG[] = "path";
 const char OUT_FORMAT_OPT_KEY = 'f';
 const char OUT_FORMAT_OPT_LONG[] = "format";
-const char OUT_FORMAT_OPT_ARG[] = "html|json|lcov";
+const char OUT_FORMAT_OPT_ARG[] = "html|json|lcov|folded|pprof";
+const char OUT_JOBS_OPT_KEY = 'j';
+const char OUT_JOBS_OPT_LONG[] = "jobs";
+const char OUT_JOBS_OPT_ARG[] = "number";
+const char OUT_INPUT_FILES_OPT_KEY = 0x8a;
+const char OUT_INPUT_FILES_OPT_LONG[] = "input-files";
+const char OUT_INPUT_FILES_OPT_ARG[] = "path";
+const char OUT_INCREMENTAL_OPT_KEY = 0x8b;
+const char OUT_INCREMENTAL_OPT_LONG[] = "incremental";
 
 static struct argp_option out_opts[] = {
     {"OPTIONS:", 0, 0, OPTION_DOC, 0, 0},
-    {OUT_OUTPUT_OPT_LONG, OUT_OUTPUT_OPT_KEY, OUT_OUTPUT_OPT_ARG, 0, "   Set the output path\n   (defaults to out[_html/|.json|.lcov])", 1},
+    {OUT_OUTPUT_OPT_LONG, OUT_OUTPUT_OPT_KEY, OUT_OUTPUT_OPT_ARG, 0, "   Set the output path\n   (defaults to out[_html/|.json|.lcov|.folded])", 1},
     {OUT_FORMAT_OPT_LONG, OUT_FORMAT_OPT_KEY, OUT_FORMAT_OPT_ARG, 0, "Set the output format\n   (defaults to html)", 1},
+    {OUT_OBJECT_OPT_LONG, OUT_OBJECT_OPT_KEY, OUT_OBJECT_OPT_ARG, 0, "   Add a BPF coverage object (*.bpf.obj)\n   (for profraw files holding many BPF objects)", 1},
+    {OUT_JOBS_OPT_LONG, OUT_JOBS_OPT_KEY, OUT_JOBS_OPT_ARG, 0, "Set the number of parallel jobs\n   (defaults to 1, more runs llvm-cov for each BPF object)", 1},
+    {OUT_INPUT_FILES_OPT_LONG, OUT_INPUT_FILES_OPT_KEY, OUT_INPUT_FILES_OPT_ARG, 0, "Add the profraw files listed in a file\n   (one path for each line)", 1},
+    {OUT_INCREMENTAL_OPT_LONG, OUT_INCREMENTAL_OPT_KEY, 0, 0, "Only regenerate the HTML pages whose coverage\n   or source changed since the last run", 1},
     {"\n", 0, 0, OPTION_DOC, 0, 0},
     {"GLOBALS:", 0, 0, OPTION_DOC, 0, 0},
     {0} // .
@@ -674,8 +969,29 @@ out_parse(int key, char *arg, struct argp_state *state)
     switch (key)
     {
     case ARGP_KEY_INIT:
-        args->parent->profraw = calloc(PATH_MAX, sizeof(char *));
+        args->parent->profraw = NULL;
         args->parent->num_profraw = 0;
+        args->parent->max_profraw = 0;
+        args->parent->bpfobj = calloc(PATH_MAX, sizeof(char *));
+        args->parent->num_bpfobj = 0;
+        break;
+    case OUT_INPUT_FILES_OPT_KEY:
+        add_input_files(state, args->parent, arg);
+        break;
+    case OUT_OBJECT_OPT_KEY:
+        if (strlen(arg) == 0)
+        {
+            argp_error(state, "option '--%s' requires a %s", OUT_OBJECT_OPT_LONG, OUT_OBJECT_OPT_ARG);
+        }
+        if (access(arg, F_OK) != 0)
+        {
+            argp_error(state, "BPF coverage object '%s' does not actually exist", arg);
+        }
+        if (args->parent->num_bpfobj == PATH_MAX - 1)
+        {
+            argp_error(state, "too many '--%s' options", OUT_OBJECT_OPT_LONG);
+        }
+        args->parent->bpfobj[args->parent->num_bpfobj++] = arg;
         break;
     case OUT_OUTPUT_OPT_KEY:
         if (strlen(arg) > 0)
@@ -701,6 +1017,14 @@ out_parse(int key, char *arg, struct argp_state *state)
             {
                 args->parent->out_format = FORMAT_lcov;
             }
+            else if (strncmp(arg, "folded", 6) == 0)
+            {
+                args->parent->out_format = FORMAT_folded;
+            }
+            else if (strncmp(arg, "pprof", 5) == 0)
+            {
+                args->parent->out_format = FORMAT_pprof;
+            }
             /**/ else
             {
                 goto out_format_error;
@@ -711,13 +1035,29 @@ out_parse(int key, char *arg, struct argp_state *state)
         argp_error(state, "option '--%s' requires a value (%s)", OUT_FORMAT_OPT_LONG, OUT_FORMAT_OPT_ARG);
         break;
 
+    case OUT_JOBS_OPT_KEY:
+    {
+        char *end;
+        long jobs = strtol(arg, &end, 10);
+        if (*arg == '\0' || *end != '\0' || jobs <= 0 || jobs > 1024)
+        {
+            argp_error(state, "option '--%s' requires a %s (1-1024)", OUT_JOBS_OPT_LONG, OUT_JOBS_OPT_ARG);
+        }
+        args->parent->jobs = jobs;
+        break;
+    }
+
+    case OUT_INCREMENTAL_OPT_KEY:
+        args->parent->incremental = true;
+        break;
+
     case ARGP_KEY_ARG:
         assert(arg);
-        args->parent->profraw[state->arg_num] = arg;
+        add_input(state, args->parent, arg);
         break;
 
     case ARGP_KEY_END:
-        if (args->parent->profraw[0] == NULL)
+        if (args->parent->num_profraw == 0)
         {
             argp_error(state, "at least one profraw input file is required");
         }
@@ -728,27 +1068,39 @@ out_parse(int key, char *arg, struct argp_state *state)
                 argp_error(state, "input profraw file '%s' does not actually exist", profraw);
             }
             // TODO(leodido) > check it really is a profraw file?
-            args->parent->num_profraw++;
         }
         if (!args->parent->report_path)
         {
             char *sep = ".";
+            const char *extension = format_string[args->parent->out_format];
             switch (args->parent->out_format)
             {
             case FORMAT_html:
                 sep = "_";
                 break;
+            case FORMAT_pprof:
+                // What pprof names its profiles
+                extension = "pb.gz";
+                break;
             default:
                 break;
             }
 
             char report_path[PATH_MAX];
-            int report_path_len = snprintf(report_path, PATH_MAX, "%s%s%s", "out", sep, format_string[args->parent->out_format]);
+            int report_path_len = snprintf(report_path, PATH_MAX, "%s%s%s", "out", sep, extension);
             if (report_path_len >= PATH_MAX)
             {
                 argp_error(state, "default output path too long");
             }
-            args->parent->report_path = report_path;
+            args->parent->report_path = strdup(report_path);
+        }
+        if (args->parent->jobs == 0)
+        {
+            args->parent->jobs = 1;
+        }
+        if (args->parent->incremental && args->parent->out_format != FORMAT_html)
+        {
+            argp_error(state, "option '--%s' only applies to the html format", OUT_INCREMENTAL_OPT_LONG);
         }
         break;
 
@@ -790,746 +1142,7214 @@ void out_cmd(struct argp_state *state)
 }
 
 // --------------------------------------------------------------------------------------------------------------------
-// Miscellaneous
+// CLI / bpfcov reset
 // --------------------------------------------------------------------------------------------------------------------
 
-const char *argp_key(int key, char *str)
+struct reset_args
 {
-    str[0] = key;
-    str[1] = 0;
+    struct root_args *parent;
+};
 
-    switch (key)
-    {
-    case ARGP_KEY_ARG:
-        return "ARGP_KEY_ARG";
-    case ARGP_KEY_ARGS:
-        return "ARGP_KEY_ARGS";
-    case ARGP_KEY_END:
-        return "ARGP_KEY_END";
-    case ARGP_KEY_NO_ARGS:
-        return "ARGP_KEY_NO_ARGS";
-    case ARGP_KEY_INIT:
-        return "ARGP_KEY_INIT";
-    case ARGP_KEY_SUCCESS:
-        return "ARGP_KEY_SUCCESS";
-    case ARGP_KEY_ERROR:
-        return "ARGP_KEY_ERROR";
-    case ARGP_KEY_FINI:
-        return "ARGP_KEY_FINI";
-    }
+static struct argp_option reset_opts[] = {
+    {"GLOBALS:", 0, 0, OPTION_DOC, 0, 0},
+    {0} // .
+};
 
-    return str;
+static char reset_docs[] = "\n"
+                           "Zero the counters of the bpfcov instrumented eBPF applications in place.\n"
+                           "\n";
+
+static struct argp reset_argp = {
+    .options = reset_opts,
+    .parser = reset_parse,
+    .args_doc = "<program>",
+    .doc = reset_docs,
 };
 
-void print_log(int level, const char *prefix, struct root_args *args, const char *fmt, ...)
+static error_t
+reset_parse(int key, char *arg, struct argp_state *state)
 {
-    if (args->verbosity < level)
-    {
-        return;
-    }
+    struct reset_args *args = state->input;
 
-    FILE *f = level == 0 ? stderr : stdout;
-    va_list argptr;
-    va_start(argptr, fmt);
+    assert(args);
+    assert(args->parent);
 
-    if (!prefix || (prefix && !*prefix))
-    {
-        goto without_prefix;
-    }
+    char str[2];
+    log_debu(args->parent, "parsing <reset> %s = '%s'\n", argp_key(key, str), arg ? arg : "(null)");
 
-    char *category = "unkn";
-    switch (level)
+    switch (key)
     {
-    case 0:
-        category = "erro";
-        break;
-    case 1:
-        category = "warn";
-        break;
-    case 2:
-        category = "info";
+    case ARGP_KEY_ARG:
+        // NOTE > Collecting also other arguments/options even though they are not used to generate the pinning path
+        args->parent->program[state->arg_num] = arg;
         break;
-    case 3:
-        category = "debu";
+
+    case ARGP_KEY_END:
+        if (!args->parent->program[0])
+        {
+            argp_error(state, "missing program argument");
+        }
+        if (access(args->parent->program[0], F_OK) != 0)
+        {
+            argp_error(state, "program '%s' does not actually exist", args->parent->program[0]);
+        }
         break;
-    }
 
-    fprintf(f, "%s: %s: ", TOOL_NAME, category);
+    default:
+        log_debu(args->parent, "parsing <reset> UNKNOWN = '%s'\n", arg ? arg : "(null)");
+        return ARGP_ERR_UNKNOWN;
+    }
 
-without_prefix:
-    vfprintf(f, fmt, argptr);
-    va_end(argptr);
+    return 0;
 }
 
-static bool is_bpffs(char *bpffs_path)
+void reset_cmd(struct argp_state *state)
 {
-    struct statfs st_fs;
+    struct reset_args args = {};
+    int argc = state->argc - state->next + 1;
+    char **argv = &state->argv[state->next - 1];
+    char *argv0 = argv[0];
 
-    if (statfs(bpffs_path, &st_fs) < 0)
-        return false;
+    args.parent = state->input;
 
-    return st_fs.f_type == BPF_FS_MAGIC;
-}
+    log_debu(args.parent, "begin <reset> (argc = %d, argv[0] = %s)\n", argc, argv[0]);
 
-static void strip_trailing_char(char *str, char c)
-{
-    int last = strlen(str) - 1;
-    while (last > 0 && str[last] == c)
+    argv[0] = malloc(strlen(state->name) + strlen(" reset") + 1);
+    if (!argv[0])
     {
-        str[last--] = '\0';
+        argp_failure(state, 1, ENOMEM, 0);
     }
-}
+    sprintf(argv[0], "%s reset", state->name);
 
-static void replace_with(char *str, const char what, const char with)
-{
-    while (*str)
-    {
-        if (*str == what)
-        {
-            *str = with;
-        }
-        str++;
-    }
+    argp_parse(&reset_argp, argc, argv, ARGP_IN_ORDER, &argc, &args);
+
+    free(argv[0]);
+
+    argv[0] = argv0;
+
+    state->next += argc - 1;
+
+    log_debu(args.parent, "end <reset> (next = %d, argv[next] = %s)\n", state->next, state->argv[state->next]);
 }
 
-static void strip_extension(char *str)
+// --------------------------------------------------------------------------------------------------------------------
+// CLI / bpfcov sweep
+// --------------------------------------------------------------------------------------------------------------------
+
+struct sweep_args
+{
+    struct root_args *parent;
+};
+
+const char SWEEP_OUTPUT_OPT_KEY = 'o';
+const char SWEEP_OUTPUT_OPT_LONG[] = "output";
+const char SWEEP_OUTPUT_OPT_ARG[] = "directory";
+
+static struct argp_option sweep_opts[] = {
+    {"OPTIONS:", 0, 0, OPTION_DOC, 0, 0},
+    {SWEEP_OUTPUT_OPT_LONG, SWEEP_OUTPUT_OPT_KEY, SWEEP_OUTPUT_OPT_ARG, 0, "Set the output directory\n(defaults to the current one)", 1},
+    {"\n", 0, 0, OPTION_DOC, 0, 0},
+    {"GLOBALS:", 0, 0, OPTION_DOC, 0, 0},
+    {0} // .
+};
+
+static char sweep_docs[] = "\n"
+                           "Generate the profraw files of all the bpfcov instrumented BPF objects loaded on the host.\n"
+                           "\n";
+
+static struct argp sweep_argp = {
+    .options = sweep_opts,
+    .parser = sweep_parse,
+    .args_doc = "",
+    .doc = sweep_docs,
+};
+
+static error_t
+sweep_parse(int key, char *arg, struct argp_state *state)
+{
+    struct sweep_args *args = state->input;
+
+    assert(args);
+    assert(args->parent);
+
+    char str[2];
+    log_debu(args->parent, "parsing <sweep> %s = '%s'\n", argp_key(key, str), arg ? arg : "(null)");
+
+    switch (key)
+    {
+    case SWEEP_OUTPUT_OPT_KEY:
+        if (strlen(arg) > 0)
+        {
+            strip_trailing_char(arg, '/');
+            args->parent->output = arg;
+            break;
+        }
+        argp_error(state, "option '--%s' requires a %s", SWEEP_OUTPUT_OPT_LONG, SWEEP_OUTPUT_OPT_ARG);
+        break;
+
+    case ARGP_KEY_ARG:
+        argp_error(state, "unexpected argument '%s'", arg);
+        break;
+
+    case ARGP_KEY_END:
+        if (!args->parent->output)
+        {
+            args->parent->output = ".";
+        }
+        struct stat st;
+        if (stat(args->parent->output, &st) != 0 || !S_ISDIR(st.st_mode))
+        {
+            argp_error(state, "output directory '%s' does not actually exist", args->parent->output);
+        }
+        break;
+
+    default:
+        log_debu(args->parent, "parsing <sweep> UNKNOWN = '%s'\n", arg ? arg : "(null)");
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+void sweep_cmd(struct argp_state *state)
+{
+    struct sweep_args args = {};
+    int argc = state->argc - state->next + 1;
+    char **argv = &state->argv[state->next - 1];
+    char *argv0 = argv[0];
+
+    args.parent = state->input;
+
+    log_debu(args.parent, "begin <sweep> (argc = %d, argv[0] = %s)\n", argc, argv[0]);
+
+    argv[0] = malloc(strlen(state->name) + strlen(" sweep") + 1);
+    if (!argv[0])
+    {
+        argp_failure(state, 1, ENOMEM, 0);
+    }
+    sprintf(argv[0], "%s sweep", state->name);
+
+    argp_parse(&sweep_argp, argc, argv, ARGP_IN_ORDER, &argc, &args);
+
+    free(argv[0]);
+
+    argv[0] = argv0;
+
+    state->next += argc - 1;
+
+    log_debu(args.parent, "end <sweep> (next = %d, argv[next] = %s)\n", state->next, state->argv[state->next]);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// CLI / bpfcov merge
+// --------------------------------------------------------------------------------------------------------------------
+
+struct merge_args
+{
+    struct root_args *parent;
+};
+
+const char MERGE_OUTPUT_OPT_KEY = 'o';
+const char MERGE_OUTPUT_OPT_LONG[] = "output";
+const char MERGE_OUTPUT_OPT_ARG[] = "path";
+const char MERGE_FORMAT_OPT_KEY = 'f';
+const char MERGE_FORMAT_OPT_LONG[] = "format";
+const char MERGE_FORMAT_OPT_ARG[] = "profraw|profdata";
+const char MERGE_JOBS_OPT_KEY = 'j';
+const char MERGE_JOBS_OPT_LONG[] = "jobs";
+const char MERGE_JOBS_OPT_ARG[] = "number";
+const char MERGE_INPUT_FILES_OPT_KEY = 0x8a;
+const char MERGE_INPUT_FILES_OPT_LONG[] = "input-files";
+const char MERGE_INPUT_FILES_OPT_ARG[] = "path";
+
+static struct argp_option merge_opts[] = {
+    {"OPTIONS:", 0, 0, OPTION_DOC, 0, 0},
+    {MERGE_OUTPUT_OPT_LONG, MERGE_OUTPUT_OPT_KEY, MERGE_OUTPUT_OPT_ARG, 0, "Set the output path, - for the standard output\n(defaults to all.<format>)", 1},
+    {MERGE_FORMAT_OPT_LONG, MERGE_FORMAT_OPT_KEY, MERGE_FORMAT_OPT_ARG, 0, "Set the output format\n(defaults to profraw)", 1},
+    {MERGE_JOBS_OPT_LONG, MERGE_JOBS_OPT_KEY, MERGE_JOBS_OPT_ARG, 0, "Set the number of threads\n(defaults to the number of online CPUs)", 1},
+    {MERGE_INPUT_FILES_OPT_LONG, MERGE_INPUT_FILES_OPT_KEY, MERGE_INPUT_FILES_OPT_ARG, 0, "Add the profraw files listed in a file\n(one path for each line)", 1},
+    {"\n", 0, 0, OPTION_DOC, 0, 0},
+    {"GLOBALS:", 0, 0, OPTION_DOC, 0, 0},
+    {0} // .
+};
+
+static char merge_docs[] = "\n"
+                           "Merge many profraw files (the same BPF objects) into one, summing their counters.\n"
+                           "\n";
+
+static struct argp merge_argp = {
+    .options = merge_opts,
+    .parser = merge_parse,
+    .args_doc = "<profraw>+",
+    .doc = merge_docs,
+};
+
+static error_t
+merge_parse(int key, char *arg, struct argp_state *state)
+{
+    struct merge_args *args = state->input;
+
+    assert(args);
+    assert(args->parent);
+
+    char str[2];
+    log_debu(args->parent, "parsing <merge> %s = '%s'\n", argp_key(key, str), arg ? arg : "(null)");
+
+    switch (key)
+    {
+    case ARGP_KEY_INIT:
+        args->parent->profraw = NULL;
+        args->parent->num_profraw = 0;
+        args->parent->max_profraw = 0;
+        break;
+
+    case MERGE_INPUT_FILES_OPT_KEY:
+        add_input_files(state, args->parent, arg);
+        break;
+
+    case MERGE_OUTPUT_OPT_KEY:
+        if (strlen(arg) > 0)
+        {
+            args->parent->output = arg;
+            break;
+        }
+        argp_error(state, "option '--%s' requires a %s", MERGE_OUTPUT_OPT_LONG, MERGE_OUTPUT_OPT_ARG);
+        break;
+
+    case MERGE_FORMAT_OPT_KEY:
+        if (strlen(arg) > 0)
+        {
+            /**/ if (strcmp(arg, "profraw") == 0)
+            {
+                args->parent->gen_format = PROFILE_profraw;
+            }
+            else if (strcmp(arg, "profdata") == 0)
+            {
+                args->parent->gen_format = PROFILE_profdata;
+            }
+            /**/ else
+            {
+                goto merge_format_error;
+            }
+            break;
+        }
+    merge_format_error:
+        argp_error(state, "option '--%s' requires a value (%s)", MERGE_FORMAT_OPT_LONG, MERGE_FORMAT_OPT_ARG);
+        break;
+
+    case MERGE_JOBS_OPT_KEY:
+    {
+        char *end;
+        long jobs = strtol(arg, &end, 10);
+        if (*arg == '\0' || *end != '\0' || jobs <= 0 || jobs > 1024)
+        {
+            argp_error(state, "option '--%s' requires a %s (1-1024)", MERGE_JOBS_OPT_LONG, MERGE_JOBS_OPT_ARG);
+        }
+        args->parent->jobs = jobs;
+        break;
+    }
+
+    case ARGP_KEY_ARG:
+        assert(arg);
+        add_input(state, args->parent, arg);
+        break;
+
+    case ARGP_KEY_END:
+        if (args->parent->num_profraw == 0)
+        {
+            argp_error(state, "at least one profraw input file is required");
+        }
+        char **ptr = args->parent->profraw;
+        for (char *profraw = *ptr; profraw; profraw = *++ptr)
+        {
+            if (access(profraw, R_OK) != 0)
+            {
+                argp_error(state, "input profraw file '%s' does not actually exist", profraw);
+            }
+        }
+        if (!args->parent->output)
+        {
+            args->parent->output = default_output(state, "all", profile_string[args->parent->gen_format]);
+        }
+        if (args->parent->jobs == 0)
+        {
+            long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+            args->parent->jobs = cpus > 0 ? cpus : 1;
+        }
+        if (args->parent->jobs > args->parent->num_profraw)
+        {
+            args->parent->jobs = args->parent->num_profraw;
+        }
+        break;
+
+    default:
+        log_debu(args->parent, "parsing <merge> UNKNOWN = '%s'\n", arg ? arg : "(null)");
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+void merge_cmd(struct argp_state *state)
+{
+    struct merge_args args = {};
+    int argc = state->argc - state->next + 1;
+    char **argv = &state->argv[state->next - 1];
+    char *argv0 = argv[0];
+
+    args.parent = state->input;
+
+    log_debu(args.parent, "begin <merge> (argc = %d, argv[0] = %s)\n", argc, argv[0]);
+
+    argv[0] = malloc(strlen(state->name) + strlen(" merge") + 1);
+    if (!argv[0])
+    {
+        argp_failure(state, 1, ENOMEM, 0);
+    }
+    sprintf(argv[0], "%s merge", state->name);
+
+    argp_parse(&merge_argp, argc, argv, ARGP_IN_ORDER, &argc, &args);
+
+    free(argv[0]);
+
+    argv[0] = argv0;
+
+    state->next += argc - 1;
+
+    log_debu(args.parent, "end <merge> (next = %d, argv[next] = %s)\n", state->next, state->argv[state->next]);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// CLI / bpfcov densify
+// --------------------------------------------------------------------------------------------------------------------
+
+struct densify_args
+{
+    struct root_args *parent;
+};
+
+const char DENSIFY_OUTPUT_OPT_KEY = 'o';
+const char DENSIFY_OUTPUT_OPT_LONG[] = "output";
+const char DENSIFY_OUTPUT_OPT_ARG[] = "path";
+const char DENSIFY_OBJECT_OPT_KEY = 0x89;
+const char DENSIFY_OBJECT_OPT_LONG[] = "object";
+const char DENSIFY_OBJECT_OPT_ARG[] = "path";
+
+static struct argp_option densify_opts[] = {
+    {"OPTIONS:", 0, 0, OPTION_DOC, 0, 0},
+    {DENSIFY_OUTPUT_OPT_LONG, DENSIFY_OUTPUT_OPT_KEY, DENSIFY_OUTPUT_OPT_ARG, 0, "Set the output path\n(defaults to <input without extension>.profraw, only for a single input)", 1},
+    {DENSIFY_OBJECT_OPT_LONG, DENSIFY_OBJECT_OPT_KEY, DENSIFY_OBJECT_OPT_ARG, 0, "Add a BPF coverage object (*.bpf.obj)\n(for sparse files holding many BPF objects)", 1},
+    {"\n", 0, 0, OPTION_DOC, 0, 0},
+    {"GLOBALS:", 0, 0, OPTION_DOC, 0, 0},
+    {0} // .
+};
+
+static char densify_docs[] = "\n"
+                             "Turn sparse files back into profraw files, using the BPF coverage objects they come from.\n"
+                             "\n";
+
+static struct argp densify_argp = {
+    .options = densify_opts,
+    .parser = densify_parse,
+    .args_doc = "<sparse>+",
+    .doc = densify_docs,
+};
+
+static error_t
+densify_parse(int key, char *arg, struct argp_state *state)
+{
+    struct densify_args *args = state->input;
+
+    assert(args);
+    assert(args->parent);
+
+    char str[2];
+    log_debu(args->parent, "parsing <densify> %s = '%s'\n", argp_key(key, str), arg ? arg : "(null)");
+
+    switch (key)
+    {
+    case ARGP_KEY_INIT:
+        args->parent->profraw = NULL;
+        args->parent->num_profraw = 0;
+        args->parent->max_profraw = 0;
+        args->parent->bpfobj = calloc(PATH_MAX, sizeof(char *));
+        args->parent->num_bpfobj = 0;
+        break;
+
+    case DENSIFY_OUTPUT_OPT_KEY:
+        if (strlen(arg) > 0)
+        {
+            args->parent->output = arg;
+            break;
+        }
+        argp_error(state, "option '--%s' requires a %s", DENSIFY_OUTPUT_OPT_LONG, DENSIFY_OUTPUT_OPT_ARG);
+        break;
+
+    case DENSIFY_OBJECT_OPT_KEY:
+        if (strlen(arg) == 0)
+        {
+            argp_error(state, "option '--%s' requires a %s", DENSIFY_OBJECT_OPT_LONG, DENSIFY_OBJECT_OPT_ARG);
+        }
+        if (access(arg, R_OK) != 0)
+        {
+            argp_error(state, "BPF coverage object '%s' does not actually exist", arg);
+        }
+        if (args->parent->num_bpfobj == PATH_MAX - 1)
+        {
+            argp_error(state, "too many '--%s' options", DENSIFY_OBJECT_OPT_LONG);
+        }
+        args->parent->bpfobj[args->parent->num_bpfobj++] = arg;
+        break;
+
+    case ARGP_KEY_ARG:
+        assert(arg);
+        add_input(state, args->parent, arg);
+        break;
+
+    case ARGP_KEY_END:
+        if (args->parent->num_profraw == 0)
+        {
+            argp_error(state, "at least one sparse input file is required");
+        }
+        char **ptr = args->parent->profraw;
+        for (char *sparse = *ptr; sparse; sparse = *++ptr)
+        {
+            if (access(sparse, R_OK) != 0)
+            {
+                argp_error(state, "input sparse file '%s' does not actually exist", sparse);
+            }
+        }
+        if (args->parent->output && args->parent->num_profraw > 1)
+        {
+            argp_error(state, "option '--%s' only applies to a single input file", DENSIFY_OUTPUT_OPT_LONG);
+        }
+        break;
+
+    default:
+        log_debu(args->parent, "parsing <densify> UNKNOWN = '%s'\n", arg ? arg : "(null)");
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+void densify_cmd(struct argp_state *state)
+{
+    struct densify_args args = {};
+    int argc = state->argc - state->next + 1;
+    char **argv = &state->argv[state->next - 1];
+    char *argv0 = argv[0];
+
+    args.parent = state->input;
+
+    log_debu(args.parent, "begin <densify> (argc = %d, argv[0] = %s)\n", argc, argv[0]);
+
+    argv[0] = malloc(strlen(state->name) + strlen(" densify") + 1);
+    if (!argv[0])
+    {
+        argp_failure(state, 1, ENOMEM, 0);
+    }
+    sprintf(argv[0], "%s densify", state->name);
+
+    argp_parse(&densify_argp, argc, argv, ARGP_IN_ORDER, &argc, &args);
+
+    free(argv[0]);
+
+    argv[0] = argv0;
+
+    state->next += argc - 1;
+
+    log_debu(args.parent, "end <densify> (next = %d, argv[next] = %s)\n", state->next, state->argv[state->next]);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// CLI / bpfcov top
+// --------------------------------------------------------------------------------------------------------------------
+
+struct top_args
+{
+    struct root_args *parent;
+};
+
+const char TOP_OBJECT_OPT_KEY = 0x8c;
+const char TOP_OBJECT_OPT_LONG[] = "object";
+const char TOP_OBJECT_OPT_ARG[] = "path";
+const char TOP_LIMIT_OPT_KEY = 'n';
+const char TOP_LIMIT_OPT_LONG[] = "limit";
+const char TOP_LIMIT_OPT_ARG[] = "number";
+const char TOP_INTERVAL_OPT_KEY = 0x8d;
+const char TOP_INTERVAL_OPT_LONG[] = "interval";
+const char TOP_INTERVAL_OPT_ARG[] = "duration";
+
+static struct argp_option top_opts[] = {
+    {"OPTIONS:", 0, 0, OPTION_DOC, 0, 0},
+    {TOP_OBJECT_OPT_LONG, TOP_OBJECT_OPT_KEY, TOP_OBJECT_OPT_ARG, 0, "Add a BPF coverage object (*.bpf.obj)\n(defaults to the ones next to the inputs, or to the program)", 1},
+    {TOP_LIMIT_OPT_LONG, TOP_LIMIT_OPT_KEY, TOP_LIMIT_OPT_ARG, 0, "Set how many functions, lines, and regions to list\n(defaults to 10)", 1},
+    {TOP_INTERVAL_OPT_LONG, TOP_INTERVAL_OPT_KEY, TOP_INTERVAL_OPT_ARG, 0, "Keep running and refresh every duration (eg. 500ms, 1s, 5s), ranking by executions per second\n(only for pinned maps)", 1},
+    {"\n", 0, 0, OPTION_DOC, 0, 0},
+    {"GLOBALS:", 0, 0, OPTION_DOC, 0, 0},
+    {0} // .
+};
+
+static char top_docs[] = "\n"
+                         "List the hottest functions, lines, and regions of the bpfcov instrumented eBPF applications.\n"
+                         "\n"
+                         "It reads either the pinned maps of a program, or profraw files.\n"
+                         "\n";
+
+static struct argp top_argp = {
+    .options = top_opts,
+    .parser = top_parse,
+    .args_doc = "<program>|<profraw>+",
+    .doc = top_docs,
+};
+
+static bool has_extension(const char *path, const char *extension)
+{
+    size_t path_len = strlen(path);
+    size_t extension_len = strlen(extension);
+    return path_len > extension_len + 1 && path[path_len - extension_len - 1] == '.' &&
+           strcmp(path + path_len - extension_len, extension) == 0;
+}
+
+static error_t
+top_parse(int key, char *arg, struct argp_state *state)
+{
+    struct top_args *args = state->input;
+
+    assert(args);
+    assert(args->parent);
+
+    char str[2];
+    log_debu(args->parent, "parsing <top> %s = '%s'\n", argp_key(key, str), arg ? arg : "(null)");
+
+    switch (key)
+    {
+    case ARGP_KEY_INIT:
+        args->parent->profraw = NULL;
+        args->parent->num_profraw = 0;
+        args->parent->max_profraw = 0;
+        args->parent->bpfobj = calloc(PATH_MAX, sizeof(char *));
+        args->parent->num_bpfobj = 0;
+        args->parent->limit = 10;
+        args->parent->jobs = 1;
+        break;
+
+    case TOP_OBJECT_OPT_KEY:
+        if (strlen(arg) == 0)
+        {
+            argp_error(state, "option '--%s' requires a %s", TOP_OBJECT_OPT_LONG, TOP_OBJECT_OPT_ARG);
+        }
+        if (access(arg, R_OK) != 0)
+        {
+            argp_error(state, "BPF coverage object '%s' does not actually exist", arg);
+        }
+        if (args->parent->num_bpfobj == PATH_MAX - 1)
+        {
+            argp_error(state, "too many '--%s' options", TOP_OBJECT_OPT_LONG);
+        }
+        args->parent->bpfobj[args->parent->num_bpfobj++] = arg;
+        break;
+
+    case TOP_LIMIT_OPT_KEY:
+    {
+        char *end;
+        long limit = strtol(arg, &end, 10);
+        if (*arg == '\0' || *end != '\0' || limit <= 0 || limit > 10000)
+        {
+            argp_error(state, "option '--%s' requires a %s (1-10000)", TOP_LIMIT_OPT_LONG, TOP_LIMIT_OPT_ARG);
+        }
+        args->parent->limit = limit;
+        break;
+    }
+
+    case TOP_INTERVAL_OPT_KEY:
+        if (parse_duration(arg, &args->parent->interval))
+        {
+            argp_error(state, "option '--%s' requires a %s (eg. 500ms, 1s, 5s)", TOP_INTERVAL_OPT_LONG, TOP_INTERVAL_OPT_ARG);
+        }
+        break;
+
+    case ARGP_KEY_ARG:
+        assert(arg);
+        // Profraw files, or the program whose pinned maps to read
+        if (!args->parent->program[0] && has_extension(arg, profile_string[PROFILE_profraw]))
+        {
+            add_input(state, args->parent, arg);
+            break;
+        }
+        if (args->parent->num_profraw > 0)
+        {
+            argp_error(state, "input '%s' is not a profraw file", arg);
+        }
+        args->parent->program[state->arg_num] = arg;
+        break;
+
+    case ARGP_KEY_END:
+        if (args->parent->num_profraw == 0 && !args->parent->program[0])
+        {
+            argp_error(state, "missing program argument (or profraw input files)");
+        }
+        if (args->parent->program[0] && access(args->parent->program[0], F_OK) != 0)
+        {
+            argp_error(state, "program '%s' does not actually exist", args->parent->program[0]);
+        }
+        char **ptr = args->parent->profraw;
+        for (char *profraw = ptr ? *ptr : NULL; profraw; profraw = *++ptr)
+        {
+            if (access(profraw, R_OK) != 0)
+            {
+                argp_error(state, "input profraw file '%s' does not actually exist", profraw);
+            }
+        }
+        if (is_periodic(args->parent) && args->parent->num_profraw > 0)
+        {
+            argp_error(state, "option '--%s' only applies to the pinned maps of a program", TOP_INTERVAL_OPT_LONG);
+        }
+        break;
+
+    default:
+        log_debu(args->parent, "parsing <top> UNKNOWN = '%s'\n", arg ? arg : "(null)");
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+void top_cmd(struct argp_state *state)
+{
+    struct top_args args = {};
+    int argc = state->argc - state->next + 1;
+    char **argv = &state->argv[state->next - 1];
+    char *argv0 = argv[0];
+
+    args.parent = state->input;
+
+    log_debu(args.parent, "begin <top> (argc = %d, argv[0] = %s)\n", argc, argv[0]);
+
+    argv[0] = malloc(strlen(state->name) + strlen(" top") + 1);
+    if (!argv[0])
+    {
+        argp_failure(state, 1, ENOMEM, 0);
+    }
+    sprintf(argv[0], "%s top", state->name);
+
+    argp_parse(&top_argp, argc, argv, ARGP_IN_ORDER, &argc, &args);
+
+    free(argv[0]);
+
+    argv[0] = argv0;
+
+    state->next += argc - 1;
+
+    log_debu(args.parent, "end <top> (next = %d, argv[next] = %s)\n", state->next, state->argv[state->next]);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// CLI / bpfcov diff
+// --------------------------------------------------------------------------------------------------------------------
+
+struct diff_args
+{
+    struct root_args *parent;
+};
+
+const char DIFF_OBJECT_OPT_KEY = 0x8e;
+const char DIFF_OBJECT_OPT_LONG[] = "object";
+const char DIFF_OBJECT_OPT_ARG[] = "path";
+const char DIFF_LIMIT_OPT_KEY = 'n';
+const char DIFF_LIMIT_OPT_LONG[] = "limit";
+const char DIFF_LIMIT_OPT_ARG[] = "number";
+
+static struct argp_option diff_opts[] = {
+    {"OPTIONS:", 0, 0, OPTION_DOC, 0, 0},
+    {DIFF_OBJECT_OPT_LONG, DIFF_OBJECT_OPT_KEY, DIFF_OBJECT_OPT_ARG, 0, "Add a BPF coverage object (*.bpf.obj)\n(defaults to the ones next to the inputs)", 1},
+    {DIFF_LIMIT_OPT_LONG, DIFF_LIMIT_OPT_KEY, DIFF_LIMIT_OPT_ARG, 0, "Set how many regions to list\n(defaults to 10)", 1},
+    {"\n", 0, 0, OPTION_DOC, 0, 0},
+    {"GLOBALS:", 0, 0, OPTION_DOC, 0, 0},
+    {0} // .
+};
+
+static char diff_docs[] = "\n"
+                          "Compare how often every region ran in two profraw files, relative to the function entries of each.\n"
+                          "\n"
+                          "The regions whose relative frequency changed most come first.\n"
+                          "\n";
+
+static struct argp diff_argp = {
+    .options = diff_opts,
+    .parser = diff_parse,
+    .args_doc = "<before.profraw> <after.profraw>",
+    .doc = diff_docs,
+};
+
+static error_t
+diff_parse(int key, char *arg, struct argp_state *state)
+{
+    struct diff_args *args = state->input;
+
+    assert(args);
+    assert(args->parent);
+
+    char str[2];
+    log_debu(args->parent, "parsing <diff> %s = '%s'\n", argp_key(key, str), arg ? arg : "(null)");
+
+    switch (key)
+    {
+    case ARGP_KEY_INIT:
+        args->parent->profraw = NULL;
+        args->parent->num_profraw = 0;
+        args->parent->max_profraw = 0;
+        args->parent->bpfobj = calloc(PATH_MAX, sizeof(char *));
+        args->parent->num_bpfobj = 0;
+        args->parent->limit = 10;
+        break;
+
+    case DIFF_OBJECT_OPT_KEY:
+        if (strlen(arg) == 0)
+        {
+            argp_error(state, "option '--%s' requires a %s", DIFF_OBJECT_OPT_LONG, DIFF_OBJECT_OPT_ARG);
+        }
+        if (access(arg, R_OK) != 0)
+        {
+            argp_error(state, "BPF coverage object '%s' does not actually exist", arg);
+        }
+        if (args->parent->num_bpfobj == PATH_MAX - 1)
+        {
+            argp_error(state, "too many '--%s' options", DIFF_OBJECT_OPT_LONG);
+        }
+        args->parent->bpfobj[args->parent->num_bpfobj++] = arg;
+        break;
+
+    case DIFF_LIMIT_OPT_KEY:
+    {
+        char *end;
+        long limit = strtol(arg, &end, 10);
+        if (*arg == '\0' || *end != '\0' || limit <= 0 || limit > 10000)
+        {
+            argp_error(state, "option '--%s' requires a %s (1-10000)", DIFF_LIMIT_OPT_LONG, DIFF_LIMIT_OPT_ARG);
+        }
+        args->parent->limit = limit;
+        break;
+    }
+
+    case ARGP_KEY_ARG:
+        assert(arg);
+        if (args->parent->num_profraw == 2)
+        {
+            argp_error(state, "too many input files, it compares two profraw files");
+        }
+        add_input(state, args->parent, arg);
+        break;
+
+    case ARGP_KEY_END:
+        if (args->parent->num_profraw != 2)
+        {
+            argp_error(state, "two profraw input files are required");
+        }
+        for (int i = 0; i < args->parent->num_profraw; i++)
+        {
+            if (access(args->parent->profraw[i], R_OK) != 0)
+            {
+                argp_error(state, "input profraw file '%s' does not actually exist", args->parent->profraw[i]);
+            }
+        }
+        break;
+
+    default:
+        log_debu(args->parent, "parsing <diff> UNKNOWN = '%s'\n", arg ? arg : "(null)");
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+void diff_cmd(struct argp_state *state)
+{
+    struct diff_args args = {};
+    int argc = state->argc - state->next + 1;
+    char **argv = &state->argv[state->next - 1];
+    char *argv0 = argv[0];
+
+    args.parent = state->input;
+
+    log_debu(args.parent, "begin <diff> (argc = %d, argv[0] = %s)\n", argc, argv[0]);
+
+    argv[0] = malloc(strlen(state->name) + strlen(" diff") + 1);
+    if (!argv[0])
+    {
+        argp_failure(state, 1, ENOMEM, 0);
+    }
+    sprintf(argv[0], "%s diff", state->name);
+
+    argp_parse(&diff_argp, argc, argv, ARGP_IN_ORDER, &argc, &args);
+
+    free(argv[0]);
+
+    argv[0] = argv0;
+
+    state->next += argc - 1;
+
+    log_debu(args.parent, "end <diff> (next = %d, argv[next] = %s)\n", state->next, state->argv[state->next]);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// CLI / bpfcov annotate
+// --------------------------------------------------------------------------------------------------------------------
+
+struct annotate_args
+{
+    struct root_args *parent;
+};
+
+const char ANNOTATE_OBJECT_OPT_KEY = 0x8f;
+const char ANNOTATE_OBJECT_OPT_LONG[] = "object";
+const char ANNOTATE_OBJECT_OPT_ARG[] = "path";
+const char ANNOTATE_LIMIT_OPT_KEY = 'n';
+const char ANNOTATE_LIMIT_OPT_LONG[] = "limit";
+const char ANNOTATE_LIMIT_OPT_ARG[] = "number";
+const char ANNOTATE_JITED_OPT_KEY = 0x90;
+const char ANNOTATE_JITED_OPT_LONG[] = "jited";
+
+static struct argp_option annotate_opts[] = {
+    {"OPTIONS:", 0, 0, OPTION_DOC, 0, 0},
+    {ANNOTATE_OBJECT_OPT_LONG, ANNOTATE_OBJECT_OPT_KEY, ANNOTATE_OBJECT_OPT_ARG, 0, "Add a BPF coverage object (*.bpf.obj)\n(defaults to the ones next to the inputs, or to the program)", 1},
+    {ANNOTATE_LIMIT_OPT_LONG, ANNOTATE_LIMIT_OPT_KEY, ANNOTATE_LIMIT_OPT_ARG, 0, "Set how many instruction blocks to list\n(defaults to 10)", 1},
+    {ANNOTATE_JITED_OPT_LONG, ANNOTATE_JITED_OPT_KEY, 0, 0, "Annotate the JITed code of every line too\n(only for pinned maps)", 1},
+    {"\n", 0, 0, OPTION_DOC, 0, 0},
+    {"GLOBALS:", 0, 0, OPTION_DOC, 0, 0},
+    {0} // .
+};
+
+static char annotate_docs[] = "\n"
+                              "Annotate the BPF instructions of the bpfcov instrumented eBPF applications with the executions of their regions.\n"
+                              "\n"
+                              "It reads either the pinned maps of a program (and the instructions the kernel translated),\n"
+                              "or profraw files (and the instructions of the BPF coverage objects).\n"
+                              "\n";
+
+static struct argp annotate_argp = {
+    .options = annotate_opts,
+    .parser = annotate_parse,
+    .args_doc = "<program>|<profraw>+",
+    .doc = annotate_docs,
+};
+
+static error_t
+annotate_parse(int key, char *arg, struct argp_state *state)
+{
+    struct annotate_args *args = state->input;
+
+    assert(args);
+    assert(args->parent);
+
+    char str[2];
+    log_debu(args->parent, "parsing <annotate> %s = '%s'\n", argp_key(key, str), arg ? arg : "(null)");
+
+    switch (key)
+    {
+    case ARGP_KEY_INIT:
+        args->parent->profraw = NULL;
+        args->parent->num_profraw = 0;
+        args->parent->max_profraw = 0;
+        args->parent->bpfobj = calloc(PATH_MAX, sizeof(char *));
+        args->parent->num_bpfobj = 0;
+        args->parent->limit = 10;
+        args->parent->jobs = 1;
+        break;
+
+    case ANNOTATE_OBJECT_OPT_KEY:
+        if (strlen(arg) == 0)
+        {
+            argp_error(state, "option '--%s' requires a %s", ANNOTATE_OBJECT_OPT_LONG, ANNOTATE_OBJECT_OPT_ARG);
+        }
+        if (access(arg, R_OK) != 0)
+        {
+            argp_error(state, "BPF coverage object '%s' does not actually exist", arg);
+        }
+        if (args->parent->num_bpfobj == PATH_MAX - 1)
+        {
+            argp_error(state, "too many '--%s' options", ANNOTATE_OBJECT_OPT_LONG);
+        }
+        args->parent->bpfobj[args->parent->num_bpfobj++] = arg;
+        break;
+
+    case ANNOTATE_LIMIT_OPT_KEY:
+    {
+        char *end;
+        long limit = strtol(arg, &end, 10);
+        if (*arg == '\0' || *end != '\0' || limit <= 0 || limit > 10000)
+        {
+            argp_error(state, "option '--%s' requires a %s (1-10000)", ANNOTATE_LIMIT_OPT_LONG, ANNOTATE_LIMIT_OPT_ARG);
+        }
+        args->parent->limit = limit;
+        break;
+    }
+
+    case ANNOTATE_JITED_OPT_KEY:
+        args->parent->jited = true;
+        break;
+
+    case ARGP_KEY_ARG:
+        assert(arg);
+        // Profraw files, or the program whose pinned maps to read
+        if (!args->parent->program[0] && has_extension(arg, profile_string[PROFILE_profraw]))
+        {
+            add_input(state, args->parent, arg);
+            break;
+        }
+        if (args->parent->num_profraw > 0)
+        {
+            argp_error(state, "input '%s' is not a profraw file", arg);
+        }
+        args->parent->program[state->arg_num] = arg;
+        break;
+
+    case ARGP_KEY_END:
+        if (args->parent->num_profraw == 0 && !args->parent->program[0])
+        {
+            argp_error(state, "missing program argument (or profraw input files)");
+        }
+        if (args->parent->program[0] && access(args->parent->program[0], F_OK) != 0)
+        {
+            argp_error(state, "program '%s' does not actually exist", args->parent->program[0]);
+        }
+        char **ptr = args->parent->profraw;
+        for (char *profraw = ptr ? *ptr : NULL; profraw; profraw = *++ptr)
+        {
+            if (access(profraw, R_OK) != 0)
+            {
+                argp_error(state, "input profraw file '%s' does not actually exist", profraw);
+            }
+        }
+        if (args->parent->jited && args->parent->num_profraw > 0)
+        {
+            argp_error(state, "option '--%s' only applies to the pinned maps of a program", ANNOTATE_JITED_OPT_LONG);
+        }
+        break;
+
+    default:
+        log_debu(args->parent, "parsing <annotate> UNKNOWN = '%s'\n", arg ? arg : "(null)");
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+void annotate_cmd(struct argp_state *state)
+{
+    struct annotate_args args = {};
+    int argc = state->argc - state->next + 1;
+    char **argv = &state->argv[state->next - 1];
+    char *argv0 = argv[0];
+
+    args.parent = state->input;
+
+    log_debu(args.parent, "begin <annotate> (argc = %d, argv[0] = %s)\n", argc, argv[0]);
+
+    argv[0] = malloc(strlen(state->name) + strlen(" annotate") + 1);
+    if (!argv[0])
+    {
+        argp_failure(state, 1, ENOMEM, 0);
+    }
+    sprintf(argv[0], "%s annotate", state->name);
+
+    argp_parse(&annotate_argp, argc, argv, ARGP_IN_ORDER, &argc, &args);
+
+    free(argv[0]);
+
+    argv[0] = argv0;
+
+    state->next += argc - 1;
+
+    log_debu(args.parent, "end <annotate> (next = %d, argv[next] = %s)\n", state->next, state->argv[state->next]);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// CLI / bpfcov cost
+// --------------------------------------------------------------------------------------------------------------------
+
+struct cost_args
+{
+    struct root_args *parent;
+};
+
+const char COST_INSTRUMENTED_OPT_KEY = 0x91;
+const char COST_INSTRUMENTED_OPT_LONG[] = "instrumented";
+const char COST_INSTRUMENTED_OPT_ARG[] = "path";
+const char COST_PLAIN_OPT_KEY = 0x92;
+const char COST_PLAIN_OPT_LONG[] = "plain";
+const char COST_PLAIN_OPT_ARG[] = "path";
+
+static struct argp_option cost_opts[] = {
+    {"OPTIONS:", 0, 0, OPTION_DOC, 0, 0},
+    {COST_INSTRUMENTED_OPT_LONG, COST_INSTRUMENTED_OPT_KEY, COST_INSTRUMENTED_OPT_ARG, 0, "Set the instrumented BPF object\n(defaults to <program>.bpf.o)", 1},
+    {COST_PLAIN_OPT_LONG, COST_PLAIN_OPT_KEY, COST_PLAIN_OPT_ARG, 0, "Set the plain BPF object\n(defaults to <program>.bpf.o in the parent directory)", 1},
+    {"\n", 0, 0, OPTION_DOC, 0, 0},
+    {"GLOBALS:", 0, 0, OPTION_DOC, 0, 0},
+    {0} // .
+};
+
+static char cost_docs[] = "\n"
+                          "Compare what the programs of a bpfcov instrumented BPF object cost with the ones of the plain object.\n"
+                          "\n"
+                          "It loads both (without attaching anything), then reports the instructions the verifier went through, "
+                          "the translated instructions, and the JITed bytes of every program, the memory of the maps, and the load time.\n"
+                          "\n"
+                          "The objects default to the ones the examples Makefile outputs (.output/cov/<program>.bpf.o and .output/<program>.bpf.o).\n"
+                          "\n";
+
+static struct argp cost_argp = {
+    .options = cost_opts,
+    .parser = cost_parse,
+    .args_doc = "<program>",
+    .doc = cost_docs,
+};
+
+static error_t
+cost_parse(int key, char *arg, struct argp_state *state)
+{
+    struct cost_args *args = state->input;
+
+    assert(args);
+    assert(args->parent);
+
+    char str[2];
+    log_debu(args->parent, "parsing <cost> %s = '%s'\n", argp_key(key, str), arg ? arg : "(null)");
+
+    switch (key)
+    {
+    case ARGP_KEY_INIT:
+        args->parent->instrumented = NULL;
+        args->parent->plain = NULL;
+        break;
+
+    case COST_INSTRUMENTED_OPT_KEY:
+    case COST_PLAIN_OPT_KEY:
+    {
+        const char *opt = key == COST_PLAIN_OPT_KEY ? COST_PLAIN_OPT_LONG : COST_INSTRUMENTED_OPT_LONG;
+        if (strlen(arg) == 0)
+        {
+            argp_error(state, "option '--%s' requires a %s", opt, COST_PLAIN_OPT_ARG);
+        }
+        if (access(arg, R_OK) != 0)
+        {
+            argp_error(state, "BPF object '%s' does not actually exist", arg);
+        }
+        *(key == COST_PLAIN_OPT_KEY ? &args->parent->plain : &args->parent->instrumented) = strdup(arg);
+        break;
+    }
+
+    case ARGP_KEY_ARG:
+        assert(arg);
+        args->parent->program[state->arg_num] = arg;
+        break;
+
+    case ARGP_KEY_END:
+        if (!args->parent->program[0] && (!args->parent->instrumented || !args->parent->plain))
+        {
+            argp_error(state, "missing program argument (or '--%s' and '--%s' options)", COST_INSTRUMENTED_OPT_LONG, COST_PLAIN_OPT_LONG);
+        }
+        // The examples Makefile outputs the instrumented objects in a directory of their own, next to the plain ones
+        char path[PATH_MAX];
+        if (!args->parent->instrumented)
+        {
+            if (snprintf(path, PATH_MAX, "%s.bpf.o", args->parent->program[0]) >= PATH_MAX)
+            {
+                argp_error(state, "%s", "instrumented BPF object path too long");
+            }
+            args->parent->instrumented = strdup(path);
+        }
+        if (!args->parent->plain)
+        {
+            const char *program = args->parent->program[0];
+            const char *name = basename(program);
+            if (snprintf(path, PATH_MAX, "%.*s../%s.bpf.o", (int)(name - program), program, name) >= PATH_MAX)
+            {
+                argp_error(state, "%s", "plain BPF object path too long");
+            }
+            args->parent->plain = strdup(path);
+        }
+        if (access(args->parent->instrumented, R_OK) != 0)
+        {
+            argp_error(state, "instrumented BPF object '%s' does not actually exist (see '--%s')", args->parent->instrumented, COST_INSTRUMENTED_OPT_LONG);
+        }
+        if (access(args->parent->plain, R_OK) != 0)
+        {
+            argp_error(state, "plain BPF object '%s' does not actually exist (see '--%s')", args->parent->plain, COST_PLAIN_OPT_LONG);
+        }
+        break;
+
+    default:
+        log_debu(args->parent, "parsing <cost> UNKNOWN = '%s'\n", arg ? arg : "(null)");
+        return ARGP_ERR_UNKNOWN;
+    }
+
+    return 0;
+}
+
+void cost_cmd(struct argp_state *state)
+{
+    struct cost_args args = {};
+    int argc = state->argc - state->next + 1;
+    char **argv = &state->argv[state->next - 1];
+    char *argv0 = argv[0];
+
+    args.parent = state->input;
+
+    log_debu(args.parent, "begin <cost> (argc = %d, argv[0] = %s)\n", argc, argv[0]);
+
+    argv[0] = malloc(strlen(state->name) + strlen(" cost") + 1);
+    if (!argv[0])
+    {
+        argp_failure(state, 1, ENOMEM, 0);
+    }
+    sprintf(argv[0], "%s cost", state->name);
+
+    argp_parse(&cost_argp, argc, argv, ARGP_IN_ORDER, &argc, &args);
+
+    free(argv[0]);
+
+    argv[0] = argv0;
+
+    state->next += argc - 1;
+
+    log_debu(args.parent, "end <cost> (next = %d, argv[next] = %s)\n", state->next, state->argv[state->next]);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Miscellaneous
+// --------------------------------------------------------------------------------------------------------------------
+
+const char *argp_key(int key, char *str)
+{
+    str[0] = key;
+    str[1] = 0;
+
+    switch (key)
+    {
+    case ARGP_KEY_ARG:
+        return "ARGP_KEY_ARG";
+    case ARGP_KEY_ARGS:
+        return "ARGP_KEY_ARGS";
+    case ARGP_KEY_END:
+        return "ARGP_KEY_END";
+    case ARGP_KEY_NO_ARGS:
+        return "ARGP_KEY_NO_ARGS";
+    case ARGP_KEY_INIT:
+        return "ARGP_KEY_INIT";
+    case ARGP_KEY_SUCCESS:
+        return "ARGP_KEY_SUCCESS";
+    case ARGP_KEY_ERROR:
+        return "ARGP_KEY_ERROR";
+    case ARGP_KEY_FINI:
+        return "ARGP_KEY_FINI";
+    }
+
+    return str;
+};
+
+void print_log(int level, const char *prefix, struct root_args *args, const char *fmt, ...)
+{
+    if (args->verbosity < level)
+    {
+        return;
+    }
+
+    // Keep the standard output clean when streaming the profiles there
+    FILE *f = level == 0 || (args->output && is_stdout(args->output)) ? stderr : stdout;
+    va_list argptr;
+    va_start(argptr, fmt);
+
+    if (!prefix || (prefix && !*prefix))
+    {
+        goto without_prefix;
+    }
+
+    char *category = "unkn";
+    switch (level)
+    {
+    case 0:
+        category = "erro";
+        break;
+    case 1:
+        category = "warn";
+        break;
+    case 2:
+        category = "info";
+        break;
+    case 3:
+        category = "debu";
+        break;
+    }
+
+    fprintf(f, "%s: %s: ", TOOL_NAME, category);
+
+without_prefix:
+    vfprintf(f, fmt, argptr);
+    va_end(argptr);
+}
+
+static bool is_bpffs(char *bpffs_path)
+{
+    struct statfs st_fs;
+
+    if (statfs(bpffs_path, &st_fs) < 0)
+        return false;
+
+    return st_fs.f_type == BPF_FS_MAGIC;
+}
+
+static void strip_trailing_char(char *str, char c)
+{
+    int last = strlen(str) - 1;
+    while (last > 0 && str[last] == c)
+    {
+        str[last--] = '\0';
+    }
+}
+
+static void replace_with(char *str, const char what, const char with)
+{
+    while (*str)
+    {
+        if (*str == what)
+        {
+            *str = with;
+        }
+        str++;
+    }
+}
+
+static void strip_extension(char *str)
 {
     char *end = str + strlen(str);
     while (end > str && *end != '.' && *end != '\\' && *end != '/') {
         --end;
     }
-    if ((end > str && *end == '.') && (*(end - 1) != '\\' && *(end - 1) != '/')) {
-        *end = '\0';
+    if ((end > str && *end == '.') && (*(end - 1) != '\\' && *(end - 1) != '/')) {
+        *end = '\0';
+    }
+}
+
+static int get_pin_path(struct root_args *args, const char *object, int idx, int generation, char *pin_path)
+{
+    int pin_path_len;
+    if (generation == 0)
+    {
+        pin_path_len = snprintf(pin_path, PATH_MAX, "%s/%s/%s", args->prog_root, object, pin_name[idx]);
+    }
+    else
+    {
+        pin_path_len = snprintf(pin_path, PATH_MAX, "%s/%s/%s_%d", args->prog_root, object, pin_name[idx], generation);
+    }
+    return pin_path_len >= PATH_MAX ? -1 : 0;
+}
+
+static int get_prog_pin_path(struct root_args *args, const char *object, const char *name, int generation, char *pin_path)
+{
+    int pin_path_len;
+    if (generation == 0)
+    {
+        pin_path_len = snprintf(pin_path, PATH_MAX, "%s/%s/" PROG_PIN_PREFIX "%s", args->prog_root, object, name);
+    }
+    else
+    {
+        pin_path_len = snprintf(pin_path, PATH_MAX, "%s/%s/" PROG_PIN_PREFIX "%s_%d", args->prog_root, object, name, generation);
+    }
+    return pin_path_len >= PATH_MAX ? -1 : 0;
+}
+
+static void list_pinned_objects(struct root_args *args)
+{
+    args->num_objects = 0;
+
+    DIR *dir = opendir(args->prog_root);
+    if (!dir)
+    {
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)))
+    {
+        if (entry->d_name[0] == '.')
+        {
+            continue;
+        }
+        char pin_path[PATH_MAX];
+        if (get_pin_path(args, entry->d_name, 0, 0, pin_path) || access(pin_path, F_OK) != 0)
+        {
+            continue;
+        }
+        char **grown = realloc(args->objects, (args->num_objects + 1) * sizeof(char *));
+        if (!grown)
+        {
+            break;
+        }
+        args->objects = grown;
+        args->objects[args->num_objects++] = strdup(entry->d_name);
+        log_info(args, "found pinned maps for object '%s'\n", entry->d_name);
+    }
+    closedir(dir);
+}
+
+static void unpin_object(struct root_args *args, struct argp_state *state, const char *object)
+{
+    int p, g;
+    for (p = 0; p < NUM_COV_MAPS; p++)
+    {
+        for (g = 0; g < MAX_GENERATIONS; g++)
+        {
+            char pin_path[PATH_MAX];
+            if (get_pin_path(args, object, p, g, pin_path) || access(pin_path, F_OK) != 0)
+            {
+                break;
+            }
+            log_warn(args, "unpinning existing map '%s'\n", pin_path);
+            if (unlink(pin_path) != 0)
+            {
+                if (state)
+                {
+                    argp_error(state, "could not unpin map '%s'", pin_path);
+                }
+                else
+                {
+                    log_fata(args, "could not unpin map '%s'\n", pin_path);
+                }
+            }
+        }
+    }
+
+    char object_root[PATH_MAX];
+    if (snprintf(object_root, PATH_MAX, "%s/%s", args->prog_root, object) >= PATH_MAX)
+    {
+        return;
+    }
+
+    // The programs pinned next to the maps (for their run time stats)
+    DIR *dir = opendir(object_root);
+    struct dirent *entry;
+    while (dir && (entry = readdir(dir)))
+    {
+        char pin_path[PATH_MAX];
+        if (strncmp(entry->d_name, PROG_PIN_PREFIX, strlen(PROG_PIN_PREFIX)) != 0 ||
+            snprintf(pin_path, PATH_MAX, "%s/%s", object_root, entry->d_name) >= PATH_MAX)
+        {
+            continue;
+        }
+        log_warn(args, "unpinning existing program '%s'\n", pin_path);
+        if (unlink(pin_path) != 0)
+        {
+            if (state)
+            {
+                argp_error(state, "could not unpin program '%s'", pin_path);
+            }
+            else
+            {
+                log_fata(args, "could not unpin program '%s'\n", pin_path);
+            }
+        }
+    }
+    if (dir)
+    {
+        closedir(dir);
+    }
+    rmdir(object_root);
+}
+
+static void handle_map_pins(struct root_args *args, struct argp_state *state, bool unpin)
+{
+    if (!unpin && args->num_objects == 0)
+    {
+        if (state)
+        {
+            argp_error(state, "could not find pinned maps in '%s'", args->prog_root);
+        }
+        else
+        {
+            log_fata(args, "could not find pinned maps in '%s'\n", args->prog_root);
+        }
+    }
+
+    int o, p;
+    for (o = 0; o < args->num_objects; o++)
+    {
+        if (unpin)
+        {
+            unpin_object(args, state, args->objects[o]);
+            continue;
+        }
+        for (p = 0; p < NUM_PINNED_MAPS; p++)
+        {
+            char pin_path[PATH_MAX];
+            if (get_pin_path(args, args->objects[o], p, 0, pin_path) || access(pin_path, F_OK) != 0)
+            {
+                if (state)
+                {
+                    argp_error(state, "could not access map '%s'", pin_path);
+                }
+                else
+                {
+                    log_fata(args, "could not access map '%s'\n", pin_path);
+                }
+            }
+        }
+    }
+}
+
+static char *default_output(struct argp_state *state, char *program, const char *extension)
+{
+    char output_path[PATH_MAX];
+    int output_path_len = snprintf(output_path, PATH_MAX, "%s.%s", program, extension);
+    if (output_path_len >= PATH_MAX)
+    {
+        argp_error(state, "default output path too long");
+    }
+    return strdup(output_path);
+}
+
+// Append an input file to the (NULL terminated) list of inputs, that grows as needed
+static void add_input(struct argp_state *state, struct root_args *args, char *path)
+{
+    if (args->num_profraw + 1 >= args->max_profraw)
+    {
+        int max_profraw = args->max_profraw ? args->max_profraw * 2 : 64;
+        char **profraw = realloc(args->profraw, max_profraw * sizeof(char *));
+        if (!profraw)
+        {
+            argp_failure(state, 1, ENOMEM, "too many input files");
+        }
+        args->profraw = profraw;
+        args->max_profraw = max_profraw;
+    }
+    args->profraw[args->num_profraw++] = path;
+    args->profraw[args->num_profraw] = NULL;
+}
+
+// Append the input files listed in a file (one for each line, like `llvm-profdata merge --input-files`)
+static void add_input_files(struct argp_state *state, struct root_args *args, const char *list)
+{
+    FILE *listfp = fopen(list, "r");
+    if (!listfp)
+    {
+        argp_error(state, "could not open the input files list '%s'", list);
+    }
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t line_len;
+    while ((line_len = getline(&line, &line_cap, listfp)) != -1)
+    {
+        while (line_len > 0 && (line[line_len - 1] == '\n' || line[line_len - 1] == '\r'))
+        {
+            line[--line_len] = '\0';
+        }
+        if (line_len == 0)
+        {
+            continue;
+        }
+        char *path = strdup(line);
+        if (!path)
+        {
+            argp_failure(state, 1, ENOMEM, "too many input files");
+        }
+        add_input(state, args, path);
+    }
+    free(line);
+    fclose(listfp);
+}
+
+static int parse_duration(const char *str, struct timespec *duration)
+{
+    errno = 0;
+    char *end;
+    long long int num = strtoll(str, &end, 10);
+    if (end == str || errno || num <= 0)
+    {
+        return -1;
+    }
+
+    long long int nsec_per_unit;
+    /**/ if (strcmp(end, "ms") == 0)
+    {
+        nsec_per_unit = 1000000LL;
+    }
+    else if (strcmp(end, "s") == 0 || *end == '\0')
+    {
+        nsec_per_unit = 1000000000LL;
+    }
+    else if (strcmp(end, "m") == 0)
+    {
+        nsec_per_unit = 60 * 1000000000LL;
+    }
+    else if (strcmp(end, "h") == 0)
+    {
+        nsec_per_unit = 3600 * 1000000000LL;
+    }
+    /**/ else
+    {
+        return -1;
+    }
+    if (num > 7 * 24 * 3600 * 1000000000LL / nsec_per_unit) // A week is plenty (and does not overflow in nanoseconds)
+    {
+        return -1;
+    }
+
+    long long int nsec = num * nsec_per_unit;
+    duration->tv_sec = nsec / 1000000000LL;
+    duration->tv_nsec = nsec % 1000000000LL;
+    return 0;
+}
+
+// <top> and <annotate> read either profraw files or the pinned maps of a program
+static bool is_offline(struct root_args *args)
+{
+    return (args->command == &top || args->command == &annotate) && args->num_profraw > 0;
+}
+
+static bool is_periodic(struct root_args *args)
+{
+    return args->interval.tv_sec > 0 || args->interval.tv_nsec > 0;
+}
+
+static int get_map_index(char *suffix)
+{
+    if (!suffix) {
+        return -1;
+    }
+
+    if (strncmp(suffix, "profc", 5) == 0)
+    {
+        return 0;
+    }
+    else if (strncmp(suffix, "profd", 5) == 0)
+    {
+        return 1;
+    }
+    else if (strncmp(suffix, "profn", 5) == 0)
+    {
+        return 2;
+    }
+    else if (strncmp(suffix, "covmap", 6) == 0)
+    {
+        return 3;
+    }
+    else if (strncmp(suffix, "profb", 5) == 0)
+    {
+        return 4;
+    }
+    else if (strncmp(suffix, "profs", 5) == 0)
+    {
+        return 5;
+    }
+
+    return -1;
+}
+
+static char *split_output(const char *output, const char *object, const char *extension)
+{
+    char *stem = strdup(output);
+    strip_extension(stem);
+
+    char split_path[PATH_MAX];
+    int split_path_len = snprintf(split_path, PATH_MAX, "%s.%s.%s", stem, object, extension);
+    free(stem);
+
+    return split_path_len >= PATH_MAX ? NULL : strdup(split_path);
+}
+
+static int get_map_info(int fd, struct bpf_map_info *info)
+{
+    int err;
+    unsigned int size = sizeof(*info);
+    memset(info, 0, size);
+    err = bpf_obj_get_info_by_fd(fd, info, &size);
+    if (err)
+    {
+        close(fd);
+    }
+    return err;
+}
+
+static int get_global_data(int fd, struct bpf_map_info *info, void *data)
+{
+    if (!info || info->max_entries > 1 || info->key_size != sizeof(__u32))
+    {
+        return -1;
+    }
+
+    // Global data maps are arrays with a single element, so the key is always 0
+    __u32 key = 0;
+    return bpf_map_lookup_elem(fd, &key, data);
+}
+
+static int open_pinned_maps(struct root_args *args, const char *object, int generation, struct cov_maps *maps)
+{
+    int p;
+    snprintf(maps->object, sizeof(maps->object), "%s", object);
+    for (p = 0; p < NUM_COV_MAPS; p++)
+    {
+        maps->fd[p] = -1;
+        memset(&maps->info[p], 0, sizeof(maps->info[p]));
+    }
+    for (p = 0; p < NUM_COV_MAPS; p++)
+    {
+        char pin_path[PATH_MAX];
+        if (get_pin_path(args, object, p, generation, pin_path))
+        {
+            close_maps(maps);
+            return -1;
+        }
+        if (p >= NUM_PINNED_MAPS && access(pin_path, F_OK) != 0)
+        {
+            continue; // Not double-buffered
+        }
+        maps->fd[p] = bpf_obj_get(pin_path);
+        if (get_map_info(maps->fd[p], &maps->info[p]))
+        {
+            log_erro(args, "could not get info about pinned map '%s'\n", pin_path);
+            maps->fd[p] = -1;
+            close_maps(maps);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int open_pinned_generations(struct root_args *args, const char *object, struct cov_maps **maps)
+{
+    int num_maps = 0;
+    *maps = NULL;
+
+    int g;
+    for (g = 0; g < MAX_GENERATIONS; g++)
+    {
+        char pin_path[PATH_MAX];
+        if (g > 0 && (get_pin_path(args, object, 0, g, pin_path) || access(pin_path, F_OK) != 0))
+        {
+            break;
+        }
+        struct cov_maps *grown = realloc(*maps, (num_maps + 1) * sizeof(struct cov_maps));
+        if (!grown)
+        {
+            break;
+        }
+        *maps = grown;
+        if (open_pinned_maps(args, object, g, &(*maps)[num_maps]))
+        {
+            break;
+        }
+        num_maps++;
+    }
+
+    return num_maps;
+}
+
+static void close_maps(struct cov_maps *maps)
+{
+    int p;
+    for (p = 0; p < NUM_COV_MAPS; p++)
+    {
+        if (maps->fd[p] >= 0)
+        {
+            close(maps->fd[p]);
+        }
+        maps->fd[p] = -1;
+    }
+}
+
+static bool is_stdout(const char *output)
+{
+    return strcmp(output, "-") == 0;
+}
+
+static FILE *open_output(struct root_args *args, const char *output, const char *object, bool append)
+{
+    // A stream of its own, so that closing it leaves the standard output open for the next ones
+    if (is_stdout(output))
+    {
+        FILE *outfp = fdopen(dup(STDOUT_FILENO), "wb");
+        if (!outfp)
+        {
+            log_erro(args, "%s\n", "could not open the standard output");
+        }
+        return outfp;
+    }
+
+    char *path = (char *)output;
+    if (args->split)
+    {
+        path = split_output(output, object, profile_string[args->gen_format]);
+        if (!path)
+        {
+            log_erro(args, "%s\n", "output path too long");
+            return NULL;
+        }
+    }
+
+    FILE *outfp = fopen(path, append && !args->split ? "ab" : "wb");
+    if (!outfp)
+    {
+        log_erro(args, "could not open the output file '%s'\n", path);
+    }
+    else
+    {
+        log_info(args, "writing object '%s' to '%s'\n", object, path);
+    }
+    if (path != output)
+    {
+        free(path);
+    }
+    return outfp;
+}
+
+// The BPF object of a program: the one its bpfcov maps are named after (none for programs not instrumented)
+static int get_prog_object(int fd, struct bpf_prog_info *info, char *object)
+{
+    __u32 map_ids[64];
+    __u32 size = sizeof(*info);
+    memset(info, 0, size);
+    if (bpf_obj_get_info_by_fd(fd, info, &size))
+    {
+        return -1;
+    }
+    __u32 num_map_ids = info->nr_map_ids < 64 ? info->nr_map_ids : 64;
+    memset(info, 0, size);
+    info->nr_map_ids = num_map_ids;
+    info->map_ids = (__u64)(unsigned long)map_ids;
+    size = sizeof(*info);
+    int err = bpf_obj_get_info_by_fd(fd, info, &size);
+    info->map_ids = 0;
+    for (__u32 m = 0; !err && m < num_map_ids; m++)
+    {
+        struct bpf_map_info map_info;
+        int map_fd = bpf_map_get_fd_by_id(map_ids[m]);
+        if (map_fd < 0 || get_map_info(map_fd, &map_info))
+        {
+            continue;
+        }
+        close(map_fd);
+        char *suffix = strchr(map_info.name, '.');
+        if (suffix && get_map_index(suffix + 1) >= 0)
+        {
+            *suffix = '\0';
+            snprintf(object, BPF_OBJ_NAME_LEN, "%s", map_info.name);
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+// The programs pinned next to the maps of a BPF object, with their run time stats as of now
+static int open_pinned_progs(struct root_args *args, const char *object, struct cov_prog **progs)
+{
+    *progs = NULL;
+    char object_root[PATH_MAX];
+    if (snprintf(object_root, PATH_MAX, "%s/%s", args->prog_root, object) >= PATH_MAX)
+    {
+        return 0;
+    }
+    DIR *dir = opendir(object_root);
+    if (!dir)
+    {
+        return 0;
+    }
+
+    int num_progs = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)))
+    {
+        char pin_path[PATH_MAX];
+        if (strncmp(entry->d_name, PROG_PIN_PREFIX, strlen(PROG_PIN_PREFIX)) != 0 ||
+            snprintf(pin_path, PATH_MAX, "%s/%s", object_root, entry->d_name) >= PATH_MAX)
+        {
+            continue;
+        }
+        struct cov_prog *grown = realloc(*progs, (num_progs + 1) * sizeof(struct cov_prog));
+        if (!grown)
+        {
+            break;
+        }
+        *progs = grown;
+        struct cov_prog *prog = &grown[num_progs];
+        memset(prog, 0, sizeof(*prog));
+        snprintf(prog->object, BPF_OBJ_NAME_LEN, "%s", object);
+        __u32 size = sizeof(prog->info);
+        prog->fd = bpf_obj_get(pin_path);
+        if (prog->fd < 0 || bpf_obj_get_info_by_fd(prog->fd, &prog->info, &size))
+        {
+            log_warn(args, "could not get the info of program '%s'\n", pin_path);
+            if (prog->fd >= 0)
+            {
+                close(prog->fd);
+            }
+            continue;
+        }
+        num_progs++;
+    }
+    closedir(dir);
+
+    return num_progs;
+}
+
+// The run time stats of the programs of a BPF object, in a file next to its profile (unless on the standard output)
+static int write_runstats(struct root_args *args, const char *object, const struct cov_prog *progs, int num_progs, bool append)
+{
+    if (is_stdout(args->output))
+    {
+        return 0;
+    }
+    char *output = args->split ? split_output(args->output, object, profile_string[args->gen_format]) : args->output;
+    char path[PATH_MAX];
+    int path_len = output ? snprintf(path, PATH_MAX, "%s.%s", output, RUNSTATS_EXTENSION) : PATH_MAX;
+    if (output != args->output)
+    {
+        free(output);
+    }
+    if (path_len >= PATH_MAX)
+    {
+        log_erro(args, "%s\n", "run time stats path too long");
+        return -1;
+    }
+
+    int num_written = 0;
+    FILE *outfp = NULL;
+    for (int p = 0; p < num_progs; p++)
+    {
+        if (strcmp(progs[p].object, object) != 0)
+        {
+            continue;
+        }
+        if (!outfp && !(outfp = fopen(path, append && !args->split ? "a" : "w")))
+        {
+            log_erro(args, "could not open the output file '%s'\n", path);
+            return -1;
+        }
+        // Then what the program costs: the instructions the verifier went through, the translated ones, its JITed bytes
+        const struct bpf_prog_info *info = &progs[p].info;
+        fprintf(outfp, "%s %s %llu %llu %u %u %u\n", object, info->name, info->run_cnt, info->run_time_ns,
+                info->verified_insns, info->xlated_prog_len / 8, info->jited_prog_len);
+        num_written++;
+    }
+    if (!outfp)
+    {
+        // No stale stats of an earlier run next to the new profile
+        if (!append || args->split)
+        {
+            unlink(path);
+        }
+        return 0;
+    }
+    log_info(args, "writing the run time stats of %d program(s) of object '%s' to '%s'\n", num_written, object, path);
+
+    return fclose(outfp) ? -1 : 0;
+}
+
+static void fill_profraw_header(long long int *header, const void *covmap_data, __u32 profd_size, __u32 profc_size, __u32 profn_size)
+{
+    // Magic number
+    char magic[8] = {0x81, 0x72, 0x66, 0x6F, 0x72, 0x70, 0x6C, 0xFF};
+    memcpy(&header[0], magic, sizeof(magic));
+    // Version
+    long long int version = 0;
+    memcpy(&version, &((const char *)covmap_data)[12], 4); // Version is the 3rd int in the coverage mapping header
+    header[1] = version + 1;                               // Version is 0 indexed
+    // Data size
+    header[2] = profd_size / 48; // 5 x i64 + 2 x i32 for each function
+    // Padding before counters
+    header[3] = 0;
+    // Counters size
+    header[4] = profc_size / 8; // 1 x i64 for each counter element
+    // Padding after counters
+    header[5] = 0;
+    // Names size
+    header[6] = profn_size;
+    // Counters delta (nulled)
+    header[7] = 0;
+    // Names delta (nulled)
+    header[8] = 0;
+    // IPVK last
+    header[9] = 1;
+}
+
+// Align the names part to 8 bytes
+static __u32 profraw_padding(__u32 profn_size)
+{
+    return 7 & (16 - profn_size % 16);
+}
+
+// Write everything, resuming after partial writes
+static int write_all(struct root_args *args, int fd, struct iovec *iov, int iovcnt)
+{
+    int i = 0;
+    while (i < iovcnt)
+    {
+        ssize_t written = writev(fd, &iov[i], iovcnt - i);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            log_erro(args, "could not write the profraw: %s\n", strerror(errno));
+            return -1;
+        }
+        // Partial write: skip what got written
+        while (i < iovcnt && (size_t)written >= iov[i].iov_len)
+        {
+            written -= iov[i++].iov_len;
+        }
+        if (i < iovcnt)
+        {
+            iov[i].iov_base = (char *)iov[i].iov_base + written;
+            iov[i].iov_len -= written;
+        }
+    }
+
+    return 0;
+}
+
+// Write everything as a gzip member (members can be concatenated as raw profiles can)
+static int write_gzip(struct root_args *args, int fd, struct iovec *iov, int iovcnt)
+{
+    gzFile gz = gzdopen(dup(fd), "wb");
+    if (!gz)
+    {
+        log_erro(args, "%s\n", "could not compress the profraw");
+        return -1;
+    }
+    // Large buffers: a couple of write system calls for the whole profraw
+    gzbuffer(gz, 1 << 20);
+    int err = 0;
+    for (int i = 0; i < iovcnt && !err; i++)
+    {
+        size_t done = 0;
+        while (done < iov[i].iov_len)
+        {
+            size_t chunk = iov[i].iov_len - done < (1U << 30) ? iov[i].iov_len - done : (1U << 30);
+            if (gzwrite(gz, (char *)iov[i].iov_base + done, chunk) <= 0)
+            {
+                err = -1;
+                break;
+            }
+            done += chunk;
+        }
+    }
+    if (gzclose(gz) != Z_OK)
+    {
+        err = -1;
+    }
+    if (err)
+    {
+        log_erro(args, "%s\n", "could not write the compressed profraw");
+    }
+
+    return err;
+}
+
+// Read a whole gzip file (possibly many members) in memory
+static char *read_gzip(struct root_args *args, int fd, size_t *size)
+{
+    gzFile gz = gzdopen(dup(fd), "rb");
+    if (!gz)
+    {
+        return NULL;
+    }
+    gzbuffer(gz, 1 << 20);
+    size_t capacity = 1 << 20;
+    char *buf = malloc(capacity);
+    *size = 0;
+    while (buf)
+    {
+        int n = gzread(gz, buf + *size, capacity - *size > (1U << 30) ? (1U << 30) : capacity - *size);
+        if (n < 0)
+        {
+            log_erro(args, "%s\n", "could not decompress the profraw");
+            free(buf);
+            buf = NULL;
+            break;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        *size += n;
+        if (*size == capacity)
+        {
+            capacity *= 2;
+            char *grown = realloc(buf, capacity);
+            if (!grown)
+            {
+                free(buf);
+            }
+            buf = grown;
+        }
+    }
+    gzclose(gz);
+
+    return buf;
+}
+
+static bool is_gzip(int fd)
+{
+    unsigned char magic[2];
+    return pread(fd, magic, sizeof(magic), 0) == sizeof(magic) && magic[0] == 0x1f && magic[1] == 0x8b;
+}
+
+// The raw profile of a BPF object, kept around so that taking further snapshots only reads its counters again
+struct cov_snapshot
+{
+    struct cov_maps *maps;   // Every generation of the maps of the BPF object
+    int num_maps;
+    char *head;              // Header and data parts (they never change)
+    size_t head_size;
+    long long int *counters; // Counters part (summed across generations)
+    long long int *previous; // Counters at the previous snapshot (only for deltas)
+    long long int *scratch;  // Counters of further generations, or deltas
+    long long int num_counters;
+    long long int **mapped;  // Read-only mappings of the counters of every generation and bank (when mmapable)
+    const long long int *out; // Counters part to write
+    long long int *zeros;    // To reset the drained bank (only for double-buffered counters)
+    char *tail;              // Names part plus the padding (they never change)
+    size_t tail_size;
+};
+
+static bool same_layout(struct cov_maps *a, struct cov_maps *b)
+{
+    return a->info[0].value_size == b->info[0].value_size && a->info[1].value_size == b->info[1].value_size;
+}
+
+// The bank of counters that the instrumented programs increment is the one the selector (.profs) points to
+static bool is_double_buffered(struct cov_maps *maps)
+{
+    return maps->fd[4] >= 0 && maps->fd[5] >= 0 &&
+           maps->info[4].value_size == maps->info[0].value_size && maps->info[5].value_size == sizeof(__u32);
+}
+
+static int bank_map(int bank)
+{
+    return bank == 0 ? 0 : 4;
+}
+
+static void free_snapshot(struct cov_snapshot *snap)
+{
+    for (int m = 0; snap->mapped && m < snap->num_maps * 2; m++)
+    {
+        if (snap->mapped[m])
+        {
+            munmap(snap->mapped[m], snap->maps[m / 2].info[0].value_size);
+        }
+    }
+    free(snap->mapped);
+    free(snap->zeros);
+    free(snap->head);
+    free(snap->counters);
+    free(snap->previous);
+    free(snap->scratch);
+    free(snap->tail);
+    memset(snap, 0, sizeof(*snap));
+}
+
+static int init_snapshot(struct root_args *args, struct cov_maps *maps, int num_maps, bool delta, struct cov_snapshot *snap)
+{
+    struct bpf_map_info *profc_info = &maps->info[0];
+    struct bpf_map_info *profd_info = &maps->info[1];
+    struct bpf_map_info *profn_info = &maps->info[2];
+    struct bpf_map_info *covmap_info = &maps->info[3];
+
+    memset(snap, 0, sizeof(*snap));
+    snap->maps = maps;
+    snap->num_maps = num_maps;
+    snap->num_counters = profc_info->value_size / 8; // 1 x i64 for each counter element
+
+    long long int header[PROFRAW_HEADER_LEN];
+    snap->head_size = sizeof(header) + profd_info->value_size;
+    snap->head = malloc(snap->head_size);
+    snap->counters = malloc(profc_info->value_size);
+    snap->scratch = malloc(profc_info->value_size);
+    snap->previous = delta ? calloc(1, profc_info->value_size) : NULL;
+    snap->tail_size = profn_info->value_size + profraw_padding(profn_info->value_size);
+    snap->tail = calloc(1, snap->tail_size);
+    snap->mapped = calloc(num_maps * 2, sizeof(long long int *));
+    snap->zeros = args->reset ? calloc(1, profc_info->value_size) : NULL;
+    void *covmap_data = malloc(covmap_info->value_size);
+    if (!snap->head || !snap->counters || !snap->scratch || (delta && !snap->previous) || !snap->tail || !snap->mapped || (args->reset && !snap->zeros) || !covmap_data)
+    {
+        log_erro(args, "%s\n", "could not allocate the profraw buffers");
+        goto error_out;
+    }
+
+    /* Prepare the header */
+    log_info(args, "%s\n", "about to prepare the profraw header...");
+    if (get_global_data(maps->fd[3], covmap_info, covmap_data))
+    {
+        log_erro(args, "could not get global data from map '%s'\n", covmap_info->name);
+        goto error_out;
+    }
+    fill_profraw_header(header, covmap_data, profd_info->value_size, profc_info->value_size, profn_info->value_size);
+    memcpy(snap->head, header, sizeof(header));
+
+    /* Prepare the data part */
+    log_info(args, "%s\n", "about to prepare the data in the profraw...");
+    if (get_global_data(maps->fd[1], profd_info, snap->head + sizeof(header)))
+    {
+        log_erro(args, "could not get global data from map '%s'\n", profd_info->name);
+        goto error_out;
+    }
+
+    /* Prepare the names part */
+    log_info(args, "%s\n", "about to prepare the names in the profraw...");
+    if (get_global_data(maps->fd[2], profn_info, snap->tail))
+    {
+        log_erro(args, "could not get global data from map '%s'\n", profn_info->name);
+        goto error_out;
+    }
+
+    if (args->reset && !is_double_buffered(maps))
+    {
+        log_erro(args, "object '%s' has not double-buffered counters (see the --double-buffered-counters pass option)\n", maps->object);
+        goto error_out;
+    }
+
+    for (int g = 0; g < num_maps; g++)
+    {
+        if (!same_layout(&maps[0], &maps[g]))
+        {
+            log_warn(args, "skipping generation %d of map '%s' since its layout differs\n", g, maps[g].info[0].name);
+            continue;
+        }
+        if (args->reset && !is_double_buffered(&maps[g]))
+        {
+            log_warn(args, "skipping generation %d of map '%s' since it has not double-buffered counters\n", g, maps[g].info[0].name);
+            continue;
+        }
+        // Map the counters read-only when possible, so that reading them does not need syscalls nor copies
+        for (int bank = 0; bank < (is_double_buffered(&maps[g]) ? 2 : 1); bank++)
+        {
+            struct bpf_map_info *info = &maps[g].info[bank_map(bank)];
+            if (!(info->map_flags & BPF_F_MMAPABLE))
+            {
+                continue;
+            }
+            void *mapped = mmap(NULL, info->value_size, PROT_READ, MAP_SHARED, maps[g].fd[bank_map(bank)], 0);
+            if (mapped == MAP_FAILED)
+            {
+                log_debu(args, "could not mmap map '%s': %s\n", info->name, strerror(errno));
+                continue;
+            }
+            snap->mapped[g * 2 + bank] = mapped;
+            log_info(args, "mapped the counters of map '%s'\n", info->name);
+        }
+    }
+
+    free(covmap_data);
+    return 0;
+
+error_out:
+    free(covmap_data);
+    free_snapshot(snap);
+    return -1;
+}
+
+// Point to the counters of a bank of a generation, either mapped or read into the given buffer
+static const long long int *read_counters(struct root_args *args, struct cov_snapshot *snap, int g, int bank, long long int *buf)
+{
+    struct cov_maps *maps = &snap->maps[g];
+    int m = bank_map(bank);
+    if (snap->mapped[g * 2 + bank])
+    {
+        return snap->mapped[g * 2 + bank];
+    }
+    if (get_global_data(maps->fd[m], &maps->info[m], buf))
+    {
+        log_warn(args, "could not get global data from map '%s' (generation %d)\n", maps->info[m].name, g);
+        return NULL;
+    }
+    return buf;
+}
+
+static void add_counters(struct cov_snapshot *snap, const long long int *counters)
+{
+    for (long long int c = 0; c < snap->num_counters; c++)
+    {
+        snap->counters[c] += counters[c];
+    }
+}
+
+// Wait for the BPF programs running right now to complete: updating a map-in-map waits for a RCU grace period
+static void wait_for_bpf_programs(struct root_args *args)
+{
+    static int inner_fd = -1;
+    static int outer_fd = -1;
+    if (outer_fd < 0 && inner_fd < 0)
+    {
+        inner_fd = bpf_map_create(BPF_MAP_TYPE_ARRAY, NULL, sizeof(__u32), sizeof(__u32), 1, NULL);
+        if (inner_fd >= 0)
+        {
+            LIBBPF_OPTS(bpf_map_create_opts, opts, .inner_map_fd = inner_fd);
+            outer_fd = bpf_map_create(BPF_MAP_TYPE_ARRAY_OF_MAPS, NULL, sizeof(__u32), sizeof(__u32), 1, &opts);
+        }
+    }
+
+    __u32 key = 0;
+    if (outer_fd >= 0 && bpf_map_update_elem(outer_fd, &key, &inner_fd, BPF_ANY) == 0)
+    {
+        return;
+    }
+
+    log_debu(args, "waiting %dms since the kernel can not tell when the programs complete\n", GRACE_PERIOD_FALLBACK_MS);
+    struct timespec grace = {.tv_sec = 0, .tv_nsec = GRACE_PERIOD_FALLBACK_MS * 1000000L};
+    while (nanosleep(&grace, &grace) && errno == EINTR)
+        ;
+}
+
+// Flip the bank of every generation, wait for the increments to the previous banks to land, then drain them
+static int drain_snapshot(struct root_args *args, struct cov_snapshot *snap)
+{
+    struct cov_maps *maps = snap->maps;
+    __u32 key = 0;
+
+    int drained[snap->num_maps];
+    for (int g = 0; g < snap->num_maps; g++)
+    {
+        drained[g] = -1;
+        if (!same_layout(&maps[0], &maps[g]) || !is_double_buffered(&maps[g]))
+        {
+            continue;
+        }
+        __u32 bank;
+        if (bpf_map_lookup_elem(maps[g].fd[5], &key, &bank))
+        {
+            log_warn(args, "could not get the bank selector '%s' (generation %d)\n", maps[g].info[5].name, g);
+            continue;
+        }
+        bank = bank ? 1 : 0;
+        __u32 next = !bank;
+        if (bpf_map_update_elem(maps[g].fd[5], &key, &next, BPF_ANY))
+        {
+            log_warn(args, "could not flip the bank selector '%s' (generation %d)\n", maps[g].info[5].name, g);
+            continue;
+        }
+        drained[g] = bank;
+    }
+
+    wait_for_bpf_programs(args);
+
+    memset(snap->counters, 0, snap->num_counters * 8);
+    for (int g = 0; g < snap->num_maps; g++)
+    {
+        if (drained[g] < 0)
+        {
+            continue;
+        }
+        const long long int *counters = read_counters(args, snap, g, drained[g], snap->scratch);
+        if (!counters)
+        {
+            continue;
+        }
+        log_info(args, "draining bank %d of the counters (generation %d)\n", drained[g], g);
+        add_counters(snap, counters);
+        // Nothing increments the drained bank anymore, so that resetting it loses nothing
+        int m = bank_map(drained[g]);
+        if (bpf_map_update_elem(maps[g].fd[m], &key, snap->zeros, BPF_ANY))
+        {
+            log_warn(args, "could not reset map '%s' (generation %d)\n", maps[g].info[m].name, g);
+        }
+    }
+    snap->out = snap->counters;
+
+    return 0;
+}
+
+// Read the counters again (summing the further generations of the same program), and compute the deltas if needed
+static int read_snapshot(struct root_args *args, struct cov_snapshot *snap)
+{
+    struct cov_maps *maps = snap->maps;
+
+    if (args->reset)
+    {
+        return drain_snapshot(args, snap);
+    }
+
+    // Zero-copy: write straight from the mapping
+    if (snap->num_maps == 1 && snap->mapped[0] && !is_double_buffered(maps) && !snap->previous)
+    {
+        snap->out = snap->mapped[0];
+        return 0;
+    }
+
+    memset(snap->counters, 0, snap->num_counters * 8);
+    for (int g = 0; g < snap->num_maps; g++)
+    {
+        if (!same_layout(&maps[0], &maps[g]))
+        {
+            continue;
+        }
+        // Both banks of double-buffered counters hold counts that were not drained yet
+        for (int bank = 0; bank < (is_double_buffered(&maps[g]) ? 2 : 1); bank++)
+        {
+            const long long int *counters = read_counters(args, snap, g, bank, snap->scratch);
+            if (!counters)
+            {
+                if (g == 0 && bank == 0)
+                {
+                    return -1;
+                }
+                continue;
+            }
+            if (g > 0 && bank == 0)
+            {
+                log_info(args, "summing generation %d of the counters\n", g);
+            }
+            add_counters(snap, counters);
+        }
+    }
+    snap->out = snap->counters;
+
+    if (snap->previous)
+    {
+        for (long long int c = 0; c < snap->num_counters; c++)
+        {
+            // Counters only decrease when something reset them, then all of them are new
+            long long int now = snap->counters[c];
+            snap->scratch[c] = now >= snap->previous[c] ? now - snap->previous[c] : now;
+            snap->previous[c] = now;
+        }
+        snap->out = snap->scratch;
+    }
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Sparse profiles
+//
+// Only the non-zero counters, for each BPF object:
+// - header: magic, raw profile version, number of functions and counters of the dense profile,
+//   number of records, and their size in bytes
+// - records: for each function with non-zero counters, its name MD5 and its hash (8 bytes each), then the number of
+//   its non-zero counters, and for each of them its index (delta from the previous index plus one) and its value
+//   (all LEB128 varints)
+//
+// Densifying it back needs the BPF coverage object (*.bpf.obj) for the data and the names of the functions.
+// --------------------------------------------------------------------------------------------------------------------
+
+#define SPARSE_MAGIC 0x70737663706662ffULL // "\xffbpfcvsp"
+
+struct sparse_header
+{
+    __u64 magic;
+    __u64 version;
+    __u64 num_functions;
+    __u64 num_counters;
+    __u64 num_records;
+    __u64 size;
+};
+
+static size_t write_varint(unsigned char *buf, __u64 value)
+{
+    size_t len = 0;
+    do
+    {
+        unsigned char byte = value & 0x7f;
+        value >>= 7;
+        buf[len++] = byte | (value ? 0x80 : 0);
+    } while (value);
+    return len;
+}
+
+static size_t read_varint(const unsigned char *p, const unsigned char *end, __u64 *value)
+{
+    *value = 0;
+    for (size_t len = 0; p + len < end && len < 10; len++)
+    {
+        *value |= (__u64)(p[len] & 0x7f) << (7 * len);
+        if (!(p[len] & 0x80))
+        {
+            return len + 1;
+        }
+    }
+    return 0;
+}
+
+static int write_sparse(struct root_args *args, struct cov_snapshot *snap, FILE *outfp)
+{
+    log_info(args, "%s\n", "about to write the sparse profile...");
+
+    const long long int *header = (const long long int *)snap->head;
+    const char *data = snap->head + PROFRAW_HEADER_LEN * 8;
+    struct sparse_header sparse = {
+        .magic = SPARSE_MAGIC,
+        .version = header[1],
+        .num_functions = header[2],
+        .num_counters = snap->num_counters,
+    };
+
+    // Worst case: every counter is non-zero
+    unsigned char *records = malloc(sparse.num_functions * (16 + 10) + snap->num_counters * (10 + 10) + 1);
+    if (!records)
+    {
+        log_erro(args, "%s\n", "could not allocate the sparse profile");
+        return -1;
+    }
+    unsigned char *p = records;
+    for (__u64 f = 0; f < sparse.num_functions; f++)
+    {
+        const char *func = data + f * PROFRAW_DATA_SIZE;
+        __u64 counter_ptr;
+        __u32 num;
+        memcpy(&counter_ptr, func + 16, 8);
+        memcpy(&num, func + 40, 4);
+        __u64 first = counter_ptr / 8;
+        if (first > (__u64)snap->num_counters || num > snap->num_counters - first)
+        {
+            continue;
+        }
+        const long long int *counters = &snap->out[first];
+        __u64 num_nonzero = 0;
+        for (__u32 c = 0; c < num; c++)
+        {
+            num_nonzero += counters[c] != 0;
+        }
+        if (num_nonzero == 0)
+        {
+            continue;
+        }
+        memcpy(p, func, 16); // Name MD5, and hash
+        p += 16;
+        p += write_varint(p, num_nonzero);
+        __u32 next = 0;
+        for (__u32 c = 0; c < num; c++)
+        {
+            if (counters[c])
+            {
+                p += write_varint(p, c - next);
+                p += write_varint(p, counters[c]);
+                next = c + 1;
+            }
+        }
+        sparse.num_records++;
+    }
+    sparse.size = p - records;
+    log_info(args, "%llu function(s) ran, %llu bytes instead of %llu\n", sparse.num_records,
+             (unsigned long long)(sizeof(sparse) + sparse.size), (unsigned long long)(snap->head_size + snap->num_counters * 8 + snap->tail_size));
+
+    struct iovec iov[2] = {
+        {.iov_base = &sparse, .iov_len = sizeof(sparse)},
+        {.iov_base = records, .iov_len = sparse.size},
+    };
+    int err = fflush(outfp);
+    if (!err)
+    {
+        err = args->gzip ? write_gzip(args, fileno(outfp), iov, 2) : write_all(args, fileno(outfp), iov, 2);
+    }
+    free(records);
+
+    return err ? -1 : 0;
+}
+
+static int write_snapshot(struct root_args *args, struct cov_snapshot *snap, FILE *outfp)
+{
+    if (args->gen_format == PROFILE_sparse)
+    {
+        return write_sparse(args, snap, outfp);
+    }
+
+    log_info(args, "%s\n", "about to write the profraw...");
+
+    // Everything in a single system call, without copying the counters into the stdio buffer
+    struct iovec iov[3] = {
+        {.iov_base = snap->head, .iov_len = snap->head_size},
+        {.iov_base = (void *)snap->out, .iov_len = snap->num_counters * 8},
+        {.iov_base = snap->tail, .iov_len = snap->tail_size},
+    };
+    if (fflush(outfp))
+    {
+        return -1;
+    }
+
+    if (args->gzip)
+    {
+        return write_gzip(args, fileno(outfp), iov, 3);
+    }
+
+    return write_all(args, fileno(outfp), iov, 3);
+}
+
+// Write (or append, since multiple raw profiles can be concatenated) the profile of a single BPF object
+static int write_profraw(struct root_args *args, struct cov_maps *maps, int num_maps, FILE *outfp)
+{
+    struct cov_snapshot snap;
+    if (init_snapshot(args, maps, num_maps, false, &snap))
+    {
+        return -1;
+    }
+    int err = read_snapshot(args, &snap) || write_snapshot(args, &snap, outfp);
+    free_snapshot(&snap);
+
+    return err ? -1 : 0;
+}
+
+// Add the functions of a snapshot to an indexed profile (in memory, without the profraw round trip)
+static int add_snapshot(struct root_args *args, struct cov_snapshot *snap, struct profdata *pd)
+{
+    const long long int *header = (const long long int *)snap->head;
+    int err = profdata_add_sections(pd, snap->head + PROFRAW_HEADER_LEN * 8, header[2] * PROFRAW_DATA_SIZE,
+                                    snap->out, snap->num_counters, snap->tail, header[6]);
+    if (err)
+    {
+        log_erro(args, "could not index the counters: %s\n", strerror(-err));
+        return -1;
+    }
+
+    return 0;
+}
+
+static int add_profdata(struct root_args *args, struct cov_maps *maps, int num_maps, struct profdata *pd)
+{
+    struct cov_snapshot snap;
+    if (init_snapshot(args, maps, num_maps, false, &snap))
+    {
+        return -1;
+    }
+    int err = read_snapshot(args, &snap) || add_snapshot(args, &snap, pd);
+    free_snapshot(&snap);
+
+    return err ? -1 : 0;
+}
+
+// Index a profraw file (it can hold many raw profiles)
+static int add_profraw(struct root_args *args, const char *path, struct profdata *pd)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        log_erro(args, "could not open '%s'\n", path);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size == 0)
+    {
+        log_erro(args, "could not read '%s'\n", path);
+        close(fd);
+        return -1;
+    }
+    int err;
+    if (is_gzip(fd))
+    {
+        size_t size;
+        char *buf = read_gzip(args, fd, &size);
+        close(fd);
+        if (!buf)
+        {
+            log_erro(args, "could not decompress '%s'\n", path);
+            return -1;
+        }
+        err = profdata_add_profraw(pd, buf, size);
+        free(buf);
+    }
+    else
+    {
+        void *buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (buf == MAP_FAILED)
+        {
+            log_erro(args, "could not map '%s'\n", path);
+            return -1;
+        }
+        err = profdata_add_profraw(pd, buf, st.st_size);
+        munmap(buf, st.st_size);
+    }
+    if (err)
+    {
+        log_erro(args, "could not index '%s': %s\n", path, strerror(-err));
+        return -1;
+    }
+
+    return 0;
+}
+
+static int write_profdata(struct root_args *args, struct profdata *pd, bool sparse, FILE *outfp)
+{
+    log_info(args, "%s\n", "about to write the profdata...");
+
+    int err = profdata_write(pd, sparse, outfp);
+    if (err)
+    {
+        log_erro(args, "could not write the profdata: %s\n", strerror(-err));
+        return -1;
+    }
+    if (profdata_mismatched(pd))
+    {
+        log_warn(args, "skipped %u function(s) whose number of counters changed\n", profdata_mismatched(pd));
+    }
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Implementation
+// --------------------------------------------------------------------------------------------------------------------
+
+static volatile sig_atomic_t interrupted;
+
+static void on_interrupt(int signo)
+{
+    interrupted = signo;
+}
+
+// Do not restart system calls (waitpid, clock_nanosleep), so that the interruption gets noticed
+static void handle_interrupts(void)
+{
+    struct sigaction act = {};
+    act.sa_handler = on_interrupt;
+    sigemptyset(&act.sa_mask);
+    sigaction(SIGINT, &act, NULL);
+    sigaction(SIGTERM, &act, NULL);
+}
+
+// The run time stats of the held programs, as of now
+static void refresh_held_progs(struct root_args *args)
+{
+    for (int p = 0; p < args->num_held_progs; p++)
+    {
+        struct cov_prog *prog = &args->held_progs[p];
+        struct bpf_prog_info info = {};
+        __u32 size = sizeof(info);
+        if (bpf_obj_get_info_by_fd(prog->fd, &info, &size) == 0)
+        {
+            prog->info = info;
+        }
+    }
+}
+
+// Keep a program the traced program loaded (when instrumented), so that its run time stats outlive it
+static void run_capture_prog(struct root_args *args, int fd)
+{
+    struct cov_prog prog = {.fd = fd};
+    int err = get_prog_object(fd, &prog.info, prog.object);
+    if (prog.info.id)
+    {
+        log_info(args, "loaded program '%s' (ID %u): %u verified instructions, %u translated instructions, %u JITed bytes\n",
+                 prog.info.name, prog.info.id, prog.info.verified_insns, prog.info.xlated_prog_len / 8, prog.info.jited_prog_len);
+    }
+    if (err)
+    {
+        close(fd);
+        return;
+    }
+
+    /* Hold the program */
+    if (args->gen_on_exit)
+    {
+        struct cov_prog *grown = realloc(args->held_progs, (args->num_held_progs + 1) * sizeof(struct cov_prog));
+        if (!grown)
+        {
+            log_warn(args, "could not hold program '%s'\n", prog.info.name);
+            close(fd);
+            return;
+        }
+        args->held_progs = grown;
+        args->held_progs[args->num_held_progs++] = prog;
+        log_warn(args, "hold program '%s' of object '%s'\n", prog.info.name, prog.object);
+        return;
+    }
+
+    /* Pin it next to the bpfcov maps of its BPF object (a further generation when already there) */
+    char pin_path[PATH_MAX];
+    err = -1;
+    for (int g = 0; g < MAX_GENERATIONS; g++)
+    {
+        if (get_prog_pin_path(args, prog.object, prog.info.name, g, pin_path))
+        {
+            break;
+        }
+        err = bpf_obj_pin(fd, pin_path);
+        if (!err || errno != EEXIST)
+        {
+            break;
+        }
+    }
+    if (err)
+    {
+        log_warn(args, "could not pin program '%s' of object '%s'\n", prog.info.name, prog.object);
+    }
+    else
+    {
+        log_warn(args, "pin program '%s' to '%s'\n", prog.info.name, pin_path);
+    }
+    close(fd);
+}
+
+static void run_gen_on_exit(struct root_args *args)
+{
+    if (!args->gen_on_exit)
+    {
+        return;
+    }
+
+    log_info(args, "generating '%s' for program '%s'\n", args->output, args->program[0]);
+
+    struct cov_maps *maps = calloc(args->num_held ? args->num_held : 1, sizeof(struct cov_maps));
+    bool *done = calloc(args->num_held ? args->num_held : 1, sizeof(bool));
+    int written = 0;
+    int g, h, p;
+    for (g = 0; g < args->num_held; g++)
+    {
+        if (done[g])
+        {
+            continue;
+        }
+
+        // Gather the generations (in creation order) for which the program created all the maps of this object
+        int num_maps = 0;
+        for (h = g; h < args->num_held; h++)
+        {
+            if (strcmp(args->held[h].object, args->held[g].object) != 0)
+            {
+                continue;
+            }
+            done[h] = true;
+            for (p = 0; p < NUM_PINNED_MAPS && args->held[h].fd[p] >= 0; p++)
+                ;
+            if (p == NUM_PINNED_MAPS)
+            {
+                maps[num_maps++] = args->held[h];
+            }
+        }
+        if (num_maps == 0)
+        {
+            log_warn(args, "skipping object '%s': program did not create all its maps\n", args->held[g].object);
+            continue;
+        }
+
+        FILE *outfp = open_output(args, args->output, args->held[g].object, written > 0);
+        if (!outfp || write_profraw(args, maps, num_maps, outfp))
+        {
+            log_erro(args, "could not generate the profraw for object '%s'\n", args->held[g].object);
+        }
+        if (outfp)
+        {
+            fclose(outfp);
+        }
+        refresh_held_progs(args);
+        if (write_runstats(args, args->held[g].object, args->held_progs, args->num_held_progs, written > 0))
+        {
+            log_erro(args, "could not write the run time stats for object '%s'\n", args->held[g].object);
+        }
+        written++;
+    }
+    if (written == 0)
+    {
+        log_erro(args, "could not generate '%s': program did not create its maps\n", args->output);
+    }
+
+    for (g = 0; g < args->num_held; g++)
+    {
+        close_maps(&args->held[g]);
+    }
+    for (g = 0; g < args->num_held_progs; g++)
+    {
+        close(args->held_progs[g].fd);
+    }
+    free(maps);
+    free(done);
+}
+
+static struct cov_maps *run_hold_slot(struct root_args *args, const char *object, int idx)
+{
+    int g;
+    bool seen = false;
+    for (g = 0; g < args->num_held; g++)
+    {
+        if (strcmp(args->held[g].object, object) != 0)
+        {
+            continue;
+        }
+        seen = true;
+        if (args->held[g].fd[idx] < 0)
+        {
+            return &args->held[g];
+        }
+    }
+    if (seen && !args->accumulate)
+    {
+        return NULL;
+    }
+
+    struct cov_maps *grown = realloc(args->held, (args->num_held + 1) * sizeof(struct cov_maps));
+    if (!grown)
+    {
+        return NULL;
+    }
+    args->held = grown;
+    snprintf(args->held[args->num_held].object, BPF_OBJ_NAME_LEN, "%s", object);
+    for (g = 0; g < NUM_COV_MAPS; g++)
+    {
+        args->held[args->num_held].fd[g] = -1;
+    }
+    return &args->held[args->num_held++];
+}
+
+static void run_wait(struct root_args *args, pid_t pid)
+{
+    while (waitpid(pid, 0, 0) == -1)
+    {
+        if (errno == EINTR && interrupted)
+        {
+            // The program gets killed when we exit (PTRACE_O_EXITKILL)
+            run_gen_on_exit(args);
+            exit(EXIT_FAILURE);
+        }
+        if (errno != EINTR)
+        {
+            log_fata(args, "%s\n", strerror(errno));
+        }
+    }
+}
+
+int run(struct root_args *args)
+{
+    log_info(args, "executing program '%s'\n", args->program[0]);
+
+    if (args->gen_on_exit)
+    {
+        // So that we can generate the profraw on CTRL+C
+        handle_interrupts();
+    }
+
+    // The kernel accounts the run time of the BPF programs for as long as we keep this open (until we exit)
+    int stats_fd = bpf_enable_stats(BPF_STATS_RUN_TIME);
+    if (stats_fd < 0)
+    {
+        log_warn(args, "could not enable the run time stats of the BPF programs: %s\n", strerror(errno));
+    }
+
+    pid_t pid = fork();
+    switch (pid)
+    {
+    case -1: /* Error */
+        log_fata(args, "%s\n", strerror(errno));
+    case 0: /* Child */
+        if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) < 0)
+        {
+            log_fata(args, "%s\n", strerror(errno));
+        }
+        execvp(args->program[0], args->program);
+        log_fata(args, "%s\n", strerror(errno));
+    }
+
+    /* Parent */
+    waitpid(pid, 0, 0); // sync with PTRACE_TRACEME
+    ptrace(PTRACE_SETOPTIONS, pid, 0, PTRACE_O_EXITKILL);
+
+    int is_map = 0;
+    int is_prog = 0;
+    for (;;)
+    {
+        /* Enter next system call */
+        if (ptrace(PTRACE_SYSCALL, pid, 0, 0) == -1)
+        {
+            log_fata(args, "%s\n", strerror(errno));
+        }
+
+        /* Waiting for PID to die */
+        run_wait(args, pid);
+
+        /* Gather system call arguments */
+        struct user_regs_struct regs;
+        if (ptrace(PTRACE_GETREGS, pid, 0, &regs) == -1)
+        {
+            log_fata(args, "%s\n", strerror(errno));
+        }
+
+        /* Mark bpf(BPF_MAP_CREATE, ...) and bpf(BPF_PROG_LOAD, ...) */
+        const unsigned int sysc = regs.orig_rax;
+        const unsigned int comm = regs.rdi;
+        is_map = (sysc == SYS_bpf && comm == BPF_MAP_CREATE);
+        is_prog = (sysc == SYS_bpf && comm == BPF_PROG_LOAD);
+
+        /* Print a representation of the system call */
+        log_debu(args,
+                 "%d(%d, %ld, %ld, %ld, %ld, %ld)",
+                 sysc,
+                 comm, (long)regs.rsi, (long)regs.rdx, (long)regs.r10, (long)regs.r8, (long)regs.r9);
+
+        /* Run system call and stop on exit */
+        if (ptrace(PTRACE_SYSCALL, pid, 0, 0) == -1)
+        {
+            log_fata(args, "%s\n", strerror(errno));
+        }
+
+        /* Waiting for PID to die */
+        run_wait(args, pid);
+
+        /* Get system call result */
+        if (ptrace(PTRACE_GETREGS, pid, 0, &regs) == -1)
+        {
+            if (DEBUG) {
+                print_log(3, NULL, args, "%s\n", " = ?");
+            }
+            if (errno == ESRCH)
+            {
+                run_gen_on_exit(args);
+                exit(regs.rdi); // _exit(2) or similar
+            }
+            log_fata(args, "%s\n", strerror(errno));
+        }
+
+        /* Print system call result */
+        long result = regs.rax;
+        if (DEBUG) {
+            print_log(3, NULL, args, " = %ld\n", result);
+        }
+
+        /* Pin (or hold) the programs using the bpfcov maps */
+        if (is_prog && result > 0)
+        {
+            int pidfd = syscall(SYS_pidfd_open, pid, 0);
+            if (pidfd < 0)
+            {
+                continue;
+            }
+            int curfd = syscall(SYS_pidfd_getfd, pidfd, result, 0);
+            close(pidfd);
+            if (curfd >= 0)
+            {
+                run_capture_prog(args, curfd);
+            }
+            continue;
+        }
+
+        /* Pin the bpfcov maps */
+        if (is_map && result)
+        {
+            int pidfd = syscall(SYS_pidfd_open, pid, 0);
+            if (pidfd < 0)
+            {
+                continue;
+            }
+            int curfd = syscall(SYS_pidfd_getfd, pidfd, result, 0);
+            if (curfd < 0)
+            {
+                continue;
+            }
+            close(pidfd);
+
+            struct bpf_map_info map_info = {};
+            int err;
+            err = get_map_info(curfd, &map_info);
+            if (!err && strlen(map_info.name) > 0)
+            {
+                log_info(args, "got info about map '%s'\n", map_info.name);
+
+                char map_name[BPF_OBJ_NAME_LEN];
+                strcpy(map_name, map_info.name);
+
+                const char *sep = ".";
+                char *object = strtok(map_info.name, sep); // The map name prefix is the BPF object name
+                char *suffix = strtok(NULL, sep);
+                int idx = get_map_index(suffix);
+                if (idx < 0)
+                {
+                    close(curfd);
+                    continue;
+                }
+
+                /* Hold the bpfcov maps */
+                if (args->gen_on_exit)
+                {
+                    struct cov_maps *slot = run_hold_slot(args, object, idx);
+                    if (!slot)
+                    {
+                        log_warn(args, "already holding a map for '%s', ignoring map '%s'\n", suffix, map_name);
+                        close(curfd);
+                        continue;
+                    }
+                    strcpy(map_info.name, map_name);
+                    slot->fd[idx] = curfd;
+                    slot->info[idx] = map_info;
+                    log_warn(args, "hold map '%s' (generation %ld)\n", map_name, (long)(slot - args->held));
+                    continue;
+                }
+
+                /* Pin the bpfcov maps in the directory of their BPF object */
+                char object_root[PATH_MAX];
+                if (snprintf(object_root, PATH_MAX, "%s/%s", args->prog_root, object) >= PATH_MAX)
+                {
+                    log_fata(args, "%s\n", "object root path too long");
+                }
+                if (mkdir(object_root, 0700) && errno != EEXIST)
+                {
+                    log_fata(args, "could not create '%s'\n", object_root);
+                }
+                char pin_path[PATH_MAX];
+                if (!get_pin_path(args, object, idx, 0, pin_path))
+                {
+                    err = bpf_obj_pin(curfd, pin_path);
+                    if (err && errno == EEXIST && args->accumulate)
+                    {
+                        // The program reloaded its maps (or it restarted): pin them as a further generation
+                        char gen_pin_path[PATH_MAX];
+                        int g;
+                        for (g = 1; g < MAX_GENERATIONS; g++)
+                        {
+                            if (get_pin_path(args, object, idx, g, gen_pin_path))
+                            {
+                                break;
+                            }
+                            err = bpf_obj_pin(curfd, gen_pin_path);
+                            if (!err || errno != EEXIST)
+                            {
+                                break;
+                            }
+                        }
+                        if (!err)
+                        {
+                            log_warn(args, "pin map '%s' to '%s' (generation %d)\n", map_name, gen_pin_path, g);
+                            continue;
+                        }
+                    }
+                    if (err)
+                    {
+                        if (errno == EEXIST)
+                        {
+                            log_warn(args, "pin '%s' already exists for map '%s'\n", pin_path, map_name);
+                            continue;
+                        }
+                        log_fata(args, "%s\n", "could not pin map");
+                    }
+                    log_warn(args, "pin map '%s' to '%s'\n", map_name, pin_path);
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+static char *timestamped_output(struct root_args *args)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    struct tm local;
+    localtime_r(&now.tv_sec, &local);
+    char timestamp[32];
+    strftime(timestamp, sizeof(timestamp), "%Y%m%dT%H%M%S", &local);
+
+    if (is_stdout(args->output))
+    {
+        return strdup(args->output);
+    }
+
+    char *stem = strdup(args->output);
+    strip_extension(stem);
+
+    char output_path[PATH_MAX];
+    int output_path_len;
+    const char *extension = profile_string[args->gen_format];
+    if (args->interval.tv_nsec == 0)
+    {
+        output_path_len = snprintf(output_path, PATH_MAX, "%s.%s.%s", stem, timestamp, extension);
+    }
+    else
+    {
+        output_path_len = snprintf(output_path, PATH_MAX, "%s.%s-%03ld.%s", stem, timestamp, now.tv_nsec / 1000000, extension);
+    }
+    free(stem);
+
+    return output_path_len >= PATH_MAX ? NULL : strdup(output_path);
+}
+
+// Keep the maps open and write a timestamped profraw every interval, until interrupted
+static int gen_periodic(struct root_args *args)
+{
+    log_info(args, "generating a snapshot for program '%s' every %ld.%03lds\n",
+             args->program[0], (long)args->interval.tv_sec, args->interval.tv_nsec / 1000000);
+
+    struct cov_maps **maps = calloc(args->num_objects, sizeof(struct cov_maps *));
+    struct cov_snapshot *snaps = calloc(args->num_objects, sizeof(struct cov_snapshot));
+    if (!maps || !snaps)
+    {
+        log_fata(args, "%s\n", "could not allocate the snapshots");
+    }
+    for (int o = 0; o < args->num_objects; o++)
+    {
+        int num_maps = open_pinned_generations(args, args->objects[o], &maps[o]);
+        if (num_maps == 0)
+        {
+            log_fata(args, "could not open the pinned maps for object '%s'\n", args->objects[o]);
+        }
+        if (init_snapshot(args, maps[o], num_maps, args->delta, &snaps[o]))
+        {
+            log_fata(args, "could not prepare the snapshot for object '%s'\n", args->objects[o]);
+        }
+        // The first delta counts what happened since now
+        if (args->delta && read_snapshot(args, &snaps[o]))
+        {
+            log_fata(args, "could not read the counters for object '%s'\n", args->objects[o]);
+        }
+    }
+
+    handle_interrupts();
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    while (!interrupted)
+    {
+        // Absolute deadlines, so that snapshots do not drift
+        deadline.tv_sec += args->interval.tv_sec;
+        deadline.tv_nsec += args->interval.tv_nsec;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        int err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+        if (interrupted)
+        {
+            break;
+        }
+        if (err && err != EINTR)
+        {
+            log_fata(args, "%s\n", strerror(err));
+        }
+
+        char *output = timestamped_output(args);
+        if (!output)
+        {
+            log_fata(args, "%s\n", "output path too long");
+        }
+        struct profdata *pd = NULL;
+        for (int o = 0; o < args->num_objects; o++)
+        {
+            if (args->gen_format == PROFILE_profdata)
+            {
+                // A single indexed profile for all the BPF objects, unless split
+                pd = pd ? pd : profdata_new();
+                if (!pd || read_snapshot(args, &snaps[o]) || add_snapshot(args, &snaps[o], pd))
+                {
+                    log_erro(args, "could not generate the profdata for object '%s'\n", args->objects[o]);
+                }
+                if (pd && (args->split || o == args->num_objects - 1))
+                {
+                    FILE *outfp = open_output(args, output, args->objects[o], false);
+                    if (!outfp || write_profdata(args, pd, false, outfp))
+                    {
+                        log_erro(args, "could not generate the profdata for object '%s'\n", args->objects[o]);
+                    }
+                    if (outfp)
+                    {
+                        fclose(outfp);
+                    }
+                    profdata_free(pd);
+                    pd = NULL;
+                }
+                continue;
+            }
+
+            FILE *outfp = open_output(args, output, args->objects[o], o > 0);
+            if (!outfp || read_snapshot(args, &snaps[o]) || write_snapshot(args, &snaps[o], outfp))
+            {
+                log_erro(args, "could not generate the profraw for object '%s'\n", args->objects[o]);
+            }
+            if (outfp)
+            {
+                fclose(outfp);
+            }
+        }
+        log_warn(args, "snapshot '%s'\n", output);
+        free(output);
+    }
+
+    log_info(args, "%s\n", "stopping the snapshots");
+    for (int o = 0; o < args->num_objects; o++)
+    {
+        for (int g = 0; g < snaps[o].num_maps; g++)
+        {
+            close_maps(&maps[o][g]);
+        }
+        free_snapshot(&snaps[o]);
+        free(maps[o]);
+    }
+    free(snaps);
+    free(maps);
+
+    /* Unpin the maps */
+    handle_map_pins(args, NULL, args->unpin);
+
+    return 0;
+}
+
+int gen(struct root_args *args)
+{
+    if (is_periodic(args))
+    {
+        return gen_periodic(args);
+    }
+
+    log_info(args, "generating '%s' for program '%s'\n", args->output, args->program[0]);
+
+    /* One raw profile for each BPF object, either concatenated in the output or in their own file (--split) */
+    /* Or a single indexed profile for all of them (one for each, when split) */
+    struct profdata *pd = NULL;
+    for (int o = 0; o < args->num_objects; o++)
+    {
+        /* Get maps info (for every generation) */
+        struct cov_maps *maps = NULL;
+        int num_maps = open_pinned_generations(args, args->objects[o], &maps);
+        if (num_maps == 0)
+        {
+            log_fata(args, "could not open the pinned maps for object '%s'\n", args->objects[o]);
+        }
+        log_info(args, "found %d generation(s) of pinned maps for object '%s'\n", num_maps, args->objects[o]);
+
+        int err;
+        if (args->gen_format == PROFILE_profdata)
+        {
+            pd = pd ? pd : profdata_new();
+            err = !pd || add_profdata(args, maps, num_maps, pd);
+            if (!err && (args->split || o == args->num_objects - 1))
+            {
+                FILE *outfp = open_output(args, args->output, args->objects[o], false);
+                err = !outfp || write_profdata(args, pd, false, outfp);
+                if (outfp)
+                {
+                    fclose(outfp);
+                }
+                profdata_free(pd);
+                pd = NULL;
+            }
+        }
+        else
+        {
+            FILE *outfp = open_output(args, args->output, args->objects[o], o > 0);
+            err = !outfp || write_profraw(args, maps, num_maps, outfp);
+            if (outfp)
+            {
+                fclose(outfp);
+            }
+        }
+        for (int g = 0; g < num_maps; g++)
+        {
+            close_maps(&maps[g]);
+        }
+        free(maps);
+        if (err)
+        {
+            log_fata(args, "could not generate the %s for object '%s'\n", profile_string[args->gen_format], args->objects[o]);
+        }
+
+        /* The run time stats of its programs, next to the profile */
+        struct cov_prog *progs;
+        int num_progs = open_pinned_progs(args, args->objects[o], &progs);
+        if (write_runstats(args, args->objects[o], progs, num_progs, o > 0))
+        {
+            log_fata(args, "could not write the run time stats for object '%s'\n", args->objects[o]);
+        }
+        for (int p = 0; p < num_progs; p++)
+        {
+            close(progs[p].fd);
+        }
+        free(progs);
+    }
+
+    /* Unpin the maps */
+    handle_map_pins(args, NULL, args->unpin);
+
+    return 0;
+}
+
+int reset(struct root_args *args)
+{
+    log_info(args, "resetting the counters of program '%s'\n", args->program[0]);
+
+    __u32 key = 0;
+    for (int o = 0; o < args->num_objects; o++)
+    {
+        struct cov_maps *maps = NULL;
+        int num_maps = open_pinned_generations(args, args->objects[o], &maps);
+        if (num_maps == 0)
+        {
+            log_fata(args, "could not open the pinned maps for object '%s'\n", args->objects[o]);
+        }
+
+        /* Zero the counters (both banks, when double-buffered) of every generation with a single update each */
+        for (int g = 0; g < num_maps; g++)
+        {
+            for (int m = 0; m < NUM_COV_MAPS; m++)
+            {
+                if ((m != 0 && m != 4) || maps[g].fd[m] < 0)
+                {
+                    continue;
+                }
+                void *zeros = calloc(1, maps[g].info[m].value_size);
+                if (!zeros || bpf_map_update_elem(maps[g].fd[m], &key, zeros, BPF_ANY))
+                {
+                    log_fata(args, "could not reset map '%s' (generation %d)\n", maps[g].info[m].name, g);
+                }
+                free(zeros);
+                log_info(args, "reset map '%s' (generation %d)\n", maps[g].info[m].name, g);
+            }
+            close_maps(&maps[g]);
+        }
+        free(maps);
+    }
+
+    return 0;
+}
+
+// A bpfcov map streamed by the BPF iterator
+struct swept_map
+{
+    struct sweep_record record;
+    char *value;
+};
+
+// The maps of a BPF object, as loaded (libbpf creates them one after the other)
+struct swept_object
+{
+    char object[BPF_OBJ_NAME_LEN];
+    struct swept_map *maps[NUM_COV_MAPS];
+};
+
+static int cmp_swept_map(const void *a, const void *b)
+{
+    __u32 x = ((const struct swept_map *)a)->record.id;
+    __u32 y = ((const struct swept_map *)b)->record.id;
+    return (x > y) - (x < y);
+}
+
+// Read the values the iterator could not stream (too big) by map ID
+static int sweep_omitted(struct root_args *args, struct swept_map *map)
+{
+    int fd = bpf_map_get_fd_by_id(map->record.id);
+    if (fd < 0)
+    {
+        log_warn(args, "could not get map '%s' (ID %u)\n", map->record.name, map->record.id);
+        return -1;
+    }
+    struct bpf_map_info info;
+    if (get_map_info(fd, &info))
+    {
+        return -1;
+    }
+    map->value = malloc(info.value_size);
+    if (!map->value || get_global_data(fd, &info, map->value))
+    {
+        log_warn(args, "could not get global data from map '%s' (ID %u)\n", map->record.name, map->record.id);
+        free(map->value);
+        map->value = NULL;
+        close(fd);
+        return -1;
+    }
+    map->record.value_size = info.value_size;
+    close(fd);
+    return 0;
+}
+
+static int sweep_write(struct root_args *args, struct swept_object *o)
+{
+    struct swept_map *profc = o->maps[0];
+    struct swept_map *profd = o->maps[1];
+    struct swept_map *profn = o->maps[2];
+    struct swept_map *covmap = o->maps[3];
+    struct swept_map *profb = o->maps[4];
+
+    // Both banks of double-buffered counters hold counts
+    long long int *counters = (long long int *)profc->value;
+    if (profb && profb->value && profb->record.value_size == profc->record.value_size)
+    {
+        for (__u32 c = 0; c < profc->record.value_size / 8; c++)
+        {
+            counters[c] += ((long long int *)profb->value)[c];
+        }
+    }
+
+    char output_path[PATH_MAX];
+    if (snprintf(output_path, PATH_MAX, "%s/%s.%u.profraw", args->output, o->object, profc->record.id) >= PATH_MAX)
+    {
+        log_erro(args, "%s\n", "output path too long");
+        return -1;
+    }
+    int fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        log_erro(args, "could not open the output file '%s'\n", output_path);
+        return -1;
+    }
+
+    long long int header[PROFRAW_HEADER_LEN];
+    fill_profraw_header(header, covmap->value, profd->record.value_size, profc->record.value_size, profn->record.value_size);
+    char padding[8] = {0};
+    struct iovec iov[5] = {
+        {.iov_base = header, .iov_len = sizeof(header)},
+        {.iov_base = profd->value, .iov_len = profd->record.value_size},
+        {.iov_base = profc->value, .iov_len = profc->record.value_size},
+        {.iov_base = profn->value, .iov_len = profn->record.value_size},
+        {.iov_base = padding, .iov_len = profraw_padding(profn->record.value_size)},
+    };
+    int err = write_all(args, fd, iov, 5);
+    close(fd);
+    if (!err)
+    {
+        log_warn(args, "sweep object '%s' to '%s'\n", o->object, output_path);
+    }
+    return err;
+}
+
+int sweep(struct root_args *args)
+{
+    log_info(args, "%s\n", "sweeping the bpfcov maps on the host...");
+
+    /* Stream every bpfcov map (records and values) through a single BPF iterator */
+    struct sweep_bpf *skel = sweep_bpf__open_and_load();
+    if (!skel)
+    {
+        log_fata(args, "%s\n", "could not load the BPF iterator (it needs a kernel supporting bpf_map iterators)");
+    }
+    struct bpf_link *link = bpf_program__attach_iter(skel->progs.dump_cov_maps, NULL);
+    if (libbpf_get_error(link))
+    {
+        log_fata(args, "%s\n", "could not attach the BPF iterator");
+    }
+    int iter_fd = bpf_iter_create(bpf_link__fd(link));
+    if (iter_fd < 0)
+    {
+        log_fata(args, "%s\n", "could not create the BPF iterator");
+    }
+
+    size_t size = 0;
+    size_t capacity = 1 << 20;
+    char *buf = malloc(capacity);
+    for (;;)
+    {
+        if (!buf)
+        {
+            log_fata(args, "%s\n", "could not allocate the sweep buffer");
+        }
+        ssize_t n = read(iter_fd, buf + size, capacity - size);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            log_fata(args, "could not read the BPF iterator: %s\n", strerror(errno));
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        size += n;
+        if (size == capacity)
+        {
+            capacity *= 2;
+            buf = realloc(buf, capacity);
+        }
+    }
+    close(iter_fd);
+    bpf_link__destroy(link);
+    sweep_bpf__destroy(skel);
+    log_info(args, "read %zu bytes from the BPF iterator\n", size);
+
+    /* Parse the records */
+    struct swept_map *maps = NULL;
+    int num_maps = 0;
+    size_t off = 0;
+    while (off + sizeof(struct sweep_record) <= size)
+    {
+        struct swept_map *grown = realloc(maps, (num_maps + 1) * sizeof(struct swept_map));
+        if (!grown)
+        {
+            log_fata(args, "%s\n", "could not allocate the swept maps");
+        }
+        maps = grown;
+        struct swept_map *map = &maps[num_maps++];
+        memcpy(&map->record, buf + off, sizeof(struct sweep_record));
+        map->record.name[SWEEP_NAME_LEN - 1] = '\0';
+        off += sizeof(struct sweep_record);
+        map->value = NULL;
+        if (map->record.flags & SWEEP_VALUE_OMITTED)
+        {
+            sweep_omitted(args, map);
+            continue;
+        }
+        if (off + map->record.value_size > size)
+        {
+            log_fata(args, "%s\n", "truncated output from the BPF iterator");
+        }
+        map->value = buf + off;
+        off += map->record.value_size;
+    }
+
+    /* Group the maps by BPF object: libbpf creates the maps of an object one after the other */
+    qsort(maps, num_maps, sizeof(struct swept_map), cmp_swept_map);
+    struct swept_object *objects = calloc(num_maps ? num_maps : 1, sizeof(struct swept_object));
+    int num_objects = 0;
+    for (int m = 0; m < num_maps; m++)
+    {
+        char name[SWEEP_NAME_LEN];
+        strcpy(name, maps[m].record.name);
+        const char *sep = ".";
+        char *object = strtok(name, sep);
+        int idx = get_map_index(strtok(NULL, sep));
+        if (idx < 0 || !maps[m].value)
+        {
+            continue;
+        }
+
+        // The latest object with the same name, unless it already got this map
+        int o;
+        for (o = num_objects - 1; o >= 0 && strcmp(objects[o].object, object) != 0; o--)
+            ;
+        if (o < 0 || objects[o].maps[idx])
+        {
+            o = num_objects++;
+            snprintf(objects[o].object, BPF_OBJ_NAME_LEN, "%s", object);
+        }
+        objects[o].maps[idx] = &maps[m];
+    }
+
+    /* Write a profraw for each BPF object */
+    int written = 0;
+    for (int o = 0; o < num_objects; o++)
+    {
+        int p;
+        for (p = 0; p < NUM_PINNED_MAPS && objects[o].maps[p]; p++)
+            ;
+        if (p < NUM_PINNED_MAPS)
+        {
+            log_warn(args, "skipping object '%s': could not find all its maps\n", objects[o].object);
+            continue;
+        }
+        if (sweep_write(args, &objects[o]) == 0)
+        {
+            written++;
+        }
+    }
+    log_info(args, "swept %d BPF object(s)\n", written);
+
+    for (int m = 0; m < num_maps; m++)
+    {
+        if (maps[m].record.flags & SWEEP_VALUE_OMITTED)
+        {
+            free(maps[m].value);
+        }
+    }
+    free(objects);
+    free(maps);
+    free(buf);
+
+    return 0;
+}
+
+// The raw profiles of the same BPF object (same layout, and same functions) get their counters summed
+struct merge_group
+{
+    long long int header[PROFRAW_HEADER_LEN];
+    __u64 digest;          // Of the data part (names, hashes, and counters offsets of the functions)
+    char *data;            // Data part (copied from the first raw profile of the group)
+    char *tail;            // Names part plus the padding
+    size_t tail_size;
+    long long int *counters; // Sum of all the raw profiles of the group (after the reduction)
+    long long int num_profiles;
+};
+
+struct merge_state
+{
+    struct root_args *args;
+    pthread_mutex_t lock; // Guards the groups
+    struct merge_group *groups;
+    int num_groups;
+    long long int version;
+    volatile int failed;
+};
+
+struct merge_worker
+{
+    struct merge_state *state;
+    pthread_t thread;
+    int first; // Inputs [first, last)
+    int last;
+    long long int **sums; // Counters of every group, summed by this worker (NULL until it meets the group)
+    long long int *num_profiles;
+    int num_sums;
+};
+
+// Vectorized 64-bit adds (4 lanes: AVX2 when available, SSE2 pairs otherwise), the counters are only 8 bytes aligned
+typedef long long int counters_vec __attribute__((vector_size(32), aligned(8)));
+
+static void sum_counters(long long int *restrict sum, const long long int *restrict counters, long long int num_counters)
+{
+    long long int c = 0;
+    for (; c + 4 <= num_counters; c += 4)
+    {
+        *(counters_vec *)&sum[c] += *(const counters_vec *)&counters[c];
+    }
+    for (; c < num_counters; c++)
+    {
+        sum[c] += counters[c];
+    }
+}
+
+// FNV-1a
+static __u64 digest_of(const char *data, size_t size)
+{
+    __u64 digest = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; i++)
+    {
+        digest = (digest ^ (unsigned char)data[i]) * 0x100000001b3ULL;
+    }
+    return digest;
+}
+
+// Find (or create) the group of a raw profile
+static int merge_group_of(struct merge_state *state, const long long int *header, const char *data, const char *tail, size_t tail_size)
+{
+    size_t data_size = header[2] * PROFRAW_DATA_SIZE;
+    __u64 digest = digest_of(data, data_size);
+    // The paddings around the counters do not tell profiles apart
+    long long int key[PROFRAW_HEADER_LEN];
+    memcpy(key, header, sizeof(key));
+    key[3] = 0;
+    key[5] = 0;
+
+    pthread_mutex_lock(&state->lock);
+    int g;
+    for (g = 0; g < state->num_groups; g++)
+    {
+        struct merge_group *group = &state->groups[g];
+        if (group->digest == digest && memcmp(group->header, key, sizeof(group->header)) == 0 &&
+            memcmp(group->data, data, data_size) == 0)
+        {
+            break;
+        }
+    }
+    if (g == state->num_groups)
+    {
+        struct merge_group *groups = realloc(state->groups, (g + 1) * sizeof(struct merge_group));
+        if (groups)
+        {
+            state->groups = groups;
+            struct merge_group *group = &groups[g];
+            memset(group, 0, sizeof(*group));
+            memcpy(group->header, key, sizeof(group->header));
+            group->digest = digest;
+            group->data = malloc(data_size ? data_size : 1);
+            group->tail = malloc(tail_size ? tail_size : 1);
+            group->tail_size = tail_size;
+            if (group->data && group->tail)
+            {
+                memcpy(group->data, data, data_size);
+                memcpy(group->tail, tail, tail_size);
+                state->num_groups++;
+            }
+            else
+            {
+                free(group->data);
+                free(group->tail);
+                g = -1;
+            }
+        }
+        else
+        {
+            g = -1;
+        }
+    }
+    pthread_mutex_unlock(&state->lock);
+
+    return g;
+}
+
+// Make room for the counters of the given number of groups
+static int merge_reserve(struct merge_worker *worker, int num_groups)
+{
+    if (num_groups > worker->num_sums)
+    {
+        int num_sums = num_groups * 2;
+        long long int **sums = realloc(worker->sums, num_sums * sizeof(long long int *));
+        long long int *num_profiles = realloc(worker->num_profiles, num_sums * sizeof(long long int));
+        if (sums)
+        {
+            worker->sums = sums;
+        }
+        if (num_profiles)
+        {
+            worker->num_profiles = num_profiles;
+        }
+        if (!sums || !num_profiles)
+        {
+            return -1;
+        }
+        memset(&sums[worker->num_sums], 0, (num_sums - worker->num_sums) * sizeof(long long int *));
+        memset(&num_profiles[worker->num_sums], 0, (num_sums - worker->num_sums) * sizeof(long long int));
+        worker->num_sums = num_sums;
+    }
+    return 0;
+}
+
+static long long int *merge_sum_of(struct merge_worker *worker, int g, long long int num_counters)
+{
+    if (merge_reserve(worker, g + 1))
+    {
+        return NULL;
+    }
+    if (!worker->sums[g])
+    {
+        worker->sums[g] = calloc(num_counters ? num_counters : 1, 8);
+    }
+    return worker->sums[g];
+}
+
+// Check the header of a raw profile, returning its size (or -1 when malformed)
+static long long int merge_check(struct merge_state *state, const char *path, const long long int *header, __u64 remaining)
+{
+    struct root_args *args = state->args;
+    if ((__u64)header[0] != PROFRAW_MAGIC)
+    {
+        log_erro(args, "'%s' is not a profraw file (bad magic)\n", path);
+        return -1;
+    }
+    if (header[1] != state->version)
+    {
+        log_erro(args, "'%s' has version %lld, expecting %lld\n", path, header[1], state->version);
+        return -1;
+    }
+    if ((__u64)header[2] > remaining / PROFRAW_DATA_SIZE || (__u64)header[4] > remaining / 8 ||
+        (__u64)header[6] > remaining || (__u64)header[3] > remaining || (__u64)header[5] > remaining)
+    {
+        log_erro(args, "'%s' has a malformed header (data, counters, or names size)\n", path);
+        return -1;
+    }
+    __u64 total = PROFRAW_HEADER_LEN * 8 + header[3] + header[2] * PROFRAW_DATA_SIZE + header[4] * 8 + header[5] +
+                  header[6] + profraw_padding(header[6]);
+    if (total > remaining)
+    {
+        log_erro(args, "'%s' is truncated\n", path);
+        return -1;
+    }
+    return total;
+}
+
+// Add the counters of a (checked) raw profile to the sums of its group
+static int merge_profile(struct merge_worker *worker, const char *profile)
+{
+    const long long int *header = (const long long int *)profile;
+    size_t data_size = header[2] * PROFRAW_DATA_SIZE;
+    // Data records, padding, counters, padding, names
+    const char *data = profile + PROFRAW_HEADER_LEN * 8;
+    const long long int *counters = (const long long int *)(data + data_size + header[3]);
+    const char *tail = (const char *)counters + header[4] * 8 + header[5];
+    int g = merge_group_of(worker->state, header, data, tail, header[6] + profraw_padding(header[6]));
+    long long int *sum = g < 0 ? NULL : merge_sum_of(worker, g, header[4]);
+    if (!sum)
+    {
+        log_erro(worker->state->args, "%s\n", "could not allocate the counters");
+        return -1;
+    }
+    sum_counters(sum, counters, header[4]);
+    worker->num_profiles[g]++;
+
+    return 0;
+}
+
+// Sum the counters of every raw profile in an input, mapping one raw profile at a time (or decompressing it all)
+static int merge_input(struct merge_worker *worker, const char *path)
+{
+    struct merge_state *state = worker->state;
+    struct root_args *args = state->args;
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        log_erro(args, "could not open '%s'\n", path);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st))
+    {
+        log_erro(args, "could not read '%s'\n", path);
+        close(fd);
+        return -1;
+    }
+
+    int err = 0;
+    if (is_gzip(fd))
+    {
+        size_t size;
+        char *buf = read_gzip(args, fd, &size);
+        close(fd);
+        if (!buf)
+        {
+            log_erro(args, "could not decompress '%s'\n", path);
+            return -1;
+        }
+        // Raw profiles are 8 bytes aligned, as their counters
+        for (size_t off = 0; !err && off < size;)
+        {
+            long long int total = size - off < PROFRAW_HEADER_LEN * 8 ? -1 : merge_check(state, path, (const long long int *)(buf + off), size - off);
+            err = total < 0 || merge_profile(worker, buf + off);
+            off += total;
+        }
+        free(buf);
+        return err ? -1 : 0;
+    }
+
+    off_t off = 0;
+    while (!err && off < st.st_size)
+    {
+        long long int header[PROFRAW_HEADER_LEN];
+        if (pread(fd, header, sizeof(header), off) != sizeof(header))
+        {
+            log_erro(args, "'%s' is truncated\n", path);
+            err = -1;
+            break;
+        }
+        long long int total = merge_check(state, path, header, st.st_size - off);
+        if (total < 0)
+        {
+            err = -1;
+            break;
+        }
+
+        // Chunked reads: only this raw profile is mapped
+        off_t start = off & ~(off_t)(page_size - 1);
+        size_t len = off + total - start;
+        char *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, start);
+        if (map == MAP_FAILED)
+        {
+            log_erro(args, "could not map '%s'\n", path);
+            err = -1;
+            break;
+        }
+        madvise(map, len, MADV_SEQUENTIAL);
+        err = merge_profile(worker, map + (off - start));
+        munmap(map, len);
+
+        off += total;
+    }
+    close(fd);
+
+    return err;
+}
+
+static void *merge_worker_run(void *arg)
+{
+    struct merge_worker *worker = arg;
+    struct merge_state *state = worker->state;
+
+    for (int i = worker->first; i < worker->last && !state->failed; i++)
+    {
+        if (merge_input(worker, state->args->profraw[i]))
+        {
+            state->failed = 1;
+        }
+    }
+
+    return NULL;
+}
+
+struct merge_reduction
+{
+    struct merge_worker *into;
+    struct merge_worker *from;
+    int num_groups;
+    long long int *num_counters; // For every group
+};
+
+static void *merge_reduce(void *arg)
+{
+    struct merge_reduction *red = arg;
+    for (int g = 0; g < red->num_groups; g++)
+    {
+        long long int *from = red->from->sums[g];
+        if (!from)
+        {
+            continue;
+        }
+        if (!red->into->sums[g])
+        {
+            red->into->sums[g] = from;
+            red->from->sums[g] = NULL;
+        }
+        else
+        {
+            sum_counters(red->into->sums[g], from, red->num_counters[g]);
+        }
+        red->into->num_profiles[g] += red->from->num_profiles[g];
+    }
+
+    return NULL;
+}
+
+static int write_merged(struct root_args *args, struct merge_state *state)
+{
+    FILE *outfp = is_stdout(args->output) ? fdopen(dup(STDOUT_FILENO), "wb") : fopen(args->output, "wb");
+    if (!outfp)
+    {
+        log_erro(args, "could not open the output file '%s'\n", args->output);
+        return -1;
+    }
+
+    int err = 0;
+    if (args->gen_format == PROFILE_profdata)
+    {
+        struct profdata *pd = profdata_new();
+        err = !pd;
+        for (int g = 0; !err && g < state->num_groups; g++)
+        {
+            struct merge_group *group = &state->groups[g];
+            int added = profdata_add_sections(pd, group->data, group->header[2] * PROFRAW_DATA_SIZE,
+                                              group->counters, group->header[4], group->tail, group->header[6]);
+            if (added)
+            {
+                log_erro(args, "could not index the counters: %s\n", strerror(-added));
+                err = -1;
+            }
+        }
+        err = err || write_profdata(args, pd, false, outfp);
+        profdata_free(pd);
+    }
+    else
+    {
+        for (int g = 0; !err && g < state->num_groups; g++)
+        {
+            struct merge_group *group = &state->groups[g];
+            // No padding around the counters in the output
+            long long int header[PROFRAW_HEADER_LEN];
+            memcpy(header, group->header, sizeof(header));
+            header[3] = 0;
+            header[5] = 0;
+            struct iovec iov[4] = {
+                {.iov_base = header, .iov_len = sizeof(header)},
+                {.iov_base = group->data, .iov_len = header[2] * PROFRAW_DATA_SIZE},
+                {.iov_base = group->counters, .iov_len = header[4] * 8},
+                {.iov_base = group->tail, .iov_len = group->tail_size},
+            };
+            err = write_all(args, fileno(outfp), iov, 4);
+        }
+    }
+    fclose(outfp);
+
+    return err ? -1 : 0;
+}
+
+int merge(struct root_args *args)
+{
+    log_info(args, "merging %d file(s) into '%s' with %d thread(s)\n", args->num_profraw, args->output, args->jobs);
+
+    struct merge_state state = {.args = args};
+    pthread_mutex_init(&state.lock, NULL);
+
+    // All the inputs must share the version of the first one
+    int fd = open(args->profraw[0], O_RDONLY);
+    long long int header[PROFRAW_HEADER_LEN];
+    bool compressed = fd >= 0 && is_gzip(fd);
+    if (compressed)
+    {
+        gzFile gz = gzdopen(dup(fd), "rb");
+        compressed = gz && gzread(gz, header, sizeof(header)) == sizeof(header);
+        if (gz)
+        {
+            gzclose(gz);
+        }
+    }
+    if (fd < 0 || (!compressed && pread(fd, header, sizeof(header), 0) != sizeof(header)) || (__u64)header[0] != PROFRAW_MAGIC)
+    {
+        log_fata(args, "'%s' is not a profraw file\n", args->profraw[0]);
+    }
+    close(fd);
+    state.version = header[1];
+
+    /* Every worker sums its share of the inputs */
+    int num_workers = args->jobs;
+    struct merge_worker *workers = calloc(num_workers, sizeof(struct merge_worker));
+    if (!workers)
+    {
+        log_fata(args, "%s\n", "could not allocate the workers");
+    }
+    for (int w = 0; w < num_workers; w++)
+    {
+        workers[w].state = &state;
+        workers[w].first = (long long int)args->num_profraw * w / num_workers;
+        workers[w].last = (long long int)args->num_profraw * (w + 1) / num_workers;
+        if (pthread_create(&workers[w].thread, NULL, merge_worker_run, &workers[w]))
+        {
+            log_fata(args, "%s\n", "could not start the workers");
+        }
+    }
+    for (int w = 0; w < num_workers; w++)
+    {
+        pthread_join(workers[w].thread, NULL);
+    }
+    if (state.failed)
+    {
+        log_fata(args, "%s\n", "could not merge the inputs");
+    }
+    log_info(args, "found %d BPF object(s)\n", state.num_groups);
+
+    /* Tree-shaped reduction: at every round, pairs of workers (w, w + stride) get summed in parallel */
+    long long int num_counters[state.num_groups ? state.num_groups : 1];
+    for (int g = 0; g < state.num_groups; g++)
+    {
+        num_counters[g] = state.groups[g].header[4];
+    }
+    for (int w = 0; w < num_workers; w++)
+    {
+        if (merge_reserve(&workers[w], state.num_groups))
+        {
+            log_fata(args, "%s\n", "could not allocate the counters");
+        }
+    }
+    struct merge_reduction *reds = calloc(num_workers, sizeof(struct merge_reduction));
+    pthread_t *threads = calloc(num_workers, sizeof(pthread_t));
+    if (!reds || !threads)
+    {
+        log_fata(args, "%s\n", "could not allocate the reduction");
+    }
+    for (int stride = 1; stride < num_workers; stride *= 2)
+    {
+        int num_reds = 0;
+        for (int w = 0; w + stride < num_workers; w += stride * 2)
+        {
+            reds[num_reds] = (struct merge_reduction){
+                .into = &workers[w],
+                .from = &workers[w + stride],
+                .num_groups = state.num_groups,
+                .num_counters = num_counters,
+            };
+            if (pthread_create(&threads[num_reds], NULL, merge_reduce, &reds[num_reds]))
+            {
+                log_fata(args, "%s\n", "could not start the reduction");
+            }
+            num_reds++;
+        }
+        for (int r = 0; r < num_reds; r++)
+        {
+            pthread_join(threads[r], NULL);
+        }
+    }
+    for (int g = 0; g < state.num_groups; g++)
+    {
+        state.groups[g].counters = workers[0].sums[g];
+        state.groups[g].num_profiles = workers[0].num_profiles[g];
+        log_debu(args, "summed %lld raw profile(s) of %lld counters (group %d)\n", state.groups[g].num_profiles, num_counters[g], g);
+    }
+
+    /* Output */
+    if (write_merged(args, &state))
+    {
+        log_fata(args, "could not write '%s'\n", args->output);
+    }
+    log_warn(args, "merged %d file(s) into '%s'\n", args->num_profraw, args->output);
+
+    for (int w = 0; w < num_workers; w++)
+    {
+        for (int g = 0; g < workers[w].num_sums; g++)
+        {
+            free(workers[w].sums[g]);
+        }
+        free(workers[w].sums);
+        free(workers[w].num_profiles);
+    }
+    for (int g = 0; g < state.num_groups; g++)
+    {
+        free(state.groups[g].data);
+        free(state.groups[g].tail);
+    }
+    free(state.groups);
+    free(workers);
+    free(reds);
+    free(threads);
+    pthread_mutex_destroy(&state.lock);
+
+    return 0;
+}
+
+// The sections of a BPF coverage object (*.bpf.obj) that a sparse profile lacks
+struct densify_object
+{
+    char *path;
+    char *buf;
+    size_t size;
+    const char *data; // __llvm_prf_data
+    __u64 num_functions;
+    __u64 num_counters;
+    __u64 *first;     // Index of the first counter of each function
+    const char *names; // __llvm_prf_names
+    __u64 names_size;
+    const char *covmap; // __llvm_covmap
+    __u64 version;
+    __u64 *sorted;    // Functions sorted by name MD5 and hash
+};
+
+static const struct densify_object *densify_sort_object;
+
+static int cmp_densify_function(const void *a, const void *b)
+{
+    const char *x = densify_sort_object->data + *(const __u64 *)a * PROFRAW_DATA_SIZE;
+    const char *y = densify_sort_object->data + *(const __u64 *)b * PROFRAW_DATA_SIZE;
+    __u64 xk[2], yk[2];
+    memcpy(xk, x, 16);
+    memcpy(yk, y, 16);
+    if (xk[0] != yk[0])
+    {
+        return xk[0] < yk[0] ? -1 : 1;
+    }
+    return (xk[1] > yk[1]) - (xk[1] < yk[1]);
+}
+
+static int load_densify_object(struct root_args *args, const char *path, struct densify_object *obj)
+{
+    memset(obj, 0, sizeof(*obj));
+    obj->path = strdup(path);
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) || st.st_size < (off_t)sizeof(Elf64_Ehdr))
+    {
+        log_erro(args, "could not read the BPF coverage object '%s'\n", path);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+    obj->size = st.st_size;
+    obj->buf = mmap(NULL, obj->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (obj->buf == MAP_FAILED)
+    {
+        obj->buf = NULL;
+        log_erro(args, "could not map the BPF coverage object '%s'\n", path);
+        return -1;
+    }
+
+    // Walking the section headers, looking for the coverage sections by name
+    const Elf64_Ehdr *ehdr = (const Elf64_Ehdr *)obj->buf;
+    if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 || ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+        ehdr->e_shentsize != sizeof(Elf64_Shdr) || ehdr->e_shoff > obj->size ||
+        (obj->size - ehdr->e_shoff) / sizeof(Elf64_Shdr) < ehdr->e_shnum || ehdr->e_shstrndx >= ehdr->e_shnum)
+    {
+        log_erro(args, "'%s' is not a BPF coverage object\n", path);
+        return -1;
+    }
+    const Elf64_Shdr *shdrs = (const Elf64_Shdr *)(obj->buf + ehdr->e_shoff);
+    const Elf64_Shdr *shstrtab = &shdrs[ehdr->e_shstrndx];
+    __u64 data_size = 0, covmap_size = 0;
+    for (int i = 0; i < ehdr->e_shnum; i++)
+    {
+        const Elf64_Shdr *shdr = &shdrs[i];
+        if (shdr->sh_type == SHT_NOBITS || shdr->sh_offset > obj->size || shdr->sh_size > obj->size - shdr->sh_offset ||
+            shdr->sh_name >= shstrtab->sh_size || shstrtab->sh_offset > obj->size - shstrtab->sh_size)
+        {
+            continue;
+        }
+        const char *name = obj->buf + shstrtab->sh_offset + shdr->sh_name;
+        if (strnlen(name, shstrtab->sh_size - shdr->sh_name) == shstrtab->sh_size - shdr->sh_name)
+        {
+            continue;
+        }
+        /**/ if (strcmp(name, "__llvm_prf_data") == 0)
+        {
+            obj->data = obj->buf + shdr->sh_offset;
+            data_size = shdr->sh_size;
+        }
+        else if (strcmp(name, "__llvm_prf_names") == 0)
+        {
+            obj->names = obj->buf + shdr->sh_offset;
+            obj->names_size = shdr->sh_size;
+        }
+        else if (strcmp(name, "__llvm_covmap") == 0)
+        {
+            obj->covmap = obj->buf + shdr->sh_offset;
+            covmap_size = shdr->sh_size;
+        }
+    }
+    if (!obj->data || !obj->names || !obj->covmap || covmap_size < 16 || data_size % PROFRAW_DATA_SIZE)
+    {
+        log_erro(args, "could not find the coverage sections in '%s'\n", path);
+        return -1;
+    }
+    __u32 version;
+    memcpy(&version, obj->covmap + 12, 4); // Version is the 3rd int in the coverage mapping header
+    obj->version = version + 1;           // Version is 0 indexed
+
+    // The pass lays out the counters of the functions one after the other, in the order of their data
+    obj->num_functions = data_size / PROFRAW_DATA_SIZE;
+    obj->first = malloc((obj->num_functions + 1) * sizeof(__u64));
+    obj->sorted = malloc((obj->num_functions + 1) * sizeof(__u64));
+    if (!obj->first || !obj->sorted)
+    {
+        log_erro(args, "%s\n", "could not allocate the functions index");
+        return -1;
+    }
+    for (__u64 f = 0; f < obj->num_functions; f++)
+    {
+        __u32 num;
+        memcpy(&num, obj->data + f * PROFRAW_DATA_SIZE + 40, 4);
+        obj->first[f] = obj->num_counters;
+        obj->num_counters += num;
+        obj->sorted[f] = f;
+    }
+    densify_sort_object = obj;
+    qsort(obj->sorted, obj->num_functions, sizeof(__u64), cmp_densify_function);
+
+    log_info(args, "loaded BPF coverage object '%s' (%llu functions, %llu counters)\n", path, obj->num_functions, obj->num_counters);
+
+    return 0;
+}
+
+static void free_densify_object(struct densify_object *obj)
+{
+    if (obj->buf)
+    {
+        munmap(obj->buf, obj->size);
+    }
+    free(obj->first);
+    free(obj->sorted);
+    free(obj->path);
+}
+
+static __s64 find_densify_function(const struct densify_object *obj, const __u64 key[2])
+{
+    __u64 lo = 0, hi = obj->num_functions;
+    while (lo < hi)
+    {
+        __u64 mid = lo + (hi - lo) / 2;
+        __u64 k[2];
+        memcpy(k, obj->data + obj->sorted[mid] * PROFRAW_DATA_SIZE, 16);
+        if (k[0] < key[0] || (k[0] == key[0] && k[1] < key[1]))
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    if (lo < obj->num_functions)
+    {
+        __u64 k[2];
+        memcpy(k, obj->data + obj->sorted[lo] * PROFRAW_DATA_SIZE, 16);
+        if (k[0] == key[0] && k[1] == key[1])
+        {
+            return obj->sorted[lo];
+        }
+    }
+    return -1;
+}
+
+// Rebuild the dense profraw of one sparse section and write it
+static int densify_section(struct root_args *args, const struct sparse_header *sparse, const unsigned char *records,
+                           const struct densify_object *obj, int fd)
+{
+    long long int *counters = calloc(obj->num_counters + 1, 8);
+    char *data = malloc(obj->num_functions * PROFRAW_DATA_SIZE + 1);
+    if (!counters || !data)
+    {
+        log_erro(args, "%s\n", "could not allocate the profraw");
+        free(counters);
+        free(data);
+        return -1;
+    }
+
+    int err = 0;
+    unsigned int unknown = 0;
+    const unsigned char *p = records, *end = records + sparse->size;
+    for (__u64 r = 0; r < sparse->num_records && !err; r++)
+    {
+        __u64 key[2], num_nonzero;
+        size_t len;
+        if (end - p < 16 || !(len = read_varint(p + 16, end, &num_nonzero)))
+        {
+            err = -1;
+            break;
+        }
+        memcpy(key, p, 16);
+        p += 16 + len;
+        __s64 f = find_densify_function(obj, key);
+        __u32 num = 0;
+        if (f >= 0)
+        {
+            memcpy(&num, obj->data + f * PROFRAW_DATA_SIZE + 40, 4);
+        }
+        else
+        {
+            unknown++;
+        }
+        __u64 c = 0;
+        for (__u64 e = 0; e < num_nonzero; e++)
+        {
+            __u64 delta, value;
+            if (!(len = read_varint(p, end, &delta)))
+            {
+                err = -1;
+                break;
+            }
+            p += len;
+            if (!(len = read_varint(p, end, &value)))
+            {
+                err = -1;
+                break;
+            }
+            p += len;
+            c += delta;
+            if (f >= 0 && c < num)
+            {
+                counters[obj->first[f] + c] = value;
+            }
+            c++;
+        }
+    }
+    if (err)
+    {
+        log_erro(args, "%s\n", "corrupted sparse records");
+        goto densify_out;
+    }
+    if (unknown)
+    {
+        log_warn(args, "skipped %u function(s) missing from '%s'\n", unknown, obj->path);
+    }
+
+    // The counters pointers are offsets from the counters part, the pointers to functions and values are nulled
+    for (__u64 f = 0; f < obj->num_functions; f++)
+    {
+        char *func = data + f * PROFRAW_DATA_SIZE;
+        memcpy(func, obj->data + f * PROFRAW_DATA_SIZE, PROFRAW_DATA_SIZE);
+        __u64 counter_ptr = obj->first[f] * 8;
+        memcpy(func + 16, &counter_ptr, 8);
+        memset(func + 24, 0, 16);
+    }
+
+    long long int header[PROFRAW_HEADER_LEN];
+    fill_profraw_header(header, obj->covmap, obj->num_functions * PROFRAW_DATA_SIZE, obj->num_counters * 8, obj->names_size);
+    char padding[8] = {0};
+    struct iovec iov[5] = {
+        {.iov_base = header, .iov_len = sizeof(header)},
+        {.iov_base = data, .iov_len = obj->num_functions * PROFRAW_DATA_SIZE},
+        {.iov_base = counters, .iov_len = obj->num_counters * 8},
+        {.iov_base = (void *)obj->names, .iov_len = obj->names_size},
+        {.iov_base = padding, .iov_len = profraw_padding(obj->names_size)},
+    };
+    err = write_all(args, fd, iov, 5);
+
+densify_out:
+    free(counters);
+    free(data);
+    return err ? -1 : 0;
+}
+
+static int densify_file(struct root_args *args, const char *path, struct densify_object *objs, int *candidates,
+                        int num_candidates, const char *output)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) || st.st_size == 0)
+    {
+        log_erro(args, "could not read '%s'\n", path);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+    size_t size = st.st_size;
+    bool gzipped = is_gzip(fd);
+    char *buf = gzipped ? read_gzip(args, fd, &size) : mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (!buf || buf == MAP_FAILED)
+    {
+        log_erro(args, "could not %s '%s'\n", gzipped ? "decompress" : "map", path);
+        return -1;
+    }
+
+    int err = 0;
+    int outfd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (outfd < 0)
+    {
+        log_erro(args, "could not open the output file '%s'\n", output);
+        err = -1;
+        goto densify_file_out;
+    }
+    log_info(args, "densifying '%s' into '%s'\n", path, output);
+
+    // Sparse sections can be concatenated (one for each BPF object)
+    for (size_t off = 0; off < size && !err;)
+    {
+        struct sparse_header sparse;
+        if (size - off < sizeof(sparse))
+        {
+            log_erro(args, "truncated sparse profile in '%s'\n", path);
+            err = -1;
+            break;
+        }
+        memcpy(&sparse, buf + off, sizeof(sparse));
+        if (sparse.magic != SPARSE_MAGIC || sparse.size > size - off - sizeof(sparse))
+        {
+            log_erro(args, "'%s' is not a sparse profile\n", path);
+            err = -1;
+            break;
+        }
+        // The BPF object it comes from has the same shape
+        int o;
+        for (o = 0; o < num_candidates; o++)
+        {
+            const struct densify_object *obj = &objs[candidates[o]];
+            if (obj->version == sparse.version && obj->num_functions == sparse.num_functions && obj->num_counters == sparse.num_counters)
+            {
+                break;
+            }
+        }
+        if (o == num_candidates)
+        {
+            log_erro(args, "could not find the BPF coverage object of a sparse profile (%llu functions, %llu counters) in '%s'\n",
+                     sparse.num_functions, sparse.num_counters, path);
+            err = -1;
+            break;
+        }
+        err = densify_section(args, &sparse, (const unsigned char *)buf + off + sizeof(sparse), &objs[candidates[o]], outfd);
+        off += sizeof(sparse) + sparse.size;
+    }
+    if (close(outfd) && !err)
+    {
+        log_erro(args, "could not write the output file '%s'\n", output);
+        err = -1;
+    }
+
+densify_file_out:
+    if (gzipped)
+    {
+        free(buf);
+    }
+    else
+    {
+        munmap(buf, size);
+    }
+    return err;
+}
+
+int densify(struct root_args *args)
+{
+    log_info(args, "%s\n", "densifying sparse profiles...");
+
+    // The objects given explicitly, plus the one sibling to each input (*.bpf.obj)
+    struct densify_object *objs = calloc(args->num_bpfobj + args->num_profraw, sizeof(*objs));
+    int *candidates = calloc(args->num_bpfobj + 1, sizeof(int));
+    if (!objs || !candidates)
+    {
+        log_fata(args, "%s\n", "could not allocate the BPF coverage objects");
+    }
+    int num_objs = 0;
+    for (int o = 0; o < args->num_bpfobj; o++)
+    {
+        if (load_densify_object(args, args->bpfobj[o], &objs[num_objs++]))
+        {
+            log_fata(args, "could not load the BPF coverage object '%s'\n", args->bpfobj[o]);
+        }
+    }
+
+    char **ptr = args->profraw;
+    for (char *sparse = *ptr; sparse; sparse = *++ptr)
+    {
+        char *stem = strdup(sparse);
+        strip_extension(stem);
+
+        int num_candidates = 0;
+        char bpfobj_path[PATH_MAX];
+        if (snprintf(bpfobj_path, PATH_MAX, "%s.bpf.obj", stem) < PATH_MAX && access(bpfobj_path, R_OK) == 0)
+        {
+            if (load_densify_object(args, bpfobj_path, &objs[num_objs]) == 0)
+            {
+                candidates[num_candidates++] = num_objs;
+            }
+            num_objs++;
+        }
+        else if (args->num_bpfobj == 0)
+        {
+            log_fata(args, "could not find the BPF coverage object at '%s'\n", bpfobj_path);
+        }
+        for (int o = 0; o < args->num_bpfobj; o++)
+        {
+            candidates[num_candidates++] = o;
+        }
+
+        char output[PATH_MAX];
+        if (args->output)
+        {
+            strncpy(output, args->output, PATH_MAX - 1);
+            output[PATH_MAX - 1] = '\0';
+        }
+        else if (snprintf(output, PATH_MAX, "%s.%s", stem, profile_string[PROFILE_profraw]) >= PATH_MAX)
+        {
+            log_fata(args, "%s\n", "profraw output path too long");
+        }
+        free(stem);
+
+        if (densify_file(args, sparse, objs, candidates, num_candidates, output))
+        {
+            log_fata(args, "could not densify '%s'\n", sparse);
+        }
+    }
+
+    for (int o = 0; o < num_objs; o++)
+    {
+        free_densify_object(&objs[o]);
+    }
+    free(objs);
+    free(candidates);
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Reports
+// --------------------------------------------------------------------------------------------------------------------
+
+struct index_worker
+{
+    struct root_args *args;
+    struct profdata *pd;
+    int first;
+    int last;
+    int failed;
+};
+
+static void *index_worker_run(void *arg)
+{
+    struct index_worker *worker = arg;
+    for (int i = worker->first; i < worker->last && !worker->failed; i++)
+    {
+        log_info(worker->args, "indexing '%s'\n", worker->args->profraw[i]);
+        worker->failed = add_profraw(worker->args, worker->args->profraw[i], worker->pd) != 0;
+    }
+    return NULL;
+}
+
+// Index the input files with many threads (each one into a profdata of its own), then merge them into the given one
+static int index_profraws(struct root_args *args, struct profdata *pd)
+{
+    int num_workers = args->jobs < args->num_profraw ? args->jobs : args->num_profraw;
+    struct index_worker *workers = calloc(num_workers, sizeof(struct index_worker));
+    pthread_t *threads = calloc(num_workers, sizeof(pthread_t));
+    if (!workers || !threads)
+    {
+        free(workers);
+        free(threads);
+        return -1;
+    }
+
+    int err = 0;
+    int started = 0;
+    for (int w = 0; w < num_workers; w++)
+    {
+        workers[w].args = args;
+        workers[w].pd = w == 0 ? pd : profdata_new();
+        workers[w].first = (long long int)args->num_profraw * w / num_workers;
+        workers[w].last = (long long int)args->num_profraw * (w + 1) / num_workers;
+        if (!workers[w].pd || (w > 0 && pthread_create(&threads[w], NULL, index_worker_run, &workers[w])))
+        {
+            err = -1;
+            break;
+        }
+        started++;
+    }
+    // The calling thread is the first worker
+    if (!err)
+    {
+        index_worker_run(&workers[0]);
+    }
+    for (int w = 1; w < started; w++)
+    {
+        pthread_join(threads[w], NULL);
+    }
+    for (int w = 0; w < num_workers; w++)
+    {
+        err = err || workers[w].failed;
+        if (w > 0 && workers[w].pd)
+        {
+            if (!err && profdata_merge(pd, workers[w].pd))
+            {
+                log_erro(args, "%s\n", "could not merge the indexed profiles");
+                err = -1;
+            }
+            profdata_free(workers[w].pd);
+        }
+    }
+    free(workers);
+    free(threads);
+
+    return err ? -1 : 0;
+}
+
+struct cov_report
+{
+    char name[NAME_MAX + 1]; // Name of the BPF object (only for reports of their own)
+    char path[PATH_MAX];
+    char **arguments;
+    char response[PATH_MAX]; // Response file holding the objects, when there are many of them
+    char response_arg[PATH_MAX + 1];
+    pid_t pid;
+    // Incremental reports only
+    bool partial;           // Only the pages that changed get regenerated (into the staging directory), then the index
+    char staging[PATH_MAX];
+    char **sources;         // Source files whose pages changed
+    int num_sources;
+    char **stale;           // Pages of the source files no longer in the report
+    int num_stale;
+    char *index;            // Index page (partial runs)
+    size_t index_size;
+    char *digests;          // Digest of every source file in the report
+    size_t digests_size;
+};
+
+// The report of a single BPF object: a directory in the HTML report directory
+static int report_part_path(const char *report_path, char **bpfobjs, int o, char *name, char *path)
+{
+    char *object = strdup(basename(bpfobjs[o]));
+    if (!object)
+    {
+        return -1;
+    }
+    char *ext = strstr(object, ".bpf.obj");
+    if (ext)
+    {
+        *ext = '\0';
+    }
+    // Objects with the same name (from different directories) get their index appended
+    int dup;
+    for (dup = 0; dup < o && strcmp(basename(bpfobjs[dup]), basename(bpfobjs[o])) != 0; dup++)
+        ;
+    int name_len = dup < o ? snprintf(name, NAME_MAX + 1, "%s.%d", object, o) : snprintf(name, NAME_MAX + 1, "%s", object);
+    free(object);
+    if (name_len > NAME_MAX)
+    {
+        return -1;
+    }
+    return snprintf(path, PATH_MAX, "%s/%s", report_path, name) >= PATH_MAX ? -1 : 0;
+}
+
+static int cmp_path(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Drop the duplicated paths (after the first ones, kept as they are), returning how many are left
+static int unique_paths(char **paths, int first, int num_paths)
+{
+    qsort(paths + first, num_paths - first, sizeof(char *), cmp_path);
+    int num_unique = first;
+    for (int p = first; p < num_paths; p++)
+    {
+        bool dup = num_unique > first && strcmp(paths[num_unique - 1], paths[p]) == 0;
+        for (int f = 0; f < first && !dup; f++)
+        {
+            dup = strcmp(paths[f], paths[p]) == 0;
+        }
+        if (dup)
+        {
+            free(paths[p]);
+            continue;
+        }
+        paths[num_unique++] = paths[p];
+    }
+    return num_unique;
+}
+
+// Above this many objects (and source files), llvm-cov gets them from a response file (@path) to stay far from ARG_MAX
+#define MAX_OBJECT_ARGUMENTS 128
+
+// Quoted, escaping quotes and backslashes (GNU style)
+static void response_argument(FILE *rspfp, const char *option, const char *value)
+{
+    if (option)
+    {
+        fprintf(rspfp, "%s ", option);
+    }
+    fputc('"', rspfp);
+    for (const char *c = value; *c; c++)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            fputc('\\', rspfp);
+        }
+        fputc(*c, rspfp);
+    }
+    fputs("\"\n", rspfp);
+}
+
+static int write_response_file(struct root_args *args, struct cov_report *report, char **bpfobjs, int num_bpfobjs)
+{
+    const char *tmpdir = getenv("TMPDIR");
+    if (snprintf(report->response, PATH_MAX, "%s/bpfcov-objects-XXXXXX", tmpdir ? tmpdir : P_tmpdir) >= PATH_MAX)
+    {
+        report->response[0] = '\0';
+        return -1;
+    }
+    int fd = mkstemp(report->response);
+    FILE *rspfp = fd == -1 ? NULL : fdopen(fd, "w");
+    if (!rspfp)
+    {
+        log_erro(args, "could not create the response file '%s'\n", report->response);
+        if (fd != -1)
+        {
+            close(fd);
+            unlink(report->response);
+        }
+        report->response[0] = '\0';
+        return -1;
+    }
+    // The source files to show follow the first object, then llvm-cov takes it as a positional argument
+    for (int o = 0; o < num_bpfobjs; o++)
+    {
+        response_argument(rspfp, o > 0 || report->num_sources == 0 ? "-object" : NULL, bpfobjs[o]);
+    }
+    for (int f = 0; f < report->num_sources; f++)
+    {
+        response_argument(rspfp, NULL, report->sources[f]);
+    }
+    return fclose(rspfp) ? -1 : 0;
+}
+
+static int llvm_cov_arguments(struct root_args *args, struct cov_report *report, const char *profdata, char **bpfobjs, int num_bpfobjs)
+{
+    bool response = num_bpfobjs + report->num_sources > MAX_OBJECT_ARGUMENTS;
+    if (response && write_response_file(args, report, bpfobjs, num_bpfobjs))
+    {
+        return -1;
+    }
+    char **arguments = calloc((response ? 1 : num_bpfobjs * 2 + report->num_sources) + 11, sizeof(char *));
+    if (!arguments)
+    {
+        return -1;
+    }
+    int a = 0;
+    arguments[a++] = "llvm-cov";
+    arguments[a++] = "show";
+    arguments[a++] = "--format=html";
+    arguments[a++] = "--show-branches=count";
+    arguments[a++] = "--show-line-counts-or-regions";
+    arguments[a++] = "--show-region-summary";
+    arguments[a++] = "--output-dir";
+    arguments[a++] = report->partial ? report->staging : report->path;
+    arguments[a++] = "-instr-profile";
+    arguments[a++] = (char *)profdata;
+    if (response)
+    {
+        snprintf(report->response_arg, sizeof(report->response_arg), "@%s", report->response);
+        arguments[a++] = report->response_arg;
+    }
+    for (int o = 0; !response && o < num_bpfobjs; o++)
+    {
+        if (o > 0 || report->num_sources == 0)
+        {
+            arguments[a++] = "-object";
+        }
+        arguments[a++] = bpfobjs[o];
+    }
+    for (int f = 0; !response && f < report->num_sources; f++)
+    {
+        arguments[a++] = report->sources[f];
+    }
+    arguments[a] = NULL;
+    report->arguments = arguments;
+
+    return 0;
+}
+
+// Run llvm-cov for every report (that needs it), at most as many at once as the jobs
+static int run_llvm_cov(struct root_args *args, struct cov_report *reports, int num_reports)
+{
+    int devnull = open("/dev/null", O_WRONLY | O_CREAT, 0666);
+    if (devnull == -1)
+    {
+        log_erro(args, "could not open %s\n", "/dev/null");
+        return -1;
+    }
+
+    int err = 0;
+    int next = 0;
+    int running = 0;
+    while ((next < num_reports && !err) || running > 0)
+    {
+        if (next < num_reports && !err && running < args->jobs)
+        {
+            struct cov_report *report = &reports[next++];
+            if (!report->arguments)
+            {
+                // Up to date, or only its index changed
+                continue;
+            }
+            log_debu(args, "%s ", report->arguments[0]);
+            for (int a = 1; report->arguments[a]; a++)
+            {
+                if (DEBUG)
+                {
+                    print_log(3, NULL, args, "%s ", report->arguments[a]);
+                }
+            }
+            if (DEBUG)
+            {
+                print_log(3, NULL, args, "%s", "\n");
+            }
+
+            switch ((report->pid = fork()))
+            {
+            case -1:
+                log_erro(args, "%s\n", "could not fork");
+                err = -1;
+                break;
+            case 0:
+                dup2(devnull, STDERR_FILENO);
+                execvp("llvm-cov", report->arguments);
+                _exit(EXIT_FAILURE);
+            default:
+                running++;
+                break;
+            }
+            continue;
+        }
+
+        int status;
+        pid_t pid = wait(&status);
+        if (pid == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        running--;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            log_erro(args, "llvm-cov exited with status %d\n", WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+            err = -1;
+        }
+    }
+    close(devnull);
+
+    return err;
+}
+
+// Link the HTML reports of every BPF object from the index page of the report directory
+static int write_html_index(struct root_args *args, const char *report_path, struct cov_report *reports, int num_reports)
+{
+    char index_path[PATH_MAX];
+    if (snprintf(index_path, PATH_MAX, "%s/index.html", report_path) >= PATH_MAX)
+    {
+        log_erro(args, "%s\n", "index path too long");
+        return -1;
+    }
+    FILE *indexfp = fopen(index_path, "w");
+    if (!indexfp)
+    {
+        log_erro(args, "could not open %s\n", index_path);
+        return -1;
+    }
+    fprintf(indexfp, "<!doctype html>\n<html>\n<head>\n<meta name='viewport' content='width=device-width,initial-scale=1'>"
+                     "<meta charset='UTF-8'>\n<title>Coverage Report</title>\n</head>\n<body>\n<h2>Coverage Report</h2>\n<ul>\n");
+    for (int r = 0; r < num_reports; r++)
+    {
+        fprintf(indexfp, "<li><a href='%s/index.html'>%s</a></li>\n", reports[r].name, reports[r].name);
+    }
+    fprintf(indexfp, "</ul>\n</body>\n</html>\n");
+
+    return fclose(indexfp) ? -1 : 0;
+}
+
+// Incremental HTML reports: every report directory keeps the digest of each source file in it (of its coverage and of
+// its contents), the next runs give llvm-cov only the source files whose digest changed, then write the index page
+
+#define HTML_DIGESTS_FILE ".bpfcov-digests"
+#define HTML_DIGESTS_HEADER "bpfcov-digests 1\n"
+
+struct html_digest
+{
+    char *name;
+    __u64 digest;
+};
+
+static int cmp_html_digest(const void *a, const void *b)
+{
+    return strcmp(((const struct html_digest *)a)->name, ((const struct html_digest *)b)->name);
+}
+
+static void free_html_digests(struct html_digest *digests, int num_digests)
+{
+    for (int d = 0; d < num_digests; d++)
+    {
+        free(digests[d].name);
+    }
+    free(digests);
+}
+
+// The digests of the last run (one line for each source file: the digest, then the name)
+static int read_html_digests(const char *path, struct html_digest **digests, int *num_digests)
+{
+    FILE *digestsfp = fopen(path, "r");
+    if (!digestsfp)
+    {
+        return -1;
+    }
+    struct html_digest *all = NULL;
+    int num = 0;
+    int max = 0;
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len = getline(&line, &cap, digestsfp);
+    bool ok = len > 0 && strcmp(line, HTML_DIGESTS_HEADER) == 0;
+    while (ok && (len = getline(&line, &cap, digestsfp)) > 0)
+    {
+        if (line[len - 1] == '\n')
+        {
+            line[--len] = '\0';
+        }
+        char *end;
+        __u64 digest = strtoull(line, &end, 16);
+        if (end != line + 16 || *end != ' ')
+        {
+            ok = false;
+            break;
+        }
+        if (num == max)
+        {
+            max = max ? max * 2 : 64;
+            struct html_digest *grown = realloc(all, max * sizeof(struct html_digest));
+            if (!grown)
+            {
+                ok = false;
+                break;
+            }
+            all = grown;
+        }
+        if (!(all[num].name = strdup(end + 1)))
+        {
+            ok = false;
+            break;
+        }
+        all[num++].digest = digest;
+    }
+    free(line);
+    fclose(digestsfp);
+    if (!ok)
+    {
+        free_html_digests(all, num);
+        return -1;
+    }
+    if (num > 0)
+    {
+        qsort(all, num, sizeof(struct html_digest), cmp_html_digest);
+    }
+    *digests = all;
+    *num_digests = num;
+    return 0;
+}
+
+// The version line llvm-cov wrote at the bottom of the index page (the pages it writes now have the same one)
+static char *html_footer(const char *index_path)
+{
+    FILE *indexfp = fopen(index_path, "r");
+    if (!indexfp)
+    {
+        return NULL;
+    }
+    char *page = NULL;
+    size_t cap = 0;
+    ssize_t len = getdelim(&page, &cap, '\0', indexfp);
+    fclose(indexfp);
+    char *footer = NULL;
+    char *start = NULL;
+    for (char *h5 = len > 0 ? strstr(page, "<h5>") : NULL; h5; h5 = strstr(h5 + 1, "<h5>"))
+    {
+        start = h5 + strlen("<h5>");
+    }
+    char *end = start ? strstr(start, "</h5>") : NULL;
+    if (end)
+    {
+        footer = strndup(start, end - start);
+    }
+    free(page);
+    return footer;
+}
+
+// MD5 of the contents of a source file (its page shows them)
+static int source_digest(const char *path, __u64 *digest)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) || !S_ISREG(st.st_mode))
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+    void *buf = st.st_size > 0 ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if (buf == MAP_FAILED)
+    {
+        return -1;
+    }
+    *digest = profdata_md5(buf ? buf : "", st.st_size);
+    if (buf)
+    {
+        munmap(buf, st.st_size);
+    }
+    return 0;
+}
+
+static bool report_file_exists(const struct cov_report *report, const char *file)
+{
+    char path[PATH_MAX];
+    return snprintf(path, PATH_MAX, "%s/%s", report->path, file) < PATH_MAX && access(path, F_OK) == 0;
+}
+
+static int add_string(char ***strings, int *num_strings, const char *str)
+{
+    char **grown = realloc(*strings, (*num_strings + 1) * sizeof(char *));
+    if (!grown)
+    {
+        return -1;
+    }
+    *strings = grown;
+    return (grown[*num_strings] = strdup(str)) ? (*num_strings)++, 0 : -1;
+}
+
+// Compare the digests of the source files with the ones of the last run: a page gets regenerated when its source file
+// is new, or its coverage or contents changed, or it went missing
+static int plan_source_files(struct cov_report *report, struct report *rep, struct html_digest *last, int num_last, FILE *digestsfp, bool *changed)
+{
+    bool *seen = calloc(num_last + 1, sizeof(bool));
+    if (!seen)
+    {
+        return -1;
+    }
+    int err = 0;
+    __u32 num_files = report_num_files(rep);
+    for (__u32 f = 0; f < num_files && !err; f++)
+    {
+        const char *name = report_file_name(rep, f);
+        __u64 digests[2] = {0};
+        bool readable = source_digest(name, &digests[1]) == 0;
+        if (report_file_digest(rep, f, &digests[0]))
+        {
+            err = -1;
+            break;
+        }
+        __u64 digest = profdata_md5(digests, sizeof(digests));
+        fprintf(digestsfp, "%016llx %s\n", digest, name);
+
+        struct html_digest key = {.name = (char *)name};
+        struct html_digest *prev = num_last > 0 ? bsearch(&key, last, num_last, sizeof(key), cmp_html_digest) : NULL;
+        if (prev)
+        {
+            seen[prev - last] = true;
+        }
+        bool same = prev && prev->digest == digest;
+        *changed = *changed || !same;
+
+        char *page = report_html_page(name);
+        if (!page)
+        {
+            err = -1;
+            break;
+        }
+        // Without its source file, llvm-cov cannot write its page
+        bool exists = report_file_exists(report, page);
+        if (readable && (!same || !exists))
+        {
+            err = add_string(&report->sources, &report->num_sources, name);
+        }
+        else if (!readable && !same && exists)
+        {
+            err = add_string(&report->stale, &report->num_stale, page);
+        }
+        free(page);
+    }
+    for (int d = 0; d < num_last && !err; d++)
+    {
+        char *page = seen[d] ? NULL : report_html_page(last[d].name);
+        *changed = *changed || !seen[d];
+        if (page && report_file_exists(report, page))
+        {
+            err = add_string(&report->stale, &report->num_stale, page);
+        }
+        free(page);
+    }
+    free(seen);
+
+    return err;
+}
+
+// Find out what changed in an HTML report since the last run: without changes it stays as it is, otherwise llvm-cov
+// writes only the pages that changed (none, when only the index did), into a staging directory
+static int plan_html_report(struct root_args *args, struct cov_report *report, const struct profdata *pd, char **bpfobjs, int num_bpfobjs)
+{
+    char digests_path[PATH_MAX];
+    char index_path[PATH_MAX];
+    if (snprintf(digests_path, PATH_MAX, "%s/%s", report->path, HTML_DIGESTS_FILE) >= PATH_MAX ||
+        snprintf(index_path, PATH_MAX, "%s/index.html", report->path) >= PATH_MAX)
+    {
+        log_erro(args, "%s\n", "report path too long");
+        return -1;
+    }
+
+    struct covmap **cms = calloc(num_bpfobjs + 1, sizeof(struct covmap *));
+    if (!cms)
+    {
+        return -1;
+    }
+    int err = 0;
+    for (int o = 0; o < num_bpfobjs && !err; o++)
+    {
+        log_info(args, "reading the coverage mapping of '%s'\n", bpfobjs[o]);
+        err = load_covmap(args, bpfobjs[o], &cms[o]);
+    }
+    struct report *rep = err ? NULL : report_new((const struct covmap *const *)cms, num_bpfobjs, pd);
+    if (!err && !rep)
+    {
+        log_erro(args, "%s\n", "could not allocate the report");
+        err = -1;
+    }
+
+    // Without the digests or the index of the last run, llvm-cov writes the whole report
+    struct html_digest *last = NULL;
+    int num_last = 0;
+    char *footer = NULL;
+    bool partial = !err && read_html_digests(digests_path, &last, &num_last) == 0 && (footer = html_footer(index_path));
+    FILE *digestsfp = err ? NULL : open_memstream(&report->digests, &report->digests_size);
+    if (!err && !digestsfp)
+    {
+        err = -1;
+    }
+    bool changed = false;
+    if (!err)
+    {
+        fputs(HTML_DIGESTS_HEADER, digestsfp);
+        err = plan_source_files(report, rep, last, num_last, digestsfp, &changed);
+        if (fclose(digestsfp))
+        {
+            err = -1;
+        }
+    }
+    if (err || !partial)
+    {
+        // The pages to regenerate only matter to partial runs
+        for (int f = 0; f < report->num_sources; f++)
+        {
+            free(report->sources[f]);
+        }
+        free(report->sources);
+        report->sources = NULL;
+        report->num_sources = 0;
+    }
+    if (!err && partial && !changed && report->num_sources == 0)
+    {
+        log_info(args, "the HTML report in '%s' is up to date\n", report->path);
+        free(report->digests);
+        report->digests = NULL;
+    }
+    else if (!err && partial)
+    {
+        log_info(args, "regenerating %d pages of the HTML report in '%s'\n", report->num_sources, report->path);
+        report->partial = true;
+        FILE *indexfp = open_memstream(&report->index, &report->index_size);
+        err = !indexfp || report_html_index(rep, footer, indexfp);
+        if (indexfp && fclose(indexfp))
+        {
+            err = -1;
+        }
+        if (!err && report->num_sources > 0 &&
+            (snprintf(report->staging, PATH_MAX, "%s/.bpfcov-XXXXXX", report->path) >= PATH_MAX || !mkdtemp(report->staging)))
+        {
+            log_erro(args, "could not create a staging directory in '%s'\n", report->path);
+            report->staging[0] = '\0';
+            err = -1;
+        }
+    }
+
+    free(footer);
+    free_html_digests(last, num_last);
+    report_free(rep);
+    for (int o = 0; o < num_bpfobjs; o++)
+    {
+        covmap_free(cms[o]);
+    }
+    free(cms);
+
+    return err ? -1 : 0;
+}
+
+// Create the missing parent directories of a path
+static int make_parents(const char *path)
+{
+    char dir[PATH_MAX];
+    if (snprintf(dir, PATH_MAX, "%s", path) >= PATH_MAX)
+    {
+        return -1;
+    }
+    for (char *slash = strchr(dir + 1, '/'); slash; slash = strchr(slash + 1, '/'))
+    {
+        *slash = '\0';
+        if (mkdir(dir, 0755) && errno != EEXIST)
+        {
+            return -1;
+        }
+        *slash = '/';
+    }
+    return 0;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    remove(path);
+    return 0;
+}
+
+// Write a file of the report atomically: an interrupted run leaves the one of the last run
+static int write_report_file(const struct cov_report *report, const char *file, const char *buf, size_t size)
+{
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    if (snprintf(path, PATH_MAX, "%s/%s", report->path, file) >= PATH_MAX ||
+        snprintf(tmp_path, PATH_MAX, "%s.XXXXXX", path) >= PATH_MAX)
+    {
+        return -1;
+    }
+    int fd = mkstemp(tmp_path);
+    FILE *outfp = fd < 0 || fchmod(fd, 0644) ? NULL : fdopen(fd, "w");
+    if (!outfp)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+            unlink(tmp_path);
+        }
+        return -1;
+    }
+    bool written = fwrite(buf, 1, size, outfp) == size;
+    if (fclose(outfp) || !written || rename(tmp_path, path))
+    {
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+// Move the pages llvm-cov regenerated into the report, drop the stale ones, then write the index and the digests
+static int finish_html_report(struct root_args *args, struct cov_report *report)
+{
+    int err = 0;
+    for (int f = 0; f < report->num_sources && !err; f++)
+    {
+        char *page = report_html_page(report->sources[f]);
+        char from[PATH_MAX];
+        char to[PATH_MAX];
+        if (!page || snprintf(from, PATH_MAX, "%s/%s", report->staging, page) >= PATH_MAX ||
+            snprintf(to, PATH_MAX, "%s/%s", report->path, page) >= PATH_MAX)
+        {
+            err = -1;
+        }
+        else if (access(from, F_OK) != 0)
+        {
+            log_warn(args, "llvm-cov did not write the page of '%s'\n", report->sources[f]);
+        }
+        else if (make_parents(to) || rename(from, to))
+        {
+            log_erro(args, "could not move the page of '%s' into '%s'\n", report->sources[f], report->path);
+            err = -1;
+        }
+        free(page);
+    }
+    if (!err && report->num_sources > 0 && !report_file_exists(report, "style.css"))
+    {
+        char from[PATH_MAX];
+        char to[PATH_MAX];
+        if (snprintf(from, PATH_MAX, "%s/style.css", report->staging) < PATH_MAX &&
+            snprintf(to, PATH_MAX, "%s/style.css", report->path) < PATH_MAX)
+        {
+            rename(from, to);
+        }
+    }
+    for (int p = 0; p < report->num_stale && !err; p++)
+    {
+        char path[PATH_MAX];
+        if (snprintf(path, PATH_MAX, "%s/%s", report->path, report->stale[p]) < PATH_MAX)
+        {
+            log_debu(args, "removing the stale page '%s'\n", path);
+            unlink(path);
+        }
+    }
+    if (!err && report->partial && write_report_file(report, "index.html", report->index, report->index_size))
+    {
+        log_erro(args, "could not write the index page of '%s'\n", report->path);
+        err = -1;
+    }
+    // Last, so that an interrupted run regenerates the same pages again
+    if (!err && write_report_file(report, HTML_DIGESTS_FILE, report->digests, report->digests_size))
+    {
+        log_erro(args, "could not write the digests of '%s'\n", report->path);
+        err = -1;
+    }
+
+    return err;
+}
+
+// Run llvm-cov show: with many jobs and many objects, it runs for each object, then an index page links their reports
+// Incremental reports let it regenerate only the pages that changed
+static int html_report(struct root_args *args, const char *report_path, const char *profdata, char **bpfobjs, int num_bpfobjs, const struct profdata *pd)
+{
+    bool per_object = args->jobs > 1 && num_bpfobjs > 1;
+    int num_reports = per_object ? num_bpfobjs : 1;
+    struct cov_report *reports = calloc(num_reports, sizeof(struct cov_report));
+    if (!reports)
+    {
+        log_erro(args, "%s\n", "could not allocate the reports");
+        return -1;
+    }
+    int err = 0;
+    for (int r = 0; r < num_reports && !err; r++)
+    {
+        struct cov_report *report = &reports[r];
+        if (!per_object)
+        {
+            snprintf(report->path, PATH_MAX, "%s", report_path);
+        }
+        else if (report_part_path(report_path, bpfobjs, r, report->name, report->path))
+        {
+            log_erro(args, "%s\n", "report path too long");
+            err = -1;
+            break;
+        }
+        char **objs = per_object ? &bpfobjs[r] : bpfobjs;
+        int num_objs = per_object ? 1 : num_bpfobjs;
+        if (args->incremental && plan_html_report(args, report, pd, objs, num_objs))
+        {
+            log_erro(args, "could not compare the HTML report in '%s' with the last run\n", report->path);
+            err = -1;
+            break;
+        }
+        if (args->incremental && (!report->digests || (report->partial && report->num_sources == 0)))
+        {
+            continue;
+        }
+        if (llvm_cov_arguments(args, report, profdata, objs, num_objs))
+        {
+            log_erro(args, "%s\n", "could not allocate the llvm-cov arguments");
+            err = -1;
+        }
+    }
+
+    if (!err)
+    {
+        err = run_llvm_cov(args, reports, num_reports);
+    }
+    for (int r = 0; r < num_reports && !err; r++)
+    {
+        if (reports[r].digests)
+        {
+            err = finish_html_report(args, &reports[r]);
+        }
+    }
+    if (!err && per_object)
+    {
+        err = write_html_index(args, report_path, reports, num_reports);
+    }
+    for (int r = 0; r < num_reports; r++)
+    {
+        struct cov_report *report = &reports[r];
+        free(report->arguments);
+        if (report->response[0])
+        {
+            unlink(report->response);
+        }
+        if (report->staging[0])
+        {
+            nftw(report->staging, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+        }
+        for (int f = 0; f < report->num_sources; f++)
+        {
+            free(report->sources[f]);
+        }
+        free(report->sources);
+        for (int p = 0; p < report->num_stale; p++)
+        {
+            free(report->stale[p]);
+        }
+        free(report->stale);
+        free(report->index);
+        free(report->digests);
+    }
+    free(reports);
+
+    return err;
+}
+
+// Use the index next to the BPF object when it is for the same build of it
+static int open_covmap_index(struct root_args *args, const char *index_path, __u64 build_hash, struct covmap **cm)
+{
+    int fd = open(index_path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) || st.st_size == 0)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+    void *buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (buf == MAP_FAILED)
+    {
+        return -1;
+    }
+    int err = covmap_open_index(buf, st.st_size, build_hash, cm);
+    if (err)
+    {
+        log_debu(args, "ignoring the coverage mapping index '%s': %s\n", index_path, strerror(-err));
+        munmap(buf, st.st_size);
+        return -1;
+    }
+    return 0;
+}
+
+// Write the index next to the BPF object (atomically, other runs could be reading it)
+static void write_covmap_index(struct root_args *args, const char *index_path, __u64 build_hash, const struct covmap *cm)
+{
+    char tmp_path[PATH_MAX];
+    if (snprintf(tmp_path, PATH_MAX, "%s.XXXXXX", index_path) >= PATH_MAX)
+    {
+        return;
+    }
+    int fd = mkstemp(tmp_path);
+    FILE *outfp = fd < 0 || fchmod(fd, 0644) ? NULL : fdopen(fd, "wb");
+    if (!outfp)
+    {
+        log_debu(args, "could not write the coverage mapping index '%s': %s\n", index_path, strerror(errno));
+        if (fd >= 0)
+        {
+            close(fd);
+            unlink(tmp_path);
+        }
+        return;
+    }
+    int err = covmap_write_index(cm, build_hash, outfp);
+    if (fclose(outfp) || err || rename(tmp_path, index_path))
+    {
+        log_debu(args, "could not write the coverage mapping index '%s'\n", index_path);
+        unlink(tmp_path);
+        return;
+    }
+    log_debu(args, "wrote the coverage mapping index '%s'\n", index_path);
+}
+
+// Decode the coverage mapping of a BPF object, or map its index (a *.covidx file next to it) when it is up to date
+static int load_covmap(struct root_args *args, const char *path, struct covmap **cm)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) || st.st_size < (off_t)sizeof(Elf64_Ehdr))
+    {
+        log_erro(args, "could not read the BPF coverage object '%s'\n", path);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+    void *buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (buf == MAP_FAILED)
+    {
+        log_erro(args, "could not map the BPF coverage object '%s'\n", path);
+        return -1;
+    }
+
+    char index_path[PATH_MAX];
+    __u64 build_hash;
+    bool indexable = snprintf(index_path, PATH_MAX, "%s.covidx", path) < PATH_MAX;
+    int err = covmap_build_hash(buf, st.st_size, &build_hash);
+    if (!err && indexable && open_covmap_index(args, index_path, build_hash, cm) == 0)
+    {
+        log_debu(args, "using the coverage mapping index '%s'\n", index_path);
+        munmap(buf, st.st_size);
+        return 0;
+    }
+    if (!err)
+    {
+        err = covmap_load(buf, st.st_size, cm);
+    }
+    munmap(buf, st.st_size);
+    if (err == -ENOTSUP)
+    {
+        log_erro(args, "the coverage mapping of '%s' is too old (LLVM 11 onwards)\n", path);
+    }
+    else if (err)
+    {
+        log_erro(args, "could not decode the coverage mapping of '%s': %s\n", path, strerror(-err));
+    }
+    else if (indexable)
+    {
+        write_covmap_index(args, index_path, build_hash, *cm);
+    }
+
+    return err ? -1 : 0;
+}
+
+// Folded stacks start with the name of their BPF object (the same one its HTML report gets)
+// The BPF objects name the programs of the folded stacks and the mappings of the pprof profiles
+static const char **program_names(char **bpfobjs, int num_bpfobjs, char (**names)[NAME_MAX + 1])
+{
+    *names = calloc(num_bpfobjs + 1, NAME_MAX + 1);
+    const char **programs = calloc(num_bpfobjs + 1, sizeof(char *));
+    int err = !*names || !programs ? -1 : 0;
+    for (int o = 0; o < num_bpfobjs && !err; o++)
+    {
+        char path[PATH_MAX];
+        err = report_part_path("", bpfobjs, o, (*names)[o], path);
+        programs[o] = (*names)[o];
+    }
+    if (err)
+    {
+        free(*names);
+        free(programs);
+        *names = NULL;
+        return NULL;
+    }
+
+    return programs;
+}
+
+static int write_folded(struct report *rep, char **bpfobjs, int num_bpfobjs, FILE *outfp)
+{
+    char (*names)[NAME_MAX + 1];
+    const char **programs = program_names(bpfobjs, num_bpfobjs, &names);
+    int err = programs ? report_folded(rep, programs, outfp) : -1;
+    free(names);
+    free(programs);
+
+    return err;
+}
+
+// A gzipped pprof profile: the samples of every input file labeled with its path (when there are many of them)
+static int write_pprof(struct root_args *args, struct report *rep, struct covmap **cms, char **bpfobjs, int num_bpfobjs,
+                       int fd)
+{
+    char (*names)[NAME_MAX + 1];
+    const char **programs = program_names(bpfobjs, num_bpfobjs, &names);
+    struct report_pprof *pp = programs ? report_pprof_new() : NULL;
+    int err = pp ? 0 : -1;
+    if (!err && args->num_profraw == 1)
+    {
+        err = report_pprof_add(pp, rep, programs, NULL);
+    }
+    for (int i = 0; i < args->num_profraw && args->num_profraw > 1 && !err; i++)
+    {
+        // Every input file on its own, then the samples of its report
+        struct profdata *pd = profdata_new();
+        err = pd ? add_profraw(args, args->profraw[i], pd) : -1;
+        struct report *profile = err ? NULL : report_new((const struct covmap *const *)cms, num_bpfobjs, pd);
+        if (!err && !profile)
+        {
+            err = -1;
+        }
+        if (!err)
+        {
+            log_debu(args, "adding the samples of '%s' to the profile\n", args->profraw[i]);
+            err = report_pprof_add(pp, profile, programs, args->profraw[i]);
+        }
+        report_free(profile);
+        profdata_free(pd);
+    }
+
+    char *buf = NULL;
+    size_t size = 0;
+    FILE *bufp = err ? NULL : open_memstream(&buf, &size);
+    if (!err && (!bufp || report_pprof_write(pp, bufp)))
+    {
+        err = -1;
+    }
+    if (bufp && fclose(bufp))
+    {
+        err = -1;
+    }
+    if (!err)
+    {
+        struct iovec iov = {.iov_base = buf, .iov_len = size};
+        err = write_gzip(args, fd, &iov, 1);
+    }
+    free(buf);
+    report_pprof_free(pp);
+    free(names);
+    free(programs);
+
+    return err ? -1 : 0;
+}
+
+// The run time stats gen wrote next to the inputs, summed for each program
+static int read_runstats(struct root_args *args, struct report_program **programs, size_t *num_programs)
+{
+    *programs = NULL;
+    *num_programs = 0;
+    for (int i = 0; i < args->num_profraw; i++)
+    {
+        char path[PATH_MAX];
+        if (snprintf(path, PATH_MAX, "%s.%s", args->profraw[i], RUNSTATS_EXTENSION) >= PATH_MAX)
+        {
+            continue;
+        }
+        FILE *infp = fopen(path, "r");
+        if (!infp)
+        {
+            continue;
+        }
+        log_info(args, "reading the run time stats in '%s'\n", path);
+        char line[256];
+        char object[BPF_OBJ_NAME_LEN], name[BPF_OBJ_NAME_LEN];
+        unsigned long long run_cnt, run_time_ns;
+        while (fgets(line, sizeof(line), infp))
+        {
+            if (sscanf(line, "%15s %15s %llu %llu", object, name, &run_cnt, &run_time_ns) != 4)
+            {
+                continue;
+            }
+            size_t p;
+            for (p = 0; p < *num_programs; p++)
+            {
+                if (strcmp((*programs)[p].object, object) == 0 && strcmp((*programs)[p].name, name) == 0)
+                {
+                    break;
+                }
+            }
+            if (p == *num_programs)
+            {
+                struct report_program *grown = realloc(*programs, (p + 1) * sizeof(struct report_program));
+                if (!grown)
+                {
+                    fclose(infp);
+                    return -1;
+                }
+                *programs = grown;
+                grown[p] = (struct report_program){.object = strdup(object), .name = strdup(name)};
+                (*num_programs)++;
+                if (!grown[p].object || !grown[p].name)
+                {
+                    fclose(infp);
+                    return -1;
+                }
+            }
+            (*programs)[p].run_cnt += run_cnt;
+            (*programs)[p].run_time_ns += run_time_ns;
+        }
+        fclose(infp);
+    }
+
+    return 0;
+}
+
+static void free_runstats(struct report_program *programs, size_t num_programs)
+{
+    for (size_t p = 0; p < num_programs; p++)
+    {
+        free((char *)programs[p].object);
+        free((char *)programs[p].name);
+    }
+    free(programs);
+}
+
+// The average run time of the programs, in a page of the HTML report
+static int write_html_programs(struct root_args *args, const char *report_path, const struct report_program *programs, size_t num_programs)
+{
+    char programs_path[PATH_MAX];
+    if (snprintf(programs_path, PATH_MAX, "%s/programs.html", report_path) >= PATH_MAX)
+    {
+        log_erro(args, "%s\n", "programs path too long");
+        return -1;
+    }
+    FILE *outfp = fopen(programs_path, "w");
+    if (!outfp)
+    {
+        log_erro(args, "could not open %s\n", programs_path);
+        return -1;
+    }
+    fprintf(outfp, "<!doctype html>\n<html>\n<head>\n<meta name='viewport' content='width=device-width,initial-scale=1'>"
+                   "<meta charset='UTF-8'>\n<title>Programs</title>\n</head>\n<body>\n<h2>Programs</h2>\n<table>\n"
+                   "<tr><th>Object</th><th>Program</th><th>Runs</th><th>Run time (ns)</th><th>Average (ns)</th></tr>\n");
+    for (size_t p = 0; p < num_programs; p++)
+    {
+        const struct report_program *prog = &programs[p];
+        fprintf(outfp, "<tr><td>%s</td><td>%s</td><td>%llu</td><td>%llu</td><td>%.1f</td></tr>\n", prog->object,
+                prog->name, prog->run_cnt, prog->run_time_ns,
+                prog->run_cnt ? (double)prog->run_time_ns / (double)prog->run_cnt : 0.0);
+    }
+    fprintf(outfp, "</table>\n</body>\n</html>\n");
+
+    return fclose(outfp) ? -1 : 0;
+}
+
+// Decode the coverage mapping of every BPF object, then write the JSON or LCOV export (or the folded stacks, the pprof
+// profile) in process
+static int export_report(struct root_args *args, const char *report_path, char **bpfobjs, int num_bpfobjs, const struct profdata *pd,
+                         const struct report_program *programs, size_t num_programs)
+{
+    struct covmap **cms = calloc(num_bpfobjs + 1, sizeof(struct covmap *));
+    if (!cms)
+    {
+        return -1;
+    }
+    int err = 0;
+    for (int o = 0; o < num_bpfobjs && !err; o++)
+    {
+        log_info(args, "reading the coverage mapping of '%s'\n", bpfobjs[o]);
+        err = load_covmap(args, bpfobjs[o], &cms[o]);
+    }
+
+    struct report *rep = err ? NULL : report_new((const struct covmap *const *)cms, num_bpfobjs, pd);
+    if (!err && !rep)
+    {
+        log_erro(args, "%s\n", "could not allocate the report");
+        err = -1;
+    }
+    FILE *outfp = err ? NULL : fopen(report_path, "w");
+    if (!err && !outfp)
+    {
+        log_erro(args, "could not open %s\n", report_path);
+        err = -1;
+    }
+    if (!err)
+    {
+        switch (args->out_format)
+        {
+        case FORMAT_lcov:
+            err = report_lcov(rep, outfp);
+            break;
+        case FORMAT_folded:
+            err = write_folded(rep, bpfobjs, num_bpfobjs, outfp);
+            break;
+        case FORMAT_pprof:
+            err = write_pprof(args, rep, cms, bpfobjs, num_bpfobjs, fileno(outfp));
+            break;
+        default:
+            err = report_json(rep, programs, num_programs, outfp);
+            break;
+        }
+        if (fclose(outfp))
+        {
+            err = -1;
+        }
+    }
+
+    report_free(rep);
+    for (int o = 0; o < num_bpfobjs; o++)
+    {
+        covmap_free(cms[o]);
+    }
+    free(cms);
+
+    return err ? -1 : 0;
+}
+
+int out(struct root_args *args)
+{
+    log_info(args, "%s\n", "generating coverage visualization...");
+
+    char report_path[PATH_MAX];
+    strcpy(report_path, args->report_path);
+
+    // Indexing all the input *.profraw into a single *.profdata, in process
+    struct profdata *pd = profdata_new();
+    if (!pd)
+    {
+        log_fata(args, "%s\n", "could not allocate the profdata");
+    }
+    char target_profdata[PATH_MAX];
+    strncpy(target_profdata, "all.profdata", PATH_MAX);
+
+    char **bpfobjs = calloc(args->num_profraw + args->num_bpfobj, sizeof(char *));
+    if (!bpfobjs)
+    {
+        log_fata(args, "%s\n", "could not allocate the BPF coverage objects");
+    }
+    int num_bpfobjs = 0;
+    for (int o = 0; o < args->num_bpfobj; o++)
+    {
+        bpfobjs[num_bpfobjs++] = strdup(args->bpfobj[o]);
+    }
+
+    char** ptr = args->profraw;
+    for (char* profraw = *ptr; profraw; profraw = *++ptr) {
+        // Looking up for *.bpf.obj file sibling to the current input *.profraw file
+        char *profraw_wo_ext = strdup(profraw);
+        strip_extension(profraw_wo_ext);
+
+        char bpfobj_path[PATH_MAX];
+        int bpfobj_path_len = snprintf(bpfobj_path, PATH_MAX, "%s.bpf.obj", profraw_wo_ext);
+        if (bpfobj_path_len >= PATH_MAX)
+        {
+            log_fata(args, "%s\n", "bpf.obj output path too long");
+        }
+        log_info(args, "looking for BPF coverage object at '%s'\n", bpfobj_path);
+        free(profraw_wo_ext);
+        if (access(bpfobj_path, F_OK) == 0)
+        {
+            // Storing the *.bpf.obj file for later (duplicates get dropped afterwards)
+            if (!(bpfobjs[num_bpfobjs++] = strdup(bpfobj_path)))
+            {
+                log_fata(args, "%s\n", "could not allocate the BPF coverage objects");
+            }
+        }
+        else if (args->num_bpfobj > 0)
+        {
+            log_warn(args, "could not find the BPF coverage object at '%s', relying on '--%s'\n", bpfobj_path, OUT_OBJECT_OPT_LONG);
+        }
+        else
+        {
+            log_fata(args, "could not find the BPF coverage object at '%s'", bpfobj_path);
+        }
+
+        // A single input gives its name to the *.profdata (relative to the execution directory)
+        if (args->num_profraw == 1)
+        {
+            char *profraw_name = strdup(basename(profraw));
+            strip_extension(profraw_name);
+
+            int profdata_path_len = snprintf(target_profdata, PATH_MAX, "%s.profdata", profraw_name);
+            if (profdata_path_len >= PATH_MAX)
+            {
+                log_fata(args, "%s\n", "profdata output path too long");
+            }
+            free(profraw_name);
+        }
+
+    }
+
+    num_bpfobjs = unique_paths(bpfobjs, args->num_bpfobj, num_bpfobjs);
+
+    if (index_profraws(args, pd))
+    {
+        log_fata(args, "%s\n", "could not index the input files");
+    }
+
+    log_info(args, "generating '%s'\n", target_profdata);
+    FILE *profdata_fp = fopen(target_profdata, "wb");
+    if (!profdata_fp)
+    {
+        log_fata(args, "could not open the output file '%s'\n", target_profdata);
+    }
+    // Like `llvm-profdata merge -sparse`: functions that never ran are left out
+    if (write_profdata(args, pd, true, profdata_fp))
+    {
+        log_fata(args, "could not generate '%s'\n", target_profdata);
+    }
+    fclose(profdata_fp);
+
+    // The run time stats of the programs show in the JSON export, and in a page of the HTML report
+    struct report_program *programs;
+    size_t num_programs;
+    if (read_runstats(args, &programs, &num_programs))
+    {
+        log_fata(args, "%s\n", "could not read the run time stats");
+    }
+    if (num_programs > 0 && args->out_format != FORMAT_html && args->out_format != FORMAT_json)
+    {
+        log_info(args, "not showing the run time stats of %zu program(s) in the %s format\n", num_programs, format_string[args->out_format]);
+    }
+
+    // The JSON and LCOV exports (the folded stacks, the pprof profile) get written in process, only the HTML report needs llvm-cov
+    log_info(args, "about to generate the %s coverage report in '%s'\n", format_string[args->out_format], report_path);
+    int err = args->out_format == FORMAT_html ? html_report(args, report_path, target_profdata, bpfobjs, num_bpfobjs, pd)
+                                              : export_report(args, report_path, bpfobjs, num_bpfobjs, pd, programs, num_programs);
+    if (!err && args->out_format == FORMAT_html && num_programs > 0)
+    {
+        err = write_html_programs(args, report_path, programs, num_programs);
+    }
+    free_runstats(programs, num_programs);
+    profdata_free(pd);
+    for (int o = 0; o < num_bpfobjs; o++)
+    {
+        free(bpfobjs[o]);
+    }
+    free(bpfobjs);
+    if (err)
+    {
+        log_fata(args, "could not generate the coverage report in '%s'\n", report_path);
+    }
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Top
+//
+// The hottest functions, lines, and code regions, out of the coverage mapping of the BPF objects and their counters:
+// ranked by execution count, or (refreshing like top does) by executions per second between two snapshots
+// --------------------------------------------------------------------------------------------------------------------
+
+#define NUM_TOP_KINDS 3
+
+static const enum report_spot_kind top_kinds[NUM_TOP_KINDS] = {REPORT_SPOT_FUNCTION, REPORT_SPOT_LINE, REPORT_SPOT_REGION};
+static const char *top_titles[NUM_TOP_KINDS] = {"FUNCTIONS", "LINES", "REGIONS"};
+
+struct top_state
+{
+    struct covmap **cms;
+    int num_cms;
+    // Pinned maps of every BPF object (live only)
+    struct cov_maps **maps;
+    struct cov_snapshot *snaps;
+    // Spots of the last snapshot, and when it got taken
+    struct report_spot *spots[NUM_TOP_KINDS];
+    size_t num_spots[NUM_TOP_KINDS];
+    struct timespec taken;
+};
+
+struct top_rank
+{
+    size_t spot;
+    __u64 count;
+    double rate;
+};
+
+static int cmp_top_rank(const void *a, const void *b)
+{
+    const struct top_rank *x = a;
+    const struct top_rank *y = b;
+    if (x->rate != y->rate)
+    {
+        return x->rate > y->rate ? -1 : 1;
+    }
+    if (x->count != y->count)
+    {
+        return x->count > y->count ? -1 : 1;
+    }
+    return (x->spot > y->spot) - (x->spot < y->spot);
+}
+
+// The BPF objects of the inputs: the ones given explicitly, plus the one sibling to each input (or to the program)
+static char **sibling_objects(struct root_args *args, const char *object_opt, int *num_bpfobjs)
+{
+    char **bpfobjs = calloc(args->num_profraw + args->num_bpfobj + 1, sizeof(char *));
+    if (!bpfobjs)
+    {
+        return NULL;
+    }
+    int num = 0;
+    for (int o = 0; o < args->num_bpfobj; o++)
+    {
+        bpfobjs[num++] = strdup(args->bpfobj[o]);
+    }
+    for (int i = 0; i < (args->num_profraw ? args->num_profraw : 1); i++)
+    {
+        char *stem = strdup(args->num_profraw ? args->profraw[i] : args->program[0]);
+        if (args->num_profraw)
+        {
+            strip_extension(stem);
+        }
+        char bpfobj_path[PATH_MAX];
+        bool found = snprintf(bpfobj_path, PATH_MAX, "%s.bpf.obj", stem) < PATH_MAX && access(bpfobj_path, R_OK) == 0;
+        free(stem);
+        if (found)
+        {
+            bpfobjs[num++] = strdup(bpfobj_path);
+        }
+        else if (args->num_bpfobj == 0)
+        {
+            log_fata(args, "could not find the BPF coverage object at '%s' (see '--%s')\n", bpfobj_path, object_opt);
+        }
+    }
+    for (int o = 0; o < num; o++)
+    {
+        if (!bpfobjs[o])
+        {
+            log_fata(args, "%s\n", "could not allocate the BPF coverage objects");
+        }
+    }
+    *num_bpfobjs = unique_paths(bpfobjs, args->num_bpfobj, num);
+    return bpfobjs;
+}
+
+// Index the counters (of the inputs, or read from the pinned maps right now), then evaluate the spots out of them
+static int top_snapshot(struct root_args *args, struct top_state *state)
+{
+    struct profdata *pd = profdata_new();
+    if (!pd)
+    {
+        return -1;
+    }
+    int err = 0;
+    if (args->num_profraw)
+    {
+        err = index_profraws(args, pd);
+    }
+    for (int o = 0; !args->num_profraw && o < args->num_objects && !err; o++)
+    {
+        err = read_snapshot(args, &state->snaps[o]) || add_snapshot(args, &state->snaps[o], pd);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &state->taken);
+
+    struct report *rep = err ? NULL : report_new((const struct covmap *const *)state->cms, state->num_cms, pd);
+    if (!err && !rep)
+    {
+        log_erro(args, "%s\n", "could not allocate the report");
+        err = -1;
+    }
+    for (int k = 0; k < NUM_TOP_KINDS && !err; k++)
+    {
+        free(state->spots[k]);
+        state->spots[k] = NULL;
+        state->num_spots[k] = 0;
+        err = report_spots(rep, top_kinds[k], &state->spots[k], &state->num_spots[k]) ? -1 : 0;
+    }
+    report_free(rep);
+    profdata_free(pd);
+
+    return err;
+}
+
+static void print_spot_location(FILE *outfp, const struct report_spot *spot)
+{
+    if (spot->col_start == 0)
+    {
+        fprintf(outfp, "%s:%u", spot->file, spot->line_start);
+    }
+    else
+    {
+        fprintf(outfp, "%s:%u:%u-%u:%u", spot->file, spot->line_start, spot->col_start, spot->line_end, spot->col_end);
+    }
+}
+
+// Print the hottest spots of a kind, by executions per second when the previous counts are given (same spots)
+static int print_top(struct root_args *args, FILE *outfp, int k, const struct report_spot *spots, size_t num_spots,
+                     const struct report_spot *previous, double elapsed)
+{
+    struct top_rank *ranks = calloc(num_spots + 1, sizeof(struct top_rank));
+    if (!ranks)
+    {
+        return -1;
+    }
+    size_t num_ranks = 0;
+    for (size_t s = 0; s < num_spots; s++)
+    {
+        // Counters only decrease when something reset them, then all of them are new
+        __u64 delta = 0;
+        if (previous)
+        {
+            delta = spots[s].count >= previous[s].count ? spots[s].count - previous[s].count : spots[s].count;
+        }
+        if (spots[s].count == 0 && delta == 0)
+        {
+            continue;
+        }
+        ranks[num_ranks++] = (struct top_rank){.spot = s, .count = spots[s].count, .rate = previous ? delta / elapsed : 0};
+    }
+    if (num_ranks > 0)
+    {
+        qsort(ranks, num_ranks, sizeof(struct top_rank), cmp_top_rank);
+    }
+    size_t num_shown = num_ranks < (size_t)args->limit ? num_ranks : (size_t)args->limit;
+
+    int width = 8;
+    for (size_t r = 0; r < num_shown; r++)
+    {
+        const char *function = spots[ranks[r].spot].function;
+        int len = function ? strlen(function) : 0;
+        width = len > width ? len : width;
+    }
+    width = width > 48 ? 48 : width;
+
+    fprintf(outfp, "%s (%zu of %zu executed)\n", top_titles[k], num_ranks, num_spots);
+    if (previous)
+    {
+        fprintf(outfp, "%14s ", "EXECUTIONS/S");
+    }
+    fprintf(outfp, "%20s  ", "EXECUTIONS");
+    if (top_kinds[k] != REPORT_SPOT_LINE)
+    {
+        fprintf(outfp, "%-*s  ", width, "FUNCTION");
+    }
+    fprintf(outfp, "%s\n", "LOCATION");
+    for (size_t r = 0; r < num_shown; r++)
+    {
+        const struct report_spot *spot = &spots[ranks[r].spot];
+        if (previous)
+        {
+            fprintf(outfp, "%14.1f ", ranks[r].rate);
+        }
+        fprintf(outfp, "%20llu  ", spot->count);
+        if (top_kinds[k] != REPORT_SPOT_LINE)
+        {
+            fprintf(outfp, "%-*.*s  ", width, width, spot->function);
+        }
+        print_spot_location(outfp, spot);
+        fputc('\n', outfp);
     }
+    free(ranks);
+
+    return 0;
 }
 
-static void handle_map_pins(struct root_args *args, struct argp_state *state, bool unpin)
+// Snapshot the pinned maps every interval, until interrupted, and print the spots ranked by their rates in between
+static int top_periodic(struct root_args *args, struct top_state *state)
 {
-    int p;
-    for (p = 0; p < NUM_PINNED_MAPS; p++)
+    bool tty = isatty(STDOUT_FILENO);
+    struct report_spot *previous[NUM_TOP_KINDS];
+    size_t num_previous[NUM_TOP_KINDS];
+
+    handle_interrupts();
+
+    struct timespec deadline = state->taken;
+    while (!interrupted)
     {
-        if (access(args->pin[p], F_OK) == 0)
+        // Absolute deadlines, so that snapshots do not drift
+        deadline.tv_sec += args->interval.tv_sec;
+        deadline.tv_nsec += args->interval.tv_nsec;
+        if (deadline.tv_nsec >= 1000000000L)
         {
-            if (unpin)
-            {
-                log_warn(args, "unpinning existing map '%s'\n", args->pin[p]);
-                if (unlink(args->pin[p]) != 0)
-                {
-                    if (state)
-                    {
-                        argp_error(state, "could not unpin map '%s'", args->pin[p]);
-                    }
-                    else
-                    {
-                        log_fata(args, "could not unpin map '%s'\n", args->pin[p]);
-                    }
-                }
-            }
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
         }
-        else
+        int err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+        if (interrupted)
+        {
+            break;
+        }
+        if (err && err != EINTR)
+        {
+            log_fata(args, "%s\n", strerror(err));
+        }
+
+        struct timespec before = state->taken;
+        for (int k = 0; k < NUM_TOP_KINDS; k++)
+        {
+            previous[k] = state->spots[k];
+            num_previous[k] = state->num_spots[k];
+            state->spots[k] = NULL;
+        }
+        if (top_snapshot(args, state))
+        {
+            log_fata(args, "could not read the counters of program '%s'\n", args->program[0]);
+        }
+        double elapsed = (state->taken.tv_sec - before.tv_sec) + (state->taken.tv_nsec - before.tv_nsec) / 1e9;
+
+        time_t now = time(NULL);
+        struct tm local;
+        localtime_r(&now, &local);
+        char clock[16];
+        strftime(clock, sizeof(clock), "%H:%M:%S", &local);
+        if (tty)
         {
-            if (!unpin)
+            fputs("\033[H\033[2J", stdout);
+        }
+        fprintf(stdout, "%s top - %s - %s, every %ld.%03lds\n\n", TOOL_NAME, args->program[0], clock,
+                (long)args->interval.tv_sec, args->interval.tv_nsec / 1000000);
+        for (int k = 0; k < NUM_TOP_KINDS; k++)
+        {
+            // The same spots in the same order, unless the layout of the counters changed in between
+            bool same = num_previous[k] == state->num_spots[k];
+            if (print_top(args, stdout, k, state->spots[k], state->num_spots[k], same ? previous[k] : NULL, elapsed))
             {
-                if (state)
-                {
-                    argp_error(state, "could not access map '%s'", args->pin[p]);
-                }
-                else
-                {
-                    log_fata(args, "could not access map '%s'\n", args->pin[p]);
-                }
+                log_fata(args, "%s\n", "could not rank the spots");
             }
+            fputc('\n', stdout);
+            free(previous[k]);
         }
+        fflush(stdout);
     }
+
+    return 0;
 }
 
-static int get_pin_path(struct root_args *args, char *suffix, char **pin_path)
+int top(struct root_args *args)
 {
-    if (!suffix) {
-        return 0;
+    struct top_state state = {};
+
+    int num_bpfobjs = 0;
+    char **bpfobjs = sibling_objects(args, TOP_OBJECT_OPT_LONG, &num_bpfobjs);
+    state.cms = calloc(num_bpfobjs + 1, sizeof(struct covmap *));
+    if (!bpfobjs || !state.cms)
+    {
+        log_fata(args, "%s\n", "could not allocate the BPF coverage objects");
+    }
+    for (int o = 0; o < num_bpfobjs; o++)
+    {
+        log_info(args, "reading the coverage mapping of '%s'\n", bpfobjs[o]);
+        if (load_covmap(args, bpfobjs[o], &state.cms[o]))
+        {
+            log_fata(args, "could not read the coverage mapping of '%s'\n", bpfobjs[o]);
+        }
+        state.num_cms++;
     }
 
-    if (strncmp(suffix, "profc", 5) == 0)
+    // Live: keep the pinned maps of every BPF object open in between the snapshots
+    int *num_maps = calloc(args->num_objects + 1, sizeof(int));
+    state.maps = calloc(args->num_objects + 1, sizeof(struct cov_maps *));
+    state.snaps = calloc(args->num_objects + 1, sizeof(struct cov_snapshot));
+    if (!num_maps || !state.maps || !state.snaps)
     {
-        *pin_path = args->pin[0];
-        return 1;
+        log_fata(args, "%s\n", "could not allocate the snapshots");
     }
-    else if (strncmp(suffix, "profd", 5) == 0)
+    for (int o = 0; !args->num_profraw && o < args->num_objects; o++)
     {
-        *pin_path = args->pin[1];
-        return 1;
+        num_maps[o] = open_pinned_generations(args, args->objects[o], &state.maps[o]);
+        if (num_maps[o] == 0)
+        {
+            log_fata(args, "could not open the pinned maps for object '%s'\n", args->objects[o]);
+        }
+        if (init_snapshot(args, state.maps[o], num_maps[o], false, &state.snaps[o]))
+        {
+            log_fata(args, "could not prepare the snapshot for object '%s'\n", args->objects[o]);
+        }
     }
-    else if (strncmp(suffix, "profn", 5) == 0)
+
+    if (top_snapshot(args, &state))
     {
-        *pin_path = args->pin[2];
-        return 1;
+        log_fata(args, "%s\n", "could not read the counters");
     }
-    else if (strncmp(suffix, "covmap", 6) == 0)
+    if (is_periodic(args))
     {
-        *pin_path = args->pin[3];
-        return 1;
+        top_periodic(args, &state);
+    }
+    else
+    {
+        for (int k = 0; k < NUM_TOP_KINDS; k++)
+        {
+            if (k > 0)
+            {
+                fputc('\n', stdout);
+            }
+            if (print_top(args, stdout, k, state.spots[k], state.num_spots[k], NULL, 0))
+            {
+                log_fata(args, "%s\n", "could not rank the spots");
+            }
+        }
     }
 
+    for (int o = 0; !args->num_profraw && o < args->num_objects; o++)
+    {
+        for (int g = 0; g < num_maps[o]; g++)
+        {
+            close_maps(&state.maps[o][g]);
+        }
+        free_snapshot(&state.snaps[o]);
+        free(state.maps[o]);
+    }
+    free(num_maps);
+    free(state.maps);
+    free(state.snaps);
+    for (int k = 0; k < NUM_TOP_KINDS; k++)
+    {
+        free(state.spots[k]);
+    }
+    for (int o = 0; o < state.num_cms; o++)
+    {
+        covmap_free(state.cms[o]);
+    }
+    free(state.cms);
+    for (int o = 0; o < num_bpfobjs; o++)
+    {
+        free(bpfobjs[o]);
+    }
+    free(bpfobjs);
+
     return 0;
 }
 
-static int get_map_info(int fd, struct bpf_map_info *info)
+// --------------------------------------------------------------------------------------------------------------------
+// Diff
+//
+// How often every code region ran, for each time the functions got entered, in two profiles: the regions whose
+// relative frequency changed most come first. A region that did not run counts as running once, so that the ones that
+// rarely run do not take over the ranking
+// --------------------------------------------------------------------------------------------------------------------
+
+struct diff_side
 {
-    int err;
-    unsigned int size = sizeof(*info);
-    memset(info, 0, size);
-    err = bpf_obj_get_info_by_fd(fd, info, &size);
-    if (err)
+    struct report_spot *regions;
+    size_t num_regions;
+    __u64 entries; // Executions of every function
+};
+
+struct diff_rank
+{
+    size_t spot;
+    double change;  // Ratio of the relative frequencies (after over before)
+    double factor;  // How many times more, or less, often
+    __u64 count;
+};
+
+static int cmp_diff_rank(const void *a, const void *b)
+{
+    const struct diff_rank *x = a;
+    const struct diff_rank *y = b;
+    if (x->factor != y->factor)
     {
-        close(fd);
+        return x->factor > y->factor ? -1 : 1;
     }
-    return err;
+    if (x->count != y->count)
+    {
+        return x->count > y->count ? -1 : 1;
+    }
+    return (x->spot > y->spot) - (x->spot < y->spot);
 }
 
-static int get_global_data(int fd, struct bpf_map_info *info, void *data)
+// Index a profraw file, then evaluate the regions (and the function entries) of the coverage mappings out of it
+static int diff_side(struct root_args *args, struct covmap **cms, int num_cms, const char *profraw, struct diff_side *side)
 {
-    int err;
-    void *k, *v;
-    k = malloc(info->key_size);
-    v = malloc(info->value_size);
-    if (!k || !v)
+    struct profdata *pd = profdata_new();
+    if (!pd)
     {
-        err = -1;
-        goto error_out;
+        return -1;
     }
-    if (!info)
+    log_info(args, "indexing '%s'\n", profraw);
+    int err = add_profraw(args, profraw, pd);
+    struct report *rep = err ? NULL : report_new((const struct covmap *const *)cms, num_cms, pd);
+    if (!err && !rep)
     {
+        log_erro(args, "%s\n", "could not allocate the report");
         err = -1;
-        goto error_out;
     }
-    if (info->max_entries > 1)
+    struct report_spot *functions = NULL;
+    size_t num_functions = 0;
+    if (!err && (report_spots(rep, REPORT_SPOT_FUNCTION, &functions, &num_functions) ||
+                 report_spots(rep, REPORT_SPOT_REGION, &side->regions, &side->num_regions)))
     {
+        log_erro(args, "%s\n", "could not evaluate the regions");
         err = -1;
-        goto error_out;
     }
+    side->entries = 0;
+    for (size_t f = 0; f < num_functions; f++)
+    {
+        side->entries += functions[f].count;
+    }
+    free(functions);
+    report_free(rep);
+    profdata_free(pd);
 
-    err = bpf_map_get_next_key(fd, NULL, k);
-    if (err)
+    return err;
+}
+
+int diff(struct root_args *args)
+{
+    int num_bpfobjs = 0;
+    char **bpfobjs = sibling_objects(args, DIFF_OBJECT_OPT_LONG, &num_bpfobjs);
+    struct covmap **cms = calloc(num_bpfobjs + 1, sizeof(struct covmap *));
+    if (!bpfobjs || !cms)
     {
-        goto error_out;
+        log_fata(args, "%s\n", "could not allocate the BPF coverage objects");
     }
-    err = bpf_map_lookup_elem(fd, k, v);
-    if (err)
+    for (int o = 0; o < num_bpfobjs; o++)
     {
-        goto error_out;
+        log_info(args, "reading the coverage mapping of '%s'\n", bpfobjs[o]);
+        if (load_covmap(args, bpfobjs[o], &cms[o]))
+        {
+            log_fata(args, "could not read the coverage mapping of '%s'\n", bpfobjs[o]);
+        }
     }
-    memcpy(data, v, info->value_size);
 
-error_out:
-    free(k);
-    free(v);
-    close(fd);
-    return err;
-}
+    // Both sides get evaluated out of the same coverage mappings: the same regions, in the same order
+    struct diff_side sides[2] = {};
+    for (int i = 0; i < 2; i++)
+    {
+        if (diff_side(args, cms, num_bpfobjs, args->profraw[i], &sides[i]))
+        {
+            log_fata(args, "could not read the counters of '%s'\n", args->profraw[i]);
+        }
+        if (sides[i].entries == 0)
+        {
+            log_warn(args, "no function ran in '%s'\n", args->profraw[i]);
+        }
+    }
+    assert(sides[0].num_regions == sides[1].num_regions);
 
-static void wait_or_exit(struct root_args *args, pid_t pid, char *err) {
-    if (!err) {
-        err = "exited with status";
+    size_t num_regions = sides[0].num_regions;
+    struct diff_rank *ranks = calloc(num_regions + 1, sizeof(struct diff_rank));
+    if (!ranks)
+    {
+        log_fata(args, "%s\n", "could not allocate the regions");
     }
-    int status;
-    waitpid(pid, &status, 0);
-    if (WIFEXITED(status))
+    double entries[2] = {sides[0].entries ? sides[0].entries : 1, sides[1].entries ? sides[1].entries : 1};
+    size_t num_ranks = 0;
+    for (size_t r = 0; r < num_regions; r++)
     {
-        int exit_status = WEXITSTATUS(status);
-        if (exit_status != 0)
+        __u64 before = sides[0].regions[r].count;
+        __u64 after = sides[1].regions[r].count;
+        if (before == 0 && after == 0)
         {
-            log_fata(args, "%s %d\n", err, exit_status);
+            continue;
         }
+        double change = ((after ? after : 1) / entries[1]) / ((before ? before : 1) / entries[0]);
+        ranks[num_ranks++] = (struct diff_rank){
+            .spot = r,
+            .change = change,
+            .factor = change >= 1 ? change : 1 / change,
+            .count = before > after ? before : after,
+        };
+    }
+    if (num_ranks > 0)
+    {
+        qsort(ranks, num_ranks, sizeof(struct diff_rank), cmp_diff_rank);
+    }
+    size_t num_shown = num_ranks < (size_t)args->limit ? num_ranks : (size_t)args->limit;
+
+    int width = 8;
+    for (size_t r = 0; r < num_shown; r++)
+    {
+        int len = strlen(sides[0].regions[ranks[r].spot].function);
+        width = len > width ? len : width;
     }
+    width = width > 48 ? 48 : width;
+
+    fprintf(stdout, "ENTRIES %llu (%s), %llu (%s)\n\n", sides[0].entries, args->profraw[0], sides[1].entries, args->profraw[1]);
+    fprintf(stdout, "REGIONS (%zu of %zu executed)\n", num_ranks, num_regions);
+    fprintf(stdout, "%10s %20s %20s %12s %12s  %-*s  %s\n", "CHANGE", "BEFORE", "AFTER", "BEFORE/ENTRY", "AFTER/ENTRY",
+            width, "FUNCTION", "LOCATION");
+    for (size_t r = 0; r < num_shown; r++)
+    {
+        const struct report_spot *before = &sides[0].regions[ranks[r].spot];
+        const struct report_spot *after = &sides[1].regions[ranks[r].spot];
+        char change[32];
+        snprintf(change, sizeof(change), "x%.2f", ranks[r].change);
+        fprintf(stdout, "%10s %20llu %20llu %12.4f %12.4f  %-*.*s  ", change, before->count, after->count,
+                before->count / entries[0], after->count / entries[1], width, width, before->function);
+        print_spot_location(stdout, before);
+        fputc('\n', stdout);
+    }
+
+    free(ranks);
+    for (int i = 0; i < 2; i++)
+    {
+        free(sides[i].regions);
+    }
+    for (int o = 0; o < num_bpfobjs; o++)
+    {
+        covmap_free(cms[o]);
+        free(bpfobjs[o]);
+    }
+    free(cms);
+    free(bpfobjs);
+
+    return 0;
 }
 
 // --------------------------------------------------------------------------------------------------------------------
-// Implementation
+// Annotate
+//
+// The BPF instructions with the executions of the code regions holding their lines: the instructions of the BPF
+// coverage objects for profraw files, the ones the kernel translated (and JITed) for the pinned maps of a program.
+// The blocks of consecutive instructions in the same region come first, ranked by how many instructions they executed
 // --------------------------------------------------------------------------------------------------------------------
 
-int run(struct root_args *args)
+struct annotated_prog
 {
-    log_info(args, "executing program '%s'\n", args->program[0]);
+    struct bpfprog prog;
+    char name[NAME_MAX + 1];
+    struct report_spot *regions; // Region of every line
+    bool *has_region;
+};
 
-    pid_t pid = fork();
-    switch (pid)
+struct annotated_block
+{
+    const struct annotated_prog *ap;
+    __u32 first, last; // Instructions
+    const struct report_spot *region;
+    __u64 executed; // Instructions executed (the executions of the region, for every instruction)
+    __u64 jited_size;
+};
+
+static int cmp_annotated_block(const void *a, const void *b)
+{
+    const struct annotated_block *x = a;
+    const struct annotated_block *y = b;
+    if (x->executed != y->executed)
     {
-    case -1: /* Error */
-        log_fata(args, "%s\n", strerror(errno));
-    case 0: /* Child */
-        if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) < 0)
-        {
-            log_fata(args, "%s\n", strerror(errno));
-        }
-        execvp(args->program[0], args->program);
-        log_fata(args, "%s\n", strerror(errno));
+        return x->executed > y->executed ? -1 : 1;
+    }
+    if (x->region->count != y->region->count)
+    {
+        return x->region->count > y->region->count ? -1 : 1;
     }
+    return (x > y) - (x < y);
+}
 
-    /* Parent */
-    waitpid(pid, 0, 0); // sync with PTRACE_TRACEME
-    ptrace(PTRACE_SETOPTIONS, pid, 0, PTRACE_O_EXITKILL);
+static bool same_region(const struct report_spot *a, const struct report_spot *b)
+{
+    return a->function == b->function && a->file == b->file && a->line_start == b->line_start &&
+           a->col_start == b->col_start && a->line_end == b->line_end && a->col_end == b->col_end;
+}
 
-    int is_map = 0;
-    for (;;)
+static int add_annotated_prog(struct annotated_prog **aps, int *num_aps, const struct bpfprog *prog, const char *name)
+{
+    struct annotated_prog *grown = realloc(*aps, (*num_aps + 1) * sizeof(struct annotated_prog));
+    if (!grown)
     {
-        /* Enter next system call */
-        if (ptrace(PTRACE_SYSCALL, pid, 0, 0) == -1)
-        {
-            log_fata(args, "%s\n", strerror(errno));
-        }
-
-        /* Waiting for PID to die */
-        if (waitpid(pid, 0, 0) == -1)
-        {
-            log_fata(args, "%s\n", strerror(errno));
-        }
+        return -1;
+    }
+    *aps = grown;
+    struct annotated_prog *ap = &grown[(*num_aps)++];
+    memset(ap, 0, sizeof(*ap));
+    ap->prog = *prog;
+    snprintf(ap->name, sizeof(ap->name), "%s", name);
+    return 0;
+}
 
-        /* Gather system call arguments */
-        struct user_regs_struct regs;
-        if (ptrace(PTRACE_GETREGS, pid, 0, &regs) == -1)
+// The programs of a BPF coverage object (every executable section of it)
+static int object_programs(struct root_args *args, const char *path, const char *object, struct annotated_prog **aps,
+                           int *num_aps)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) || st.st_size < (off_t)sizeof(Elf64_Ehdr))
+    {
+        log_erro(args, "could not read the BPF coverage object '%s'\n", path);
+        if (fd >= 0)
         {
-            log_fata(args, "%s\n", strerror(errno));
+            close(fd);
         }
+        return -1;
+    }
+    void *buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (buf == MAP_FAILED)
+    {
+        log_erro(args, "could not map the BPF coverage object '%s'\n", path);
+        return -1;
+    }
+    struct bpfprog *progs = NULL;
+    int num_progs = 0;
+    int err = bpfprog_load_object(buf, st.st_size, &progs, &num_progs);
+    munmap(buf, st.st_size);
+    if (err)
+    {
+        log_erro(args, "could not read the programs of '%s': %s\n", path, strerror(-err));
+        return -1;
+    }
+    int p;
+    for (p = 0; p < num_progs && !err; p++)
+    {
+        char name[NAME_MAX + 1];
+        snprintf(name, sizeof(name), "%s:%s", object, progs[p].name);
+        err = add_annotated_prog(aps, num_aps, &progs[p], name);
+    }
+    if (err)
+    {
+        bpfprog_free(progs + p - 1, num_progs - p + 1);
+    }
+    free(progs);
 
-        /* Mark bpf(BPF_MAP_CREATE, ...) */
-        const unsigned int sysc = regs.orig_rax;
-        const unsigned int comm = regs.rdi;
-        is_map = (sysc == SYS_bpf && comm == BPF_MAP_CREATE);
+    return err;
+}
 
-        /* Print a representation of the system call */
-        log_debu(args,
-                 "%d(%d, %ld, %ld, %ld, %ld, %ld)",
-                 sysc,
-                 comm, (long)regs.rsi, (long)regs.rdx, (long)regs.r10, (long)regs.r8, (long)regs.r9);
+// Get the info of a program twice: its sizes first, then the arrays they are the sizes of
+static int get_prog_info(int fd, struct bpfprog *prog)
+{
+    struct bpf_prog_info info = {};
+    __u32 len = sizeof(info);
+    if (bpf_obj_get_info_by_fd(fd, &info, &len))
+    {
+        return -1;
+    }
+    struct bpf_prog_info sizes = info;
+    memset(&info, 0, sizeof(info));
+    void *insns = calloc(sizes.xlated_prog_len + 1, 1);
+    void *func_info = calloc(sizes.nr_func_info + 1, sizes.func_info_rec_size + 1);
+    void *line_info = calloc(sizes.nr_line_info + 1, sizes.line_info_rec_size + 1);
+    void *jited_line_info = calloc(sizes.nr_jited_line_info + 1, sizes.jited_line_info_rec_size + 1);
+    void *jited_ksyms = calloc(sizes.nr_jited_ksyms + 1, sizeof(__u64));
+    void *jited_func_lens = calloc(sizes.nr_jited_func_lens + 1, sizeof(__u32));
+    int err = !insns || !func_info || !line_info || !jited_line_info || !jited_ksyms || !jited_func_lens ? -1 : 0;
+    if (!err)
+    {
+        info.xlated_prog_len = sizes.xlated_prog_len;
+        info.xlated_prog_insns = (__u64)(unsigned long)insns;
+        info.nr_func_info = sizes.nr_func_info;
+        info.func_info_rec_size = sizes.func_info_rec_size;
+        info.func_info = (__u64)(unsigned long)func_info;
+        info.nr_line_info = sizes.nr_line_info;
+        info.line_info_rec_size = sizes.line_info_rec_size;
+        info.line_info = (__u64)(unsigned long)line_info;
+        info.nr_jited_line_info = sizes.nr_jited_line_info;
+        info.jited_line_info_rec_size = sizes.jited_line_info_rec_size;
+        info.jited_line_info = (__u64)(unsigned long)jited_line_info;
+        info.nr_jited_ksyms = sizes.nr_jited_ksyms;
+        info.jited_ksyms = (__u64)(unsigned long)jited_ksyms;
+        info.nr_jited_func_lens = sizes.nr_jited_func_lens;
+        info.jited_func_lens = (__u64)(unsigned long)jited_func_lens;
+        len = sizeof(info);
+        err = bpf_obj_get_info_by_fd(fd, &info, &len) ? -1 : 0;
+    }
 
-        /* Run system call and stop on exit */
-        if (ptrace(PTRACE_SYSCALL, pid, 0, 0) == -1)
+    // The strings of the lines are in the BTF of the program
+    struct bpf_btf_info btf_info = {};
+    void *btf = NULL;
+    int btf_fd = !err && info.btf_id ? bpf_btf_get_fd_by_id(info.btf_id) : -1;
+    if (btf_fd >= 0)
+    {
+        len = sizeof(btf_info);
+        if (bpf_obj_get_info_by_fd(btf_fd, &btf_info, &len) == 0 && (btf = calloc(btf_info.btf_size + 1, 1)))
         {
-            log_fata(args, "%s\n", strerror(errno));
+            __u32 btf_size = btf_info.btf_size;
+            memset(&btf_info, 0, sizeof(btf_info));
+            btf_info.btf = (__u64)(unsigned long)btf;
+            btf_info.btf_size = btf_size;
+            len = sizeof(btf_info);
+            if (bpf_obj_get_info_by_fd(btf_fd, &btf_info, &len))
+            {
+                free(btf);
+                btf = NULL;
+            }
         }
+        close(btf_fd);
+    }
+    if (!err)
+    {
+        err = bpfprog_load_info(&info, btf, btf ? btf_info.btf_size : 0, prog) ? -1 : 0;
+    }
+    free(btf);
+    free(insns);
+    free(func_info);
+    free(line_info);
+    free(jited_line_info);
+    free(jited_ksyms);
+    free(jited_func_lens);
 
-        /* Waiting for PID to die */
-        if (waitpid(pid, 0, 0) == -1)
+    return err;
+}
+
+// The programs loaded in the kernel that use the given maps
+static int kernel_programs(struct root_args *args, const __u32 *map_ids, int num_map_ids, struct annotated_prog **aps,
+                           int *num_aps)
+{
+    int err = 0;
+    __u32 id = 0;
+    while (!err && bpf_prog_get_next_id(id, &id) == 0)
+    {
+        int fd = bpf_prog_get_fd_by_id(id);
+        if (fd < 0)
         {
-            log_fata(args, "%s\n", strerror(errno));
+            continue; // Gone in the meantime
         }
-
-        /* Get system call result */
-        if (ptrace(PTRACE_GETREGS, pid, 0, &regs) == -1)
+        struct bpf_prog_info info = {};
+        __u32 len = sizeof(info);
+        __u32 *ids = NULL;
+        if (bpf_obj_get_info_by_fd(fd, &info, &len) == 0 && info.nr_map_ids > 0 &&
+            (ids = calloc(info.nr_map_ids, sizeof(__u32))))
         {
-            if (DEBUG) {
-                print_log(3, NULL, args, "%s\n", " = ?");
+            __u32 nr_map_ids = info.nr_map_ids;
+            memset(&info, 0, sizeof(info));
+            info.nr_map_ids = nr_map_ids;
+            info.map_ids = (__u64)(unsigned long)ids;
+            len = sizeof(info);
+            bool uses = false;
+            // The program may have more maps by now, only the ones that fit got written
+            __u32 num_ids = bpf_obj_get_info_by_fd(fd, &info, &len) ? 0 : info.nr_map_ids;
+            num_ids = num_ids < nr_map_ids ? num_ids : nr_map_ids;
+            for (__u32 m = 0; m < num_ids && !uses; m++)
+            {
+                for (int i = 0; i < num_map_ids && !uses; i++)
+                {
+                    uses = ids[m] == map_ids[i];
+                }
             }
-            if (errno == ESRCH)
+            struct bpfprog prog;
+            if (uses)
             {
-                exit(regs.rdi); // _exit(2) or similar
+                log_info(args, "annotating program '%s' (ID %u)\n", info.name, id);
+                if (get_prog_info(fd, &prog))
+                {
+                    log_erro(args, "could not read the instructions of program ID %u\n", id);
+                    err = -1;
+                }
+                else if (add_annotated_prog(aps, num_aps, &prog, prog.name))
+                {
+                    bpfprog_free(&prog, 1);
+                    err = -1;
+                }
             }
-            log_fata(args, "%s\n", strerror(errno));
         }
+        free(ids);
+        close(fd);
+    }
 
-        /* Print system call result */
-        long result = regs.rax;
-        if (DEBUG) {
-            print_log(3, NULL, args, " = %ld\n", result);
-        }
+    return err;
+}
 
-        /* Pin the bpfcov maps */
-        if (is_map && result)
+// The line holding every instruction (the last one starting at or before it)
+static const struct bpfprog_line *line_of(const struct bpfprog *prog, __u32 insn, __u32 *line)
+{
+    while (*line + 1 < prog->num_lines && prog->lines[*line + 1].insn <= insn)
+    {
+        (*line)++;
+    }
+    return *line < prog->num_lines && prog->lines[*line].insn <= insn ? &prog->lines[*line] : NULL;
+}
+
+// Blocks of consecutive instructions whose lines are in the same region
+static int annotated_blocks(const struct annotated_prog *aps, int num_aps, struct annotated_block **blocks,
+                            size_t *num_blocks)
+{
+    size_t capacity = 0;
+    *blocks = NULL;
+    *num_blocks = 0;
+    for (int p = 0; p < num_aps; p++)
+    {
+        const struct annotated_prog *ap = &aps[p];
+        struct annotated_block *block = NULL;
+        __u32 l = 0;
+        for (__u32 i = 0; i < ap->prog.num_insns; i++)
         {
-            int pidfd = syscall(SYS_pidfd_open, pid, 0);
-            if (pidfd < 0)
-            {
-                continue;
-            }
-            int curfd = syscall(SYS_pidfd_getfd, pidfd, result, 0);
-            if (curfd < 0)
+            const struct bpfprog_line *line = line_of(&ap->prog, i, &l);
+            if (!line || !ap->has_region[l])
             {
+                block = NULL;
                 continue;
             }
-            close(pidfd);
-
-            struct bpf_map_info map_info = {};
-            int err;
-            err = get_map_info(curfd, &map_info);
-            if (!err && strlen(map_info.name) > 0)
+            const struct report_spot *region = &ap->regions[l];
+            if (!block || !same_region(block->region, region))
             {
-                log_info(args, "got info about map '%s'\n", map_info.name);
-
-                char map_name[BPF_OBJ_NAME_LEN];
-                strcpy(map_name, map_info.name);
-
-                const char *sep = ".";
-                strtok(map_info.name, sep);
-                char *suffix = strtok(NULL, sep);
-
-                char *pin_path = "";
-                if (get_pin_path(args, suffix, &pin_path))
+                if (*num_blocks == capacity)
                 {
-                    err = bpf_obj_pin(curfd, pin_path);
-                    if (err)
+                    capacity = capacity ? capacity * 2 : 256;
+                    struct annotated_block *grown = realloc(*blocks, capacity * sizeof(struct annotated_block));
+                    if (!grown)
                     {
-                        if (errno == EEXIST)
-                        {
-                            log_warn(args, "pin '%s' already exists for map '%s'\n", pin_path, map_name);
-                            continue;
-                        }
-                        log_fata(args, "%s\n", "could not pin map");
+                        return -1;
                     }
-                    log_warn(args, "pin map '%s' to '%s'\n", map_name, pin_path);
+                    *blocks = grown;
                 }
+                block = &(*blocks)[(*num_blocks)++];
+                *block = (struct annotated_block){.ap = ap, .first = i, .region = region};
+            }
+            if (line->insn == i)
+            {
+                block->jited_size += line->jited_size;
             }
+            block->last = i;
+            block->executed += region->count;
         }
     }
-
     return 0;
 }
 
-int gen(struct root_args *args)
+static void print_blocks(struct root_args *args, FILE *outfp, struct annotated_block *blocks, size_t num_blocks)
 {
-    log_info(args, "generating '%s' for program '%s'\n", args->output, args->program[0]);
-
-    /* Get maps info */
-    struct bpf_map_info profc_info = {};
-    if (get_map_info(bpf_obj_get(args->pin[0]), &profc_info))
+    size_t num_executed = 0;
+    for (size_t b = 0; b < num_blocks; b++)
     {
-        log_fata(args, "could not get info about pinned map '%s'\n", args->pin[0]);
+        num_executed += blocks[b].executed > 0;
     }
-    struct bpf_map_info profd_info = {};
-    if (get_map_info(bpf_obj_get(args->pin[1]), &profd_info))
+    if (num_blocks > 0)
     {
-        log_fata(args, "could not get info about pinned map '%s'\n", args->pin[1]);
+        qsort(blocks, num_blocks, sizeof(struct annotated_block), cmp_annotated_block);
     }
-    struct bpf_map_info profn_info = {};
-    if (get_map_info(bpf_obj_get(args->pin[2]), &profn_info))
+    size_t num_shown = num_executed < (size_t)args->limit ? num_executed : (size_t)args->limit;
+
+    int width = 8;
+    for (size_t b = 0; b < num_shown; b++)
     {
-        log_fata(args, "could not get info about pinned map '%s'\n", args->pin[2]);
+        int len = strlen(blocks[b].ap->name);
+        width = len > width ? len : width;
     }
-    struct bpf_map_info covmap_info = {};
-    if (get_map_info(bpf_obj_get(args->pin[3]), &covmap_info))
+    width = width > 48 ? 48 : width;
+
+    fprintf(outfp, "BLOCKS (%zu of %zu executed)\n", num_executed, num_blocks);
+    fprintf(outfp, "%20s  %20s  ", "INSTRUCTIONS", "EXECUTIONS");
+    if (args->jited)
     {
-        log_fata(args, "could not get info about pinned map '%s'\n", args->pin[3]);
+        fprintf(outfp, "%8s  ", "JITED");
     }
-
-    /* Time to write binary data to the output file */
-    FILE *outfp = fopen(args->output, "wb");
-    if (!outfp)
+    fprintf(outfp, "%-11s  %-*s  %s\n", "INSNS", width, "PROGRAM", "LOCATION");
+    for (size_t b = 0; b < num_shown; b++)
     {
-        log_fata(args, "could not open the output file '%s'\n", args->output);
+        const struct annotated_block *block = &blocks[b];
+        char insns[32];
+        snprintf(insns, sizeof(insns), "%u-%u", block->first, block->last);
+        fprintf(outfp, "%20llu  %20llu  ", block->executed, block->region->count);
+        if (args->jited)
+        {
+            fprintf(outfp, "%8llu  ", block->jited_size);
+        }
+        fprintf(outfp, "%-11s  %-*.*s  ", insns, width, width, block->ap->name);
+        print_spot_location(outfp, block->region);
+        fputc('\n', outfp);
     }
+}
 
-    /* Write the header */
-    log_info(args, "%s\n", "about to write the profraw header...");
-    // Magic number
-    char magic[8] = {0x81, 0x72, 0x66, 0x6F, 0x72, 0x70, 0x6C, 0xFF};
-    fwrite(magic, 1, sizeof(magic), outfp);
-    // Version
-    void *covmap_data = malloc(covmap_info.value_size);
-    if (get_global_data(bpf_obj_get(args->pin[3]), &covmap_info, covmap_data))
+// Every instruction with the executions of its region, after the source line it comes from (and its JITed code)
+static void print_annotated(struct root_args *args, FILE *outfp, const struct annotated_prog *ap)
+{
+    fprintf(outfp, "\nPROGRAM %s (%u instructions)\n", ap->name, ap->prog.num_insns);
+    __u32 l = 0;
+    __u32 f = 0;
+    const struct bpfprog_line *previous = NULL;
+    for (__u32 i = 0; i < ap->prog.num_insns;)
     {
-        fclose(outfp);
-        log_fata(args, "could not get global data from map '%s'\n", args->pin[3]);
+        for (; f < ap->prog.num_funcs && ap->prog.funcs[f].insn <= i; f++)
+        {
+            fprintf(outfp, "%s:\n", ap->prog.funcs[f].name);
+        }
+        const struct bpfprog_line *line = line_of(&ap->prog, i, &l);
+        if (line && line != previous && line->line > 0)
+        {
+            const char *source = line->source;
+            while (*source == ' ' || *source == '\t')
+            {
+                source++;
+            }
+            fprintf(outfp, "%20s  ; %s @ %s:%u:%u\n", "", source, line->file, line->line, line->col);
+            if (args->jited && line->jited)
+            {
+                fprintf(outfp, "%20s  ; jited 0x%llx (%u bytes)\n", "", (unsigned long long)line->jited, line->jited_size);
+            }
+            previous = line;
+        }
+        char disasm[128];
+        int slots = bpfprog_disasm(&ap->prog, i, disasm, sizeof(disasm));
+        if (line && ap->has_region[l])
+        {
+            fprintf(outfp, "%20llu", ap->regions[l].count);
+        }
+        else
+        {
+            fprintf(outfp, "%20s", "-");
+        }
+        fprintf(outfp, "  %5u: %s\n", i, disasm);
+        i += slots;
     }
-    long long int version = 0;
-    memcpy(&version, &((char *)covmap_data)[12], 4); // Version is the 3rd int in the coverage mapping header
-    version += 1;                                    // Version is 0 indexed
-    fwrite(&version, 1, sizeof(version), outfp);
-    free(covmap_data);
-    // Data size
-    long long int func_num = profd_info.value_size / 48; // 5 x i64 + 2 x i32 for each function
-    fwrite(&func_num, 1, sizeof(func_num), outfp);
-    // Padding before counters
-    long long int pad_bef = 0;
-    fwrite(&pad_bef, 1, sizeof(pad_bef), outfp);
-    // Counters size
-    long long int counters_num = profc_info.value_size / 8; // 1 x i64 for each counter element
-    fwrite(&counters_num, 1, sizeof(counters_num), outfp);
-    // Padding after counters
-    long long int pad_aft = 0;
-    fwrite(&pad_aft, 1, sizeof(pad_aft), outfp);
-    // Names size
-    long long int names_sz = profn_info.value_size;
-    fwrite(&names_sz, 1, sizeof(names_sz), outfp);
-    // Counters delta (nulled)
-    long long int counters_delta = 0;
-    fwrite(&counters_delta, 1, sizeof(counters_delta), outfp);
-    // Names delta (nulled)
-    long long int names_delta = 0;
-    fwrite(&names_delta, 1, sizeof(names_delta), outfp);
-    // IPVK last
-    long long int ipvk_last = 1;
-    fwrite(&ipvk_last, 1, sizeof(ipvk_last), outfp);
+}
 
-    /* Write the data part */
-    log_info(args, "%s\n", "about to write the data in the profraw...");
-    void *profd_data = malloc(profd_info.value_size);
-    if (get_global_data(bpf_obj_get(args->pin[1]), &profd_info, profd_data))
+int annotate(struct root_args *args)
+{
+    int num_bpfobjs = 0;
+    char **bpfobjs = sibling_objects(args, ANNOTATE_OBJECT_OPT_LONG, &num_bpfobjs);
+    struct covmap **cms = calloc(num_bpfobjs + 1, sizeof(struct covmap *));
+    if (!bpfobjs || !cms)
     {
-        fclose(outfp);
-        log_fata(args, "could not get global data from map '%s'\n", args->pin[1]);
+        log_fata(args, "%s\n", "could not allocate the BPF coverage objects");
+    }
+    for (int o = 0; o < num_bpfobjs; o++)
+    {
+        log_info(args, "reading the coverage mapping of '%s'\n", bpfobjs[o]);
+        if (load_covmap(args, bpfobjs[o], &cms[o]))
+        {
+            log_fata(args, "could not read the coverage mapping of '%s'\n", bpfobjs[o]);
+        }
     }
-    fwrite(profd_data, profd_info.value_size, 1, outfp);
 
-    /* Write the counters part */
-    log_info(args, "%s\n", "about to write the counters in the profraw..");
-    void *profc_data = malloc(profc_info.value_size);
-    if (get_global_data(bpf_obj_get(args->pin[0]), &profc_info, profc_data))
+    // The counters, and the IDs of the pinned maps the programs use
+    struct profdata *pd = profdata_new();
+    if (!pd)
+    {
+        log_fata(args, "%s\n", "could not allocate the profdata");
+    }
+    __u32 *map_ids = NULL;
+    int num_map_ids = 0;
+    if (args->num_profraw && index_profraws(args, pd))
+    {
+        log_fata(args, "%s\n", "could not index the input files");
+    }
+    for (int o = 0; !args->num_profraw && o < args->num_objects; o++)
+    {
+        struct cov_maps *maps;
+        int num_maps = open_pinned_generations(args, args->objects[o], &maps);
+        if (num_maps == 0)
+        {
+            log_fata(args, "could not open the pinned maps for object '%s'\n", args->objects[o]);
+        }
+        struct cov_snapshot snap;
+        if (init_snapshot(args, maps, num_maps, false, &snap) || read_snapshot(args, &snap) || add_snapshot(args, &snap, pd))
+        {
+            log_fata(args, "could not read the counters of object '%s'\n", args->objects[o]);
+        }
+        free_snapshot(&snap);
+        map_ids = realloc(map_ids, (num_map_ids + num_maps * NUM_COV_MAPS) * sizeof(__u32));
+        if (!map_ids)
+        {
+            log_fata(args, "%s\n", "could not allocate the map IDs");
+        }
+        for (int g = 0; g < num_maps; g++)
+        {
+            for (int p = 0; p < NUM_COV_MAPS; p++)
+            {
+                if (maps[g].fd[p] >= 0)
+                {
+                    map_ids[num_map_ids++] = maps[g].info[p].id;
+                }
+            }
+            close_maps(&maps[g]);
+        }
+        free(maps);
+    }
+    struct report *rep = report_new((const struct covmap *const *)cms, num_bpfobjs, pd);
+    if (!rep)
     {
-        fclose(outfp);
-        log_fata(args, "could not get global data from map '%s'\n", args->pin[0]);
+        log_fata(args, "%s\n", "could not allocate the report");
     }
-    fwrite(profc_data, profc_info.value_size, 1, outfp);
 
-    /* Write the names part */
-    log_info(args, "%s\n", "about to write the names in the profraw...");
-    void *profn_data = malloc(profn_info.value_size);
-    if (get_global_data(bpf_obj_get(args->pin[2]), &profn_info, profn_data))
+    // The instructions: of the BPF objects, or of the programs using the pinned maps
+    struct annotated_prog *aps = NULL;
+    int num_aps = 0;
+    if (args->num_profraw)
+    {
+        char (*names)[NAME_MAX + 1];
+        const char **objects = program_names(bpfobjs, num_bpfobjs, &names);
+        if (!objects)
+        {
+            log_fata(args, "%s\n", "could not name the programs");
+        }
+        for (int o = 0; o < num_bpfobjs; o++)
+        {
+            if (object_programs(args, bpfobjs[o], objects[o], &aps, &num_aps))
+            {
+                log_fata(args, "could not read the instructions of '%s'\n", bpfobjs[o]);
+            }
+        }
+        free(names);
+        free(objects);
+    }
+    else if (kernel_programs(args, map_ids, num_map_ids, &aps, &num_aps))
+    {
+        log_fata(args, "%s\n", "could not read the loaded programs");
+    }
+    if (num_aps == 0)
     {
-        fclose(outfp);
-        log_fata(args, "could not get global data from map '%s'\n", args->pin[2]);
+        log_fata(args, "%s\n", "could not find any program to annotate");
     }
-    fwrite(profn_data, profn_info.value_size, 1, outfp);
 
-    /* Align to 8 bytes */
-    unsigned int b = 0;
-    for (unsigned int p = b; p < (7 & (16 - profn_info.value_size % 16)); p++)
+    // The region of every line
+    for (int p = 0; p < num_aps; p++)
     {
-        fwrite(&b, 1, 1, outfp);
+        struct annotated_prog *ap = &aps[p];
+        ap->regions = calloc(ap->prog.num_lines + 1, sizeof(struct report_spot));
+        ap->has_region = calloc(ap->prog.num_lines + 1, sizeof(bool));
+        if (!ap->regions || !ap->has_region)
+        {
+            log_fata(args, "%s\n", "could not allocate the regions");
+        }
+        for (__u32 l = 0; l < ap->prog.num_lines; l++)
+        {
+            const struct bpfprog_line *line = &ap->prog.lines[l];
+            ap->has_region[l] = report_region_at(rep, line->file, line->line, line->col, &ap->regions[l]) == 0;
+        }
     }
 
-    /* Close */
-    fclose(outfp);
+    struct annotated_block *blocks;
+    size_t num_blocks;
+    if (annotated_blocks(aps, num_aps, &blocks, &num_blocks))
+    {
+        log_fata(args, "%s\n", "could not allocate the blocks");
+    }
+    print_blocks(args, stdout, blocks, num_blocks);
+    for (int p = 0; p < num_aps; p++)
+    {
+        print_annotated(args, stdout, &aps[p]);
+    }
 
-    /* Unpin the maps */
-    handle_map_pins(args, NULL, args->unpin);
+    free(blocks);
+    for (int p = 0; p < num_aps; p++)
+    {
+        bpfprog_free(&aps[p].prog, 1);
+        free(aps[p].regions);
+        free(aps[p].has_region);
+    }
+    free(aps);
+    report_free(rep);
+    profdata_free(pd);
+    free(map_ids);
+    for (int o = 0; o < num_bpfobjs; o++)
+    {
+        covmap_free(cms[o]);
+        free(bpfobjs[o]);
+    }
+    free(cms);
+    free(bpfobjs);
 
     return 0;
 }
 
-int out(struct root_args *args)
-{
-    log_info(args, "%s\n", "generating coverage visualization...");
+// --------------------------------------------------------------------------------------------------------------------
+// Cost
+//
+// What the instrumentation costs: the programs of the instrumented BPF object against the ones of the plain object,
+// both loaded (and verified, and JITed) but not attached
+// --------------------------------------------------------------------------------------------------------------------
 
-    char report_path[PATH_MAX];
-    strcpy(report_path, args->report_path);
+struct cost_prog
+{
+    char name[BPF_OBJ_NAME_LEN];
+    __u64 verified_insns;
+    __u64 xlated_insns;
+    __u64 jited_bytes;
+};
 
-    // Generating a *.profdata for each input *.profraw
-    char profdata[args->num_profraw][PATH_MAX];
-    memset(profdata, 0, args->num_profraw * PATH_MAX * sizeof(char));
+struct cost_object
+{
+    struct cost_prog *progs;
+    int num_progs;
+    int num_maps;
+    __u64 map_bytes; // Of the values (and keys, for maps not indexed by them) of every map
+    __u64 load_ns;
+};
 
-    char bpfobjs[args->num_profraw][PATH_MAX];
-    memset(bpfobjs, 0, args->num_profraw * PATH_MAX * sizeof(char));
+static int load_cost(struct root_args *args, const char *path, struct cost_object *co)
+{
+    memset(co, 0, sizeof(*co));
+    struct bpf_object *obj = bpf_object__open_file(path, NULL);
+    if (libbpf_get_error(obj))
+    {
+        log_erro(args, "could not open the BPF object '%s'\n", path);
+        return -1;
+    }
 
-    int c = 0;
-    char** ptr = args->profraw;
-    for (char* profraw = *ptr; profraw; profraw = *++ptr) {
-        // Looking up for *.bpf.obj file sibling to the current input *.profraw file
-        char *profraw_wo_ext = strdup(profraw);
-        strip_extension(profraw_wo_ext);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int err = bpf_object__load(obj);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (err)
+    {
+        log_erro(args, "could not load the BPF object '%s': %s\n", path, strerror(-err));
+        bpf_object__close(obj);
+        return -1;
+    }
+    co->load_ns = (end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec;
 
-        char bpfobj_path[PATH_MAX];
-        int bpfobj_path_len = snprintf(bpfobj_path, PATH_MAX, "%s.bpf.obj", profraw_wo_ext);
-        if (bpfobj_path_len >= PATH_MAX)
+    struct bpf_program *prog;
+    bpf_object__for_each_program(prog, obj)
+    {
+        struct bpf_prog_info info = {};
+        __u32 size = sizeof(info);
+        int fd = bpf_program__fd(prog);
+        if (fd < 0 || bpf_obj_get_info_by_fd(fd, &info, &size))
         {
-            log_fata(args, "%s\n", "bpf.obj output path too long");
+            continue; // Not loaded
         }
-        log_info(args, "looking for BPF coverage object at '%s'\n", bpfobj_path);
-        if (access(bpfobj_path, F_OK) != 0)
+        struct cost_prog *grown = realloc(co->progs, (co->num_progs + 1) * sizeof(struct cost_prog));
+        if (!grown)
         {
-            log_fata(args, "could not find the BPF coverage object at '%s'", bpfobj_path);
+            err = -1;
+            break;
         }
-        free(profraw_wo_ext);
-
-        // Storing the *.bpf.obj file for later
-        strncpy(bpfobjs[c], bpfobj_path, PATH_MAX);
-
-        // Creating the *.profdata path (relative to the execution directory)
-        char *profraw_name = strdup(basename(profraw));
-        strtok(profraw_name, ".");
+        co->progs = grown;
+        struct cost_prog *cp = &co->progs[co->num_progs++];
+        snprintf(cp->name, sizeof(cp->name), "%s", info.name);
+        cp->verified_insns = info.verified_insns;
+        cp->xlated_insns = info.xlated_prog_len / sizeof(struct bpf_insn);
+        cp->jited_bytes = info.jited_prog_len;
+    }
 
-        char profdata_path[PATH_MAX];
-        int profdata_path_len = snprintf(profdata_path, PATH_MAX, "%s.profdata", profraw_name);
-        if (profdata_path_len >= PATH_MAX)
+    struct bpf_map *map;
+    bpf_object__for_each_map(map, obj)
+    {
+        struct bpf_map_info info = {};
+        __u32 size = sizeof(info);
+        int fd = bpf_map__fd(map);
+        if (fd < 0 || bpf_obj_get_info_by_fd(fd, &info, &size))
         {
-            log_fata(args, "%s\n", "profdata output path too long");
+            continue;
         }
-        free(profraw_name);
+        bool indexed = info.type == BPF_MAP_TYPE_ARRAY || info.type == BPF_MAP_TYPE_PERCPU_ARRAY;
+        co->map_bytes += (__u64)(info.value_size + (indexed ? 0 : info.key_size)) * info.max_entries;
+        co->num_maps++;
+    }
+    bpf_object__close(obj);
 
-        // Storing the output *.profdata file for later
-        strncpy(profdata[c], profdata_path, PATH_MAX);
-        log_info(args, "generating '%s'\n", profdata[c]);
+    return err;
+}
 
-        // Generating the single *.profdata file
-        pid_t data_pid;
-        switch ((data_pid = fork()))
+static const struct cost_prog *find_cost_prog(const struct cost_object *co, const char *name)
+{
+    for (int p = 0; p < co->num_progs; p++)
+    {
+        if (strcmp(co->progs[p].name, name) == 0)
         {
-        case -1:
-            log_fata(args, "%s\n", "could not fork");
-            break;
-        case 0:
-            log_debu(args, "llvm-profdata merge -sparse %s -o %s\n", profraw, profdata[c]);
-
-            int devnull = open("/dev/null", O_WRONLY | O_CREAT, 0666);
-            dup2(devnull, STDERR_FILENO);
-            execlp("llvm-profdata", "llvm-profdata", "merge", "-sparse", profraw, "-o", profdata[c], NULL);
-            close(devnull);
-            log_fata(args, "%s\n", "could not exec llvm-profdata");
-            break;
+            return &co->progs[p];
         }
-        wait_or_exit(args, data_pid, "llvm-profdata: exited with status");
-
-        c++;
     }
+    return NULL;
+}
 
-    // Merge all the *.profdata into one
-    char target_profdata[PATH_MAX];
-    int num_profdata = sizeof(profdata) / PATH_MAX;
-    if (num_profdata > 1) {
-        strncpy(target_profdata, "all.profdata", PATH_MAX);
-
-        log_info(args, "merging into '%s'\n", target_profdata);
-
-        pid_t merge_pid;
-        switch ((merge_pid = fork()))
+static void print_cost(FILE *outfp, const char *program, const char *metric, bool plain, __u64 before, bool instrumented, __u64 after)
+{
+    fprintf(outfp, "%-16s  %-22s  ", program, metric);
+    if (plain)
+    {
+        fprintf(outfp, "%12llu  ", before);
+    }
+    else
+    {
+        fprintf(outfp, "%12s  ", "-");
+    }
+    if (instrumented)
+    {
+        fprintf(outfp, "%12llu  ", after);
+    }
+    else
+    {
+        fprintf(outfp, "%12s  ", "-");
+    }
+    if (plain && instrumented)
+    {
+        fprintf(outfp, "%+12lld  ", (long long)(after - before));
+        if (before)
         {
-        case -1:
-            log_fata(args, "%s\n", "could not fork");
-            break;
-        case 0:
-            char *arguments[num_profdata + 6];
-            arguments[0] = "llvm-profdata";
-            arguments[1] = "merge";
-            arguments[2] = "-sparse";
-            arguments[3] = "-o";
-            arguments[4] = target_profdata;
-            for (int i = 0; i < num_profdata; i++) {
-                arguments[i + 5] = profdata[i];
-            }
-            arguments[num_profdata + 5] = NULL;
-
-            log_debu(args, "%s ", arguments[0]);
-            for (int a = 1; a < num_profdata + 5; a++) {
-                if (DEBUG) {
-                    print_log(3, NULL, args, "%s ", arguments[a]);
-                }
-            }
-            if (DEBUG) {
-                print_log(3, NULL, args, "%s", "\n");
-            }
-
-            int devnull = open("/dev/null", O_WRONLY | O_CREAT, 0666);
-            dup2(devnull, STDERR_FILENO);
-            execvp("llvm-profdata", arguments);
-            close(devnull);
-            log_fata(args, "%s\n", "could not exec llvm-profdata");
-            break;
+            fprintf(outfp, "%+8.1f%%", ((double)after - (double)before) / (double)before * 100.0);
+        }
+        else
+        {
+            fprintf(outfp, "%9s", "-");
         }
-        wait_or_exit(args, merge_pid, "llvm-profdata: exited with status");
     }
-    else {
-        strncpy(target_profdata, profdata[0], PATH_MAX);
+    else
+    {
+        fprintf(outfp, "%12s  %9s", "-", "-");
     }
+    fputc('\n', outfp);
+}
 
-    int num_bpfobj_params = num_profdata * 2;
-    int devnull = open("/dev/null", O_WRONLY | O_CREAT, 0666);
-    if (devnull == -1) {
-        log_fata(args, "could not open %s\n", "/dev/null");
+int cost(struct root_args *args)
+{
+    struct cost_object plain, instrumented;
+    log_info(args, "loading the plain BPF object '%s'\n", args->plain);
+    if (load_cost(args, args->plain, &plain))
+    {
+        log_fata(args, "could not load the plain BPF object '%s'\n", args->plain);
     }
-    log_info(args, "about to generate the %s coverage report in '%s'\n", format_string[args->out_format], report_path);
-    switch (args->out_format)
+    log_info(args, "loading the instrumented BPF object '%s'\n", args->instrumented);
+    if (load_cost(args, args->instrumented, &instrumented))
     {
-        case FORMAT_html:
-            pid_t html_pid;
-            switch ((html_pid = fork()))
-            {
-            case -1:
-                log_fata(args, "%s\n", "could not fork");
-                break;
-            case 0:
-                char *arguments[num_bpfobj_params + 11];
-                arguments[0] = "llvm-cov";
-                arguments[1] = "show";
-                arguments[2] = "--format=html";
-                arguments[3] = "--show-branches=count";
-                arguments[4] = "--show-line-counts-or-regions";
-                arguments[5] = "--show-region-summary";
-                arguments[6] = "--output-dir";
-                arguments[7] = report_path;
-                arguments[8] = "-instr-profile";
-                arguments[9] = target_profdata;
-                for (int i = 0; i < num_profdata; i++) {
-                    int off = i * 2;
-                    arguments[off + 10] = "-object";
-                    arguments[off + 11] = bpfobjs[i];
-                }
-                arguments[num_bpfobj_params + 10] = NULL;
-
-                log_debu(args, "%s ", arguments[0]);
-                for (int a = 1; a < num_bpfobj_params + 10; a++) {
-                    if (DEBUG) {
-                        print_log(3, NULL, args, "%s ", arguments[a]);
-                    }
-                }
-                if (DEBUG) {
-                    print_log(3, NULL, args, "%s", "\n");
-                }
-
-                dup2(devnull, STDERR_FILENO);
-                execvp("llvm-cov", arguments);
-                break;
-            }
-            close(devnull);
-            wait_or_exit(args, html_pid, "llvm-cov exited with status");
-            break;
-        case FORMAT_lcov:
-            /* Fallthrough */
-        case FORMAT_json:
-            int outfile = open(report_path, O_RDWR | O_CREAT, 0600);
-            if (outfile == -1) {
-                log_fata(args, "could not open %s\n", report_path);
-            }
-
-            pid_t export_pid;
-            switch ((export_pid = fork()))
-            {
-            case -1:
-                log_fata(args, "%s\n", "could not fork");
-                break;
-            case 0:
-                char *arguments[num_bpfobj_params + 8];
-                arguments[0] = "llvm-cov";
-                arguments[1] = "export";
-                arguments[2] = "--format=text";
-                arguments[3] = "--show-branch-summary";
-                arguments[4] = "--show-region-summary";
-                arguments[5] = "-instr-profile";
-                arguments[6] = target_profdata;
-                for (int i = 0; i < num_profdata; i++) {
-                    int off = i > 0 ? (i + 1) : i;
-                    arguments[off + 7] = "-object";
-                    arguments[off + 8] = bpfobjs[i];
-                }
-                arguments[num_bpfobj_params + 7] = NULL;
-
-                log_debu(args, "%s ", arguments[0]);
-                for (int a = 1; a < num_bpfobj_params + 7; a++) {
-                    if (DEBUG) {
-                        print_log(3, NULL, args, "%s ", arguments[a]);
-                    }
-                }
-                if (DEBUG) {
-                    print_log(3, NULL, args, "%s", "\n");
-                }
+        log_fata(args, "could not load the instrumented BPF object '%s'\n", args->instrumented);
+    }
 
-                dup2(devnull, STDERR_FILENO);
-                dup2(outfile, STDOUT_FILENO);
-                execvp("llvm-cov", arguments);
-                break;
-            }
-            close(devnull);
-            close(outfile);
-            wait_or_exit(args, export_pid, "llvm-cov exited with status");
-            break;
+    // The programs of the plain object (next to the same ones instrumented), then the ones only the instrumented one has
+    fprintf(stdout, "%-16s  %-22s  %12s  %12s  %12s  %9s\n", "PROGRAM", "METRIC", "PLAIN", "INSTRUMENTED", "DELTA", "CHANGE");
+    for (int p = 0; p < plain.num_progs + instrumented.num_progs; p++)
+    {
+        const char *name = p < plain.num_progs ? plain.progs[p].name : instrumented.progs[p - plain.num_progs].name;
+        const struct cost_prog *before = find_cost_prog(&plain, name);
+        const struct cost_prog *after = find_cost_prog(&instrumented, name);
+        if (p >= plain.num_progs && before)
+        {
+            continue; // Already there
+        }
+        print_cost(stdout, name, "verified instructions", before, before ? before->verified_insns : 0, after, after ? after->verified_insns : 0);
+        print_cost(stdout, name, "translated instructions", before, before ? before->xlated_insns : 0, after, after ? after->xlated_insns : 0);
+        print_cost(stdout, name, "JITed bytes", before, before ? before->jited_bytes : 0, after, after ? after->jited_bytes : 0);
     }
+    const char *object = basename(args->instrumented);
+    print_cost(stdout, object, "maps", true, plain.num_maps, true, instrumented.num_maps);
+    print_cost(stdout, object, "map bytes", true, plain.map_bytes, true, instrumented.map_bytes);
+    print_cost(stdout, object, "load time (us)", true, plain.load_ns / 1000, true, instrumented.load_ns / 1000);
+
+    free(plain.progs);
+    free(instrumented.progs);
 
     return 0;
-}
\ No newline at end of file
+}
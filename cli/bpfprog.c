@@ -0,0 +1,735 @@
+#define _GNU_SOURCE
+
+/* C standard library */
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* POSIX */
+#include <elf.h>
+
+#include <linux/btf.h>
+
+#include "bpfprog.h"
+
+// --------------------------------------------------------------------------------------------------------------------
+// BPF programs reader
+//
+// It reads the instructions of the BPF programs, and where they come from:
+// - .BTF: a header, then the types, then the strings (the names of the types, of the files, and the source lines)
+// - .BTF.ext: a header, then the function info and the line info: the size of a record, then for each program
+//   section its name, its number of records, and its records (offset of the first instruction in bytes, offsets of
+//   the file and of the source line in the strings, line and column)
+// The kernel gives the same records for a loaded program, with offsets in instructions, in the strings of its BTF
+// --------------------------------------------------------------------------------------------------------------------
+
+#define BTF_EXT_MAGIC BTF_MAGIC
+#define BTF_LINE_SHIFT 10
+#define BTF_COL_MASK 0x3ff
+
+// Not in the UAPI headers of every kernel
+#ifndef BPF_MEMSX
+#define BPF_MEMSX 0x80
+#endif
+#ifndef BPF_XCHG
+#define BPF_XCHG (0xe0 | BPF_FETCH)
+#endif
+#ifndef BPF_CMPXCHG
+#define BPF_CMPXCHG (0xf0 | BPF_FETCH)
+#endif
+
+struct btf_ext_header
+{
+    __u16 magic;
+    __u8 version;
+    __u8 flags;
+    __u32 hdr_len;
+    __u32 func_info_off;
+    __u32 func_info_len;
+    __u32 line_info_off;
+    __u32 line_info_len;
+};
+
+// The strings of a BTF, and the names of its types (by type ID)
+struct btf_names
+{
+    char *strings;
+    __u32 strings_size;
+    __u32 *types; // Offsets of their names
+    __u32 num_types;
+};
+
+// --------------------------------------------------------------------------------------------------------------------
+// BTF
+// --------------------------------------------------------------------------------------------------------------------
+
+// Size of the data following a type, by kind (like the kernel checks it)
+static size_t btf_type_data(__u32 kind, __u32 vlen)
+{
+    switch (kind)
+    {
+    case BTF_KIND_INT:
+    case BTF_KIND_VAR:
+    case 17: // BTF_KIND_DECL_TAG
+        return sizeof(__u32);
+    case BTF_KIND_ARRAY:
+        return sizeof(struct btf_array);
+    case BTF_KIND_STRUCT:
+    case BTF_KIND_UNION:
+    case BTF_KIND_DATASEC:
+    case 19: // BTF_KIND_ENUM64
+        return vlen * 3 * sizeof(__u32);
+    case BTF_KIND_ENUM:
+    case BTF_KIND_FUNC_PROTO:
+        return vlen * 2 * sizeof(__u32);
+    default:
+        return 0;
+    }
+}
+
+static int read_btf(const void *btf, size_t size, struct btf_names *names)
+{
+    memset(names, 0, sizeof(*names));
+    struct btf_header hdr;
+    if (size < sizeof(hdr))
+    {
+        return -EINVAL;
+    }
+    memcpy(&hdr, btf, sizeof(hdr));
+    if (hdr.magic != BTF_MAGIC || hdr.hdr_len > size || hdr.str_off > size - hdr.hdr_len ||
+        hdr.str_len > size - hdr.hdr_len - hdr.str_off || hdr.type_off > size - hdr.hdr_len ||
+        hdr.type_len > size - hdr.hdr_len - hdr.type_off)
+    {
+        return -EINVAL;
+    }
+    names->strings = malloc(hdr.str_len + 1);
+    if (!names->strings)
+    {
+        return -ENOMEM;
+    }
+    memcpy(names->strings, (const char *)btf + hdr.hdr_len + hdr.str_off, hdr.str_len);
+    names->strings[hdr.str_len] = '\0';
+    names->strings_size = hdr.str_len;
+
+    // Type IDs start from 1 (0 is void), up to the first kind this does not know the size of
+    const char *types = (const char *)btf + hdr.hdr_len + hdr.type_off;
+    size_t capacity = 0;
+    names->num_types = 1;
+    for (size_t off = 0; off + sizeof(struct btf_type) <= hdr.type_len;)
+    {
+        struct btf_type type;
+        memcpy(&type, types + off, sizeof(type));
+        __u32 kind = BTF_INFO_KIND(type.info);
+        if (kind > 19)
+        {
+            break;
+        }
+        if (names->num_types >= capacity)
+        {
+            capacity = capacity ? capacity * 2 : 1024;
+            __u32 *grown = realloc(names->types, capacity * sizeof(__u32));
+            if (!grown)
+            {
+                return -ENOMEM;
+            }
+            names->types = grown;
+            names->types[0] = 0;
+        }
+        names->types[names->num_types++] = type.name_off;
+        off += sizeof(type) + btf_type_data(kind, BTF_INFO_VLEN(type.info));
+    }
+
+    return 0;
+}
+
+static void free_btf(struct btf_names *names)
+{
+    free(names->strings);
+    free(names->types);
+}
+
+static const char *btf_string(const struct btf_names *names, __u32 off)
+{
+    return off < names->strings_size ? names->strings + off : "";
+}
+
+static const char *btf_type_name(const struct btf_names *names, __u32 type_id)
+{
+    return type_id < names->num_types ? btf_string(names, names->types[type_id]) : "";
+}
+
+static int add_line(struct bpfprog *prog, const struct btf_names *names, const struct bpf_line_info *info, __u32 insn)
+{
+    if (insn >= prog->num_insns)
+    {
+        return -EINVAL;
+    }
+    prog->lines[prog->num_lines++] = (struct bpfprog_line){
+        .insn = insn,
+        .file = btf_string(names, info->file_name_off),
+        .source = btf_string(names, info->line_off),
+        .line = info->line_col >> BTF_LINE_SHIFT,
+        .col = info->line_col & BTF_COL_MASK,
+    };
+    return 0;
+}
+
+static int add_func(struct bpfprog *prog, const struct btf_names *names, const struct bpf_func_info *info, __u32 insn)
+{
+    if (insn >= prog->num_insns)
+    {
+        return -EINVAL;
+    }
+    prog->funcs[prog->num_funcs++] = (struct bpfprog_func){.insn = insn, .name = btf_type_name(names, info->type_id)};
+    return 0;
+}
+
+static int cmp_line(const void *a, const void *b)
+{
+    const struct bpfprog_line *x = a;
+    const struct bpfprog_line *y = b;
+    return (x->insn > y->insn) - (x->insn < y->insn);
+}
+
+static int cmp_func(const void *a, const void *b)
+{
+    const struct bpfprog_func *x = a;
+    const struct bpfprog_func *y = b;
+    return (x->insn > y->insn) - (x->insn < y->insn);
+}
+
+static void sort_prog(struct bpfprog *prog)
+{
+    if (prog->num_lines > 0)
+    {
+        qsort(prog->lines, prog->num_lines, sizeof(struct bpfprog_line), cmp_line);
+    }
+    if (prog->num_funcs > 0)
+    {
+        qsort(prog->funcs, prog->num_funcs, sizeof(struct bpfprog_func), cmp_func);
+    }
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Objects
+// --------------------------------------------------------------------------------------------------------------------
+
+struct btf_ext_info
+{
+    const unsigned char *data;
+    size_t size;
+    __u32 rec_size;
+};
+
+// The records of the function or line info of a section (-ENOENT when it has none)
+static int find_ext_records(const struct btf_ext_info *ext, const struct btf_names *names, const char *section,
+                            const unsigned char **records, __u32 *num_records)
+{
+    for (size_t off = sizeof(__u32); ext->rec_size && off + 2 * sizeof(__u32) <= ext->size;)
+    {
+        __u32 sec_name_off, num_info;
+        memcpy(&sec_name_off, ext->data + off, sizeof(__u32));
+        memcpy(&num_info, ext->data + off + sizeof(__u32), sizeof(__u32));
+        off += 2 * sizeof(__u32);
+        if (num_info > (ext->size - off) / ext->rec_size)
+        {
+            return -EINVAL;
+        }
+        if (strcmp(btf_string(names, sec_name_off), section) == 0)
+        {
+            *records = ext->data + off;
+            *num_records = num_info;
+            return 0;
+        }
+        off += (size_t)num_info * ext->rec_size;
+    }
+    return -ENOENT;
+}
+
+static int read_btf_ext(const unsigned char *data, size_t size, struct btf_ext_info *funcs, struct btf_ext_info *lines)
+{
+    struct btf_ext_header hdr = {0};
+    if (size < offsetof(struct btf_ext_header, line_info_off))
+    {
+        return -EINVAL;
+    }
+    memcpy(&hdr, data, size < sizeof(hdr) ? size : sizeof(hdr));
+    if (hdr.magic != BTF_EXT_MAGIC || hdr.hdr_len > size || hdr.hdr_len < sizeof(hdr))
+    {
+        return -EINVAL;
+    }
+    struct
+    {
+        struct btf_ext_info *info;
+        __u32 off, len, min_rec_size;
+    } infos[] = {
+        {funcs, hdr.func_info_off, hdr.func_info_len, sizeof(struct bpf_func_info)},
+        {lines, hdr.line_info_off, hdr.line_info_len, sizeof(struct bpf_line_info)},
+    };
+    for (size_t i = 0; i < sizeof(infos) / sizeof(infos[0]); i++)
+    {
+        if (infos[i].off > size - hdr.hdr_len || infos[i].len > size - hdr.hdr_len - infos[i].off ||
+            (infos[i].len > 0 && infos[i].len < sizeof(__u32)))
+        {
+            return -EINVAL;
+        }
+        infos[i].info->data = data + hdr.hdr_len + infos[i].off;
+        infos[i].info->size = infos[i].len;
+        if (infos[i].len > 0)
+        {
+            memcpy(&infos[i].info->rec_size, infos[i].info->data, sizeof(__u32));
+            if (infos[i].info->rec_size < infos[i].min_rec_size)
+            {
+                return -EINVAL;
+            }
+        }
+    }
+    return 0;
+}
+
+// A section with its instructions, and its functions and lines (pointing into its own copy of the strings of the BTF)
+static int read_section(const unsigned char *data, size_t size, const char *name, const struct btf_names *btf,
+                        const struct btf_ext_info *funcs, const struct btf_ext_info *lines, struct bpfprog *prog)
+{
+    prog->name = strdup(name);
+    prog->num_insns = size / sizeof(struct bpf_insn);
+    prog->insns = malloc(prog->num_insns * sizeof(struct bpf_insn) + 1);
+    prog->strings = malloc(btf->strings_size + 1);
+    if (!prog->name || !prog->insns || !prog->strings)
+    {
+        return -ENOMEM;
+    }
+    memcpy(prog->insns, data, prog->num_insns * sizeof(struct bpf_insn));
+    memcpy(prog->strings, btf->strings, btf->strings_size + 1);
+    struct btf_names own = *btf;
+    own.strings = prog->strings;
+    const struct btf_names *names = &own;
+
+    const unsigned char *records[2] = {NULL, NULL};
+    __u32 num_records[2] = {0, 0};
+    const struct btf_ext_info *infos[2] = {funcs, lines};
+    for (int i = 0; i < 2; i++)
+    {
+        int err = find_ext_records(infos[i], names, name, &records[i], &num_records[i]);
+        if (err && err != -ENOENT)
+        {
+            return err;
+        }
+    }
+    prog->funcs = calloc(num_records[0] + 1, sizeof(struct bpfprog_func));
+    prog->lines = calloc(num_records[1] + 1, sizeof(struct bpfprog_line));
+    if (!prog->funcs || !prog->lines)
+    {
+        return -ENOMEM;
+    }
+    int err = 0;
+    for (__u32 r = 0; r < num_records[0] && !err; r++)
+    {
+        struct bpf_func_info info;
+        memcpy(&info, records[0] + (size_t)r * funcs->rec_size, sizeof(info));
+        err = add_func(prog, names, &info, info.insn_off / sizeof(struct bpf_insn));
+    }
+    for (__u32 r = 0; r < num_records[1] && !err; r++)
+    {
+        struct bpf_line_info info;
+        memcpy(&info, records[1] + (size_t)r * lines->rec_size, sizeof(info));
+        err = add_line(prog, names, &info, info.insn_off / sizeof(struct bpf_insn));
+    }
+    sort_prog(prog);
+
+    return err;
+}
+
+int bpfprog_load_object(const void *buf, size_t size, struct bpfprog **out, int *num_out)
+{
+    const Elf64_Ehdr *ehdr = buf;
+    if (size < sizeof(Elf64_Ehdr) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 || ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+        ehdr->e_machine != EM_BPF || ehdr->e_shentsize != sizeof(Elf64_Shdr) || ehdr->e_shoff > size ||
+        (size - ehdr->e_shoff) / sizeof(Elf64_Shdr) < ehdr->e_shnum || ehdr->e_shstrndx >= ehdr->e_shnum)
+    {
+        return -EINVAL;
+    }
+    const Elf64_Shdr *shdrs = (const Elf64_Shdr *)((const char *)buf + ehdr->e_shoff);
+    const Elf64_Shdr *shstrtab = &shdrs[ehdr->e_shstrndx];
+    if (shstrtab->sh_offset > size || shstrtab->sh_size > size - shstrtab->sh_offset || shstrtab->sh_size == 0)
+    {
+        return -EINVAL;
+    }
+    const char *shstrs = (const char *)buf + shstrtab->sh_offset;
+
+    // The program sections, and the BTF
+    const unsigned char *btf = NULL, *btf_ext = NULL;
+    size_t btf_size = 0, btf_ext_size = 0;
+    int num_progs = 0;
+    for (int i = 0; i < ehdr->e_shnum; i++)
+    {
+        const Elf64_Shdr *shdr = &shdrs[i];
+        if (shdr->sh_type == SHT_NOBITS || shdr->sh_offset > size || shdr->sh_size > size - shdr->sh_offset ||
+            shdr->sh_name >= shstrtab->sh_size || !memchr(shstrs + shdr->sh_name, '\0', shstrtab->sh_size - shdr->sh_name))
+        {
+            continue;
+        }
+        const char *name = shstrs + shdr->sh_name;
+        /**/ if (strcmp(name, ".BTF") == 0)
+        {
+            btf = (const unsigned char *)buf + shdr->sh_offset;
+            btf_size = shdr->sh_size;
+        }
+        else if (strcmp(name, ".BTF.ext") == 0)
+        {
+            btf_ext = (const unsigned char *)buf + shdr->sh_offset;
+            btf_ext_size = shdr->sh_size;
+        }
+        else if (shdr->sh_type == SHT_PROGBITS && (shdr->sh_flags & SHF_EXECINSTR) && shdr->sh_size >= sizeof(struct bpf_insn))
+        {
+            num_progs++;
+        }
+    }
+    if (num_progs == 0)
+    {
+        return -ENOENT;
+    }
+
+    // Without BTF, the programs have no lines
+    struct btf_names names = {0};
+    struct btf_ext_info funcs = {0}, lines = {0};
+    int err = btf ? read_btf(btf, btf_size, &names) : 0;
+    if (!err && btf && btf_ext)
+    {
+        err = read_btf_ext(btf_ext, btf_ext_size, &funcs, &lines);
+    }
+    if (!err && !names.strings && !(names.strings = calloc(1, 1)))
+    {
+        err = -ENOMEM;
+    }
+    struct bpfprog *progs = err ? NULL : calloc(num_progs + 1, sizeof(struct bpfprog));
+    if (!err && !progs)
+    {
+        err = -ENOMEM;
+    }
+    int p = 0;
+    for (int i = 0; i < ehdr->e_shnum && !err; i++)
+    {
+        const Elf64_Shdr *shdr = &shdrs[i];
+        if (shdr->sh_type == SHT_PROGBITS && (shdr->sh_flags & SHF_EXECINSTR) && shdr->sh_size >= sizeof(struct bpf_insn) &&
+            shdr->sh_offset <= size && shdr->sh_size <= size - shdr->sh_offset && shdr->sh_name < shstrtab->sh_size &&
+            memchr(shstrs + shdr->sh_name, '\0', shstrtab->sh_size - shdr->sh_name))
+        {
+            err = read_section((const unsigned char *)buf + shdr->sh_offset, shdr->sh_size, shstrs + shdr->sh_name, &names,
+                               &funcs, &lines, &progs[p++]);
+        }
+    }
+    free_btf(&names);
+    if (err)
+    {
+        bpfprog_free(progs, p);
+        free(progs);
+        return err;
+    }
+    *out = progs;
+    *num_out = num_progs;
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Loaded programs
+// --------------------------------------------------------------------------------------------------------------------
+
+// Where the JITed code of every line starts, then how long it is: until the next line in the same function
+static void add_jited_lines(struct bpfprog *prog, const struct bpf_prog_info *info)
+{
+    const __u64 *jited_lines = (const __u64 *)(unsigned long)info->jited_line_info;
+    const __u64 *ksyms = (const __u64 *)(unsigned long)info->jited_ksyms;
+    const __u32 *func_lens = (const __u32 *)(unsigned long)info->jited_func_lens;
+    __u32 num_funcs = info->nr_jited_ksyms < info->nr_jited_func_lens ? info->nr_jited_ksyms : info->nr_jited_func_lens;
+    if (!jited_lines || info->nr_jited_line_info != prog->num_lines || info->jited_line_info_rec_size != sizeof(__u64) ||
+        !ksyms || !func_lens)
+    {
+        return;
+    }
+    for (__u32 l = 0; l < prog->num_lines; l++)
+    {
+        __u64 address = jited_lines[l];
+        for (__u32 f = 0; f < num_funcs; f++)
+        {
+            __u64 end = ksyms[f] + func_lens[f];
+            if (address < ksyms[f] || address >= end)
+            {
+                continue;
+            }
+            if (l + 1 < prog->num_lines && jited_lines[l + 1] > address && jited_lines[l + 1] < end)
+            {
+                end = jited_lines[l + 1];
+            }
+            prog->lines[l].jited = address;
+            prog->lines[l].jited_size = end - address;
+            break;
+        }
+    }
+}
+
+int bpfprog_load_info(const struct bpf_prog_info *info, const void *btf, size_t btf_size, struct bpfprog *prog)
+{
+    memset(prog, 0, sizeof(*prog));
+    struct btf_names names = {0};
+    int err = btf ? read_btf(btf, btf_size, &names) : 0;
+    if (!err && !names.strings && !(names.strings = calloc(1, 1)))
+    {
+        err = -ENOMEM;
+    }
+    if (err)
+    {
+        free_btf(&names);
+        return err;
+    }
+    prog->strings = names.strings;
+    prog->name = strndup(info->name, sizeof(info->name));
+    prog->num_insns = info->xlated_prog_insns ? info->xlated_prog_len / sizeof(struct bpf_insn) : 0;
+    prog->insns = malloc(prog->num_insns * sizeof(struct bpf_insn) + 1);
+    __u32 num_funcs = info->func_info && info->func_info_rec_size >= sizeof(struct bpf_func_info) ? info->nr_func_info : 0;
+    __u32 num_lines = info->line_info && info->line_info_rec_size >= sizeof(struct bpf_line_info) ? info->nr_line_info : 0;
+    prog->funcs = calloc(num_funcs + 1, sizeof(struct bpfprog_func));
+    prog->lines = calloc(num_lines + 1, sizeof(struct bpfprog_line));
+    if (!prog->name || !prog->insns || !prog->funcs || !prog->lines)
+    {
+        err = -ENOMEM;
+    }
+    if (!err && prog->num_insns)
+    {
+        memcpy(prog->insns, (const void *)(unsigned long)info->xlated_prog_insns, prog->num_insns * sizeof(struct bpf_insn));
+    }
+    for (__u32 r = 0; r < num_funcs && !err; r++)
+    {
+        struct bpf_func_info func;
+        memcpy(&func, (const char *)(unsigned long)info->func_info + (size_t)r * info->func_info_rec_size, sizeof(func));
+        err = add_func(prog, &names, &func, func.insn_off);
+    }
+    for (__u32 r = 0; r < num_lines && !err; r++)
+    {
+        struct bpf_line_info line;
+        memcpy(&line, (const char *)(unsigned long)info->line_info + (size_t)r * info->line_info_rec_size, sizeof(line));
+        err = add_line(prog, &names, &line, line.insn_off);
+    }
+    free(names.types);
+    if (err)
+    {
+        bpfprog_free(prog, 1);
+        memset(prog, 0, sizeof(*prog));
+        return err;
+    }
+    // The kernel lists the lines in order, as the JITed addresses
+    add_jited_lines(prog, info);
+    sort_prog(prog);
+
+    return 0;
+}
+
+void bpfprog_free(struct bpfprog *progs, int num_progs)
+{
+    for (int p = 0; progs && p < num_progs; p++)
+    {
+        free(progs[p].name);
+        free(progs[p].insns);
+        free(progs[p].lines);
+        free(progs[p].funcs);
+        free(progs[p].strings);
+    }
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Disassembly
+// --------------------------------------------------------------------------------------------------------------------
+
+static const char *alu_ops[16] = {"+=", "-=", "*=", "/=", "|=", "&=", "<<=", ">>=", "neg", "%=", "^=", "=", "s>>=", "end"};
+static const char *jmp_ops[16] = {"goto", "==", ">", ">=", "&", "!=", "s>", "s>=", "call", "exit", "<", "<=", "s<", "s<="};
+static const char *size_names[4] = {"u32", "u16", "u8", "u64"};
+
+static void print(char *buf, size_t size, size_t *len, const char *fmt, ...)
+{
+    if (*len >= size)
+    {
+        return;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf + *len, size - *len, fmt, ap);
+    va_end(ap);
+    *len += n > 0 ? (size_t)n : 0;
+}
+
+static void print_atomic(char *buf, size_t size, size_t *len, const struct bpf_insn *insn, const char *type)
+{
+    /**/ if (insn->imm == BPF_XCHG)
+    {
+        print(buf, size, len, "r%u = xchg(*(%s *)(r%u %+d), r%u)", insn->src_reg, type, insn->dst_reg, insn->off,
+              insn->src_reg);
+    }
+    else if (insn->imm == BPF_CMPXCHG)
+    {
+        print(buf, size, len, "r0 = cmpxchg(*(%s *)(r%u %+d), r0, r%u)", type, insn->dst_reg, insn->off, insn->src_reg);
+    }
+    else
+    {
+        const char *op = alu_ops[BPF_OP(insn->imm) >> 4];
+        print(buf, size, len, insn->imm & BPF_FETCH ? "r%4$u = fetch(lock *(%1$s *)(r%2$u %3$+d) %5$s r%4$u)"
+                                                    : "lock *(%1$s *)(r%2$u %3$+d) %5$s r%4$u",
+              type, insn->dst_reg, insn->off, insn->src_reg, op ? op : "?=");
+    }
+}
+
+int bpfprog_disasm(const struct bpfprog *prog, __u32 i, char *buf, size_t size)
+{
+    const struct bpf_insn *insn = &prog->insns[i];
+    __u8 cls = BPF_CLASS(insn->code);
+    __u8 op = BPF_OP(insn->code);
+    const char *type = size_names[BPF_SIZE(insn->code) >> 3];
+    size_t len = 0;
+    int slots = 1;
+    if (size > 0)
+    {
+        buf[0] = '\0';
+    }
+    print(buf, size, &len, "(%02x) ", insn->code);
+    switch (cls)
+    {
+    case BPF_ALU:
+    case BPF_ALU64:
+    {
+        char r = cls == BPF_ALU64 ? 'r' : 'w';
+        /**/ if (op == BPF_END)
+        {
+            const char *swap = cls == BPF_ALU64 ? "bswap" : BPF_SRC(insn->code) == BPF_TO_BE ? "be" : "le";
+            print(buf, size, &len, "r%u = %s%d r%u", insn->dst_reg, swap, insn->imm, insn->dst_reg);
+        }
+        else if (op == BPF_NEG)
+        {
+            print(buf, size, &len, "%c%u = -%c%u", r, insn->dst_reg, r, insn->dst_reg);
+        }
+        else if (!alu_ops[op >> 4])
+        {
+            print(buf, size, &len, "%s", "unknown");
+        }
+        else if (BPF_SRC(insn->code) == BPF_X)
+        {
+            print(buf, size, &len, "%c%u %s %c%u", r, insn->dst_reg, alu_ops[op >> 4], r, insn->src_reg);
+        }
+        else
+        {
+            print(buf, size, &len, "%c%u %s %d", r, insn->dst_reg, alu_ops[op >> 4], insn->imm);
+        }
+        break;
+    }
+    case BPF_JMP:
+    case BPF_JMP32:
+    {
+        char r = cls == BPF_JMP ? 'r' : 'w';
+        /**/ if (op == BPF_JA)
+        {
+            print(buf, size, &len, "goto pc%+d", cls == BPF_JMP ? insn->off : insn->imm);
+        }
+        else if (op == BPF_CALL)
+        {
+            print(buf, size, &len, insn->src_reg == BPF_PSEUDO_CALL ? "call pc%+d" : "call %d", insn->imm);
+        }
+        else if (op == BPF_EXIT)
+        {
+            print(buf, size, &len, "%s", "exit");
+        }
+        else if (!jmp_ops[op >> 4])
+        {
+            print(buf, size, &len, "%s", "unknown");
+        }
+        else if (BPF_SRC(insn->code) == BPF_X)
+        {
+            print(buf, size, &len, "if %c%u %s %c%u goto pc%+d", r, insn->dst_reg, jmp_ops[op >> 4], r, insn->src_reg,
+                  insn->off);
+        }
+        else
+        {
+            print(buf, size, &len, "if %c%u %s 0x%x goto pc%+d", r, insn->dst_reg, jmp_ops[op >> 4], insn->imm,
+                  insn->off);
+        }
+        break;
+    }
+    case BPF_LD:
+        /**/ if (insn->code == (BPF_LD | BPF_IMM | BPF_DW) && i + 1 < prog->num_insns)
+        {
+            // The kernel gives the IDs of the maps (and the offsets in their values)
+            const struct bpf_insn *next = insn + 1;
+            __u64 imm = (__u32)insn->imm | (__u64)(__u32)next->imm << 32;
+            /**/ if (insn->src_reg == BPF_PSEUDO_MAP_FD)
+            {
+                print(buf, size, &len, "r%u = map[id:%u]", insn->dst_reg, (__u32)insn->imm);
+            }
+            else if (insn->src_reg == BPF_PSEUDO_MAP_VALUE)
+            {
+                print(buf, size, &len, "r%u = map[id:%u][0]+%u", insn->dst_reg, (__u32)insn->imm, (__u32)next->imm);
+            }
+            else
+            {
+                print(buf, size, &len, "r%u = 0x%llx ll", insn->dst_reg, (unsigned long long)imm);
+            }
+            slots = 2;
+        }
+        else if (BPF_MODE(insn->code) == BPF_ABS)
+        {
+            print(buf, size, &len, "r0 = *(%s *)skb[%d]", type, insn->imm);
+        }
+        else if (BPF_MODE(insn->code) == BPF_IND)
+        {
+            print(buf, size, &len, "r0 = *(%s *)skb[r%u + %d]", type, insn->src_reg, insn->imm);
+        }
+        else
+        {
+            print(buf, size, &len, "%s", "unknown");
+        }
+        break;
+    case BPF_LDX:
+        /**/ if (BPF_MODE(insn->code) == BPF_MEM)
+        {
+            print(buf, size, &len, "r%u = *(%s *)(r%u %+d)", insn->dst_reg, type, insn->src_reg, insn->off);
+        }
+        else if (BPF_MODE(insn->code) == BPF_MEMSX)
+        {
+            print(buf, size, &len, "r%u = *(s%s *)(r%u %+d)", insn->dst_reg, type + 1, insn->src_reg, insn->off);
+        }
+        else
+        {
+            print(buf, size, &len, "%s", "unknown");
+        }
+        break;
+    case BPF_ST:
+        /**/ if (BPF_MODE(insn->code) == BPF_MEM)
+        {
+            print(buf, size, &len, "*(%s *)(r%u %+d) = %d", type, insn->dst_reg, insn->off, insn->imm);
+        }
+        else
+        {
+            print(buf, size, &len, "%s", "unknown");
+        }
+        break;
+    case BPF_STX:
+        /**/ if (BPF_MODE(insn->code) == BPF_MEM)
+        {
+            print(buf, size, &len, "*(%s *)(r%u %+d) = r%u", type, insn->dst_reg, insn->off, insn->src_reg);
+        }
+        else if (BPF_MODE(insn->code) == BPF_XADD) // BPF_ATOMIC
+        {
+            print_atomic(buf, size, &len, insn, type);
+        }
+        else
+        {
+            print(buf, size, &len, "%s", "unknown");
+        }
+        break;
+    default:
+        print(buf, size, &len, "%s", "unknown");
+        break;
+    }
+
+    return slots;
+}
@@ -0,0 +1,76 @@
+#ifndef BPFCOV_BPFPROG_H
+#define BPFCOV_BPFPROG_H
+
+#include <stddef.h>
+#include <linux/bpf.h>
+#include <linux/types.h>
+
+/**
+ * Where the instructions from an instruction on (until the next line) come from, as the BTF line info tells.
+ */
+struct bpfprog_line
+{
+    __u32 insn;         // Index of its first instruction
+    const char *file;   // In the strings of the program
+    const char *source; // The source line itself (empty when unknown)
+    __u32 line;
+    __u32 col;
+    __u64 jited;        // Address of its JITed code (0 when not JITed)
+    __u32 jited_size;
+};
+
+/**
+ * A function starting at an instruction.
+ */
+struct bpfprog_func
+{
+    __u32 insn;
+    const char *name;
+};
+
+/**
+ * The instructions of a BPF program: an executable section of a BPF object (with all its functions), or the
+ * translated instructions of a program loaded in the kernel.
+ */
+struct bpfprog
+{
+    char *name;
+    struct bpf_insn *insns;
+    __u32 num_insns;
+    struct bpfprog_line *lines; // Sorted by instruction
+    __u32 num_lines;
+    struct bpfprog_func *funcs; // Sorted by instruction
+    __u32 num_funcs;
+    char *strings; // Its copy of the strings of the BTF
+};
+
+/**
+ * Read the programs of a BPF object (the executable sections of the ELF) and the line info of its BTF (.BTF.ext),
+ * into an array to free (after bpfprog_free()).
+ *
+ * Returns 0 on success, a negative errno otherwise (-ENOENT when it has no programs).
+ */
+int bpfprog_load_object(const void *buf, size_t size, struct bpfprog **progs, int *num_progs);
+
+/**
+ * Read a program loaded in the kernel out of its info: its translated instructions, its line info and, when
+ * JITed, where the code of its lines starts (every pointer of the info pointing to the arrays it got filled with),
+ * given its BTF (the raw BTF its btf_id refers to).
+ *
+ * Returns 0 on success, a negative errno otherwise.
+ */
+int bpfprog_load_info(const struct bpf_prog_info *info, const void *btf, size_t btf_size, struct bpfprog *prog);
+
+/**
+ * Free what the programs hold (not the array of them).
+ */
+void bpfprog_free(struct bpfprog *progs, int num_progs);
+
+/**
+ * Write an instruction like the verifier log does (eg. `(bf) r6 = r1`).
+ *
+ * Returns how many instructions it takes (2 for 64 bit immediate loads).
+ */
+int bpfprog_disasm(const struct bpfprog *prog, __u32 insn, char *buf, size_t size);
+
+#endif // BPFCOV_BPFPROG_H
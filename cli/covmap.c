@@ -0,0 +1,1131 @@
+#define _GNU_SOURCE
+
+/* C standard library */
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* POSIX */
+#include <elf.h>
+#include <sys/mman.h>
+
+#include <zlib.h>
+
+#include "covmap.h"
+#include "profdata.h"
+
+// --------------------------------------------------------------------------------------------------------------------
+// Coverage mapping reader
+//
+// It decodes what `llvm-cov` reads out of the BPF coverage objects (LLVM 11 onwards):
+// - __llvm_covmap: for each translation unit, a header (number of records, size of the file names, size of the
+//   coverage, version), then its file names (ULEB128 count, uncompressed and compressed sizes, then for each one
+//   its ULEB128 length and bytes, zlib compressed or not), aligned to 8 bytes
+// - __llvm_covfun: for each function, its name MD5, the size of its mapping, its hash, the MD5 of the file names of
+//   its translation unit, then its mapping (virtual files, counter expressions, regions of each virtual file),
+//   aligned to 8 bytes
+// - __llvm_prf_names: the function names (chunks of names, zlib compressed or not, separated by \01)
+// --------------------------------------------------------------------------------------------------------------------
+
+#define COVMAP_HEADER_SIZE 16
+#define COVFUN_HEADER_SIZE 28 // Packed: name MD5, data size, hash, file names MD5
+#define COVMAP_NAME_SEP '\01'
+#define COVMAP_GAP_BIT (1U << 31)
+#define COVMAP_EXPANSION_BIT 4
+
+struct covmap_unit
+{
+    __u64 filenames_ref;
+    __u32 first_file; // In the units files
+    __u32 num_files;
+};
+
+struct covmap_name
+{
+    __u64 name_ref;
+    const char *name;
+    size_t len;
+};
+
+// State while decoding an object (tables grow as needed)
+struct covmap_builder
+{
+    struct covmap *cm;
+    __u32 strings_cap, files_cap, function_files_cap, functions_cap, regions_cap, expressions_cap;
+    struct covmap_unit *units;
+    __u32 num_units;
+    __u32 *unit_files; // Indexes in the file table
+    __u32 num_unit_files, unit_files_cap;
+    struct covmap_name *names;
+    size_t num_names;
+    char **chunks;
+    size_t num_chunks;
+    unsigned char *expression_kinds; // Of the expressions of the function being decoded
+    __u32 expression_kinds_cap;
+    __u32 *expanders; // By file of the function being decoded: 1 + its last expansion region (0 for none)
+    __u32 expanders_cap;
+};
+
+static int grow(void **array, __u32 *capacity, __u32 needed, size_t size)
+{
+    if (needed <= *capacity)
+    {
+        return 0;
+    }
+    __u32 more = *capacity ? *capacity : 64;
+    while (more < needed)
+    {
+        more *= 2;
+    }
+    void *grown = realloc(*array, (size_t)more * size);
+    if (!grown)
+    {
+        return -ENOMEM;
+    }
+    *array = grown;
+    *capacity = more;
+    return 0;
+}
+
+static int add_string(struct covmap_builder *b, const char *str, size_t len, __u32 *offset)
+{
+    struct covmap *cm = b->cm;
+    int err = grow((void **)&cm->strings, &b->strings_cap, cm->strings_size + len + 1, 1);
+    if (err)
+    {
+        return err;
+    }
+    memcpy(cm->strings + cm->strings_size, str, len);
+    cm->strings[cm->strings_size + len] = '\0';
+    *offset = cm->strings_size;
+    cm->strings_size += len + 1;
+    return 0;
+}
+
+// Index of a file name in the file table (added when it is not there yet)
+static int add_file(struct covmap_builder *b, const char *name, size_t len, __u32 *index)
+{
+    struct covmap *cm = b->cm;
+    for (__u32 f = 0; f < cm->num_files; f++)
+    {
+        const char *known = covmap_string(cm, cm->files[f]);
+        if (strlen(known) == len && memcmp(known, name, len) == 0)
+        {
+            *index = f;
+            return 0;
+        }
+    }
+    int err = grow((void **)&cm->files, &b->files_cap, cm->num_files + 1, sizeof(__u32));
+    if (!err)
+    {
+        err = add_string(b, name, len, &cm->files[cm->num_files]);
+    }
+    if (err)
+    {
+        return err;
+    }
+    *index = cm->num_files++;
+    return 0;
+}
+
+static bool read_uleb128(const unsigned char **p, const unsigned char *end, __u64 *value)
+{
+    *value = 0;
+    for (unsigned int shift = 0; *p < end && shift < 64; shift += 7)
+    {
+        unsigned char byte = *(*p)++;
+        *value |= (__u64)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static __u32 read_u32(const unsigned char *p)
+{
+    __u32 value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static __u64 read_u64(const unsigned char *p)
+{
+    __u64 value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Sections
+// --------------------------------------------------------------------------------------------------------------------
+
+struct covmap_sections
+{
+    const unsigned char *covmap;
+    size_t covmap_size;
+    const unsigned char *names;
+    size_t names_size;
+    const Elf64_Shdr *shdrs;
+    const char *shstrtab;
+    size_t shstrtab_size;
+    int num_sections;
+};
+
+static int find_sections(const void *buf, size_t size, struct covmap_sections *sections)
+{
+    const Elf64_Ehdr *ehdr = buf;
+    if (size < sizeof(Elf64_Ehdr) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 || ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+        ehdr->e_shentsize != sizeof(Elf64_Shdr) || ehdr->e_shoff > size ||
+        (size - ehdr->e_shoff) / sizeof(Elf64_Shdr) < ehdr->e_shnum || ehdr->e_shstrndx >= ehdr->e_shnum)
+    {
+        return -EINVAL;
+    }
+    memset(sections, 0, sizeof(*sections));
+    sections->shdrs = (const Elf64_Shdr *)((const char *)buf + ehdr->e_shoff);
+    sections->num_sections = ehdr->e_shnum;
+    const Elf64_Shdr *shstrtab = &sections->shdrs[ehdr->e_shstrndx];
+    if (shstrtab->sh_offset > size || shstrtab->sh_size > size - shstrtab->sh_offset)
+    {
+        return -EINVAL;
+    }
+    sections->shstrtab = (const char *)buf + shstrtab->sh_offset;
+    sections->shstrtab_size = shstrtab->sh_size;
+
+    for (int i = 0; i < sections->num_sections; i++)
+    {
+        const Elf64_Shdr *shdr = &sections->shdrs[i];
+        if (shdr->sh_type == SHT_NOBITS || shdr->sh_offset > size || shdr->sh_size > size - shdr->sh_offset ||
+            shdr->sh_name >= sections->shstrtab_size)
+        {
+            continue;
+        }
+        const char *name = sections->shstrtab + shdr->sh_name;
+        /**/ if (strncmp(name, "__llvm_covmap", sections->shstrtab_size - shdr->sh_name) == 0)
+        {
+            sections->covmap = (const unsigned char *)buf + shdr->sh_offset;
+            sections->covmap_size = shdr->sh_size;
+        }
+        else if (strncmp(name, "__llvm_prf_names", sections->shstrtab_size - shdr->sh_name) == 0)
+        {
+            sections->names = (const unsigned char *)buf + shdr->sh_offset;
+            sections->names_size = shdr->sh_size;
+        }
+    }
+    return sections->covmap && sections->names ? 0 : -ENOENT;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Names
+// --------------------------------------------------------------------------------------------------------------------
+
+static int cmp_name(const void *a, const void *b)
+{
+    __u64 x = ((const struct covmap_name *)a)->name_ref;
+    __u64 y = ((const struct covmap_name *)b)->name_ref;
+    return (x > y) - (x < y);
+}
+
+static int read_names(struct covmap_builder *b, const unsigned char *p, const unsigned char *end)
+{
+    size_t capacity = 0;
+    while (p < end)
+    {
+        __u64 uncompressed_size, compressed_size;
+        if (!read_uleb128(&p, end, &uncompressed_size) || !read_uleb128(&p, end, &compressed_size))
+        {
+            return -EINVAL;
+        }
+        __u64 size = compressed_size ? compressed_size : uncompressed_size;
+        if (size > (__u64)(end - p))
+        {
+            return -EINVAL;
+        }
+
+        char *chunk = malloc(uncompressed_size + 1);
+        char **grown = realloc(b->chunks, (b->num_chunks + 1) * sizeof(char *));
+        if (!chunk || !grown)
+        {
+            free(chunk);
+            return -ENOMEM;
+        }
+        b->chunks = grown;
+        b->chunks[b->num_chunks++] = chunk;
+        if (compressed_size)
+        {
+            uLongf len = uncompressed_size;
+            if (uncompress((Bytef *)chunk, &len, p, compressed_size) != Z_OK || len != uncompressed_size)
+            {
+                return -EINVAL;
+            }
+        }
+        else
+        {
+            memcpy(chunk, p, uncompressed_size);
+        }
+        chunk[uncompressed_size] = COVMAP_NAME_SEP;
+        p += size;
+
+        for (char *name = chunk; name < chunk + uncompressed_size;)
+        {
+            char *sep = memchr(name, COVMAP_NAME_SEP, chunk + uncompressed_size + 1 - name);
+            if (b->num_names == capacity)
+            {
+                capacity = capacity ? capacity * 2 : 64;
+                struct covmap_name *more = realloc(b->names, capacity * sizeof(struct covmap_name));
+                if (!more)
+                {
+                    return -ENOMEM;
+                }
+                b->names = more;
+            }
+            struct covmap_name *entry = &b->names[b->num_names++];
+            entry->name = name;
+            entry->len = sep - name;
+            entry->name_ref = profdata_md5(name, entry->len);
+            name = sep + 1;
+        }
+
+        // Names chunks are padded with zeros
+        while (p < end && *p == 0)
+        {
+            p++;
+        }
+    }
+
+    qsort(b->names, b->num_names, sizeof(struct covmap_name), cmp_name);
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Translation units
+// --------------------------------------------------------------------------------------------------------------------
+
+static bool read_string(const unsigned char **p, const unsigned char *end, const char **str, size_t *len)
+{
+    __u64 size;
+    if (!read_uleb128(p, end, &size) || size > (__u64)(end - *p))
+    {
+        return false;
+    }
+    *str = (const char *)*p;
+    *len = size;
+    *p += size;
+    return true;
+}
+
+static int read_filenames(struct covmap_builder *b, __u32 version, const unsigned char *p, const unsigned char *end,
+                          struct covmap_unit *unit)
+{
+    __u64 num_filenames, uncompressed_size, compressed_size;
+    if (!read_uleb128(&p, end, &num_filenames) || num_filenames == 0 || !read_uleb128(&p, end, &uncompressed_size) ||
+        !read_uleb128(&p, end, &compressed_size))
+    {
+        return -EINVAL;
+    }
+
+    unsigned char *uncompressed = NULL;
+    if (compressed_size)
+    {
+        uLongf len = uncompressed_size;
+        uncompressed = malloc(uncompressed_size ? uncompressed_size : 1);
+        if (!uncompressed)
+        {
+            return -ENOMEM;
+        }
+        if (compressed_size > (__u64)(end - p) || uncompress(uncompressed, &len, p, compressed_size) != Z_OK || len != uncompressed_size)
+        {
+            free(uncompressed);
+            return -EINVAL;
+        }
+        p = uncompressed;
+        end = uncompressed + uncompressed_size;
+    }
+
+    int err = 0;
+    unit->first_file = b->num_unit_files;
+    unit->num_files = 0;
+    const char *cwd = NULL;
+    size_t cwd_len = 0;
+    for (__u64 f = 0; !err && f < num_filenames; f++)
+    {
+        const char *name;
+        size_t len;
+        if (!read_string(&p, end, &name, &len))
+        {
+            err = -EINVAL;
+            break;
+        }
+        // Since LLVM 14, the first file name is the compilation directory, the other ones are relative to it
+        char *joined = NULL;
+        if (version >= 5 && f == 0)
+        {
+            cwd = name;
+            cwd_len = len;
+        }
+        else if (version >= 5 && len > 0 && name[0] != '/' && cwd_len > 0)
+        {
+            joined = malloc(cwd_len + 1 + len);
+            if (!joined)
+            {
+                err = -ENOMEM;
+                break;
+            }
+            memcpy(joined, cwd, cwd_len);
+            size_t joined_len = cwd_len;
+            if (cwd[cwd_len - 1] != '/')
+            {
+                joined[joined_len++] = '/';
+            }
+            memcpy(joined + joined_len, name, len);
+            name = joined;
+            len = joined_len + len;
+        }
+
+        __u32 index;
+        err = add_file(b, name, len, &index);
+        free(joined);
+        if (!err)
+        {
+            err = grow((void **)&b->unit_files, &b->unit_files_cap, b->num_unit_files + 1, sizeof(__u32));
+        }
+        if (!err)
+        {
+            b->unit_files[b->num_unit_files++] = index;
+            unit->num_files++;
+        }
+    }
+    free(uncompressed);
+
+    return err;
+}
+
+static int read_units(struct covmap_builder *b, const unsigned char *covmap, size_t covmap_size)
+{
+    size_t off = 0;
+    while (off + COVMAP_HEADER_SIZE <= covmap_size)
+    {
+        const unsigned char *header = covmap + off;
+        __u32 num_records = read_u32(header);
+        __u32 filenames_size = read_u32(header + 4);
+        __u32 coverage_size = read_u32(header + 8);
+        __u32 version = read_u32(header + 12);
+        if (version < COVMAP_VERSION_MIN)
+        {
+            return -ENOTSUP;
+        }
+        if (version > COVMAP_VERSION_MAX || num_records || coverage_size || filenames_size > covmap_size - off - COVMAP_HEADER_SIZE)
+        {
+            return -EINVAL;
+        }
+
+        struct covmap_unit *more = realloc(b->units, (b->num_units + 1) * sizeof(struct covmap_unit));
+        if (!more)
+        {
+            return -ENOMEM;
+        }
+        b->units = more;
+        struct covmap_unit *unit = &b->units[b->num_units++];
+        const unsigned char *filenames = header + COVMAP_HEADER_SIZE;
+        unit->filenames_ref = profdata_md5(filenames, filenames_size);
+        int err = read_filenames(b, version, filenames, filenames + filenames_size, unit);
+        if (err)
+        {
+            return err;
+        }
+
+        // Each translation unit is aligned to 8 bytes
+        off += COVMAP_HEADER_SIZE + filenames_size;
+        off = (off + 7) & ~(size_t)7;
+    }
+    return 0;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Function records
+// --------------------------------------------------------------------------------------------------------------------
+
+// Expressions do not hold their kind (subtraction or addition), the counters referring to them do: like llvm-cov,
+// the last counter read gives the kind of the expression
+static bool use_counter(struct covmap_builder *b, __u64 counter, __u32 num_expressions)
+{
+    __u64 tag = counter & ((1 << COVMAP_COUNTER_TAG_BITS) - 1);
+    if (tag < COVMAP_COUNTER_SUB)
+    {
+        return true;
+    }
+    if ((counter >> COVMAP_COUNTER_TAG_BITS) >= num_expressions)
+    {
+        return false;
+    }
+    b->expression_kinds[counter >> COVMAP_COUNTER_TAG_BITS] = tag;
+    return true;
+}
+
+static bool read_counter(struct covmap_builder *b, const unsigned char **p, const unsigned char *end,
+                         __u32 num_expressions, __u32 *counter)
+{
+    __u64 encoded;
+    if (!read_uleb128(p, end, &encoded) || encoded > 0xffffffffULL || !use_counter(b, encoded, num_expressions))
+    {
+        return false;
+    }
+    *counter = encoded;
+    return true;
+}
+
+static __u64 with_kind(const struct covmap_builder *b, __u64 counter)
+{
+    __u64 mask = (1 << COVMAP_COUNTER_TAG_BITS) - 1;
+    if ((counter & mask) < COVMAP_COUNTER_SUB)
+    {
+        return counter;
+    }
+    return (counter & ~mask) | b->expression_kinds[counter >> COVMAP_COUNTER_TAG_BITS];
+}
+
+static int read_regions(struct covmap_builder *b, const unsigned char **p, const unsigned char *end, __u32 file,
+                        __u32 num_files, __u32 num_expressions)
+{
+    struct covmap *cm = b->cm;
+    __u64 num_regions;
+    if (!read_uleb128(p, end, &num_regions) || num_regions > (__u64)(end - *p))
+    {
+        return -EINVAL;
+    }
+    int err = grow((void **)&cm->regions, &b->regions_cap, cm->num_regions + num_regions, sizeof(struct covmap_region));
+    if (err)
+    {
+        return err;
+    }
+
+    __u32 line_start = 0;
+    for (__u64 r = 0; r < num_regions; r++)
+    {
+        struct covmap_region *region = &cm->regions[cm->num_regions];
+        memset(region, 0, sizeof(*region));
+        region->file = file;
+        region->kind = COVMAP_REGION_CODE;
+
+        // Either a counter (of a code region), or a zero counter with the kind of region in the upper bits
+        __u64 encoded;
+        if (!read_uleb128(p, end, &encoded) || encoded > 0xffffffffULL)
+        {
+            return -EINVAL;
+        }
+        __u64 tag = encoded & ((1 << COVMAP_COUNTER_TAG_BITS) - 1);
+        if (tag != COVMAP_COUNTER_ZERO)
+        {
+            if (!use_counter(b, encoded, num_expressions))
+            {
+                return -EINVAL;
+            }
+            region->counter = encoded;
+        }
+        else if (encoded & COVMAP_EXPANSION_BIT)
+        {
+            region->kind = COVMAP_REGION_EXPANSION;
+            region->expanded_file = encoded >> (COVMAP_COUNTER_TAG_BITS + 1);
+            if (region->expanded_file >= num_files)
+            {
+                return -EINVAL;
+            }
+        }
+        else
+        {
+            switch (encoded >> (COVMAP_COUNTER_TAG_BITS + 1))
+            {
+            case COVMAP_REGION_CODE:
+                break;
+            case COVMAP_REGION_SKIPPED:
+                region->kind = COVMAP_REGION_SKIPPED;
+                break;
+            case COVMAP_REGION_BRANCH:
+                region->kind = COVMAP_REGION_BRANCH;
+                if (!read_counter(b, p, end, num_expressions, &region->counter) ||
+                    !read_counter(b, p, end, num_expressions, &region->false_counter))
+                {
+                    return -EINVAL;
+                }
+                break;
+            default:
+                return -EINVAL;
+            }
+        }
+
+        // The source range: line (delta from the previous region), column, number of lines, end column
+        __u64 line_delta, col_start, num_lines, col_end;
+        if (!read_uleb128(p, end, &line_delta) || !read_uleb128(p, end, &col_start) ||
+            !read_uleb128(p, end, &num_lines) || !read_uleb128(p, end, &col_end) ||
+            line_delta > 0xffffffffULL || col_start > 0xffffffffULL || num_lines > 0xffffffffULL || col_end > 0xffffffffULL)
+        {
+            return -EINVAL;
+        }
+        line_start += line_delta;
+        if (col_end & COVMAP_GAP_BIT)
+        {
+            region->kind = COVMAP_REGION_GAP;
+            col_end &= ~COVMAP_GAP_BIT;
+        }
+        // Whole lines (eg. skipped by the preprocessor)
+        if (col_start == 0 && col_end == 0)
+        {
+            col_start = 1;
+            col_end = 0xffffffffU;
+        }
+        region->line_start = line_start;
+        region->col_start = col_start;
+        region->line_end = line_start + num_lines;
+        region->col_end = col_end;
+        if (region->line_end < region->line_start || (num_lines == 0 && col_end < col_start))
+        {
+            return -EINVAL;
+        }
+        cm->num_regions++;
+    }
+    return 0;
+}
+
+static int read_mapping(struct covmap_builder *b, const struct covmap_unit *unit, const unsigned char *p,
+                        const unsigned char *end, struct covmap_function *fn)
+{
+    struct covmap *cm = b->cm;
+
+    // Virtual files: indexes in the file names of the translation unit
+    __u64 num_files;
+    if (!read_uleb128(&p, end, &num_files) || num_files > (__u64)(end - p))
+    {
+        return -EINVAL;
+    }
+    int err = grow((void **)&cm->function_files, &b->function_files_cap, cm->num_function_files + num_files, sizeof(__u32));
+    if (err)
+    {
+        return err;
+    }
+    fn->first_file = cm->num_function_files;
+    fn->num_files = num_files;
+    for (__u64 f = 0; f < num_files; f++)
+    {
+        __u64 index;
+        if (!read_uleb128(&p, end, &index) || index >= unit->num_files)
+        {
+            return -EINVAL;
+        }
+        cm->function_files[cm->num_function_files++] = b->unit_files[unit->first_file + index];
+    }
+
+    // Counter expressions
+    __u64 num_expressions;
+    if (!read_uleb128(&p, end, &num_expressions) || num_expressions > (__u64)(end - p))
+    {
+        return -EINVAL;
+    }
+    err = grow((void **)&cm->expressions, &b->expressions_cap, cm->num_expressions + num_expressions, sizeof(struct covmap_expression));
+    if (!err)
+    {
+        err = grow((void **)&b->expression_kinds, &b->expression_kinds_cap, num_expressions, 1);
+    }
+    if (err)
+    {
+        return err;
+    }
+    if (num_expressions)
+    {
+        memset(b->expression_kinds, COVMAP_COUNTER_SUB, num_expressions);
+    }
+    fn->first_expression = cm->num_expressions;
+    fn->num_expressions = num_expressions;
+    for (__u64 e = 0; e < num_expressions; e++)
+    {
+        struct covmap_expression *expr = &cm->expressions[cm->num_expressions++];
+        if (!read_counter(b, &p, end, num_expressions, &expr->lhs) || !read_counter(b, &p, end, num_expressions, &expr->rhs))
+        {
+            return -EINVAL;
+        }
+    }
+
+    // Regions, for each virtual file
+    fn->first_region = cm->num_regions;
+    for (__u32 f = 0; f < num_files; f++)
+    {
+        err = read_regions(b, &p, end, f, num_files, num_expressions);
+        if (err)
+        {
+            return err;
+        }
+    }
+    fn->num_regions = cm->num_regions - fn->first_region;
+    struct covmap_region *regions = &cm->regions[fn->first_region];
+    struct covmap_expression *expressions = &cm->expressions[fn->first_expression];
+    for (__u32 e = 0; e < fn->num_expressions; e++)
+    {
+        expressions[e].lhs = with_kind(b, expressions[e].lhs);
+        expressions[e].rhs = with_kind(b, expressions[e].rhs);
+    }
+    for (__u32 r = 0; r < fn->num_regions; r++)
+    {
+        regions[r].counter = with_kind(b, regions[r].counter);
+        regions[r].false_counter = with_kind(b, regions[r].false_counter);
+    }
+
+    // Expansion regions take the counter of the first region of the file they expand (nested ones included):
+    // like llvm-cov, when a file is expanded many times only its last expansion gets it
+    err = grow((void **)&b->expanders, &b->expanders_cap, num_files, sizeof(__u32));
+    if (err)
+    {
+        return err;
+    }
+    for (__u32 pass = 1; pass < num_files; pass++)
+    {
+        memset(b->expanders, 0, num_files * sizeof(__u32));
+        for (__u32 r = 0; r < fn->num_regions; r++)
+        {
+            if (regions[r].kind == COVMAP_REGION_EXPANSION)
+            {
+                b->expanders[regions[r].expanded_file] = r + 1;
+            }
+        }
+        for (__u32 r = 0; r < fn->num_regions; r++)
+        {
+            if (b->expanders[regions[r].file])
+            {
+                regions[b->expanders[regions[r].file] - 1].counter = regions[r].counter;
+                b->expanders[regions[r].file] = 0;
+            }
+        }
+    }
+
+    return 0;
+}
+
+// A record without hash, a single file, no expressions, and a single region with a zero counter
+static bool is_dummy(const struct covmap *cm, const struct covmap_function *fn)
+{
+    return fn->hash == 0 && fn->num_files == 1 && fn->num_expressions == 0 && fn->num_regions == 1 &&
+           cm->regions[fn->first_region].counter == 0;
+}
+
+static int read_functions(struct covmap_builder *b, const unsigned char *covfun, size_t covfun_size)
+{
+    struct covmap *cm = b->cm;
+    size_t off = 0;
+    while (off + COVFUN_HEADER_SIZE <= covfun_size)
+    {
+        const unsigned char *record = covfun + off;
+        __u64 name_ref = read_u64(record);
+        __u32 data_size = read_u32(record + 8);
+        __u64 hash = read_u64(record + 12);
+        __u64 filenames_ref = read_u64(record + 20);
+        if (data_size > covfun_size - off - COVFUN_HEADER_SIZE)
+        {
+            return -EINVAL;
+        }
+        off += COVFUN_HEADER_SIZE + data_size;
+        off = (off + 7) & ~(size_t)7;
+
+        const struct covmap_unit *unit = NULL;
+        for (__u32 u = 0; u < b->num_units && !unit; u++)
+        {
+            if (b->units[u].filenames_ref == filenames_ref)
+            {
+                unit = &b->units[u];
+            }
+        }
+        struct covmap_name key = {.name_ref = name_ref};
+        const struct covmap_name *name = bsearch(&key, b->names, b->num_names, sizeof(struct covmap_name), cmp_name);
+        if (!unit || !name)
+        {
+            return -EINVAL;
+        }
+
+        int err = grow((void **)&cm->functions, &b->functions_cap, cm->num_functions + 1, sizeof(struct covmap_function));
+        if (err)
+        {
+            return err;
+        }
+        struct covmap_function *fn = &cm->functions[cm->num_functions];
+        memset(fn, 0, sizeof(*fn));
+        fn->name_ref = name_ref;
+        fn->hash = hash;
+        __u32 num_regions = cm->num_regions, num_expressions = cm->num_expressions, num_function_files = cm->num_function_files;
+        err = read_mapping(b, unit, record + COVFUN_HEADER_SIZE, record + COVFUN_HEADER_SIZE + data_size, fn);
+        if (err)
+        {
+            return err;
+        }
+
+        // Records of the same function: the first one wins, unless it is a dummy one (eg. of an unused inline function)
+        __u32 same;
+        for (same = 0; same < cm->num_functions && cm->functions[same].name_ref != name_ref; same++)
+            ;
+        if (same < cm->num_functions && (!is_dummy(cm, &cm->functions[same]) || is_dummy(cm, fn)))
+        {
+            cm->num_regions = num_regions;
+            cm->num_expressions = num_expressions;
+            cm->num_function_files = num_function_files;
+            continue;
+        }
+
+        // The names of local functions start with their file name (see getPGOFuncName), that reports leave out
+        const char *file = fn->num_files ? covmap_file(cm, fn, 0) : "";
+        size_t file_len = strlen(file);
+        const char *str = name->name;
+        size_t len = name->len;
+        if (file_len && len > file_len && strncmp(str, file, file_len) == 0 && str[file_len] == ':')
+        {
+            str += file_len + 1;
+            len -= file_len + 1;
+        }
+        err = add_string(b, str, len, &fn->name);
+        if (err)
+        {
+            return err;
+        }
+        if (same < cm->num_functions)
+        {
+            cm->functions[same] = *fn;
+            continue;
+        }
+        cm->num_functions++;
+    }
+    return 0;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// API
+// --------------------------------------------------------------------------------------------------------------------
+
+int covmap_load(const void *buf, size_t size, struct covmap **out)
+{
+    struct covmap_sections sections;
+    int err = find_sections(buf, size, &sections);
+    if (err)
+    {
+        return err;
+    }
+
+    struct covmap_builder b = {.cm = calloc(1, sizeof(struct covmap))};
+    if (!b.cm)
+    {
+        return -ENOMEM;
+    }
+    err = read_names(&b, sections.names, sections.names + sections.names_size);
+    if (!err)
+    {
+        err = read_units(&b, sections.covmap, sections.covmap_size);
+    }
+    // Function records can be spread across many sections (one for each function, in COMDAT groups)
+    for (int i = 0; !err && i < sections.num_sections; i++)
+    {
+        const Elf64_Shdr *shdr = &sections.shdrs[i];
+        if (shdr->sh_type == SHT_NOBITS || shdr->sh_offset > size || shdr->sh_size > size - shdr->sh_offset ||
+            shdr->sh_name >= sections.shstrtab_size)
+        {
+            continue;
+        }
+        if (strncmp(sections.shstrtab + shdr->sh_name, "__llvm_covfun", sections.shstrtab_size - shdr->sh_name) == 0)
+        {
+            err = read_functions(&b, (const unsigned char *)buf + shdr->sh_offset, shdr->sh_size);
+        }
+    }
+
+    for (size_t c = 0; c < b.num_chunks; c++)
+    {
+        free(b.chunks[c]);
+    }
+    free(b.chunks);
+    free(b.names);
+    free(b.units);
+    free(b.unit_files);
+    free(b.expression_kinds);
+    free(b.expanders);
+    if (err)
+    {
+        covmap_free(b.cm);
+        return err;
+    }
+    *out = b.cm;
+
+    return 0;
+}
+
+void covmap_free(struct covmap *cm)
+{
+    if (!cm)
+    {
+        return;
+    }
+    if (cm->index)
+    {
+        munmap(cm->index, cm->index_size);
+        free(cm);
+        return;
+    }
+    free(cm->strings);
+    free(cm->files);
+    free(cm->function_files);
+    free(cm->functions);
+    free(cm->regions);
+    free(cm->expressions);
+    free(cm);
+}
+
+static __s64 evaluate(const struct covmap *cm, const struct covmap_function *fn, __u64 counter, const __u64 *counters,
+                      __u64 num_counters, int depth)
+{
+    __u64 id = counter >> COVMAP_COUNTER_TAG_BITS;
+    switch (counter & ((1 << COVMAP_COUNTER_TAG_BITS) - 1))
+    {
+    case COVMAP_COUNTER_REF:
+        return id < num_counters ? (__s64)counters[id] : 0;
+    case COVMAP_COUNTER_SUB:
+    case COVMAP_COUNTER_ADD:
+    {
+        // Expressions only refer to the ones before them, yet a corrupted mapping could loop
+        if (id >= fn->num_expressions || depth > 4096)
+        {
+            return 0;
+        }
+        const struct covmap_expression *expr = &cm->expressions[fn->first_expression + id];
+        __s64 lhs = evaluate(cm, fn, expr->lhs, counters, num_counters, depth + 1);
+        __s64 rhs = evaluate(cm, fn, expr->rhs, counters, num_counters, depth + 1);
+        return (counter & 1) ? lhs + rhs : lhs - rhs;
+    }
+    default:
+        return 0;
+    }
+}
+
+__u64 covmap_evaluate(const struct covmap *cm, const struct covmap_function *fn, __u64 counter,
+                      const __u64 *counters, __u64 num_counters)
+{
+    __s64 value = evaluate(cm, fn, counter, counters, num_counters, 0);
+    return value > 0 ? value : 0;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Index
+//
+// The flat tables of a decoded coverage mapping, as they are in memory (host byte order), so that mapping the index
+// is all it takes to use them again:
+// - header: magic, version, the build hash of the BPF coverage object, and the size of each table
+// - functions, regions, expressions, files, virtual files of the functions, strings: each one aligned to 8 bytes
+// --------------------------------------------------------------------------------------------------------------------
+
+#define COVMAP_INDEX_MAGIC 0x5844494f43465042ULL // "BPFCOIDX" (read in the wrong byte order, it does not match)
+#define COVMAP_INDEX_VERSION 1
+
+struct covmap_index_header
+{
+    __u64 magic;
+    __u32 version;
+    __u32 strings_size;
+    __u64 build_hash;
+    __u32 num_files;
+    __u32 num_function_files;
+    __u32 num_functions;
+    __u32 num_regions;
+    __u32 num_expressions;
+    __u32 pad;
+};
+
+static size_t align8(size_t size)
+{
+    return (size + 7) & ~(size_t)7;
+}
+
+int covmap_build_hash(const void *buf, size_t size, __u64 *hash)
+{
+    struct covmap_sections sections;
+    int err = find_sections(buf, size, &sections);
+    if (err)
+    {
+        return err;
+    }
+    // Chaining the MD5 of every coverage section (in the order they are in the object)
+    __u64 chain[2] = {COVMAP_INDEX_VERSION, 0};
+    for (int i = 0; i < sections.num_sections; i++)
+    {
+        const Elf64_Shdr *shdr = &sections.shdrs[i];
+        if (shdr->sh_type == SHT_NOBITS || shdr->sh_offset > size || shdr->sh_size > size - shdr->sh_offset ||
+            shdr->sh_name >= sections.shstrtab_size)
+        {
+            continue;
+        }
+        const char *name = sections.shstrtab + shdr->sh_name;
+        size_t max_len = sections.shstrtab_size - shdr->sh_name;
+        if (strncmp(name, "__llvm_covmap", max_len) == 0 || strncmp(name, "__llvm_covfun", max_len) == 0 ||
+            strncmp(name, "__llvm_prf_names", max_len) == 0)
+        {
+            chain[1] = profdata_md5((const char *)buf + shdr->sh_offset, shdr->sh_size);
+            chain[0] = profdata_md5(chain, sizeof(chain));
+        }
+    }
+    *hash = chain[0];
+
+    return 0;
+}
+
+static int write_table(const void *table, size_t size, FILE *outfp)
+{
+    static const char padding[8];
+    if ((size && fwrite(table, size, 1, outfp) != 1) ||
+        (align8(size) != size && fwrite(padding, align8(size) - size, 1, outfp) != 1))
+    {
+        return -EIO;
+    }
+    return 0;
+}
+
+int covmap_write_index(const struct covmap *cm, __u64 build_hash, FILE *outfp)
+{
+    struct covmap_index_header header = {
+        .magic = COVMAP_INDEX_MAGIC,
+        .version = COVMAP_INDEX_VERSION,
+        .strings_size = cm->strings_size,
+        .build_hash = build_hash,
+        .num_files = cm->num_files,
+        .num_function_files = cm->num_function_files,
+        .num_functions = cm->num_functions,
+        .num_regions = cm->num_regions,
+        .num_expressions = cm->num_expressions,
+    };
+    int err = write_table(&header, sizeof(header), outfp);
+    if (!err)
+    {
+        err = write_table(cm->functions, (size_t)cm->num_functions * sizeof(struct covmap_function), outfp);
+    }
+    if (!err)
+    {
+        err = write_table(cm->regions, (size_t)cm->num_regions * sizeof(struct covmap_region), outfp);
+    }
+    if (!err)
+    {
+        err = write_table(cm->expressions, (size_t)cm->num_expressions * sizeof(struct covmap_expression), outfp);
+    }
+    if (!err)
+    {
+        err = write_table(cm->files, (size_t)cm->num_files * sizeof(__u32), outfp);
+    }
+    if (!err)
+    {
+        err = write_table(cm->function_files, (size_t)cm->num_function_files * sizeof(__u32), outfp);
+    }
+    if (!err)
+    {
+        err = write_table(cm->strings, cm->strings_size, outfp);
+    }
+    return err;
+}
+
+// The reports trust the tables: everything they refer to must be in them
+static bool valid_index(const struct covmap *cm)
+{
+    if (cm->strings_size && cm->strings[cm->strings_size - 1] != '\0')
+    {
+        return false;
+    }
+    for (__u32 f = 0; f < cm->num_files; f++)
+    {
+        if (cm->files[f] >= cm->strings_size)
+        {
+            return false;
+        }
+    }
+    for (__u32 f = 0; f < cm->num_function_files; f++)
+    {
+        if (cm->function_files[f] >= cm->num_files)
+        {
+            return false;
+        }
+    }
+    for (__u32 i = 0; i < cm->num_functions; i++)
+    {
+        const struct covmap_function *fn = &cm->functions[i];
+        if (fn->name >= cm->strings_size || (__u64)fn->first_file + fn->num_files > cm->num_function_files ||
+            (__u64)fn->first_region + fn->num_regions > cm->num_regions ||
+            (__u64)fn->first_expression + fn->num_expressions > cm->num_expressions)
+        {
+            return false;
+        }
+        for (__u32 r = fn->first_region; r < fn->first_region + fn->num_regions; r++)
+        {
+            const struct covmap_region *region = &cm->regions[r];
+            if (region->file >= fn->num_files || region->kind > COVMAP_REGION_BRANCH ||
+                (region->kind == COVMAP_REGION_EXPANSION && region->expanded_file >= fn->num_files) ||
+                region->line_start > region->line_end ||
+                (region->line_start == region->line_end && region->col_start > region->col_end))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int covmap_open_index(void *buf, size_t size, __u64 build_hash, struct covmap **out)
+{
+    struct covmap_index_header header;
+    if (size < sizeof(header))
+    {
+        return -EINVAL;
+    }
+    memcpy(&header, buf, sizeof(header));
+    if (header.magic != COVMAP_INDEX_MAGIC || header.version != COVMAP_INDEX_VERSION)
+    {
+        return -EINVAL;
+    }
+    if (header.build_hash != build_hash)
+    {
+        return -ESTALE;
+    }
+
+    struct covmap *cm = calloc(1, sizeof(struct covmap));
+    if (!cm)
+    {
+        return -ENOMEM;
+    }
+    size_t offset = sizeof(header);
+    size_t sizes[] = {
+        (size_t)header.num_functions * sizeof(struct covmap_function),
+        (size_t)header.num_regions * sizeof(struct covmap_region),
+        (size_t)header.num_expressions * sizeof(struct covmap_expression),
+        (size_t)header.num_files * sizeof(__u32),
+        (size_t)header.num_function_files * sizeof(__u32),
+        header.strings_size,
+    };
+    void **tables[] = {
+        (void **)&cm->functions, (void **)&cm->regions, (void **)&cm->expressions,
+        (void **)&cm->files,     (void **)&cm->function_files, (void **)&cm->strings,
+    };
+    for (size_t t = 0; t < sizeof(sizes) / sizeof(sizes[0]); t++)
+    {
+        if (align8(sizes[t]) > size - offset)
+        {
+            free(cm);
+            return -EINVAL;
+        }
+        *tables[t] = (char *)buf + offset;
+        offset += align8(sizes[t]);
+    }
+    cm->strings_size = header.strings_size;
+    cm->num_files = header.num_files;
+    cm->num_function_files = header.num_function_files;
+    cm->num_functions = header.num_functions;
+    cm->num_regions = header.num_regions;
+    cm->num_expressions = header.num_expressions;
+    if (!valid_index(cm))
+    {
+        free(cm);
+        return -EINVAL;
+    }
+    cm->index = buf;
+    cm->index_size = size;
+    *out = cm;
+
+    return 0;
+}
@@ -0,0 +1,140 @@
+#ifndef BPFCOV_COVMAP_H
+#define BPFCOV_COVMAP_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <linux/types.h>
+
+// Coverage mapping versions (0 indexed, like in the __llvm_covmap header) that keep the function records apart
+#define COVMAP_VERSION_MIN 3 // LLVM 11
+#define COVMAP_VERSION_MAX 5 // LLVM 14
+
+// Counters are encoded with a tag in their lowest 2 bits
+#define COVMAP_COUNTER_TAG_BITS 2
+#define COVMAP_COUNTER_ZERO 0
+#define COVMAP_COUNTER_REF 1
+#define COVMAP_COUNTER_SUB 2
+#define COVMAP_COUNTER_ADD 3
+
+enum covmap_region_kind
+{
+    COVMAP_REGION_CODE = 0,
+    COVMAP_REGION_EXPANSION = 1,
+    COVMAP_REGION_SKIPPED = 2,
+    COVMAP_REGION_GAP = 3,
+    COVMAP_REGION_BRANCH = 4,
+};
+
+struct covmap_region
+{
+    __u32 counter;       // Encoded counter (or the counter of the true branch)
+    __u32 false_counter; // Encoded counter of the false branch (only for branch regions)
+    __u32 file;          // Virtual file of the function the region is in
+    __u32 expanded_file; // Virtual file the region expands (only for expansion regions)
+    __u32 kind;
+    __u32 line_start;
+    __u32 col_start;
+    __u32 line_end;
+    __u32 col_end;
+};
+
+struct covmap_expression
+{
+    __u32 lhs; // Encoded counters
+    __u32 rhs;
+};
+
+struct covmap_function
+{
+    __u64 name_ref; // MD5 of the PGO name
+    __u64 hash;     // Structural hash, as in the profiles
+    __u32 name;     // Offset of the name in the strings
+    __u32 first_file; // First virtual file in the files of the functions
+    __u32 num_files;
+    __u32 first_region;
+    __u32 num_regions;
+    __u32 first_expression;
+    __u32 num_expressions;
+    __u32 pad;
+};
+
+/**
+ * The coverage mapping of a BPF coverage object (*.bpf.obj), decoded into flat tables.
+ *
+ * Strings (file names, function names) are offsets in a single pool, and the virtual files of the functions
+ * are indexes in the file table.
+ */
+struct covmap
+{
+    char *strings;
+    __u32 strings_size;
+    __u32 *files; // Offsets of the file names in the strings
+    __u32 num_files;
+    __u32 *function_files; // Virtual files of every function (indexes in the file table)
+    __u32 num_function_files;
+    struct covmap_function *functions;
+    __u32 num_functions;
+    struct covmap_region *regions;
+    __u32 num_regions;
+    struct covmap_expression *expressions;
+    __u32 num_expressions;
+    void *index; // Mapping of the index the tables point into (NULL when they got decoded)
+    size_t index_size;
+};
+
+/**
+ * Decode the coverage mapping (__llvm_covmap, __llvm_covfun) and the function names (__llvm_prf_names)
+ * of an ELF object.
+ *
+ * Returns 0 on success, a negative errno otherwise (-ENOTSUP for coverage mapping versions before LLVM 11).
+ */
+int covmap_load(const void *buf, size_t size, struct covmap **cm);
+
+void covmap_free(struct covmap *cm);
+
+/**
+ * Hash of the coverage sections (__llvm_covmap, __llvm_covfun, __llvm_prf_names) of an ELF object:
+ * what keys its index, since its coverage mapping only changes when it gets built again.
+ *
+ * Returns 0 on success, a negative errno otherwise.
+ */
+int covmap_build_hash(const void *buf, size_t size, __u64 *hash);
+
+/**
+ * Write the index of a coverage mapping: its tables, ready to be mapped by covmap_open_index().
+ *
+ * Returns 0 on success, a negative errno otherwise.
+ */
+int covmap_write_index(const struct covmap *cm, __u64 build_hash, FILE *outfp);
+
+/**
+ * Use the index of a coverage mapping in place: its tables point into buf (a read-only mapping of the whole index),
+ * that covmap_free() unmaps.
+ *
+ * Returns 0 on success (buf is then taken over), a negative errno otherwise (-ESTALE when the index is for another
+ * build of the object).
+ */
+int covmap_open_index(void *buf, size_t size, __u64 build_hash, struct covmap **cm);
+
+static inline const char *covmap_string(const struct covmap *cm, __u32 offset)
+{
+    return cm->strings + offset;
+}
+
+/**
+ * Name of the file of a virtual file of a function.
+ */
+static inline const char *covmap_file(const struct covmap *cm, const struct covmap_function *fn, __u32 file)
+{
+    return covmap_string(cm, cm->files[cm->function_files[fn->first_file + file]]);
+}
+
+/**
+ * Evaluate an encoded counter of a function, given the values of its counters (none when it never ran).
+ *
+ * Negative results (inconsistent counters) are clamped to zero.
+ */
+__u64 covmap_evaluate(const struct covmap *cm, const struct covmap_function *fn, __u64 counter,
+                      const __u64 *counters, __u64 num_counters);
+
+#endif // BPFCOV_COVMAP_H
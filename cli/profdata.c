@@ -0,0 +1,885 @@
+#define _GNU_SOURCE
+
+/* C standard library */
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* POSIX */
+#include <endian.h>
+
+#include <zlib.h>
+
+#include "profdata.h"
+
+// --------------------------------------------------------------------------------------------------------------------
+// Indexed profile writer
+//
+// It produces the same file `llvm-profdata merge -sparse` does out of the raw profiles bpfcov generates:
+// - header: magic, version, unused, hash type (MD5), offset of the hash table
+// - profile summary: the summary fields, then the detailed summary for every default cutoff
+// - payload of the on-disk chained hash table: for each bucket, its number of keys, then for each key
+//   its hash, its length, the length of its data, the function name, and its data (hash, number of counters,
+//   counters, and an empty value profile for every function with such name)
+// - buckets of the on-disk chained hash table (8 bytes aligned): number of buckets, number of keys,
+//   and the offset of each bucket
+// --------------------------------------------------------------------------------------------------------------------
+
+#define PROFDATA_HASH_MD5 0
+#define PROFDATA_NUM_SUMMARY_FIELDS 6
+#define PROFDATA_SUMMARY_SCALE 1000000
+#define PROFDATA_NAME_SEP '\01'
+#define ZLIB_MAX_RATIO 1032 // How many times bigger than compressed the data of zlib can get
+
+static const __u32 cutoffs[] = {10000, 100000, 200000, 300000, 400000, 500000, 600000, 700000,
+                                800000, 900000, 950000, 990000, 999000, 999900, 999990, 999999};
+
+#define NUM_CUTOFFS (sizeof(cutoffs) / sizeof(cutoffs[0]))
+
+struct profdata_record
+{
+    char *name;
+    __u64 name_ref; // Low 64 bits of the MD5 of the name
+    __u64 hash;
+    __u64 num_counters;
+    __u64 *counters;
+};
+
+struct profdata
+{
+    struct profdata_record *records;
+    size_t num_records;
+    size_t capacity;
+    size_t *slots; // Open addressing on (name, hash), holding the record index plus one
+    size_t num_slots;
+    unsigned int mismatched;
+};
+
+// --------------------------------------------------------------------------------------------------------------------
+// MD5 (the names of the functions are keyed by the low 64 bits of their digest)
+// --------------------------------------------------------------------------------------------------------------------
+
+static const __u32 md5_k[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
+
+static const unsigned char md5_r[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21};
+
+static void md5_block(__u32 h[4], const unsigned char *block)
+{
+    __u32 w[16];
+    for (int i = 0; i < 16; i++)
+    {
+        w[i] = block[i * 4] | block[i * 4 + 1] << 8 | block[i * 4 + 2] << 16 | (__u32)block[i * 4 + 3] << 24;
+    }
+
+    __u32 a = h[0], b = h[1], c = h[2], d = h[3];
+    for (int i = 0; i < 64; i++)
+    {
+        __u32 f;
+        int g;
+        if (i < 16)
+        {
+            f = (b & c) | (~b & d);
+            g = i;
+        }
+        else if (i < 32)
+        {
+            f = (d & b) | (~d & c);
+            g = (5 * i + 1) % 16;
+        }
+        else if (i < 48)
+        {
+            f = b ^ c ^ d;
+            g = (3 * i + 5) % 16;
+        }
+        else
+        {
+            f = c ^ (b | ~d);
+            g = (7 * i) % 16;
+        }
+        __u32 rotated = a + f + md5_k[i] + w[g];
+        a = d;
+        d = c;
+        c = b;
+        b += (rotated << md5_r[i]) | (rotated >> (32 - md5_r[i]));
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+}
+
+static __u64 md5_low(const char *str, size_t len)
+{
+    __u32 h[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+    const unsigned char *p = (const unsigned char *)str;
+    size_t left = len;
+    for (; left >= 64; left -= 64, p += 64)
+    {
+        md5_block(h, p);
+    }
+
+    // Padding: a single 1 bit, zeros, then the length in bits
+    unsigned char tail[128] = {0};
+    memcpy(tail, p, left);
+    tail[left] = 0x80;
+    size_t tail_len = left < 56 ? 64 : 128;
+    __u64 bits = (__u64)len * 8;
+    for (int i = 0; i < 8; i++)
+    {
+        tail[tail_len - 8 + i] = bits >> (i * 8);
+    }
+    for (size_t off = 0; off < tail_len; off += 64)
+    {
+        md5_block(h, tail + off);
+    }
+
+    // The first 8 bytes of the digest, little endian
+    return (__u64)h[1] << 32 | h[0];
+}
+
+__u64 profdata_md5(const void *data, size_t len)
+{
+    return md5_low(data, len);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Records
+// --------------------------------------------------------------------------------------------------------------------
+
+struct profdata *profdata_new(void)
+{
+    return calloc(1, sizeof(struct profdata));
+}
+
+void profdata_free(struct profdata *pd)
+{
+    if (!pd)
+    {
+        return;
+    }
+    for (size_t r = 0; r < pd->num_records; r++)
+    {
+        free(pd->records[r].name);
+        free(pd->records[r].counters);
+    }
+    free(pd->records);
+    free(pd->slots);
+    free(pd);
+}
+
+unsigned int profdata_mismatched(const struct profdata *pd)
+{
+    return pd->mismatched;
+}
+
+static size_t slot_of(const struct profdata *pd, __u64 name_ref, __u64 hash)
+{
+    __u64 mixed = (name_ref ^ (hash * 0x9e3779b97f4a7c15ULL)) * 0xff51afd7ed558ccdULL;
+    return (mixed ^ (mixed >> 32)) & (pd->num_slots - 1);
+}
+
+// Find the slot of the record with the given name and hash (an empty slot when it is not there yet)
+static size_t *find_slot(struct profdata *pd, __u64 name_ref, __u64 hash)
+{
+    size_t s = slot_of(pd, name_ref, hash);
+    while (pd->slots[s])
+    {
+        struct profdata_record *rec = &pd->records[pd->slots[s] - 1];
+        if (rec->name_ref == name_ref && rec->hash == hash)
+        {
+            break;
+        }
+        s = (s + 1) & (pd->num_slots - 1);
+    }
+    return &pd->slots[s];
+}
+
+const __u64 *profdata_counters(const struct profdata *pd, __u64 name_ref, __u64 hash, __u64 *num_counters)
+{
+    if (!pd->num_slots)
+    {
+        return NULL;
+    }
+    for (size_t s = slot_of(pd, name_ref, hash); pd->slots[s]; s = (s + 1) & (pd->num_slots - 1))
+    {
+        const struct profdata_record *rec = &pd->records[pd->slots[s] - 1];
+        if (rec->name_ref == name_ref && rec->hash == hash)
+        {
+            *num_counters = rec->num_counters;
+            return rec->counters;
+        }
+    }
+    return NULL;
+}
+
+// Keep the slots at most half full
+static int grow_slots(struct profdata *pd)
+{
+    if ((pd->num_records + 1) * 2 <= pd->num_slots)
+    {
+        return 0;
+    }
+    size_t num_slots = pd->num_slots ? pd->num_slots * 2 : 1024;
+    size_t *slots = calloc(num_slots, sizeof(size_t));
+    if (!slots)
+    {
+        return -ENOMEM;
+    }
+    free(pd->slots);
+    pd->slots = slots;
+    pd->num_slots = num_slots;
+    for (size_t r = 0; r < pd->num_records; r++)
+    {
+        *find_slot(pd, pd->records[r].name_ref, pd->records[r].hash) = r + 1;
+    }
+    return 0;
+}
+
+static int add_record(struct profdata *pd, const char *name, size_t name_len, __u64 name_ref, __u64 hash,
+                      const long long int *counters, __u64 num_counters)
+{
+    int err = grow_slots(pd);
+    if (err)
+    {
+        return err;
+    }
+
+    size_t *slot = find_slot(pd, name_ref, hash);
+    if (*slot)
+    {
+        struct profdata_record *rec = &pd->records[*slot - 1];
+        if (rec->num_counters != num_counters)
+        {
+            pd->mismatched++;
+            return 0;
+        }
+        for (__u64 c = 0; c < num_counters; c++)
+        {
+            rec->counters[c] += counters[c];
+        }
+        return 0;
+    }
+
+    if (pd->num_records == pd->capacity)
+    {
+        size_t capacity = pd->capacity ? pd->capacity * 2 : 256;
+        struct profdata_record *records = realloc(pd->records, capacity * sizeof(struct profdata_record));
+        if (!records)
+        {
+            return -ENOMEM;
+        }
+        pd->records = records;
+        pd->capacity = capacity;
+    }
+    struct profdata_record *rec = &pd->records[pd->num_records];
+    rec->name = strndup(name, name_len);
+    rec->counters = malloc((num_counters ? num_counters : 1) * sizeof(__u64));
+    if (!rec->name || !rec->counters)
+    {
+        free(rec->name);
+        free(rec->counters);
+        return -ENOMEM;
+    }
+    rec->name_ref = name_ref;
+    rec->hash = hash;
+    rec->num_counters = num_counters;
+    memcpy(rec->counters, counters, num_counters * sizeof(__u64));
+    *slot = ++pd->num_records;
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Raw profiles
+// --------------------------------------------------------------------------------------------------------------------
+
+struct name_entry
+{
+    __u64 name_ref;
+    const char *name;
+    size_t len;
+};
+
+static int cmp_name_entry(const void *a, const void *b)
+{
+    __u64 x = ((const struct name_entry *)a)->name_ref;
+    __u64 y = ((const struct name_entry *)b)->name_ref;
+    return (x > y) - (x < y);
+}
+
+static __u64 read_uleb128(const unsigned char **p, const unsigned char *end)
+{
+    __u64 value = 0;
+    for (unsigned int shift = 0; *p < end && shift < 64; shift += 7)
+    {
+        unsigned char byte = *(*p)++;
+        value |= (__u64)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            break;
+        }
+    }
+    return value;
+}
+
+// Split the names (chunks of names, zlib compressed or not, separated by \01) and key them by their MD5
+static int parse_names(const char *names, __u64 names_size, struct name_entry **entries, size_t *num_entries,
+                       char ***chunks, size_t *num_chunks)
+{
+    const unsigned char *p = (const unsigned char *)names;
+    const unsigned char *end = p + names_size;
+    size_t capacity = 0;
+    *entries = NULL;
+    *num_entries = 0;
+    *chunks = NULL;
+    *num_chunks = 0;
+
+    while (p < end)
+    {
+        __u64 uncompressed_size = read_uleb128(&p, end);
+        __u64 compressed_size = read_uleb128(&p, end);
+        __u64 size = compressed_size ? compressed_size : uncompressed_size;
+        if (size > (__u64)(end - p))
+        {
+            return -EINVAL;
+        }
+        // Nor more than zlib can inflate them to (which the allocation can hold)
+        if (compressed_size && (uncompressed_size / ZLIB_MAX_RATIO > compressed_size || uncompressed_size >= SIZE_MAX))
+        {
+            return -EINVAL;
+        }
+
+        char *chunk = malloc(uncompressed_size + 1);
+        char **grown = realloc(*chunks, (*num_chunks + 1) * sizeof(char *));
+        if (!chunk || !grown)
+        {
+            free(chunk);
+            return -ENOMEM;
+        }
+        *chunks = grown;
+        (*chunks)[(*num_chunks)++] = chunk;
+        if (compressed_size)
+        {
+            uLongf len = uncompressed_size;
+            if (uncompress((Bytef *)chunk, &len, p, compressed_size) != Z_OK || len != uncompressed_size)
+            {
+                return -EINVAL;
+            }
+        }
+        else
+        {
+            memcpy(chunk, p, uncompressed_size);
+        }
+        chunk[uncompressed_size] = PROFDATA_NAME_SEP;
+        p += size;
+
+        for (char *name = chunk; name < chunk + uncompressed_size;)
+        {
+            char *sep = memchr(name, PROFDATA_NAME_SEP, chunk + uncompressed_size + 1 - name);
+            if (*num_entries == capacity)
+            {
+                capacity = capacity ? capacity * 2 : 64;
+                struct name_entry *more = realloc(*entries, capacity * sizeof(struct name_entry));
+                if (!more)
+                {
+                    return -ENOMEM;
+                }
+                *entries = more;
+            }
+            struct name_entry *entry = &(*entries)[(*num_entries)++];
+            entry->name = name;
+            entry->len = sep - name;
+            entry->name_ref = md5_low(name, entry->len);
+            name = sep + 1;
+        }
+
+        // Names chunks are padded with zeros
+        while (p < end && *p == 0)
+        {
+            p++;
+        }
+    }
+
+    qsort(*entries, *num_entries, sizeof(struct name_entry), cmp_name_entry);
+
+    return 0;
+}
+
+static int add_sections(struct profdata *pd, const void *data, __u64 data_size, const long long int *counters,
+                        __u64 num_counters, __u64 counters_delta, const char *names, __u64 names_size)
+{
+    struct name_entry *entries;
+    size_t num_entries;
+    char **chunks;
+    size_t num_chunks;
+    int err = parse_names(names, names_size, &entries, &num_entries, &chunks, &num_chunks);
+
+    const unsigned char *d = data;
+    for (__u64 off = 0; !err && off + PROFRAW_DATA_SIZE <= data_size; off += PROFRAW_DATA_SIZE)
+    {
+        __u64 name_ref, hash, counter_ptr;
+        __u32 num;
+        memcpy(&name_ref, d + off, 8);
+        memcpy(&hash, d + off + 8, 8);
+        memcpy(&counter_ptr, d + off + 16, 8);
+        memcpy(&num, d + off + 40, 4);
+
+        // The counters pointers are offsets in bytes from the start of the counters
+        __u64 first = (counter_ptr - counters_delta) / 8;
+        if (first > num_counters || num > num_counters - first)
+        {
+            err = -EINVAL;
+            break;
+        }
+
+        struct name_entry key = {.name_ref = name_ref};
+        struct name_entry *entry = bsearch(&key, entries, num_entries, sizeof(struct name_entry), cmp_name_entry);
+        if (!entry)
+        {
+            err = -EINVAL;
+            break;
+        }
+
+        err = add_record(pd, entry->name, entry->len, name_ref, hash, &counters[first], num);
+    }
+
+    for (size_t c = 0; c < num_chunks; c++)
+    {
+        free(chunks[c]);
+    }
+    free(chunks);
+    free(entries);
+
+    return err;
+}
+
+int profdata_add_sections(struct profdata *pd, const void *data, __u64 data_size, const long long int *counters,
+                          __u64 num_counters, const char *names, __u64 names_size)
+{
+    return add_sections(pd, data, data_size, counters, num_counters, 0, names, names_size);
+}
+
+int profdata_add_profraw(struct profdata *pd, const void *buf, size_t size)
+{
+    const char *p = buf;
+    const char *end = p + size;
+    while (p < end)
+    {
+        long long int header[PROFRAW_HEADER_LEN];
+        if ((size_t)(end - p) < sizeof(header))
+        {
+            return -EINVAL;
+        }
+        memcpy(header, p, sizeof(header));
+        if ((__u64)header[0] != PROFRAW_MAGIC)
+        {
+            return -EINVAL;
+        }
+
+        __u64 data_size = (__u64)header[2] * PROFRAW_DATA_SIZE;
+        __u64 num_counters = header[4];
+        __u64 names_size = header[6];
+        __u64 padding = 7 & (16 - names_size % 16);
+        __u64 total = sizeof(header) + header[3] + data_size + num_counters * 8 + header[5] + names_size + padding;
+        if ((__u64)header[2] > size || num_counters > size || names_size > size || total > (__u64)(end - p))
+        {
+            return -EINVAL;
+        }
+
+        const char *data = p + sizeof(header);
+        const char *counters = data + data_size + header[3];
+        const char *names = counters + num_counters * 8 + header[5];
+        // Counters are not necessarily aligned in the buffer
+        long long int *aligned = malloc((num_counters ? num_counters : 1) * 8);
+        if (!aligned)
+        {
+            return -ENOMEM;
+        }
+        memcpy(aligned, counters, num_counters * 8);
+        int err = add_sections(pd, data, data_size, aligned, num_counters, header[7], names, names_size);
+        free(aligned);
+        if (err)
+        {
+            return err;
+        }
+
+        p += total;
+    }
+
+    return 0;
+}
+
+int profdata_merge(struct profdata *pd, const struct profdata *other)
+{
+    for (size_t r = 0; r < other->num_records; r++)
+    {
+        const struct profdata_record *rec = &other->records[r];
+        int err = add_record(pd, rec->name, strlen(rec->name), rec->name_ref, rec->hash,
+                             (const long long int *)rec->counters, rec->num_counters);
+        if (err)
+        {
+            return err;
+        }
+    }
+    pd->mismatched += other->mismatched;
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Output
+// --------------------------------------------------------------------------------------------------------------------
+
+static int cmp_desc_u64(const void *a, const void *b)
+{
+    __u64 x = *(const __u64 *)a;
+    __u64 y = *(const __u64 *)b;
+    return (x < y) - (x > y);
+}
+
+static __u64 num_buckets_of(__u64 num_keys)
+{
+    if (num_keys <= 2)
+    {
+        return 1;
+    }
+    // Load factor of 3/4 (the next power of two strictly greater)
+    __u64 target = num_keys * 4 / 3;
+    __u64 buckets = 1;
+    while (buckets <= target)
+    {
+        buckets <<= 1;
+    }
+    return buckets;
+}
+
+static struct profdata *sort_pd; // qsort has no context argument
+static size_t *sort_order;
+static __u64 sort_mask;
+
+static int cmp_record_index(const void *a, const void *b)
+{
+    const struct profdata_record *x = &sort_pd->records[*(const size_t *)a];
+    const struct profdata_record *y = &sort_pd->records[*(const size_t *)b];
+    if (x->name_ref != y->name_ref)
+    {
+        return (x->name_ref > y->name_ref) - (x->name_ref < y->name_ref);
+    }
+    int cmp = strcmp(x->name, y->name);
+    if (cmp)
+    {
+        return cmp;
+    }
+    return (x->hash > y->hash) - (x->hash < y->hash);
+}
+
+// Keys (first record, number of records) by bucket
+static int cmp_key(const void *a, const void *b)
+{
+    const struct profdata_record *x = &sort_pd->records[sort_order[*(const __u64 *)a]];
+    const struct profdata_record *y = &sort_pd->records[sort_order[*(const __u64 *)b]];
+    __u64 bx = x->name_ref & sort_mask;
+    __u64 by = y->name_ref & sort_mask;
+    return (bx > by) - (bx < by);
+}
+
+static bool ran(const struct profdata_record *rec)
+{
+    for (__u64 c = 0; c < rec->num_counters; c++)
+    {
+        if (rec->counters[c])
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int write_le64(FILE *outfp, __u64 value)
+{
+    value = htole64(value);
+    return fwrite(&value, sizeof(value), 1, outfp) == 1 ? 0 : -EIO;
+}
+
+static int write_counters(FILE *outfp, const __u64 *counters, __u64 num_counters)
+{
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+    return fwrite(counters, sizeof(__u64), num_counters, outfp) == num_counters ? 0 : -EIO;
+#else
+    for (__u64 c = 0; c < num_counters; c++)
+    {
+        if (write_le64(outfp, counters[c]))
+        {
+            return -EIO;
+        }
+    }
+    return 0;
+#endif
+}
+
+// The data of a key: the hash, the number of counters, the counters, and the (empty) value profile of every function
+static __u64 data_len(const struct profdata_record *rec)
+{
+    return 8 + 8 + rec->num_counters * 8 + 8;
+}
+
+int profdata_write(struct profdata *pd, bool sparse, FILE *outfp)
+{
+    int err = -ENOMEM;
+
+    /* Pick the functions (all the functions with a name, as soon as one of them ran, when sparse) */
+    size_t *order = malloc((pd->num_records ? pd->num_records : 1) * sizeof(size_t));
+    __u64 *keys = NULL;
+    __u64 *bucket_offsets = NULL;
+    __u64 *counts = NULL;
+    if (!order)
+    {
+        goto out;
+    }
+    for (size_t r = 0; r < pd->num_records; r++)
+    {
+        order[r] = r;
+    }
+    sort_pd = pd;
+    qsort(order, pd->num_records, sizeof(size_t), cmp_record_index);
+
+    size_t num_picked = 0;
+    __u64 num_keys = 0;
+    __u64 total_counters = 0;
+    for (size_t r = 0; r < pd->num_records;)
+    {
+        size_t k = r;
+        bool any = !sparse;
+        for (; k < pd->num_records && strcmp(pd->records[order[k]].name, pd->records[order[r]].name) == 0; k++)
+        {
+            any |= ran(&pd->records[order[k]]);
+        }
+        if (any)
+        {
+            for (; r < k; r++)
+            {
+                total_counters += pd->records[order[r]].num_counters;
+                order[num_picked++] = order[r];
+            }
+            num_keys++;
+        }
+        r = k;
+    }
+
+    /* Profile summary */
+    __u64 fields[PROFDATA_NUM_SUMMARY_FIELDS] = {0};
+    counts = malloc((total_counters ? total_counters : 1) * sizeof(__u64));
+    if (!counts)
+    {
+        goto out;
+    }
+    __u64 num_counts = 0;
+    for (size_t p = 0; p < num_picked; p++)
+    {
+        struct profdata_record *rec = &pd->records[order[p]];
+        if (rec->num_counters == 0)
+        {
+            continue;
+        }
+        // The first counter counts the entries of the function
+        fields[0]++;
+        if (rec->counters[0] > fields[2])
+        {
+            fields[2] = rec->counters[0];
+        }
+        for (__u64 c = 0; c < rec->num_counters; c++)
+        {
+            __u64 count = rec->counters[c];
+            counts[num_counts++] = count;
+            fields[5] += count;
+            if (count > fields[3])
+            {
+                fields[3] = count;
+            }
+            if (c > 0 && count > fields[4])
+            {
+                fields[4] = count;
+            }
+        }
+    }
+    fields[1] = num_counts;
+    qsort(counts, num_counts, sizeof(__u64), cmp_desc_u64);
+
+    __u64 entries[NUM_CUTOFFS][3];
+    __u64 seen = 0, sum = 0, count = 0;
+    for (size_t c = 0; c < NUM_CUTOFFS; c++)
+    {
+        __u64 desired = (unsigned __int128)fields[5] * cutoffs[c] / PROFDATA_SUMMARY_SCALE;
+        while (sum < desired && seen < num_counts)
+        {
+            count = counts[seen++];
+            sum += count;
+            // Same counts count once
+            while (seen < num_counts && counts[seen] == count)
+            {
+                sum += counts[seen++];
+            }
+        }
+        entries[c][0] = cutoffs[c];
+        entries[c][1] = count;
+        entries[c][2] = seen;
+    }
+
+    /* Lay out the hash table: the keys, in bucket order, then the buckets */
+    __u64 num_buckets = num_buckets_of(num_keys);
+    keys = malloc((num_keys ? num_keys : 1) * sizeof(__u64) * 2); // First record, and number of records
+    bucket_offsets = calloc(num_buckets, sizeof(__u64));
+    if (!keys || !bucket_offsets)
+    {
+        goto out;
+    }
+    __u64 k = 0;
+    for (size_t p = 0; p < num_picked; k++)
+    {
+        keys[k * 2] = p;
+        for (; p < num_picked && strcmp(pd->records[order[p]].name, pd->records[order[keys[k * 2]]].name) == 0; p++)
+            ;
+        keys[k * 2 + 1] = p - keys[k * 2];
+    }
+    sort_order = order;
+    sort_mask = num_buckets - 1;
+    qsort(keys, num_keys, sizeof(__u64) * 2, cmp_key);
+
+    __u64 offset = 5 * 8 + (2 + PROFDATA_NUM_SUMMARY_FIELDS + NUM_CUTOFFS * 3) * 8;
+    for (__u64 b = 0, first = 0; b < num_buckets; b++)
+    {
+        __u64 last = first;
+        for (; last < num_keys && (pd->records[order[keys[last * 2]]].name_ref & (num_buckets - 1)) == b; last++)
+            ;
+        if (last == first)
+        {
+            continue;
+        }
+        bucket_offsets[b] = offset;
+        offset += 2;
+        for (__u64 j = first; j < last; j++)
+        {
+            struct profdata_record *rec = &pd->records[order[keys[j * 2]]];
+            offset += 8 + 8 + 8 + strlen(rec->name);
+            for (__u64 i = 0; i < keys[j * 2 + 1]; i++)
+            {
+                offset += data_len(&pd->records[order[keys[j * 2] + i]]);
+            }
+        }
+        first = last;
+    }
+    __u64 table_offset = (offset + 7) & ~7ULL;
+
+    /* Header, and summary */
+    err = -EIO;
+    if (write_le64(outfp, PROFDATA_MAGIC) || write_le64(outfp, PROFDATA_VERSION) || write_le64(outfp, 0) ||
+        write_le64(outfp, PROFDATA_HASH_MD5) || write_le64(outfp, table_offset))
+    {
+        goto out;
+    }
+    if (write_le64(outfp, PROFDATA_NUM_SUMMARY_FIELDS) || write_le64(outfp, NUM_CUTOFFS))
+    {
+        goto out;
+    }
+    for (int f = 0; f < PROFDATA_NUM_SUMMARY_FIELDS; f++)
+    {
+        if (write_le64(outfp, fields[f]))
+        {
+            goto out;
+        }
+    }
+    for (size_t c = 0; c < NUM_CUTOFFS; c++)
+    {
+        if (write_le64(outfp, entries[c][0]) || write_le64(outfp, entries[c][1]) || write_le64(outfp, entries[c][2]))
+        {
+            goto out;
+        }
+    }
+
+    /* Payload (the keys are sorted by bucket) */
+    for (__u64 b = 0, first = 0; b < num_buckets; b++)
+    {
+        __u64 last = first;
+        for (; last < num_keys && (pd->records[order[keys[last * 2]]].name_ref & (num_buckets - 1)) == b; last++)
+            ;
+        if (last == first)
+        {
+            continue;
+        }
+        __u16 len = htole16(last - first);
+        if (fwrite(&len, sizeof(len), 1, outfp) != 1)
+        {
+            goto out;
+        }
+        for (__u64 j = first; j < last; j++)
+        {
+            struct profdata_record *rec = &pd->records[order[keys[j * 2]]];
+            __u64 name_len = strlen(rec->name);
+            __u64 len = 0;
+            for (__u64 i = 0; i < keys[j * 2 + 1]; i++)
+            {
+                len += data_len(&pd->records[order[keys[j * 2] + i]]);
+            }
+            if (write_le64(outfp, rec->name_ref) || write_le64(outfp, name_len) || write_le64(outfp, len) ||
+                fwrite(rec->name, 1, name_len, outfp) != name_len)
+            {
+                goto out;
+            }
+            for (__u64 i = 0; i < keys[j * 2 + 1]; i++)
+            {
+                struct profdata_record *func = &pd->records[order[keys[j * 2] + i]];
+                // No value profile: its total size (8 bytes), and no value kinds
+                if (write_le64(outfp, func->hash) || write_le64(outfp, func->num_counters) ||
+                    write_counters(outfp, func->counters, func->num_counters) || write_le64(outfp, 8))
+                {
+                    goto out;
+                }
+            }
+        }
+        first = last;
+    }
+
+    /* Buckets */
+    for (; offset < table_offset; offset++)
+    {
+        if (fputc(0, outfp) == EOF)
+        {
+            goto out;
+        }
+    }
+    if (write_le64(outfp, num_buckets) || write_le64(outfp, num_keys))
+    {
+        goto out;
+    }
+    for (__u64 b = 0; b < num_buckets; b++)
+    {
+        if (write_le64(outfp, bucket_offsets[b]))
+        {
+            goto out;
+        }
+    }
+    err = fflush(outfp) ? -EIO : 0;
+
+out:
+    free(order);
+    free(keys);
+    free(bucket_offsets);
+    free(counts);
+
+    return err;
+}
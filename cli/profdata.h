@@ -0,0 +1,76 @@
+#ifndef BPFCOV_PROFDATA_H
+#define BPFCOV_PROFDATA_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <linux/types.h>
+
+// The layout of the raw profiles that bpfcov writes (LLVM raw profile version 5)
+#define PROFRAW_MAGIC 0xff6c70726f667281ULL
+#define PROFRAW_HEADER_LEN 10
+#define PROFRAW_DATA_SIZE 48 // 5 x i64 + 2 x i32 for each function
+
+// The indexed profiles that llvm-cov reads (what `llvm-profdata merge` writes)
+#define PROFDATA_MAGIC 0x8169666f72706cffULL
+#define PROFDATA_VERSION 7
+
+struct profdata;
+
+/**
+ * Create an empty indexed profile.
+ *
+ * Returns NULL when out of memory.
+ */
+struct profdata *profdata_new(void);
+
+void profdata_free(struct profdata *pd);
+
+/**
+ * Add the functions of a raw profile, given its sections: data (.profd), counters (.profc), and names (.profn).
+ *
+ * The counters of the functions already in the profile (same name and hash) get summed.
+ *
+ * Returns 0 on success, a negative errno otherwise.
+ */
+int profdata_add_sections(struct profdata *pd, const void *data, __u64 data_size, const long long int *counters,
+                          __u64 num_counters, const char *names, __u64 names_size);
+
+/**
+ * Add the functions of every raw profile in the buffer (raw profiles can be concatenated).
+ *
+ * Returns 0 on success, a negative errno otherwise.
+ */
+int profdata_add_profraw(struct profdata *pd, const void *buf, size_t size);
+
+/**
+ * Add the functions of another indexed profile (eg. one filled by another thread).
+ *
+ * Returns 0 on success, a negative errno otherwise.
+ */
+int profdata_merge(struct profdata *pd, const struct profdata *other);
+
+/**
+ * Number of functions skipped so far because their number of counters changed for the same hash.
+ */
+unsigned int profdata_mismatched(const struct profdata *pd);
+
+/**
+ * Counters of a function (NULL when it is not in the profile).
+ */
+const __u64 *profdata_counters(const struct profdata *pd, __u64 name_ref, __u64 hash, __u64 *num_counters);
+
+/**
+ * Low 64 bits of the MD5 of the data (what keys function names and file names in profiles and coverage mappings).
+ */
+__u64 profdata_md5(const void *data, size_t len);
+
+/**
+ * Write the indexed profile (on-disk hash table of the functions keyed by name, plus the profile summary).
+ *
+ * When sparse, the functions that never ran are left out (like `llvm-profdata merge -sparse`).
+ *
+ * Returns 0 on success, a negative errno otherwise.
+ */
+int profdata_write(struct profdata *pd, bool sparse, FILE *outfp);
+
+#endif // BPFCOV_PROFDATA_H
@@ -0,0 +1,2673 @@
+#define _GNU_SOURCE
+
+/* C standard library */
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "report.h"
+
+// --------------------------------------------------------------------------------------------------------------------
+// Coverage reports
+//
+// It computes what `llvm-cov export` (LLVM 14) does out of the coverage mapping and the indexed profiles:
+// - the count of every region of every function, evaluating its counter (expansion regions take the count of the
+//   first region of the file they expand)
+// - the segments of a file (or of a function, or of an expansion): the points where the count changes, after
+//   sorting the regions (nested ones after the ones containing them) and combining the ones covering the same area
+// - the execution count of every line, out of the segments starting on it, and the segment wrapping it
+// - the summaries (regions, lines, branches, functions, instantiations) of every file, and their totals
+// --------------------------------------------------------------------------------------------------------------------
+
+#define REPORT_JSON_TYPE "llvm.coverage.json.export"
+#define REPORT_JSON_VERSION "2.0.1"
+
+struct loc
+{
+    __u32 line;
+    __u32 col;
+};
+
+struct counted_region
+{
+    const struct covmap_region *region;
+    __u64 count;
+    __u64 false_count;
+};
+
+struct segment
+{
+    __u32 line;
+    __u32 col;
+    __u64 count;
+    bool has_count;
+    bool entry; // Start of a region (not a gap)
+    bool gap;
+};
+
+struct report_function;
+
+struct expansion
+{
+    const struct report_function *function;
+    const struct counted_region *region;
+};
+
+// The coverage of a file, a function, or an expansion
+struct coverage
+{
+    struct segment *segments;
+    size_t num_segments;
+    struct expansion *expansions;
+    size_t num_expansions, expansions_cap;
+    const struct counted_region **branches;
+    size_t num_branches, branches_cap;
+};
+
+struct report_function
+{
+    const struct covmap *cm;
+    const struct covmap_function *fn;
+    __u32 *files; // Report files of the virtual files
+    struct counted_region *regions; // All but the branch regions, in the order of the mapping
+    __u32 num_regions;
+    struct counted_region *branches;
+    __u32 num_branches;
+    __u64 execution_count; // Count of its first region
+    int main_file;         // Virtual file that no region expands (-1 when there is none)
+    bool summarized;
+    struct report_summary summary;
+};
+
+struct report_file
+{
+    const char *name;
+    __u32 *functions; // Functions with regions in the file
+    size_t num_functions, functions_cap;
+};
+
+struct report
+{
+    const struct covmap **cms; // The coverage mappings it got made of
+    int num_cms;
+    struct report_function *functions;
+    __u32 num_functions;
+    struct report_file *files; // Sorted by name
+    __u32 num_files;
+};
+
+// Append an (uninitialized) item to an array, growing it as needed
+static void *push(void **array, size_t *num, size_t *capacity, size_t size)
+{
+    if (*num == *capacity)
+    {
+        size_t more = *capacity ? *capacity * 2 : 16;
+        void *grown = realloc(*array, more * size);
+        if (!grown)
+        {
+            return NULL;
+        }
+        *array = grown;
+        *capacity = more;
+    }
+    return (char *)*array + (*num)++ * size;
+}
+
+static int cmp_loc(struct loc a, struct loc b)
+{
+    if (a.line != b.line)
+    {
+        return a.line < b.line ? -1 : 1;
+    }
+    return (a.col > b.col) - (a.col < b.col);
+}
+
+static struct loc start_of(const struct counted_region *cr)
+{
+    return (struct loc){cr->region->line_start, cr->region->col_start};
+}
+
+static struct loc end_of(const struct counted_region *cr)
+{
+    return (struct loc){cr->region->line_end, cr->region->col_end};
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Segments
+// --------------------------------------------------------------------------------------------------------------------
+
+struct segment_builder
+{
+    struct segment *segments;
+    size_t num_segments, segments_cap;
+    const struct counted_region **active; // Regions started, and not completed yet
+    size_t num_active, active_cap;
+    const struct counted_region **completed;
+    size_t num_completed, completed_cap;
+    int err;
+};
+
+static void start_segment(struct segment_builder *b, const struct counted_region *cr, struct loc loc, bool entry, bool skipped)
+{
+    bool has_count = !skipped && cr->region->kind != COVMAP_REGION_SKIPPED;
+
+    // Segments that would not change the rendering are left out, but never right after the start of a region
+    if (b->num_segments && !entry && !skipped)
+    {
+        const struct segment *last = &b->segments[b->num_segments - 1];
+        if (last->has_count == has_count && last->count == cr->count && !last->entry)
+        {
+            return;
+        }
+    }
+
+    struct segment *seg = push((void **)&b->segments, &b->num_segments, &b->segments_cap, sizeof(struct segment));
+    if (!seg)
+    {
+        b->err = -ENOMEM;
+        return;
+    }
+    seg->line = loc.line;
+    seg->col = loc.col;
+    seg->count = has_count ? cr->count : 0;
+    seg->has_count = has_count;
+    seg->entry = entry;
+    seg->gap = has_count && cr->region->kind == COVMAP_REGION_GAP;
+}
+
+// Emit the segments of the active regions, from the first completed one, that end before the given location
+static void complete_regions(struct segment_builder *b, const struct loc *loc, size_t first_completed)
+{
+    const struct counted_region **active = b->active;
+    size_t num_active = b->num_active;
+
+    // Completed regions, sorted by their end (insertion sort, keeping the order of the ones ending together)
+    for (size_t i = first_completed + 1; i < num_active; i++)
+    {
+        const struct counted_region *cr = active[i];
+        size_t j;
+        for (j = i; j > first_completed && cmp_loc(end_of(active[j - 1]), end_of(cr)) > 0; j--)
+        {
+            active[j] = active[j - 1];
+        }
+        active[j] = cr;
+    }
+
+    for (size_t i = first_completed + 1; i < num_active; i++)
+    {
+        const struct counted_region *completed = active[i];
+        struct loc completed_loc = end_of(active[i - 1]);
+        // No more segments where the new region starts
+        if (loc && cmp_loc(completed_loc, *loc) == 0)
+        {
+            break;
+        }
+        // Nor when the next completed region ends at the same location
+        if (cmp_loc(completed_loc, end_of(completed)) == 0)
+        {
+            continue;
+        }
+        // The last completed region ending at this location gives the count
+        for (size_t j = i + 1; j < num_active; j++)
+        {
+            if (cmp_loc(end_of(completed), end_of(active[j])) == 0)
+            {
+                completed = active[j];
+            }
+        }
+        start_segment(b, completed, completed_loc, false, false);
+    }
+
+    const struct counted_region *last = active[num_active - 1];
+    if (first_completed && cmp_loc(end_of(last), *loc) != 0)
+    {
+        // The next active region fills the gap up to the new region
+        start_segment(b, active[first_completed - 1], end_of(last), false, false);
+    }
+    else if (!first_completed && (!loc || cmp_loc(*loc, end_of(last)) != 0))
+    {
+        // Nothing is active anymore: a skipped segment marks the gap (eg. between functions)
+        start_segment(b, last, end_of(last), false, true);
+    }
+
+    b->num_active = first_completed;
+}
+
+static int cmp_counted_region(const void *a, const void *b)
+{
+    const struct counted_region *x = a;
+    const struct counted_region *y = b;
+    int cmp = cmp_loc(start_of(x), start_of(y));
+    if (cmp)
+    {
+        return cmp;
+    }
+    // Regions containing other ones come first
+    cmp = cmp_loc(end_of(y), end_of(x));
+    if (cmp)
+    {
+        return cmp;
+    }
+    // Code regions, then expansion regions, then skipped regions
+    return (x->region->kind > y->region->kind) - (x->region->kind < y->region->kind);
+}
+
+// Regions covering the same area get the sum of the counts of the ones of the same kind as the first one
+static size_t combine_regions(struct counted_region *regions, size_t num_regions)
+{
+    if (!num_regions)
+    {
+        return 0;
+    }
+    size_t active = 0;
+    for (size_t r = 1; r < num_regions; r++)
+    {
+        if (cmp_loc(start_of(&regions[active]), start_of(&regions[r])) != 0 ||
+            cmp_loc(end_of(&regions[active]), end_of(&regions[r])) != 0)
+        {
+            regions[++active] = regions[r];
+            continue;
+        }
+        if (regions[r].region->kind == regions[active].region->kind)
+        {
+            regions[active].count += regions[r].count;
+        }
+    }
+    return active + 1;
+}
+
+static int build_segments(struct counted_region *regions, size_t num_regions, struct coverage *cov)
+{
+    if (num_regions)
+    {
+        qsort(regions, num_regions, sizeof(struct counted_region), cmp_counted_region);
+    }
+    num_regions = combine_regions(regions, num_regions);
+
+    struct segment_builder b = {0};
+    for (size_t r = 0; r < num_regions && !b.err; r++)
+    {
+        const struct counted_region *cr = &regions[r];
+        struct loc start = start_of(cr);
+
+        // Active regions ending before the current one starts get completed (they keep their order)
+        size_t num_kept = 0;
+        b.num_completed = 0;
+        for (size_t a = 0; a < b.num_active; a++)
+        {
+            if (cmp_loc(end_of(b.active[a]), start) <= 0)
+            {
+                const struct counted_region **completed = push((void **)&b.completed, &b.num_completed, &b.completed_cap, sizeof(*completed));
+                if (!completed)
+                {
+                    b.err = -ENOMEM;
+                    break;
+                }
+                *completed = b.active[a];
+            }
+            else
+            {
+                b.active[num_kept++] = b.active[a];
+            }
+        }
+        if (b.err)
+        {
+            break;
+        }
+        if (b.num_completed)
+        {
+            memcpy(&b.active[num_kept], b.completed, b.num_completed * sizeof(*b.completed));
+            complete_regions(&b, &start, num_kept);
+        }
+
+        bool gap = cr->region->kind == COVMAP_REGION_GAP;
+        if (cmp_loc(start, end_of(cr)) == 0)
+        {
+            // Empty regions do not get active: the region before them gives the count, unless it is the last one
+            bool skipped = r + 1 == num_regions || cr->region->kind == COVMAP_REGION_SKIPPED;
+            start_segment(&b, b.num_active ? b.active[b.num_active - 1] : cr, start, !gap, skipped);
+            if (skipped && b.num_active)
+            {
+                start_segment(&b, b.active[b.num_active - 1], start, false, false);
+            }
+            continue;
+        }
+        if (r + 1 == num_regions || cmp_loc(start, start_of(&regions[r + 1])) != 0)
+        {
+            start_segment(&b, cr, start, !gap, false);
+        }
+
+        const struct counted_region **active = push((void **)&b.active, &b.num_active, &b.active_cap, sizeof(*active));
+        if (!active)
+        {
+            b.err = -ENOMEM;
+            break;
+        }
+        *active = cr;
+    }
+    if (!b.err && b.num_active)
+    {
+        complete_regions(&b, NULL, 0);
+    }
+
+    free(b.active);
+    free(b.completed);
+    if (b.err)
+    {
+        free(b.segments);
+        return b.err;
+    }
+    cov->segments = b.segments;
+    cov->num_segments = b.num_segments;
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Lines
+// --------------------------------------------------------------------------------------------------------------------
+
+struct line_iterator
+{
+    const struct segment *segments;
+    size_t num_segments;
+    size_t next;
+    const struct segment *wrapped; // Last segment of the lines before
+    __u32 line;
+    bool mapped;
+    __u64 count;
+};
+
+static void lines_of(const struct coverage *cov, __u32 first_line, struct line_iterator *it)
+{
+    memset(it, 0, sizeof(*it));
+    it->segments = cov->segments;
+    it->num_segments = cov->num_segments;
+    it->line = first_line - 1;
+}
+
+// Move to the next line, up to the last one with segments
+static bool next_line(struct line_iterator *it)
+{
+    if (it->next == it->num_segments)
+    {
+        return false;
+    }
+    it->line++;
+    const struct segment *segments = &it->segments[it->next];
+    size_t num_segments = 0;
+    while (it->next < it->num_segments && it->segments[it->next].line == it->line)
+    {
+        it->next++;
+        num_segments++;
+    }
+
+    // Regions starting on the line (not gaps)
+    unsigned int num_starts = 0;
+    for (size_t s = 0; s < num_segments; s++)
+    {
+        num_starts += !segments[s].gap && segments[s].has_count && segments[s].entry;
+    }
+    bool skipped = num_segments && !segments[0].has_count && segments[0].entry;
+    it->mapped = !skipped && ((it->wrapped && it->wrapped->has_count) || num_starts > 0);
+    it->count = 0;
+    if (it->mapped)
+    {
+        // The highest count among the wrapping segment and the regions starting on the line
+        it->count = it->wrapped ? it->wrapped->count : 0;
+        for (size_t s = 0; num_starts && s < num_segments; s++)
+        {
+            if (!segments[s].gap && segments[s].has_count && segments[s].entry && segments[s].count > it->count)
+            {
+                it->count = segments[s].count;
+            }
+        }
+    }
+    if (num_segments)
+    {
+        it->wrapped = &segments[num_segments - 1];
+    }
+
+    return true;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Coverage
+// --------------------------------------------------------------------------------------------------------------------
+
+static void free_coverage(struct coverage *cov)
+{
+    free(cov->segments);
+    free(cov->expansions);
+    free(cov->branches);
+    memset(cov, 0, sizeof(*cov));
+}
+
+static int add_expansion(struct coverage *cov, const struct report_function *rf, const struct counted_region *cr)
+{
+    struct expansion *exp = push((void **)&cov->expansions, &cov->num_expansions, &cov->expansions_cap, sizeof(struct expansion));
+    if (!exp)
+    {
+        return -ENOMEM;
+    }
+    exp->function = rf;
+    exp->region = cr;
+    return 0;
+}
+
+static int add_branch(struct coverage *cov, const struct counted_region *cr)
+{
+    const struct counted_region **branch = push((void **)&cov->branches, &cov->num_branches, &cov->branches_cap, sizeof(*branch));
+    if (!branch)
+    {
+        return -ENOMEM;
+    }
+    *branch = cr;
+    return 0;
+}
+
+static int add_region(struct counted_region **regions, size_t *num_regions, size_t *capacity, const struct counted_region *cr)
+{
+    struct counted_region *copy = push((void **)regions, num_regions, capacity, sizeof(struct counted_region));
+    if (!copy)
+    {
+        return -ENOMEM;
+    }
+    *copy = *cr;
+    return 0;
+}
+
+// The coverage of a virtual file of a function: of the function itself (its main file), or of an expansion
+static int coverage_of_file_id(const struct report_function *rf, int file, struct coverage *cov)
+{
+    memset(cov, 0, sizeof(*cov));
+    if (file < 0)
+    {
+        return 0;
+    }
+
+    struct counted_region *regions = NULL;
+    size_t num_regions = 0, regions_cap = 0;
+    int err = 0;
+    for (__u32 r = 0; r < rf->num_regions && !err; r++)
+    {
+        const struct counted_region *cr = &rf->regions[r];
+        if (cr->region->file != (__u32)file)
+        {
+            continue;
+        }
+        err = add_region(&regions, &num_regions, &regions_cap, cr);
+        if (!err && cr->region->kind == COVMAP_REGION_EXPANSION)
+        {
+            err = add_expansion(cov, rf, cr);
+        }
+    }
+    for (__u32 r = 0; r < rf->num_branches && !err; r++)
+    {
+        if (rf->branches[r].region->file == (__u32)file)
+        {
+            err = add_branch(cov, &rf->branches[r]);
+        }
+    }
+    if (!err)
+    {
+        err = build_segments(regions, num_regions, cov);
+    }
+    free(regions);
+    if (err)
+    {
+        free_coverage(cov);
+    }
+    return err;
+}
+
+// The coverage of a file, out of every function with regions in it
+static int coverage_of_file(const struct report *rep, __u32 file, struct coverage *cov)
+{
+    memset(cov, 0, sizeof(*cov));
+
+    const struct report_file *rfile = &rep->files[file];
+    struct counted_region *regions = NULL;
+    size_t num_regions = 0, regions_cap = 0;
+    int err = 0;
+    for (size_t f = 0; f < rfile->num_functions && !err; f++)
+    {
+        const struct report_function *rf = &rep->functions[rfile->functions[f]];
+        int main_file = rf->main_file >= 0 && rf->files[rf->main_file] == file ? rf->main_file : -1;
+        for (__u32 r = 0; r < rf->num_regions && !err; r++)
+        {
+            const struct counted_region *cr = &rf->regions[r];
+            if (rf->files[cr->region->file] != file)
+            {
+                continue;
+            }
+            err = add_region(&regions, &num_regions, &regions_cap, cr);
+            if (!err && cr->region->kind == COVMAP_REGION_EXPANSION && cr->region->file == (__u32)main_file)
+            {
+                err = add_expansion(cov, rf, cr);
+            }
+        }
+        // Branches of the function itself (the ones of its expansions belong to the expansions)
+        for (__u32 r = 0; r < rf->num_branches && !err; r++)
+        {
+            const struct counted_region *cr = &rf->branches[r];
+            if (rf->files[cr->region->file] == file && cr->region->file == cr->region->expanded_file)
+            {
+                err = add_branch(cov, cr);
+            }
+        }
+    }
+    if (!err)
+    {
+        err = build_segments(regions, num_regions, cov);
+    }
+    free(regions);
+    if (err)
+    {
+        free_coverage(cov);
+    }
+    return err;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Summaries
+// --------------------------------------------------------------------------------------------------------------------
+
+static bool is_folded(const struct counted_region *cr)
+{
+    return cr->region->counter == 0 && cr->region->false_counter == 0;
+}
+
+static void sum_branches(const struct coverage *cov, struct report_summary *summary)
+{
+    for (size_t b = 0; b < cov->num_branches; b++)
+    {
+        const struct counted_region *cr = cov->branches[b];
+        if (is_folded(cr))
+        {
+            continue;
+        }
+        summary->branches += 2;
+        summary->covered_branches += (cr->count > 0) + (cr->false_count > 0);
+    }
+}
+
+static int sum_expansion_branches(const struct coverage *cov, struct report_summary *summary)
+{
+    for (size_t e = 0; e < cov->num_expansions; e++)
+    {
+        struct coverage expanded;
+        int err = coverage_of_file_id(cov->expansions[e].function, cov->expansions[e].region->region->expanded_file, &expanded);
+        if (!err)
+        {
+            sum_branches(&expanded, summary);
+            err = sum_expansion_branches(&expanded, summary);
+        }
+        free_coverage(&expanded);
+        if (err)
+        {
+            return err;
+        }
+    }
+    return 0;
+}
+
+static int summarize_function(struct report_function *rf)
+{
+    if (rf->summarized)
+    {
+        return 0;
+    }
+    struct report_summary *summary = &rf->summary;
+    memset(summary, 0, sizeof(*summary));
+
+    for (__u32 r = 0; r < rf->num_regions; r++)
+    {
+        if (rf->regions[r].region->kind == COVMAP_REGION_CODE)
+        {
+            summary->regions++;
+            summary->covered_regions += rf->regions[r].count > 0;
+        }
+    }
+
+    struct coverage cov;
+    int err = coverage_of_file_id(rf, rf->main_file, &cov);
+    if (err)
+    {
+        return err;
+    }
+    struct line_iterator it;
+    lines_of(&cov, cov.num_segments ? cov.segments[0].line : 1, &it);
+    while (next_line(&it))
+    {
+        if (it.mapped)
+        {
+            summary->lines++;
+            summary->covered_lines += it.count > 0;
+        }
+    }
+    sum_branches(&cov, summary);
+    err = sum_expansion_branches(&cov, summary);
+    free_coverage(&cov);
+    if (err)
+    {
+        return err;
+    }
+    rf->summarized = true;
+
+    return 0;
+}
+
+static __u64 max_u64(__u64 a, __u64 b)
+{
+    return a > b ? a : b;
+}
+
+struct instantiation_group
+{
+    struct loc loc;
+    __u64 execution_count;
+    struct report_summary summary;
+};
+
+// Functions with the same definition (eg. static functions of a header in many objects) count once in the
+// function summaries, with the highest summaries of theirs
+static int summarize_file(struct report *rep, __u32 file, struct report_summary *summary)
+{
+    memset(summary, 0, sizeof(*summary));
+
+    const struct report_file *rfile = &rep->files[file];
+    struct instantiation_group *groups = NULL;
+    size_t num_groups = 0, groups_cap = 0;
+    int err = 0;
+    for (size_t f = 0; f < rfile->num_functions && !err; f++)
+    {
+        struct report_function *rf = &rep->functions[rfile->functions[f]];
+        if (rf->main_file < 0 || rf->files[rf->main_file] != file)
+        {
+            continue;
+        }
+        err = summarize_function(rf);
+        if (err)
+        {
+            break;
+        }
+        summary->instantiations++;
+        summary->covered_instantiations += rf->execution_count > 0;
+
+        // Instantiations of the same definition start at the same location in the main file
+        struct loc loc = {0, 0};
+        for (__u32 r = 0; r < rf->num_regions; r++)
+        {
+            if (rf->regions[r].region->file == (__u32)rf->main_file)
+            {
+                loc = start_of(&rf->regions[r]);
+                break;
+            }
+        }
+        size_t g;
+        for (g = 0; g < num_groups && cmp_loc(groups[g].loc, loc) != 0; g++)
+            ;
+        if (g == num_groups)
+        {
+            struct instantiation_group *group = push((void **)&groups, &num_groups, &groups_cap, sizeof(struct instantiation_group));
+            if (!group)
+            {
+                err = -ENOMEM;
+                break;
+            }
+            group->loc = loc;
+            group->execution_count = rf->execution_count;
+            group->summary = rf->summary;
+            continue;
+        }
+        struct report_summary *merged = &groups[g].summary;
+        groups[g].execution_count += rf->execution_count;
+        merged->regions = max_u64(merged->regions, rf->summary.regions);
+        merged->covered_regions = max_u64(merged->covered_regions, rf->summary.covered_regions);
+        merged->lines = max_u64(merged->lines, rf->summary.lines);
+        merged->covered_lines = max_u64(merged->covered_lines, rf->summary.covered_lines);
+        merged->branches = max_u64(merged->branches, rf->summary.branches);
+        merged->covered_branches = max_u64(merged->covered_branches, rf->summary.covered_branches);
+    }
+    for (size_t g = 0; g < num_groups && !err; g++)
+    {
+        summary->regions += groups[g].summary.regions;
+        summary->covered_regions += groups[g].summary.covered_regions;
+        summary->lines += groups[g].summary.lines;
+        summary->covered_lines += groups[g].summary.covered_lines;
+        summary->branches += groups[g].summary.branches;
+        summary->covered_branches += groups[g].summary.covered_branches;
+        summary->functions++;
+        summary->covered_functions += groups[g].execution_count > 0;
+    }
+    free(groups);
+
+    return err;
+}
+
+static void add_summary(struct report_summary *totals, const struct report_summary *summary)
+{
+    totals->regions += summary->regions;
+    totals->covered_regions += summary->covered_regions;
+    totals->lines += summary->lines;
+    totals->covered_lines += summary->covered_lines;
+    totals->branches += summary->branches;
+    totals->covered_branches += summary->covered_branches;
+    totals->functions += summary->functions;
+    totals->covered_functions += summary->covered_functions;
+    totals->instantiations += summary->instantiations;
+    totals->covered_instantiations += summary->covered_instantiations;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Report
+// --------------------------------------------------------------------------------------------------------------------
+
+static int cmp_string(const void *a, const void *b)
+{
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+static int cmp_file_name(const void *key, const void *file)
+{
+    return strcmp(key, ((const struct report_file *)file)->name);
+}
+
+static const struct report *sort_report;
+
+// Functions with the same name and files sort together, in the order they got loaded otherwise
+static int cmp_function_index(const void *a, const void *b)
+{
+    const struct report_function *x = &sort_report->functions[*(const __u32 *)a];
+    const struct report_function *y = &sort_report->functions[*(const __u32 *)b];
+    if (x->fn->num_files != y->fn->num_files)
+    {
+        return x->fn->num_files < y->fn->num_files ? -1 : 1;
+    }
+    int cmp = memcmp(x->files, y->files, x->fn->num_files * sizeof(__u32));
+    if (!cmp)
+    {
+        cmp = strcmp(covmap_string(x->cm, x->fn->name), covmap_string(y->cm, y->fn->name));
+    }
+    if (!cmp)
+    {
+        cmp = (*(const __u32 *)a > *(const __u32 *)b) - (*(const __u32 *)a < *(const __u32 *)b);
+    }
+    return cmp;
+}
+
+static int same_function(const struct report_function *x, const struct report_function *y)
+{
+    return x->fn->num_files == y->fn->num_files && memcmp(x->files, y->files, x->fn->num_files * sizeof(__u32)) == 0 &&
+           strcmp(covmap_string(x->cm, x->fn->name), covmap_string(y->cm, y->fn->name)) == 0;
+}
+
+// The same function (same name, same files) in many objects gets reported once
+static int drop_duplicates(struct report *rep)
+{
+    __u32 *order = malloc(rep->num_functions * sizeof(__u32) + 1);
+    bool *duplicate = calloc(rep->num_functions + 1, sizeof(bool));
+    if (!order || !duplicate)
+    {
+        free(order);
+        free(duplicate);
+        return -ENOMEM;
+    }
+    for (__u32 f = 0; f < rep->num_functions; f++)
+    {
+        order[f] = f;
+    }
+    sort_report = rep;
+    qsort(order, rep->num_functions, sizeof(__u32), cmp_function_index);
+    for (__u32 f = 1; f < rep->num_functions; f++)
+    {
+        duplicate[order[f]] = same_function(&rep->functions[order[f - 1]], &rep->functions[order[f]]);
+    }
+
+    __u32 num_functions = 0;
+    for (__u32 f = 0; f < rep->num_functions; f++)
+    {
+        if (duplicate[f])
+        {
+            free(rep->functions[f].files);
+            continue;
+        }
+        rep->functions[num_functions++] = rep->functions[f];
+    }
+    rep->num_functions = num_functions;
+    free(order);
+    free(duplicate);
+
+    return 0;
+}
+
+static int load_functions(struct report *rep, const struct covmap *const *cms, int num_cms)
+{
+    size_t num_functions = 0;
+    for (int c = 0; c < num_cms; c++)
+    {
+        num_functions += cms[c]->num_functions;
+    }
+    rep->functions = calloc(num_functions + 1, sizeof(struct report_function));
+    if (!rep->functions)
+    {
+        return -ENOMEM;
+    }
+
+    // The files of every function, sorted
+    const char **names = NULL;
+    size_t num_names = 0, names_cap = 0;
+    for (int c = 0; c < num_cms; c++)
+    {
+        const struct covmap *cm = cms[c];
+        for (__u32 f = 0; f < cm->num_functions; f++)
+        {
+            const struct covmap_function *fn = &cm->functions[f];
+            for (__u32 v = 0; v < fn->num_files; v++)
+            {
+                const char **name = push((void **)&names, &num_names, &names_cap, sizeof(*name));
+                if (!name)
+                {
+                    free(names);
+                    return -ENOMEM;
+                }
+                *name = covmap_file(cm, fn, v);
+            }
+        }
+    }
+    qsort(names, num_names, sizeof(*names), cmp_string);
+    rep->files = calloc(num_names + 1, sizeof(struct report_file));
+    if (!rep->files)
+    {
+        free(names);
+        return -ENOMEM;
+    }
+    for (size_t n = 0; n < num_names; n++)
+    {
+        if (rep->num_files == 0 || strcmp(rep->files[rep->num_files - 1].name, names[n]) != 0)
+        {
+            rep->files[rep->num_files++].name = names[n];
+        }
+    }
+    free(names);
+
+    for (int c = 0; c < num_cms; c++)
+    {
+        const struct covmap *cm = cms[c];
+        for (__u32 f = 0; f < cm->num_functions; f++)
+        {
+            struct report_function *rf = &rep->functions[rep->num_functions++];
+            rf->cm = cm;
+            rf->fn = &cm->functions[f];
+            rf->files = malloc((rf->fn->num_files + 1) * sizeof(__u32));
+            if (!rf->files)
+            {
+                return -ENOMEM;
+            }
+            for (__u32 v = 0; v < rf->fn->num_files; v++)
+            {
+                const struct report_file *file = bsearch(covmap_file(cm, rf->fn, v), rep->files, rep->num_files,
+                                                         sizeof(struct report_file), cmp_file_name);
+                rf->files[v] = file - rep->files;
+            }
+        }
+    }
+
+    return drop_duplicates(rep);
+}
+
+static int count_regions(struct report_function *rf, const struct profdata *pd)
+{
+    const struct covmap *cm = rf->cm;
+    const struct covmap_function *fn = rf->fn;
+    __u64 num_counters = 0;
+    const __u64 *counters = profdata_counters(pd, fn->name_ref, fn->hash, &num_counters);
+
+    rf->regions = calloc(fn->num_regions + 1, sizeof(struct counted_region));
+    rf->branches = calloc(fn->num_regions + 1, sizeof(struct counted_region));
+    bool *expanded = calloc(fn->num_files + 1, sizeof(bool));
+    if (!rf->regions || !rf->branches || !expanded)
+    {
+        free(expanded);
+        return -ENOMEM;
+    }
+    for (__u32 r = 0; r < fn->num_regions; r++)
+    {
+        const struct covmap_region *region = &cm->regions[fn->first_region + r];
+        struct counted_region *cr = region->kind == COVMAP_REGION_BRANCH ? &rf->branches[rf->num_branches++]
+                                                                         : &rf->regions[rf->num_regions++];
+        cr->region = region;
+        cr->count = covmap_evaluate(cm, fn, region->counter, counters, counters ? num_counters : 0);
+        if (region->kind == COVMAP_REGION_BRANCH)
+        {
+            cr->false_count = covmap_evaluate(cm, fn, region->false_counter, counters, counters ? num_counters : 0);
+        }
+        else if (region->kind == COVMAP_REGION_EXPANSION)
+        {
+            expanded[region->expanded_file] = true;
+        }
+    }
+    rf->execution_count = rf->num_regions ? rf->regions[0].count : 0;
+
+    // The main file is the first one that no region expands
+    rf->main_file = -1;
+    for (__u32 v = 0; v < fn->num_files && rf->main_file < 0; v++)
+    {
+        if (!expanded[v])
+        {
+            rf->main_file = v;
+        }
+    }
+    free(expanded);
+
+    return 0;
+}
+
+struct report *report_new(const struct covmap *const *cms, int num_cms, const struct profdata *pd)
+{
+    struct report *rep = calloc(1, sizeof(struct report));
+    if (!rep)
+    {
+        return NULL;
+    }
+    rep->cms = malloc((num_cms + 1) * sizeof(struct covmap *));
+    if (!rep->cms)
+    {
+        free(rep);
+        return NULL;
+    }
+    memcpy(rep->cms, cms, num_cms * sizeof(struct covmap *));
+    rep->num_cms = num_cms;
+    int err = load_functions(rep, cms, num_cms);
+    for (__u32 f = 0; f < rep->num_functions && !err; f++)
+    {
+        struct report_function *rf = &rep->functions[f];
+        err = count_regions(rf, pd);
+
+        // Every file lists the functions with regions in it, in order
+        for (__u32 v = 0; v < rf->fn->num_files && !err; v++)
+        {
+            struct report_file *file = &rep->files[rf->files[v]];
+            if (file->num_functions && file->functions[file->num_functions - 1] == f)
+            {
+                continue;
+            }
+            __u32 *function = push((void **)&file->functions, &file->num_functions, &file->functions_cap, sizeof(__u32));
+            if (!function)
+            {
+                err = -ENOMEM;
+                break;
+            }
+            *function = f;
+        }
+    }
+    if (err)
+    {
+        report_free(rep);
+        return NULL;
+    }
+
+    return rep;
+}
+
+void report_free(struct report *rep)
+{
+    if (!rep)
+    {
+        return;
+    }
+    for (__u32 f = 0; f < rep->num_functions; f++)
+    {
+        free(rep->functions[f].files);
+        free(rep->functions[f].regions);
+        free(rep->functions[f].branches);
+    }
+    for (__u32 f = 0; f < rep->num_files; f++)
+    {
+        free(rep->files[f].functions);
+    }
+    free(rep->functions);
+    free(rep->files);
+    free(rep->cms);
+    free(rep);
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// LCOV
+// --------------------------------------------------------------------------------------------------------------------
+
+struct lcov_branch
+{
+    const struct counted_region *cr;
+    __u32 line; // Line of the expansion, for the branches of expansions
+    size_t order;
+};
+
+static int cmp_lcov_branch(const void *a, const void *b)
+{
+    const struct lcov_branch *x = a;
+    const struct lcov_branch *y = b;
+    if (x->line != y->line)
+    {
+        return x->line < y->line ? -1 : 1;
+    }
+    if (x->cr->region->col_start != y->cr->region->col_start)
+    {
+        return x->cr->region->col_start < y->cr->region->col_start ? -1 : 1;
+    }
+    return (x->order > y->order) - (x->order < y->order);
+}
+
+// The branches of the expansions (nested ones first), on the line of the outermost expansion
+static int add_lcov_branches(const struct coverage *cov, int depth, __u32 line, struct lcov_branch **branches,
+                             size_t *num_branches, size_t *capacity)
+{
+    for (size_t e = 0; e < cov->num_expansions; e++)
+    {
+        const struct expansion *exp = &cov->expansions[e];
+        __u32 expansion_line = depth == 0 ? exp->region->region->line_start : line;
+        struct coverage expanded;
+        int err = coverage_of_file_id(exp->function, exp->region->region->expanded_file, &expanded);
+        if (!err)
+        {
+            err = add_lcov_branches(&expanded, depth + 1, expansion_line, branches, num_branches, capacity);
+        }
+        for (size_t b = 0; b < expanded.num_branches && !err; b++)
+        {
+            if (is_folded(expanded.branches[b]))
+            {
+                continue;
+            }
+            struct lcov_branch *branch = push((void **)branches, num_branches, capacity, sizeof(struct lcov_branch));
+            if (!branch)
+            {
+                err = -ENOMEM;
+                break;
+            }
+            branch->cr = expanded.branches[b];
+            branch->line = expansion_line;
+            branch->order = *num_branches;
+        }
+        free_coverage(&expanded);
+        if (err)
+        {
+            return err;
+        }
+    }
+    return 0;
+}
+
+static int write_lcov_branches(const struct coverage *cov, FILE *outfp)
+{
+    struct lcov_branch *branches = NULL;
+    size_t num_branches = 0, capacity = 0;
+    int err = 0;
+    for (size_t b = 0; b < cov->num_branches && !err; b++)
+    {
+        struct lcov_branch *branch = push((void **)&branches, &num_branches, &capacity, sizeof(struct lcov_branch));
+        if (!branch)
+        {
+            err = -ENOMEM;
+            break;
+        }
+        branch->cr = cov->branches[b];
+        branch->line = cov->branches[b]->region->line_start;
+        branch->order = num_branches;
+    }
+    if (!err)
+    {
+        err = add_lcov_branches(cov, 0, 0, &branches, &num_branches, &capacity);
+    }
+    if (err)
+    {
+        free(branches);
+        return err;
+    }
+    if (num_branches)
+    {
+        qsort(branches, num_branches, sizeof(struct lcov_branch), cmp_lcov_branch);
+    }
+
+    // Branches on the same line get numbered, both one by one, and by pairs (true, false)
+    for (size_t b = 0; b < num_branches;)
+    {
+        __u32 line = branches[b].line;
+        unsigned int pair = 0, index = 0;
+        for (; b < num_branches && branches[b].line == line; b++)
+        {
+            const struct counted_region *cr = branches[b].cr;
+            if (is_folded(cr))
+            {
+                continue;
+            }
+            for (int i = 0; i < 2; i++, index++)
+            {
+                if (cr->count == 0 && cr->false_count == 0)
+                {
+                    fprintf(outfp, "BRDA:%u,%u,%u,-\n", line, pair, index);
+                }
+                else
+                {
+                    fprintf(outfp, "BRDA:%u,%u,%u,%llu\n", line, pair, index, i == 0 ? cr->count : cr->false_count);
+                }
+            }
+            pair++;
+        }
+    }
+    free(branches);
+
+    return 0;
+}
+
+int report_lcov(struct report *rep, FILE *outfp)
+{
+    int err = 0;
+    for (__u32 file = 0; file < rep->num_files && !err; file++)
+    {
+        const struct report_file *rfile = &rep->files[file];
+        struct report_summary summary;
+        err = summarize_file(rep, file, &summary);
+        if (err)
+        {
+            break;
+        }
+
+        fprintf(outfp, "SF:%s\n", rfile->name);
+        // The functions of the file are the ones whose first virtual file it is
+        for (size_t f = 0; f < rfile->num_functions; f++)
+        {
+            const struct report_function *rf = &rep->functions[rfile->functions[f]];
+            if (rf->files[0] == file && rf->num_regions)
+            {
+                fprintf(outfp, "FN:%u,%s\n", rf->regions[0].region->line_start, covmap_string(rf->cm, rf->fn->name));
+            }
+        }
+        for (size_t f = 0; f < rfile->num_functions; f++)
+        {
+            const struct report_function *rf = &rep->functions[rfile->functions[f]];
+            if (rf->files[0] == file && rf->num_regions)
+            {
+                fprintf(outfp, "FNDA:%llu,%s\n", rf->execution_count, covmap_string(rf->cm, rf->fn->name));
+            }
+        }
+        fprintf(outfp, "FNF:%llu\nFNH:%llu\n", summary.functions, summary.covered_functions);
+
+        struct coverage cov;
+        err = coverage_of_file(rep, file, &cov);
+        if (err)
+        {
+            break;
+        }
+        struct line_iterator it;
+        lines_of(&cov, 1, &it);
+        while (next_line(&it))
+        {
+            if (it.mapped)
+            {
+                fprintf(outfp, "DA:%u,%llu\n", it.line, it.count);
+            }
+        }
+        err = write_lcov_branches(&cov, outfp);
+        free_coverage(&cov);
+
+        fprintf(outfp, "BRF:%llu\nBRH:%llu\n", summary.branches, summary.covered_branches);
+        fprintf(outfp, "LF:%llu\nLH:%llu\n", summary.lines, summary.covered_lines);
+        fprintf(outfp, "end_of_record\n");
+    }
+    if (!err && ferror(outfp))
+    {
+        err = -EIO;
+    }
+
+    return err;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// JSON
+// --------------------------------------------------------------------------------------------------------------------
+
+static void json_string(FILE *outfp, const char *str)
+{
+    fputc('"', outfp);
+    for (const unsigned char *c = (const unsigned char *)str; *c; c++)
+    {
+        switch (*c)
+        {
+        case '"':
+        case '\\':
+            fputc('\\', outfp);
+            fputc(*c, outfp);
+            break;
+        case '\t':
+            fputs("\\t", outfp);
+            break;
+        case '\n':
+            fputs("\\n", outfp);
+            break;
+        case '\r':
+            fputs("\\r", outfp);
+            break;
+        default:
+            if (*c < 0x20)
+            {
+                fprintf(outfp, "\\u%04x", *c);
+            }
+            else
+            {
+                fputc(*c, outfp);
+            }
+        }
+    }
+    fputc('"', outfp);
+}
+
+// Counts are signed in JSON
+static long long int json_count(__u64 count)
+{
+    return count > INT64_MAX ? INT64_MAX : (long long int)count;
+}
+
+static void json_percent(FILE *outfp, __u64 covered, __u64 count)
+{
+    fprintf(outfp, "%.17g", count ? (double)covered / (double)count * 100.0 : 0.0);
+}
+
+static void json_region(FILE *outfp, const struct counted_region *cr)
+{
+    const struct covmap_region *region = cr->region;
+    fprintf(outfp, "[%u,%u,%u,%u,%lld,%u,%u,%u]", region->line_start, region->col_start, region->line_end,
+            region->col_end, json_count(cr->count), region->file, region->expanded_file, region->kind);
+}
+
+static void json_branch(FILE *outfp, const struct counted_region *cr)
+{
+    const struct covmap_region *region = cr->region;
+    fprintf(outfp, "[%u,%u,%u,%u,%lld,%lld,%u,%u,%u]", region->line_start, region->col_start, region->line_end,
+            region->col_end, json_count(cr->count), json_count(cr->false_count), region->file, region->expanded_file,
+            region->kind);
+}
+
+static void json_regions(FILE *outfp, const struct report_function *rf)
+{
+    fputc('[', outfp);
+    for (__u32 r = 0; r < rf->num_regions; r++)
+    {
+        if (r)
+        {
+            fputc(',', outfp);
+        }
+        json_region(outfp, &rf->regions[r]);
+    }
+    fputc(']', outfp);
+}
+
+static void json_filenames(FILE *outfp, const struct report_function *rf)
+{
+    fputc('[', outfp);
+    for (__u32 v = 0; v < rf->fn->num_files; v++)
+    {
+        if (v)
+        {
+            fputc(',', outfp);
+        }
+        json_string(outfp, covmap_file(rf->cm, rf->fn, v));
+    }
+    fputc(']', outfp);
+}
+
+static void json_function(FILE *outfp, const struct report_function *rf)
+{
+    fputs("{\"branches\":[", outfp);
+    bool first = true;
+    for (__u32 b = 0; b < rf->num_branches; b++)
+    {
+        if (is_folded(&rf->branches[b]))
+        {
+            continue;
+        }
+        if (!first)
+        {
+            fputc(',', outfp);
+        }
+        first = false;
+        json_branch(outfp, &rf->branches[b]);
+    }
+    fprintf(outfp, "],\"count\":%lld,\"filenames\":", json_count(rf->execution_count));
+    json_filenames(outfp, rf);
+    fputs(",\"name\":", outfp);
+    json_string(outfp, covmap_string(rf->cm, rf->fn->name));
+    fputs(",\"regions\":", outfp);
+    json_regions(outfp, rf);
+    fputc('}', outfp);
+}
+
+static void json_summary(FILE *outfp, const struct report_summary *summary)
+{
+    fprintf(outfp, "{\"branches\":{\"count\":%llu,\"covered\":%llu,\"notcovered\":%llu,\"percent\":", summary->branches,
+            summary->covered_branches, summary->branches - summary->covered_branches);
+    json_percent(outfp, summary->covered_branches, summary->branches);
+    fprintf(outfp, "},\"functions\":{\"count\":%llu,\"covered\":%llu,\"percent\":", summary->functions, summary->covered_functions);
+    json_percent(outfp, summary->covered_functions, summary->functions);
+    fprintf(outfp, "},\"instantiations\":{\"count\":%llu,\"covered\":%llu,\"percent\":", summary->instantiations,
+            summary->covered_instantiations);
+    json_percent(outfp, summary->covered_instantiations, summary->instantiations);
+    fprintf(outfp, "},\"lines\":{\"count\":%llu,\"covered\":%llu,\"percent\":", summary->lines, summary->covered_lines);
+    json_percent(outfp, summary->covered_lines, summary->lines);
+    fprintf(outfp, "},\"regions\":{\"count\":%llu,\"covered\":%llu,\"notcovered\":%llu,\"percent\":", summary->regions,
+            summary->covered_regions, summary->regions - summary->covered_regions);
+    json_percent(outfp, summary->covered_regions, summary->regions);
+    fputs("}}", outfp);
+}
+
+// The branches of an expansion, and of the ones nested in it (first)
+static int json_expansion_branches(FILE *outfp, const struct expansion *exp, bool *first)
+{
+    struct coverage expanded;
+    int err = coverage_of_file_id(exp->function, exp->region->region->expanded_file, &expanded);
+    for (size_t e = 0; e < expanded.num_expansions && !err; e++)
+    {
+        err = json_expansion_branches(outfp, &expanded.expansions[e], first);
+    }
+    for (size_t b = 0; b < expanded.num_branches && !err; b++)
+    {
+        if (is_folded(expanded.branches[b]))
+        {
+            continue;
+        }
+        if (!*first)
+        {
+            fputc(',', outfp);
+        }
+        *first = false;
+        json_branch(outfp, expanded.branches[b]);
+    }
+    free_coverage(&expanded);
+
+    return err;
+}
+
+static int json_file(struct report *rep, __u32 file, FILE *outfp, struct report_summary *totals)
+{
+    struct report_summary summary;
+    int err = summarize_file(rep, file, &summary);
+    if (err)
+    {
+        return err;
+    }
+    add_summary(totals, &summary);
+    struct coverage cov;
+    err = coverage_of_file(rep, file, &cov);
+    if (err)
+    {
+        return err;
+    }
+
+    fputs("{\"branches\":[", outfp);
+    for (size_t b = 0; b < cov.num_branches; b++)
+    {
+        if (b)
+        {
+            fputc(',', outfp);
+        }
+        json_branch(outfp, cov.branches[b]);
+    }
+    fputs("],\"expansions\":[", outfp);
+    for (size_t e = 0; e < cov.num_expansions && !err; e++)
+    {
+        const struct expansion *exp = &cov.expansions[e];
+        fputs(e ? ",{\"branches\":[" : "{\"branches\":[", outfp);
+        bool first = true;
+        err = json_expansion_branches(outfp, exp, &first);
+        fputs("],\"filenames\":", outfp);
+        json_filenames(outfp, exp->function);
+        fputs(",\"source_region\":", outfp);
+        json_region(outfp, exp->region);
+        fputs(",\"target_regions\":", outfp);
+        json_regions(outfp, exp->function);
+        fputc('}', outfp);
+    }
+    fputs("],\"filename\":", outfp);
+    json_string(outfp, rep->files[file].name);
+    fputs(",\"segments\":[", outfp);
+    for (size_t s = 0; s < cov.num_segments; s++)
+    {
+        const struct segment *seg = &cov.segments[s];
+        fprintf(outfp, "%s[%u,%u,%lld,%s,%s,%s]", s ? "," : "", seg->line, seg->col, json_count(seg->count),
+                seg->has_count ? "true" : "false", seg->entry ? "true" : "false", seg->gap ? "true" : "false");
+    }
+    fputs("],\"summary\":", outfp);
+    json_summary(outfp, &summary);
+    fputc('}', outfp);
+    free_coverage(&cov);
+
+    return err;
+}
+
+static void json_program(FILE *outfp, const struct report_program *prog)
+{
+    fprintf(outfp, "{\"average_ns\":%.17g,\"name\":", prog->run_cnt ? (double)prog->run_time_ns / (double)prog->run_cnt : 0.0);
+    json_string(outfp, prog->name);
+    fputs(",\"object\":", outfp);
+    json_string(outfp, prog->object);
+    fprintf(outfp, ",\"run_cnt\":%lld,\"run_time_ns\":%lld}", json_count(prog->run_cnt), json_count(prog->run_time_ns));
+}
+
+int report_json(struct report *rep, const struct report_program *programs, size_t num_programs, FILE *outfp)
+{
+    struct report_summary totals = {0};
+    int err = 0;
+
+    fputs("{\"data\":[{\"files\":[", outfp);
+    for (__u32 file = 0; file < rep->num_files && !err; file++)
+    {
+        if (file)
+        {
+            fputc(',', outfp);
+        }
+        err = json_file(rep, file, outfp, &totals);
+    }
+    fputs("],\"functions\":[", outfp);
+    for (__u32 f = 0; f < rep->num_functions && !err; f++)
+    {
+        if (f)
+        {
+            fputc(',', outfp);
+        }
+        json_function(outfp, &rep->functions[f]);
+    }
+    if (num_programs > 0)
+    {
+        fputs("],\"programs\":[", outfp);
+    }
+    for (size_t p = 0; p < num_programs; p++)
+    {
+        if (p)
+        {
+            fputc(',', outfp);
+        }
+        json_program(outfp, &programs[p]);
+    }
+    fputs("],\"totals\":", outfp);
+    json_summary(outfp, &totals);
+    fputs("}],\"type\":\"" REPORT_JSON_TYPE "\",\"version\":\"" REPORT_JSON_VERSION "\"}", outfp);
+    if (!err && ferror(outfp))
+    {
+        err = -EIO;
+    }
+
+    return err;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Source files
+// --------------------------------------------------------------------------------------------------------------------
+
+__u32 report_num_files(const struct report *rep)
+{
+    return rep->num_files;
+}
+
+const char *report_file_name(const struct report *rep, __u32 file)
+{
+    return rep->files[file].name;
+}
+
+int report_file_summary(struct report *rep, __u32 file, struct report_summary *summary)
+{
+    return summarize_file(rep, file, summary);
+}
+
+int report_file_digest(struct report *rep, __u32 file, __u64 *digest)
+{
+    char *buf = NULL;
+    size_t size = 0;
+    FILE *memfp = open_memstream(&buf, &size);
+    if (!memfp)
+    {
+        return -ENOMEM;
+    }
+    // Its JSON export, then the one of the functions in it (their instantiations show in its page)
+    struct report_summary totals = {0};
+    int err = json_file(rep, file, memfp, &totals);
+    const struct report_file *rfile = &rep->files[file];
+    for (size_t f = 0; f < rfile->num_functions && !err; f++)
+    {
+        json_function(memfp, &rep->functions[rfile->functions[f]]);
+    }
+    if (fclose(memfp) && !err)
+    {
+        err = -ENOMEM;
+    }
+    if (!err)
+    {
+        *digest = profdata_md5(buf, size);
+    }
+    free(buf);
+
+    return err;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Folded stacks
+//
+// Like the ones `stackcollapse` scripts write for flame graphs: the program, the function, then its regions, each one
+// nested in the region containing it (in its file), or in the expansion of the macro it comes from. Every stack counts
+// the executions of its last region but the ones of the regions nested in it (at least zero, since loop bodies run
+// more often than the regions containing them)
+// --------------------------------------------------------------------------------------------------------------------
+
+#define FOLDED_MAX_DEPTH 128
+
+struct folded_node
+{
+    const struct counted_region *cr;
+    __s64 parent; // Region containing it in its file (-1 for the outermost ones)
+};
+
+struct folded_function;
+
+// Called with the stack of every region that counts executions of its own (the regions nested in the function)
+typedef int (*folded_visit_t)(const struct folded_function *ff, int depth, __u64 count, void *ctx);
+
+struct folded_function
+{
+    const struct report *rep;
+    __u32 function;
+    const struct report_function *rf;
+    struct folded_node *nodes; // Code and expansion regions, sorted by file then location
+    size_t num_nodes;
+    const struct counted_region *frames[FOLDED_MAX_DEPTH];
+    folded_visit_t visit;
+    void *ctx;
+};
+
+static int cmp_folded_node(const void *a, const void *b)
+{
+    const struct counted_region *x = ((const struct folded_node *)a)->cr;
+    const struct counted_region *y = ((const struct folded_node *)b)->cr;
+    if (x->region->file != y->region->file)
+    {
+        return x->region->file < y->region->file ? -1 : 1;
+    }
+    int cmp = cmp_loc(start_of(x), start_of(y));
+    if (!cmp)
+    {
+        // The larger ones first: they contain the others
+        cmp = -cmp_loc(end_of(x), end_of(y));
+    }
+    if (!cmp)
+    {
+        cmp = (x > y) - (x < y);
+    }
+    return cmp;
+}
+
+// Semicolons separate the frames, the last space the count
+static void folded_name(FILE *outfp, const char *name)
+{
+    for (const char *c = name; *c; c++)
+    {
+        fputc(*c == ';' || *c == ' ' || *c == '\t' || *c == '\n' ? '_' : *c, outfp);
+    }
+}
+
+struct folded_stacks
+{
+    FILE *outfp;
+    const char *program;
+};
+
+static int folded_stack(const struct folded_function *ff, int depth, __u64 count, void *ctx)
+{
+    const struct folded_stacks *stacks = ctx;
+    FILE *outfp = stacks->outfp;
+    folded_name(outfp, stacks->program);
+    fputc(';', outfp);
+    folded_name(outfp, covmap_string(ff->rf->cm, ff->rf->fn->name));
+    for (int d = 0; d < depth; d++)
+    {
+        const struct covmap_region *region = ff->frames[d]->region;
+        const char *file = ff->rep->files[ff->rf->files[region->file]].name;
+        const char *slash = strrchr(file, '/');
+        fputc(';', outfp);
+        folded_name(outfp, slash ? slash + 1 : file);
+        fprintf(outfp, ":%u:%u", region->line_start, region->col_start);
+    }
+    fprintf(outfp, " %llu\n", count);
+
+    return 0;
+}
+
+// Regions nest in the region containing them, the outermost regions of an expanded file in the expansion
+static bool is_folded_child(const struct folded_function *ff, size_t n, size_t parent)
+{
+    const struct folded_node *node = &ff->nodes[n];
+    if (node->parent >= 0)
+    {
+        return (size_t)node->parent == parent;
+    }
+    const struct covmap_region *expansion = ff->nodes[parent].cr->region;
+    return expansion->kind == COVMAP_REGION_EXPANSION && node->cr->region->file == expansion->expanded_file;
+}
+
+// Visit the stack of a region (of the function itself, at depth zero), then the ones of the regions nested in it
+static int folded_region(struct folded_function *ff, size_t node, int depth)
+{
+    int err = 0;
+    __u64 nested = 0;
+    for (size_t n = 0; n < ff->num_nodes; n++)
+    {
+        if (is_folded_child(ff, n, node))
+        {
+            nested += ff->nodes[n].cr->count;
+        }
+    }
+    if (ff->nodes[node].cr->count > nested)
+    {
+        err = ff->visit(ff, depth, ff->nodes[node].cr->count - nested, ff->ctx);
+    }
+    if (depth == FOLDED_MAX_DEPTH)
+    {
+        return err;
+    }
+    for (size_t n = 0; n < ff->num_nodes && !err; n++)
+    {
+        if (ff->nodes[n].cr->count && is_folded_child(ff, n, node))
+        {
+            ff->frames[depth] = ff->nodes[n].cr;
+            err = folded_region(ff, n, depth + 1);
+        }
+    }
+
+    return err;
+}
+
+static int folded_function(const struct report *rep, __u32 function, folded_visit_t visit, void *ctx)
+{
+    const struct report_function *rf = &rep->functions[function];
+    struct folded_function ff = {.rep = rep, .function = function, .rf = rf, .visit = visit, .ctx = ctx};
+    ff.nodes = calloc(rf->num_regions + 1, sizeof(struct folded_node));
+    __s64 *open = calloc(rf->num_regions + 1, sizeof(__s64));
+    if (!ff.nodes || !open)
+    {
+        free(ff.nodes);
+        free(open);
+        return -ENOMEM;
+    }
+    for (__u32 r = 0; r < rf->num_regions; r++)
+    {
+        const struct counted_region *cr = &rf->regions[r];
+        if (cr->region->kind == COVMAP_REGION_CODE || cr->region->kind == COVMAP_REGION_EXPANSION)
+        {
+            ff.nodes[ff.num_nodes++].cr = cr;
+        }
+    }
+    if (ff.num_nodes > 0)
+    {
+        qsort(ff.nodes, ff.num_nodes, sizeof(struct folded_node), cmp_folded_node);
+    }
+
+    // The regions still open (containing the next ones, in the same file)
+    int err = 0;
+    size_t num_open = 0;
+    __s64 root = -1;
+    for (size_t n = 0; n < ff.num_nodes; n++)
+    {
+        const struct counted_region *cr = ff.nodes[n].cr;
+        while (num_open > 0)
+        {
+            const struct counted_region *outer = ff.nodes[open[num_open - 1]].cr;
+            if (outer->region->file == cr->region->file && cmp_loc(end_of(outer), end_of(cr)) >= 0)
+            {
+                break;
+            }
+            num_open--;
+        }
+        ff.nodes[n].parent = num_open > 0 ? open[num_open - 1] : -1;
+        open[num_open++] = n;
+        root = cr == &rf->regions[0] ? (__s64)n : root;
+    }
+    free(open);
+
+    // The function is its first region: the other outermost regions of its file nest in it
+    if (root >= 0 && ff.nodes[root].parent < 0)
+    {
+        for (size_t n = 0; n < ff.num_nodes; n++)
+        {
+            if (ff.nodes[n].parent < 0 && (__s64)n != root && ff.nodes[n].cr->region->file == rf->regions[0].region->file)
+            {
+                ff.nodes[n].parent = root;
+            }
+        }
+        err = folded_region(&ff, root, 0);
+    }
+    free(ff.nodes);
+
+    return err;
+}
+
+int report_folded(struct report *rep, const char *const *programs, FILE *outfp)
+{
+    int err = 0;
+    for (__u32 f = 0; f < rep->num_functions && !err; f++)
+    {
+        const struct report_function *rf = &rep->functions[f];
+        if (!rf->num_regions || !rf->execution_count)
+        {
+            continue;
+        }
+        int c;
+        for (c = 0; c < rep->num_cms && rep->cms[c] != rf->cm; c++)
+            ;
+        struct folded_stacks stacks = {.outfp = outfp, .program = c < rep->num_cms ? programs[c] : ""};
+        err = folded_function(rep, f, folded_stack, &stacks);
+    }
+    if (!err && ferror(outfp))
+    {
+        err = -EIO;
+    }
+
+    return err;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// pprof
+//
+// The messages of profile.proto (https://github.com/google/pprof/blob/main/proto/profile.proto), encoded as pprof
+// reads them. Every code region counting executions of its own (as in the folded stacks) is a location, with a line
+// for the region then one for each expansion it comes from (like the frames of inlined functions), and every function
+// has a function for each of its files. The samples count those executions, labeled with the profile of the report
+// they come from
+// --------------------------------------------------------------------------------------------------------------------
+
+#define PB_VARINT 0
+#define PB_BYTES 2
+
+enum pprof_field
+{
+    PROFILE_SAMPLE_TYPE = 1,
+    PROFILE_SAMPLE = 2,
+    PROFILE_MAPPING = 3,
+    PROFILE_LOCATION = 4,
+    PROFILE_FUNCTION = 5,
+    PROFILE_STRING_TABLE = 6,
+    PROFILE_PERIOD_TYPE = 11,
+    PROFILE_PERIOD = 12,
+    VALUE_TYPE_TYPE = 1,
+    VALUE_TYPE_UNIT = 2,
+    SAMPLE_LOCATION_ID = 1,
+    SAMPLE_VALUE = 2,
+    SAMPLE_LABEL = 3,
+    LABEL_KEY = 1,
+    LABEL_STR = 2,
+    MAPPING_ID = 1,
+    MAPPING_FILENAME = 5,
+    MAPPING_HAS_FUNCTIONS = 7,
+    MAPPING_HAS_FILENAMES = 8,
+    MAPPING_HAS_LINE_NUMBERS = 9,
+    MAPPING_HAS_INLINE_FRAMES = 10,
+    LOCATION_ID = 1,
+    LOCATION_MAPPING_ID = 2,
+    LOCATION_LINE = 4,
+    LINE_FUNCTION_ID = 1,
+    LINE_LINE = 2,
+    LINE_COLUMN = 3,
+    FUNCTION_ID = 1,
+    FUNCTION_NAME = 2,
+    FUNCTION_SYSTEM_NAME = 3,
+    FUNCTION_FILENAME = 4,
+    FUNCTION_START_LINE = 5,
+};
+
+// Encoded fields
+struct pb
+{
+    unsigned char *data;
+    size_t size, capacity;
+    bool failed;
+};
+
+static void pb_raw(struct pb *pb, const void *data, size_t size)
+{
+    if (pb->failed)
+    {
+        return;
+    }
+    if (pb->size + size > pb->capacity)
+    {
+        size_t capacity = pb->capacity ? pb->capacity : 256;
+        while (pb->size + size > capacity)
+        {
+            capacity *= 2;
+        }
+        unsigned char *grown = realloc(pb->data, capacity);
+        if (!grown)
+        {
+            pb->failed = true;
+            return;
+        }
+        pb->data = grown;
+        pb->capacity = capacity;
+    }
+    memcpy(pb->data + pb->size, data, size);
+    pb->size += size;
+}
+
+static void pb_varint(struct pb *pb, __u64 value)
+{
+    unsigned char buf[10];
+    size_t size = 0;
+    do
+    {
+        buf[size] = value & 0x7f;
+        value >>= 7;
+        buf[size++] |= value ? 0x80 : 0;
+    } while (value);
+    pb_raw(pb, buf, size);
+}
+
+// Zero is the default value: it is left out
+static void pb_uint(struct pb *pb, enum pprof_field field, __u64 value)
+{
+    if (value)
+    {
+        pb_varint(pb, (__u64)field << 3 | PB_VARINT);
+        pb_varint(pb, value);
+    }
+}
+
+static void pb_bytes(struct pb *pb, enum pprof_field field, const void *data, size_t size)
+{
+    pb_varint(pb, (__u64)field << 3 | PB_BYTES);
+    pb_varint(pb, size);
+    pb_raw(pb, data, size);
+}
+
+// Append a message, then empty it for the next one
+static void pb_message(struct pb *pb, enum pprof_field field, struct pb *msg)
+{
+    pb_bytes(pb, field, msg->data, msg->size);
+    pb->failed |= msg->failed;
+    msg->size = 0;
+    msg->failed = false;
+}
+
+struct report_pprof
+{
+    const struct covmap **cms; // The coverage mappings of the reports
+    int num_cms;
+    __u32 num_functions;
+    size_t *first_function; // Function ids of every report function (one for each virtual file) start past these
+    size_t *first_location; // Location ids of every report function (one for each region) start past these
+    bool *has_function;     // Functions and locations already encoded
+    bool *has_location;
+    char **strings;
+    size_t num_strings, strings_cap;
+    size_t *slots; // Open addressing on the strings, holding their index plus one
+    size_t num_slots;
+    size_t executions, count, profile; // Strings of the sample type and of the label key
+    struct pb samples, mappings, locations, functions;
+    struct pb sample, label, location, line, function; // Messages being encoded
+    bool failed;
+};
+
+static size_t pprof_slot(const struct report_pprof *pp, const char *str)
+{
+    __u64 hash = 0xcbf29ce484222325ULL; // FNV-1a
+    for (const unsigned char *c = (const unsigned char *)str; *c; c++)
+    {
+        hash = (hash ^ *c) * 0x100000001b3ULL;
+    }
+    return (hash ^ (hash >> 32)) & (pp->num_slots - 1);
+}
+
+// Index of a string in the string table (zero, the empty string, when it could not get added)
+static size_t pprof_string(struct report_pprof *pp, const char *str)
+{
+    // Keep the slots at most half full
+    if ((pp->num_strings + 1) * 2 > pp->num_slots)
+    {
+        size_t num_slots = pp->num_slots ? pp->num_slots * 2 : 1024;
+        size_t *slots = calloc(num_slots, sizeof(size_t));
+        if (!slots)
+        {
+            pp->failed = true;
+            return 0;
+        }
+        free(pp->slots);
+        pp->slots = slots;
+        pp->num_slots = num_slots;
+        for (size_t i = 0; i < pp->num_strings; i++)
+        {
+            size_t s = pprof_slot(pp, pp->strings[i]);
+            while (pp->slots[s])
+            {
+                s = (s + 1) & (pp->num_slots - 1);
+            }
+            pp->slots[s] = i + 1;
+        }
+    }
+    size_t s = pprof_slot(pp, str);
+    while (pp->slots[s])
+    {
+        if (strcmp(pp->strings[pp->slots[s] - 1], str) == 0)
+        {
+            return pp->slots[s] - 1;
+        }
+        s = (s + 1) & (pp->num_slots - 1);
+    }
+    char **string = push((void **)&pp->strings, &pp->num_strings, &pp->strings_cap, sizeof(char *));
+    if (!string || !(*string = strdup(str)))
+    {
+        pp->num_strings -= string ? 1 : 0;
+        pp->failed = true;
+        return 0;
+    }
+    pp->slots[s] = pp->num_strings;
+
+    return pp->num_strings - 1;
+}
+
+struct report_pprof *report_pprof_new(void)
+{
+    struct report_pprof *pp = calloc(1, sizeof(struct report_pprof));
+    if (!pp)
+    {
+        return NULL;
+    }
+    // The string table starts with the empty string
+    pprof_string(pp, "");
+    pp->executions = pprof_string(pp, "executions");
+    pp->count = pprof_string(pp, "count");
+    pp->profile = pprof_string(pp, "profile");
+    if (pp->failed)
+    {
+        report_pprof_free(pp);
+        return NULL;
+    }
+
+    return pp;
+}
+
+void report_pprof_free(struct report_pprof *pp)
+{
+    if (!pp)
+    {
+        return;
+    }
+    for (size_t i = 0; i < pp->num_strings; i++)
+    {
+        free(pp->strings[i]);
+    }
+    struct pb *pbs[] = {&pp->samples, &pp->mappings, &pp->locations, &pp->functions, &pp->sample,
+                        &pp->label,   &pp->location, &pp->line,      &pp->function};
+    for (size_t i = 0; i < sizeof(pbs) / sizeof(pbs[0]); i++)
+    {
+        free(pbs[i]->data);
+    }
+    free(pp->strings);
+    free(pp->slots);
+    free(pp->cms);
+    free(pp->first_function);
+    free(pp->first_location);
+    free(pp->has_function);
+    free(pp->has_location);
+    free(pp);
+}
+
+// The mappings (and the ids of the functions and of the locations) of the first report
+static int pprof_layout(struct report_pprof *pp, const struct report *rep, const char *const *programs)
+{
+    pp->cms = calloc(rep->num_cms + 1, sizeof(struct covmap *));
+    pp->first_function = calloc(rep->num_functions + 1, sizeof(size_t));
+    pp->first_location = calloc(rep->num_functions + 1, sizeof(size_t));
+    if (!pp->cms || !pp->first_function || !pp->first_location)
+    {
+        return -ENOMEM;
+    }
+    memcpy(pp->cms, rep->cms, rep->num_cms * sizeof(struct covmap *));
+    pp->num_cms = rep->num_cms;
+    pp->num_functions = rep->num_functions;
+    for (__u32 f = 0; f < rep->num_functions; f++)
+    {
+        pp->first_function[f + 1] = pp->first_function[f] + rep->functions[f].fn->num_files;
+        pp->first_location[f + 1] = pp->first_location[f] + rep->functions[f].fn->num_regions;
+    }
+    pp->has_function = calloc(pp->first_function[rep->num_functions] + 1, sizeof(bool));
+    pp->has_location = calloc(pp->first_location[rep->num_functions] + 1, sizeof(bool));
+    if (!pp->has_function || !pp->has_location)
+    {
+        return -ENOMEM;
+    }
+
+    // The regions of every BPF object have no addresses: they come with their functions, files, and lines
+    struct pb mapping = {0};
+    for (int c = 0; c < rep->num_cms; c++)
+    {
+        pb_uint(&mapping, MAPPING_ID, c + 1);
+        pb_uint(&mapping, MAPPING_FILENAME, pprof_string(pp, programs[c]));
+        pb_uint(&mapping, MAPPING_HAS_FUNCTIONS, 1);
+        pb_uint(&mapping, MAPPING_HAS_FILENAMES, 1);
+        pb_uint(&mapping, MAPPING_HAS_LINE_NUMBERS, 1);
+        pb_uint(&mapping, MAPPING_HAS_INLINE_FRAMES, 1);
+        pb_message(&pp->mappings, PROFILE_MAPPING, &mapping);
+    }
+    free(mapping.data);
+
+    return 0;
+}
+
+// A line of a location, in a file of the function (encoding the function of that file the first time)
+static void pprof_line(struct report_pprof *pp, const struct folded_function *ff, __u32 file,
+                       const struct covmap_region *region)
+{
+    const struct report_function *rf = ff->rf;
+    size_t function = pp->first_function[ff->function] + file;
+    if (!pp->has_function[function])
+    {
+        // It starts on the first line of its regions in the file
+        __u32 start_line = 0;
+        for (__u32 r = 0; r < rf->num_regions; r++)
+        {
+            const struct covmap_region *other = rf->regions[r].region;
+            if (other->file == file && (!start_line || other->line_start < start_line))
+            {
+                start_line = other->line_start;
+            }
+        }
+        size_t name = pprof_string(pp, covmap_string(rf->cm, rf->fn->name));
+        pb_uint(&pp->function, FUNCTION_ID, function + 1);
+        pb_uint(&pp->function, FUNCTION_NAME, name);
+        pb_uint(&pp->function, FUNCTION_SYSTEM_NAME, name);
+        pb_uint(&pp->function, FUNCTION_FILENAME, pprof_string(pp, ff->rep->files[rf->files[file]].name));
+        pb_uint(&pp->function, FUNCTION_START_LINE, start_line);
+        pb_message(&pp->functions, PROFILE_FUNCTION, &pp->function);
+        pp->has_function[function] = true;
+    }
+    pb_uint(&pp->line, LINE_FUNCTION_ID, function + 1);
+    pb_uint(&pp->line, LINE_LINE, region->line_start);
+    pb_uint(&pp->line, LINE_COLUMN, region->col_start);
+    pb_message(&pp->location, LOCATION_LINE, &pp->line);
+}
+
+struct pprof_samples
+{
+    struct report_pprof *pp;
+    size_t label; // Zero for no label
+};
+
+static int pprof_sample(const struct folded_function *ff, int depth, __u64 count, void *ctx)
+{
+    const struct pprof_samples *samples = ctx;
+    struct report_pprof *pp = samples->pp;
+    const struct report_function *rf = ff->rf;
+    const struct counted_region *cr = depth > 0 ? ff->frames[depth - 1] : &rf->regions[0];
+    size_t location = pp->first_location[ff->function] + (cr - rf->regions);
+    if (!pp->has_location[location])
+    {
+        int c;
+        for (c = 0; c < pp->num_cms && pp->cms[c] != rf->cm; c++)
+            ;
+        pb_uint(&pp->location, LOCATION_ID, location + 1);
+        pb_uint(&pp->location, LOCATION_MAPPING_ID, c < pp->num_cms ? c + 1 : 0);
+
+        // The region, then the expansions it comes from (the outermost one last, as the callers of inlined frames)
+        __u32 file = cr->region->file;
+        pprof_line(pp, ff, file, cr->region);
+        for (int d = depth - 2; d >= 0; d--)
+        {
+            const struct covmap_region *region = ff->frames[d]->region;
+            if (region->kind == COVMAP_REGION_EXPANSION && region->expanded_file == file)
+            {
+                file = region->file;
+                pprof_line(pp, ff, file, region);
+            }
+        }
+        pb_message(&pp->locations, PROFILE_LOCATION, &pp->location);
+        pp->has_location[location] = true;
+    }
+    pb_uint(&pp->sample, SAMPLE_LOCATION_ID, location + 1);
+    pb_uint(&pp->sample, SAMPLE_VALUE, count);
+    if (samples->label)
+    {
+        pb_uint(&pp->label, LABEL_KEY, pp->profile);
+        pb_uint(&pp->label, LABEL_STR, samples->label);
+        pb_message(&pp->sample, SAMPLE_LABEL, &pp->label);
+    }
+    pb_message(&pp->samples, PROFILE_SAMPLE, &pp->sample);
+
+    return pp->failed || pp->samples.failed ? -ENOMEM : 0;
+}
+
+int report_pprof_add(struct report_pprof *pp, struct report *rep, const char *const *programs, const char *label)
+{
+    int err = 0;
+    if (!pp->cms)
+    {
+        err = pprof_layout(pp, rep, programs);
+    }
+    else if (rep->num_cms != pp->num_cms || rep->num_functions != pp->num_functions ||
+             memcmp(rep->cms, pp->cms, rep->num_cms * sizeof(struct covmap *)))
+    {
+        err = -EINVAL;
+    }
+    struct pprof_samples samples = {.pp = pp, .label = label ? pprof_string(pp, label) : 0};
+    for (__u32 f = 0; f < rep->num_functions && !err; f++)
+    {
+        const struct report_function *rf = &rep->functions[f];
+        if (rf->num_regions && rf->execution_count)
+        {
+            err = folded_function(rep, f, pprof_sample, &samples);
+        }
+    }
+    if (!err && (pp->failed || pp->samples.failed || pp->mappings.failed || pp->locations.failed ||
+                 pp->functions.failed))
+    {
+        err = -ENOMEM;
+    }
+
+    return err;
+}
+
+int report_pprof_write(struct report_pprof *pp, FILE *outfp)
+{
+    // One sample type for the executions, one execution being the period
+    struct pb profile = {0};
+    struct pb value_type = {0};
+    pb_uint(&value_type, VALUE_TYPE_TYPE, pp->executions);
+    pb_uint(&value_type, VALUE_TYPE_UNIT, pp->count);
+    pb_bytes(&profile, PROFILE_SAMPLE_TYPE, value_type.data, value_type.size);
+    fwrite(profile.data, 1, profile.size, outfp);
+    profile.size = 0;
+    fwrite(pp->samples.data, 1, pp->samples.size, outfp);
+    fwrite(pp->mappings.data, 1, pp->mappings.size, outfp);
+    fwrite(pp->locations.data, 1, pp->locations.size, outfp);
+    fwrite(pp->functions.data, 1, pp->functions.size, outfp);
+    for (size_t i = 0; i < pp->num_strings; i++)
+    {
+        pb_bytes(&profile, PROFILE_STRING_TABLE, pp->strings[i], strlen(pp->strings[i]));
+    }
+    pb_message(&profile, PROFILE_PERIOD_TYPE, &value_type);
+    pb_uint(&profile, PROFILE_PERIOD, 1);
+    fwrite(profile.data, 1, profile.size, outfp);
+    int err = profile.failed ? -ENOMEM : 0;
+    free(profile.data);
+    free(value_type.data);
+    if (!err && ferror(outfp))
+    {
+        err = -EIO;
+    }
+
+    return err;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Spots
+//
+// The functions, the lines, and the code regions of the report with their execution counts, to rank them
+// --------------------------------------------------------------------------------------------------------------------
+
+static int add_function_spots(const struct report *rep, struct report_spot **spots, size_t *num_spots, size_t *capacity)
+{
+    for (__u32 f = 0; f < rep->num_functions; f++)
+    {
+        const struct report_function *rf = &rep->functions[f];
+        if (!rf->num_regions)
+        {
+            continue;
+        }
+        struct report_spot *spot = push((void **)spots, num_spots, capacity, sizeof(struct report_spot));
+        if (!spot)
+        {
+            return -ENOMEM;
+        }
+        const struct covmap_region *region = rf->regions[0].region;
+        *spot = (struct report_spot){
+            .function = covmap_string(rf->cm, rf->fn->name),
+            .file = rep->files[rf->files[0]].name,
+            .line_start = region->line_start,
+            .col_start = region->col_start,
+            .line_end = region->line_end,
+            .col_end = region->col_end,
+            .count = rf->execution_count,
+        };
+    }
+    return 0;
+}
+
+static int add_line_spots(const struct report *rep, struct report_spot **spots, size_t *num_spots, size_t *capacity)
+{
+    int err = 0;
+    for (__u32 file = 0; file < rep->num_files && !err; file++)
+    {
+        struct coverage cov;
+        err = coverage_of_file(rep, file, &cov);
+        if (err)
+        {
+            break;
+        }
+        struct line_iterator it;
+        lines_of(&cov, 1, &it);
+        while (next_line(&it))
+        {
+            if (!it.mapped)
+            {
+                continue;
+            }
+            struct report_spot *spot = push((void **)spots, num_spots, capacity, sizeof(struct report_spot));
+            if (!spot)
+            {
+                err = -ENOMEM;
+                break;
+            }
+            *spot = (struct report_spot){
+                .file = rep->files[file].name,
+                .line_start = it.line,
+                .line_end = it.line,
+                .count = it.count,
+            };
+        }
+        free_coverage(&cov);
+    }
+    return err;
+}
+
+static int add_region_spots(const struct report *rep, struct report_spot **spots, size_t *num_spots, size_t *capacity)
+{
+    for (__u32 f = 0; f < rep->num_functions; f++)
+    {
+        const struct report_function *rf = &rep->functions[f];
+        for (__u32 r = 0; r < rf->num_regions; r++)
+        {
+            const struct counted_region *cr = &rf->regions[r];
+            if (cr->region->kind != COVMAP_REGION_CODE)
+            {
+                continue;
+            }
+            struct report_spot *spot = push((void **)spots, num_spots, capacity, sizeof(struct report_spot));
+            if (!spot)
+            {
+                return -ENOMEM;
+            }
+            *spot = (struct report_spot){
+                .function = covmap_string(rf->cm, rf->fn->name),
+                .file = rep->files[rf->files[cr->region->file]].name,
+                .line_start = cr->region->line_start,
+                .col_start = cr->region->col_start,
+                .line_end = cr->region->line_end,
+                .col_end = cr->region->col_end,
+                .count = cr->count,
+            };
+        }
+    }
+    return 0;
+}
+
+int report_spots(struct report *rep, enum report_spot_kind kind, struct report_spot **spots, size_t *num_spots)
+{
+    size_t capacity = 0;
+    *spots = NULL;
+    *num_spots = 0;
+    int err;
+    switch (kind)
+    {
+    case REPORT_SPOT_FUNCTION:
+        err = add_function_spots(rep, spots, num_spots, &capacity);
+        break;
+    case REPORT_SPOT_LINE:
+        err = add_line_spots(rep, spots, num_spots, &capacity);
+        break;
+    case REPORT_SPOT_REGION:
+        err = add_region_spots(rep, spots, num_spots, &capacity);
+        break;
+    default:
+        err = -EINVAL;
+        break;
+    }
+    if (err)
+    {
+        free(*spots);
+        *spots = NULL;
+        *num_spots = 0;
+    }
+    return err;
+}
+
+// Length of the path suffix two file names share, in whole path components
+static size_t common_suffix(const char *a, const char *b)
+{
+    size_t len_a = strlen(a), len_b = strlen(b);
+    size_t n = 0, whole = 0;
+    while (n < len_a && n < len_b && a[len_a - n - 1] == b[len_b - n - 1])
+    {
+        whole = a[len_a - ++n] == '/' ? n : whole;
+    }
+    if ((n == len_a || a[len_a - n - 1] == '/') && (n == len_b || b[len_b - n - 1] == '/'))
+    {
+        whole = n;
+    }
+    return whole;
+}
+
+int report_region_at(const struct report *rep, const char *file, __u32 line, __u32 col, struct report_spot *spot)
+{
+    // The file with that name, or the one ending with most of its path
+    const struct report_file *found = bsearch(file, rep->files, rep->num_files, sizeof(struct report_file), cmp_file_name);
+    size_t longest = 0;
+    for (__u32 f = 0; !found && f < rep->num_files; f++)
+    {
+        size_t suffix = common_suffix(file, rep->files[f].name);
+        if (suffix > longest)
+        {
+            longest = suffix;
+            found = &rep->files[f];
+        }
+    }
+    if (!found)
+    {
+        return -ENOENT;
+    }
+
+    // Unknown columns are the start of the line
+    struct loc at = {line, col ? col : 1};
+    const struct report_function *innermost_function = NULL;
+    const struct counted_region *innermost = NULL;
+    for (size_t i = 0; i < found->num_functions; i++)
+    {
+        const struct report_function *rf = &rep->functions[found->functions[i]];
+        for (__u32 r = 0; r < rf->num_regions; r++)
+        {
+            const struct counted_region *cr = &rf->regions[r];
+            if (cr->region->kind != COVMAP_REGION_CODE || &rep->files[rf->files[cr->region->file]] != found ||
+                cmp_loc(start_of(cr), at) > 0 || cmp_loc(at, end_of(cr)) > 0)
+            {
+                continue;
+            }
+            int cmp = innermost ? cmp_loc(start_of(cr), start_of(innermost)) : 1;
+            if (cmp > 0 || (cmp == 0 && cmp_loc(end_of(cr), end_of(innermost)) < 0))
+            {
+                innermost_function = rf;
+                innermost = cr;
+            }
+        }
+    }
+    if (!innermost)
+    {
+        return -ENOENT;
+    }
+    *spot = (struct report_spot){
+        .function = covmap_string(innermost_function->cm, innermost_function->fn->name),
+        .file = found->name,
+        .line_start = innermost->region->line_start,
+        .col_start = innermost->region->col_start,
+        .line_end = innermost->region->line_end,
+        .col_end = innermost->region->col_end,
+        .count = innermost->count,
+    };
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// HTML
+//
+// The index page of the HTML reports, like `llvm-cov show` (LLVM 14) writes it: a table with the summary of every
+// source file (with functions), named after their longest common directory, then the totals
+// --------------------------------------------------------------------------------------------------------------------
+
+#define HTML_TAB_SIZE 2
+
+// Like llvm::sys::path::relative_path() then remove_dots(): no root, no '.' components, no 'dir/..' components
+static char *relative_path(const char *path, size_t len)
+{
+    char *out = malloc(len + 1);
+    if (!out)
+    {
+        return NULL;
+    }
+    bool absolute = len > 0 && path[0] == '/';
+    size_t n = 0;
+    for (size_t i = 0; i < len;)
+    {
+        size_t end = i;
+        while (end < len && path[end] != '/')
+        {
+            end++;
+        }
+        const char *component = path + i;
+        size_t component_len = end - i;
+        i = end + 1;
+        if (component_len == 0 || (component_len == 1 && component[0] == '.'))
+        {
+            continue;
+        }
+        if (component_len == 2 && component[0] == '.' && component[1] == '.')
+        {
+            size_t last = n;
+            while (last > 0 && out[last - 1] != '/')
+            {
+                last--;
+            }
+            if (n > 0 && !(n - last == 2 && out[last] == '.' && out[last + 1] == '.'))
+            {
+                n = last > 0 ? last - 1 : 0;
+                continue;
+            }
+            if (absolute)
+            {
+                continue;
+            }
+        }
+        if (n > 0)
+        {
+            out[n++] = '/';
+        }
+        memcpy(out + n, component, component_len);
+        n += component_len;
+    }
+    out[n] = '\0';
+    return out;
+}
+
+char *report_html_page(const char *name)
+{
+    const char *slash = strrchr(name, '/');
+    const char *filename = slash ? slash + 1 : name;
+    char *parent = relative_path(name, slash ? (size_t)(slash - name) : 0);
+    char *page = NULL;
+    if (parent && asprintf(&page, "coverage/%s%s%s.html", parent, parent[0] ? "/" : "", filename) < 0)
+    {
+        page = NULL;
+    }
+    free(parent);
+    return page;
+}
+
+static void html_escape(FILE *outfp, const char *str)
+{
+    unsigned int column = 0;
+    for (const char *c = str; *c; c++, column++)
+    {
+        switch (*c)
+        {
+        case '&':
+            fputs("&amp;", outfp);
+            break;
+        case '<':
+            fputs("&lt;", outfp);
+            break;
+        case '>':
+            fputs("&gt;", outfp);
+            break;
+        case '"':
+            fputs("&quot;", outfp);
+            break;
+        case '\'':
+            fputs("&apos;", outfp);
+            break;
+        case '\t':
+            // Expanded to the next tab stop
+            for (unsigned int spaces = HTML_TAB_SIZE - column % HTML_TAB_SIZE; spaces > 0; spaces--)
+            {
+                fputc(' ', outfp);
+            }
+            column += HTML_TAB_SIZE - column % HTML_TAB_SIZE - 1;
+            break;
+        default:
+            fputc(*c, outfp);
+        }
+    }
+}
+
+// Covered items out of the total (percentages are floats in llvm-cov), green when all of them are, red under 80%
+static void html_cell(FILE *outfp, __u64 covered, __u64 count)
+{
+    float percent = count ? (double)covered / (double)count * 100.0 : 0.0;
+    const char *class = covered == count ? "green" : percent < 80.0 ? "red" : "yellow";
+    fprintf(outfp, "<td class='column-entry-%s'><pre>", class);
+    if (count)
+    {
+        fprintf(outfp, "%7.2f%% ", percent);
+    }
+    else
+    {
+        fputs("- ", outfp);
+    }
+    fprintf(outfp, "(%llu/%llu)</pre></td>", covered, count);
+}
+
+static int html_link(FILE *outfp, const struct report *rep, __u32 file, size_t prefix_len)
+{
+    const char *name = rep->files[file].name + prefix_len;
+    char *page = report_html_page(rep->files[file].name);
+    char *text = relative_path(name, strlen(name));
+    if (!page || !text)
+    {
+        free(page);
+        free(text);
+        return -ENOMEM;
+    }
+    fputs("<a href='", outfp);
+    html_escape(outfp, page);
+    fputs("'>", outfp);
+    html_escape(outfp, text);
+    fputs("</a>", outfp);
+    free(page);
+    free(text);
+    return 0;
+}
+
+static void html_summary_cells(FILE *outfp, const struct report_summary *summary)
+{
+    html_cell(outfp, summary->covered_functions, summary->functions);
+    html_cell(outfp, summary->covered_lines, summary->lines);
+    html_cell(outfp, summary->covered_regions, summary->regions);
+    html_cell(outfp, summary->covered_branches, summary->branches);
+}
+
+// Longest common prefix of the file names, up to a directory separator (none with a single file)
+static size_t common_prefix_len(const struct report *rep)
+{
+    if (rep->num_files < 2)
+    {
+        return 0;
+    }
+    const char *first = rep->files[0].name;
+    size_t len = strlen(first);
+    for (__u32 file = 1; file < rep->num_files; file++)
+    {
+        const char *name = rep->files[file].name;
+        size_t same = 0;
+        while (same < len && name[same] == first[same])
+        {
+            same++;
+        }
+        len = same;
+    }
+    while (len > 0 && first[len - 1] != '/')
+    {
+        len--;
+    }
+    return len;
+}
+
+int report_html_index(struct report *rep, const char *footer, FILE *outfp)
+{
+    char created[32];
+    time_t now = time(NULL);
+    struct tm local;
+    if (!localtime_r(&now, &local) || !strftime(created, sizeof(created), "%Y-%m-%d %H:%M", &local))
+    {
+        created[0] = '\0';
+    }
+    fprintf(outfp, "<!doctype html><html><head><meta name='viewport' content='width=device-width,initial-scale=1'>"
+                   "<meta charset='UTF-8'><link rel='stylesheet' type='text/css' href='style.css'></head><body>"
+                   "<h2>Coverage Report</h2><h4>Created: %s</h4><p>Click "
+                   "<a href='http://clang.llvm.org/docs/SourceBasedCodeCoverage.html#interpreting-reports'>here</a> "
+                   "for information about interpreting this report.</p><div class='centered'><table><tr>"
+                   "<td class='column-entry-bold'>Filename</td><td class='column-entry-bold'>Function Coverage</td>"
+                   "<td class='column-entry-bold'>Line Coverage</td><td class='column-entry-bold'>Region Coverage</td>"
+                   "<td class='column-entry-bold'>Branch Coverage</td></tr>",
+            created);
+
+    size_t prefix_len = common_prefix_len(rep);
+    struct report_summary totals = {0};
+    bool empty_files = false;
+    int err = 0;
+    for (__u32 file = 0; file < rep->num_files && !err; file++)
+    {
+        struct report_summary summary;
+        err = summarize_file(rep, file, &summary);
+        if (err)
+        {
+            break;
+        }
+        add_summary(&totals, &summary);
+        if (!summary.functions)
+        {
+            empty_files = true;
+            continue;
+        }
+        fputs("<tr class='light-row'><td><pre>", outfp);
+        err = html_link(outfp, rep, file, prefix_len);
+        fputs("</pre></td>", outfp);
+        html_summary_cells(outfp, &summary);
+        fputs("</tr>", outfp);
+    }
+    fputs("<tr class='light-row-bold'><td><pre>Totals</pre></td>", outfp);
+    html_summary_cells(outfp, &totals);
+    fputs("</tr></table></div>", outfp);
+
+    // Files without functions (code pulled into other files by the preprocessor) are only linked
+    if (empty_files && !err)
+    {
+        fputs("<p>Files which contain no functions. (These files contain code pulled into other files by the "
+              "preprocessor.)\n</p><div class='centered'><table>",
+              outfp);
+        for (__u32 file = 0; file < rep->num_files && !err; file++)
+        {
+            struct report_summary summary;
+            err = summarize_file(rep, file, &summary);
+            if (err || summary.functions)
+            {
+                continue;
+            }
+            fputs("<tr class='light-row'><td><pre>", outfp);
+            err = html_link(outfp, rep, file, prefix_len);
+            fputs("</pre></td></tr>\n", outfp);
+        }
+        fputs("</table></div>", outfp);
+    }
+    fprintf(outfp, "<h5>%s</h5></body></html>", footer);
+    if (!err && ferror(outfp))
+    {
+        err = -EIO;
+    }
+
+    return err;
+}
@@ -0,0 +1,177 @@
+#ifndef BPFCOV_REPORT_H
+#define BPFCOV_REPORT_H
+
+#include <stdio.h>
+
+#include "covmap.h"
+#include "profdata.h"
+
+/**
+ * The coverage of many BPF objects: the regions of their functions (from their coverage mapping),
+ * with the counts of the indexed profiles.
+ *
+ * It reports the same things `llvm-cov export` reports, without loading the objects and the profiles again.
+ */
+struct report;
+
+/**
+ * What got covered, out of what could be.
+ */
+struct report_summary
+{
+    __u64 regions, covered_regions;
+    __u64 lines, covered_lines;
+    __u64 branches, covered_branches;
+    __u64 functions, covered_functions;
+    __u64 instantiations, covered_instantiations;
+};
+
+/**
+ * Evaluate the regions of the functions of the given coverage mappings.
+ *
+ * Functions the profiles miss did not run: their counts are zero.
+ * Returns NULL when out of memory.
+ */
+struct report *report_new(const struct covmap *const *cms, int num_cms, const struct profdata *pd);
+
+void report_free(struct report *rep);
+
+/**
+ * Write the report in the LCOV tracefile format (like `llvm-cov export --format=lcov`).
+ *
+ * Returns 0 on success, a negative errno otherwise.
+ */
+int report_lcov(struct report *rep, FILE *outfp);
+
+/**
+ * How often a BPF program ran, and for how long, as the kernel accounts it (when BPF_STATS_RUN_TIME is on).
+ */
+struct report_program
+{
+    const char *object;
+    const char *name;
+    __u64 run_cnt;
+    __u64 run_time_ns;
+};
+
+/**
+ * Write the report in the JSON format of `llvm-cov export --format=text`.
+ *
+ * The programs (when any) go in a further "programs" array, with the average time of their runs.
+ * Returns 0 on success, a negative errno otherwise.
+ */
+int report_json(struct report *rep, const struct report_program *programs, size_t num_programs, FILE *outfp);
+
+/**
+ * Write the report as folded stacks for flame graphs (`program;function;region;...;region count`, one for each line).
+ *
+ * The regions nest in the ones containing them, or in the expansions of the macros they come from. Each stack counts
+ * the executions of its last region but the ones of the regions nested in it. The programs name the coverage mappings
+ * of the report (in the order they got given).
+ * Returns 0 on success, a negative errno otherwise.
+ */
+int report_folded(struct report *rep, const char *const *programs, FILE *outfp);
+
+struct report_pprof;
+
+/**
+ * Start a pprof profile (profile.proto, uncompressed) of reports of the same coverage mappings.
+ */
+struct report_pprof *report_pprof_new(void);
+
+void report_pprof_free(struct report_pprof *pp);
+
+/**
+ * Add the samples of a report to the profile: the executions of its code regions but the ones of the regions nested in
+ * them (as the folded stacks count them), at locations with a line for the region and one for each expansion it comes
+ * from. The programs name the coverage mappings of the report, the label (when not NULL) the profile its samples come
+ * from.
+ *
+ * Returns 0 on success, a negative errno otherwise (-EINVAL for a report of other coverage mappings).
+ */
+int report_pprof_add(struct report_pprof *pp, struct report *rep, const char *const *programs, const char *label);
+
+/**
+ * Write the profile, to get compressed with gzip as pprof reads it.
+ *
+ * Returns 0 on success, a negative errno otherwise.
+ */
+int report_pprof_write(struct report_pprof *pp, FILE *outfp);
+
+/**
+ * Number of source files in the report (sorted by name).
+ */
+__u32 report_num_files(const struct report *rep);
+
+const char *report_file_name(const struct report *rep, __u32 file);
+
+/**
+ * Summarize the coverage of a source file.
+ *
+ * Returns 0 on success, a negative errno otherwise.
+ */
+int report_file_summary(struct report *rep, __u32 file, struct report_summary *summary);
+
+/**
+ * Digest of the coverage of a source file: the counts of its lines, regions, branches and expansions, and of the
+ * functions in it (all that its page shows in the HTML reports, but its source).
+ *
+ * Returns 0 on success, a negative errno otherwise.
+ */
+int report_file_digest(struct report *rep, __u32 file, __u64 *digest);
+
+/**
+ * What to rank by execution count: the functions, the lines (of every source file), or the code regions.
+ */
+enum report_spot_kind
+{
+    REPORT_SPOT_FUNCTION,
+    REPORT_SPOT_LINE,
+    REPORT_SPOT_REGION,
+};
+
+/**
+ * A function, a line, or a code region of the report, with its execution count.
+ */
+struct report_spot
+{
+    const char *function; // NULL for lines
+    const char *file;
+    __u32 line_start, col_start; // Columns are 0 for lines
+    __u32 line_end, col_end;
+    __u64 count;
+};
+
+/**
+ * List every function, line, or code region of the report (the caller frees them).
+ *
+ * The order only depends on the coverage mappings: reports of the same ones list the same spots in the same order,
+ * whatever their profiles.
+ * Returns 0 on success, a negative errno otherwise.
+ */
+int report_spots(struct report *rep, enum report_spot_kind kind, struct report_spot **spots, size_t *num_spots);
+
+/**
+ * The innermost code region holding a location of a source file (named as in the report, or ending with the same
+ * path components), as a spot.
+ *
+ * Returns 0 on success, -ENOENT when no code region holds it.
+ */
+int report_region_at(const struct report *rep, const char *file, __u32 line, __u32 col, struct report_spot *spot);
+
+/**
+ * Path of the page of a source file in the HTML reports of `llvm-cov show` (relative to the report directory).
+ *
+ * Returns NULL when out of memory.
+ */
+char *report_html_page(const char *name);
+
+/**
+ * Write the index page of the HTML reports of `llvm-cov show` (summary of every source file, linking its page).
+ *
+ * The footer is the version line `llvm-cov` writes at the bottom of its pages (HTML).
+ * Returns 0 on success, a negative errno otherwise.
+ */
+int report_html_index(struct report *rep, const char *footer, FILE *outfp);
+
+#endif // BPFCOV_REPORT_H
@@ -0,0 +1,114 @@
+// SPDX-License-Identifier: GPL-2.0-only
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_core_read.h>
+#include <bpf/bpf_tracing.h>
+
+#include "sweep.h"
+
+char LICENSE[] SEC("license") = "GPL";
+
+struct chunk
+{
+  char data[SWEEP_CHUNK_SIZE];
+};
+
+struct
+{
+  __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+  __uint(max_entries, 1);
+  __type(key, __u32);
+  __type(value, struct chunk);
+} chunks SEC(".maps");
+
+#define NUM_SUFFIXES 6
+#define MAX_SUFFIX_LEN 7
+
+static const char suffixes[NUM_SUFFIXES][MAX_SUFFIX_LEN] = {"profc", "profd", "profn", "covmap", "profb", "profs"};
+
+// The map names of the bpfcov maps are <object>.<suffix>
+static __always_inline bool is_cov_map(const char *name)
+{
+  int dot = -1;
+  for (int i = 0; i < SWEEP_NAME_LEN && name[i]; i++)
+  {
+    if (name[i] == '.')
+    {
+      dot = i;
+      break;
+    }
+  }
+  if (dot < 0)
+  {
+    return false;
+  }
+
+  for (int s = 0; s < NUM_SUFFIXES; s++)
+  {
+    const char *suffix = suffixes[s];
+    for (int i = 0; i < MAX_SUFFIX_LEN && dot + 1 + i < SWEEP_NAME_LEN; i++)
+    {
+      if (name[dot + 1 + i] != suffix[i])
+      {
+        break;
+      }
+      if (!suffix[i])
+      {
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+SEC("iter/bpf_map")
+int dump_cov_maps(struct bpf_iter__bpf_map *ctx)
+{
+  struct seq_file *seq = ctx->meta->seq;
+  struct bpf_map *map = ctx->map;
+  if (!map)
+  {
+    return 0;
+  }
+
+  struct sweep_record record = {};
+  bpf_probe_read_kernel_str(record.name, sizeof(record.name), map->name);
+  if (!is_cov_map(record.name))
+  {
+    return 0;
+  }
+  record.id = map->id;
+  record.value_size = map->value_size;
+
+  __u32 zero = 0;
+  struct chunk *chunk = bpf_map_lookup_elem(&chunks, &zero);
+  if (!chunk || map->map_type != BPF_MAP_TYPE_ARRAY || map->max_entries != 1 || record.value_size > SWEEP_MAX_VALUE_SIZE)
+  {
+    record.flags = SWEEP_VALUE_OMITTED;
+    bpf_seq_write(seq, &record, sizeof(record));
+    return 0;
+  }
+  bpf_seq_write(seq, &record, sizeof(record));
+
+  // The value of global data maps (single element arrays) sits right after the struct bpf_map in the struct bpf_array
+  unsigned long value = (unsigned long)map - bpf_core_field_offset(struct bpf_array, map) + bpf_core_field_offset(struct bpf_array, value);
+  for (int c = 0; c < SWEEP_MAX_CHUNKS; c++)
+  {
+    __u32 offset = c * SWEEP_CHUNK_SIZE;
+    if (offset >= record.value_size)
+    {
+      break;
+    }
+    __u32 len = record.value_size - offset;
+    if (len > SWEEP_CHUNK_SIZE)
+    {
+      len = SWEEP_CHUNK_SIZE;
+    }
+    // On failure, the chunk gets zeroed: the stream stays in sync anyways
+    bpf_probe_read_kernel(chunk->data, len, (const void *)(value + offset));
+    bpf_seq_write(seq, chunk->data, len);
+  }
+
+  return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef BPFCOV_SWEEP_H
+#define BPFCOV_SWEEP_H
+
+// The values are read in chunks, and every map must fit the seq_file buffer (8 pages) together with its record
+#define SWEEP_CHUNK_SIZE 4096
+#define SWEEP_MAX_CHUNKS 7
+#define SWEEP_MAX_VALUE_SIZE (SWEEP_CHUNK_SIZE * SWEEP_MAX_CHUNKS)
+
+// The value does not follow the record (too big, or not a global data map): read it by map ID instead
+#define SWEEP_VALUE_OMITTED 1
+
+#define SWEEP_NAME_LEN 16
+
+// Every bpfcov map on the host is streamed as a record followed by its value (value_size bytes, unless omitted)
+struct sweep_record
+{
+    __u32 id;
+    __u32 value_size;
+    __u32 flags;
+    __u32 pad;
+    char name[SWEEP_NAME_LEN];
+};
+
+#endif // BPFCOV_SWEEP_H
@@ -10,11 +10,16 @@
 //------------------------------------------------------------------------------
 struct BPFCov : public llvm::PassInfoMixin<BPFCov>
 {
+    BPFCov(bool DoubleBuffered = false) : DoubleBuffered(DoubleBuffered) {}
+
     llvm::PreservedAnalyses run(llvm::Module &M, llvm::ModuleAnalysisManager &MAM);
 
     static bool isRequired() { return true; }
 
     virtual bool runOnModule(llvm::Module &M);
+
+    // Emit two banks of counters plus a bank selector
+    bool DoubleBuffered;
 };
 
 //------------------------------------------------------------------------------
@@ -10,11 +10,15 @@
 //
 // USAGE:
 //    1. Legacy LLVM Pass Manager
-//        opt --load libBPFCov.{so,dylib} [--strip-initializers-only] --bpf-cov <input>
+//        opt --load libBPFCov.{so,dylib} [--strip-initializers-only] [--double-buffered-counters] --bpf-cov <input>
 //
 //    2. New LLVM Pass Manager
 //        opt --load-pass-plugin libBPFCov.{so,dylib} --passes='bpf-cov' <input>
 //
+//        OR (for double-buffered counters)
+//
+//        opt --load-pass-plugin libBPFCov.{so,dylib} --passes='bpf-cov<double-buffered-counters>' <input>
+//
 //        OR
 //
 //        opt --load-pass-plugin libBPFCov.{so,dylib} --passes='default<O2>' <input>
@@ -39,6 +43,7 @@
 #include "llvm/Support/CommandLine.h"
 
 static constexpr char PassArg[] = "bpf-cov";
+static constexpr char DoubleBufferedPassArg[] = "bpf-cov<double-buffered-counters>";
 static constexpr char PassName[] = "BPF Coverage Pass";
 static constexpr char PluginName[] = "BPFCov";
 
@@ -61,6 +66,14 @@ static cl::opt<bool>
         cl::desc("Stop the pass after the initializers have been removed"),
         cl::init(false));
 
+// This emits a second bank of counters (.data.profb) plus a bank selector (.data.profs),
+// so that the counters of the inactive bank can be read and reset without losing increments.
+static cl::opt<bool>
+    DoubleBufferedCounters(
+        "double-buffered-counters",
+        cl::desc("Increment the counters of the bank the selector points to"),
+        cl::init(false));
+
 //---------------------------------------------------------------------------------------------------------------------
 // Utility functions
 //---------------------------------------------------------------------------------------------------------------------
@@ -425,6 +438,144 @@ namespace
         return Changed;
     }
 
+    // Rebuild (as instructions) the constant expression accessing the global From, on top of the pointer To
+    Value *rebaseConstant(IRBuilder<> &Builder, Constant *C, GlobalVariable *From, Value *To)
+    {
+        if (C == From)
+        {
+            return To;
+        }
+        auto *CE = dyn_cast<ConstantExpr>(C);
+        if (!CE)
+        {
+            return C;
+        }
+        auto *I = CE->getAsInstruction();
+        for (unsigned int i = 0; i < I->getNumOperands(); i++)
+        {
+            if (auto *Op = dyn_cast<Constant>(I->getOperand(i)))
+            {
+                I->setOperand(i, rebaseConstant(Builder, Op, From, To));
+            }
+        }
+        return Builder.Insert(I);
+    }
+
+    bool bankCounters(Module &M)
+    {
+        auto &CTX = M.getContext();
+
+        SmallVector<GlobalVariable *, 8> Counters;
+        for (auto gv_iter = M.global_begin(); gv_iter != M.global_end(); gv_iter++)
+        {
+            GlobalVariable *GV = &*gv_iter;
+            if (GV->hasName() && GV->getName().startswith("__profc") && GV->getValueType()->isArrayTy())
+            {
+                Counters.push_back(GV);
+            }
+        }
+        if (Counters.empty())
+        {
+            return false;
+        }
+
+        errs() << "emitting the bank selector\n";
+        auto *I32Ty = Type::getInt32Ty(CTX);
+        auto *Bank = new GlobalVariable(
+            M,
+            /*Ty=*/I32Ty,
+            /*isConstant=*/false,
+            /*Linkage=*/GlobalVariable::ExternalLinkage,
+            /*Initializer=*/ConstantInt::get(I32Ty, 0),
+            /*Name=*/"__bpfcov_bank");
+        Bank->setDSOLocal(true);
+        Bank->setAlignment(MaybeAlign(4));
+        Bank->setSection(".data.profs");
+        appendToUsed(M, Bank);
+
+        // Load the selector once per function, so that every increment of an invocation lands in the same bank
+        DenseMap<Function *, Instruction *> IsSecondBank;
+        auto getIsSecondBank = [&](Function *F) -> Instruction *
+        {
+            auto It = IsSecondBank.find(F);
+            if (It != IsSecondBank.end())
+            {
+                return It->second;
+            }
+            IRBuilder<> Builder(&*F->getEntryBlock().getFirstInsertionPt());
+            auto *Selector = Builder.CreateLoad(I32Ty, Bank, /*isVolatile=*/true, "bpfcov.bank");
+            auto *IsSecond = cast<Instruction>(Builder.CreateICmpNE(Selector, ConstantInt::get(I32Ty, 0), "bpfcov.bank.second"));
+            IsSecondBank[F] = IsSecond;
+            return IsSecond;
+        };
+
+        for (auto *GV : Counters)
+        {
+            auto Name = GV->getName();
+            errs() << "emitting the second bank of " << Name << "\n";
+
+            // Same layout of the first bank, so that the counters offsets (__profd_*.2) hold for both
+            auto *GVB = new GlobalVariable(
+                M,
+                /*Ty=*/GV->getValueType(),
+                /*isConstant=*/false,
+                /*Linkage=*/GlobalVariable::ExternalLinkage,
+                /*Initializer=*/Constant::getNullValue(GV->getValueType()),
+                /*Name=*/"__profb" + Name.drop_front(strlen("__profc")),
+                /*InsertBefore=*/GV);
+            GVB->setDSOLocal(true);
+            GVB->setAlignment(MaybeAlign(GV->getAlignment()));
+            GVB->setSection(".data.profb");
+            appendToUsed(M, GVB);
+
+            // Collect the instructions accessing the counters, directly or through constant expressions
+            SmallVector<std::pair<Instruction *, Constant *>, 8> Accesses;
+            SmallVector<Constant *, 8> Worklist;
+            Worklist.push_back(GV);
+            while (!Worklist.empty())
+            {
+                auto *C = Worklist.pop_back_val();
+                for (auto *U : C->users())
+                {
+                    if (auto *I = dyn_cast<Instruction>(U))
+                    {
+                        if (isa<LoadInst>(I) || isa<StoreInst>(I) || isa<AtomicRMWInst>(I))
+                        {
+                            Accesses.push_back(std::make_pair(I, C));
+                        }
+                    }
+                    else if (auto *CE = dyn_cast<ConstantExpr>(U))
+                    {
+                        Worklist.push_back(CE);
+                    }
+                }
+            }
+
+            // Select the bank once per function (one branch for the BPF verifier to explore),
+            // then access the counters at the same offsets from the selected bank
+            DenseMap<Function *, Value *> Selected;
+            for (auto &Access : Accesses)
+            {
+                auto *I = Access.first;
+                auto *C = Access.second;
+                auto *F = I->getFunction();
+
+                auto It = Selected.find(F);
+                if (It == Selected.end())
+                {
+                    auto *IsSecond = getIsSecondBank(F);
+                    IRBuilder<> Builder(IsSecond->getNextNode());
+                    It = Selected.insert(std::make_pair(F, Builder.CreateSelect(IsSecond, GVB, GV, "bpfcov.counters"))).first;
+                }
+
+                IRBuilder<> Builder(I);
+                I->replaceUsesOfWith(C, rebaseConstant(Builder, C, GV, It->second));
+            }
+        }
+
+        return true;
+    }
+
     bool annotateCounters(Module &M)
     {
         bool Annotated = false;
@@ -447,7 +598,7 @@ namespace
             GlobalVariable *GV = &*gv_iter;
             if (GV->hasName())
             {
-                if (GV->getName().startswith("__profc") && GV->getValueType()->isArrayTy())
+                if ((GV->getName().startswith("__profc") || GV->getName().startswith("__profb")) && GV->getValueType()->isArrayTy())
                 {
                     // Change to DSO local
                     GV->setLinkage(GlobalValue::LinkageTypes::ExternalLinkage);
@@ -519,6 +670,27 @@ namespace
 
                     Annotated = true;
                 }
+                else if (GV->getName() == "__bpfcov_bank")
+                {
+                    auto *DebugGVE = DIB.createGlobalVariableExpression(
+                        /*Context=*/DebugCU,
+                        /*Name=*/GV->getName(),
+                        /*LinkageName=*/"",
+                        /*File=*/DebugFile,
+                        /*LineNo=*/0,
+                        /*Ty=*/DIB.createBasicType("int", 32, dwarf::DW_ATE_signed),
+                        /*IsLocalToUnit=*/GV->hasLocalLinkage(),
+                        /*IsDefinition=*/true,
+                        /*Expr=*/nullptr,
+                        /*Decl=*/nullptr,
+                        /*TemplateParams=*/nullptr,
+                        /*AlignInBits=*/0);
+
+                    GV->addDebugInfo(DebugGVE);
+                    DebugGlobals.push_back(DebugGVE);
+
+                    Annotated = true;
+                }
                 else if (GV->getName().startswith("__profd"))
                 {
                     DIBasicType *Ty;
@@ -686,6 +858,10 @@ bool BPFCov::runOnModule(Module &M)
     instrumented |= swapSectionWithPrefix(M, "__llvm_prf_cnts", ".data.profc");
     instrumented |= swapSectionWithPrefix(M, "__llvm_prf_names", ".rodata.profn");
     instrumented |= convertStructs(M);
+    if (DoubleBuffered || DoubleBufferedCounters)
+    {
+        instrumented |= bankCounters(M);
+    }
     instrumented |= annotateCounters(M);
     instrumented |= swapSectionWithPrefix(M, "__llvm_prf_data", ".rodata.profd");
     instrumented |= swapSectionWithPrefix(M, "__llvm_covmap", ".rodata.covmap");
@@ -740,6 +916,12 @@ PassPluginLibraryInfo getBPFCovPluginInfo()
                             MPM.addPass(BPFCov());
                             return true;
                         }
+                        if (Name.equals(DoubleBufferedPassArg))
+                        {
+                            errs() << "double-buffered-counters: true\n";
+                            MPM.addPass(BPFCov(/*DoubleBuffered=*/true));
+                            return true;
+                        }
                         return false;
                     });
                 // #2 Register for running at "default<O2>" // TODO > double-check
@@ -0,0 +1,594 @@
+#define _GNU_SOURCE
+
+/* C standard library */
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* POSIX */
+#include <unistd.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+/* Linux */
+#include <linux/limits.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "libbpfcov.h"
+
+// --------------------------------------------------------------------------------------------------------------------
+// Global info
+// --------------------------------------------------------------------------------------------------------------------
+
+#define TOOL_NAME "libbpfcov"
+
+#define MAX_OBJECTS 64
+#define NUM_COV_MAPS 4
+#define PROFRAW_HEADER_SIZE 80
+
+enum cov_map
+{
+    MAP_PROFC,
+    MAP_PROFD,
+    MAP_PROFN,
+    MAP_COVMAP,
+};
+
+static const char *cov_map_suffix[NUM_COV_MAPS] = {"profc", "profd", "profn", "covmap"};
+
+// Environment variables driving the runtime
+//  BPFCOV_MODE   = profraw (default) | pin | both
+//  BPFCOV_OUTPUT = profraw path (defaults to <exe>.profraw), "%o" expands to the BPF object name
+//  BPFCOV_BPFFS  = BPF FS path (defaults to /sys/fs/bpf)
+//  BPFCOV_DEBUG  = when set, log to stderr
+struct rt_config
+{
+    bool initialized;
+    bool pin;
+    bool profraw;
+    bool debug;
+    char exe[PATH_MAX];
+    char output[PATH_MAX];
+    char bpffs[PATH_MAX];
+};
+
+struct rt_object
+{
+    const struct bpf_object *obj;
+    char name[BPF_OBJ_NAME_LEN];
+    int fd[NUM_COV_MAPS];
+    __u32 id[NUM_COV_MAPS];
+    __u32 size[NUM_COV_MAPS];
+    void *data[NUM_COV_MAPS]; // Pre-allocated so that flushing never allocates
+    char output[PATH_MAX];
+};
+
+static struct rt_config config;
+static struct rt_object objects[MAX_OBJECTS];
+static int num_objects;
+static struct sigaction prev_actions[NSIG];
+
+#define log_debu(fmt, ...)                                              \
+    do                                                                  \
+    {                                                                   \
+        if (config.debug)                                               \
+            fprintf(stderr, TOOL_NAME ": debu: " fmt, __VA_ARGS__);     \
+    } while (0)
+
+// --------------------------------------------------------------------------------------------------------------------
+// Configuration
+// --------------------------------------------------------------------------------------------------------------------
+
+static void on_exit_flush(void);
+static void on_signal(int signo, siginfo_t *info, void *ucontext);
+
+static void replace_with(char *str, const char what, const char with)
+{
+    while (*str)
+    {
+        if (*str == what)
+        {
+            *str = with;
+        }
+        str++;
+    }
+}
+
+static void install_signal(int signo)
+{
+    struct sigaction act = {};
+    act.sa_sigaction = on_signal;
+    act.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&act.sa_mask);
+    sigaction(signo, &act, &prev_actions[signo]);
+}
+
+static void init(void)
+{
+    if (config.initialized)
+    {
+        return;
+    }
+    config.initialized = true;
+
+    config.debug = getenv("BPFCOV_DEBUG") != NULL;
+
+    const char *mode = getenv("BPFCOV_MODE");
+    if (!mode || strcmp(mode, "profraw") == 0)
+    {
+        config.profraw = true;
+    }
+    else if (strcmp(mode, "pin") == 0)
+    {
+        config.pin = true;
+    }
+    else if (strcmp(mode, "both") == 0)
+    {
+        config.pin = true;
+        config.profraw = true;
+    }
+    else
+    {
+        fprintf(stderr, TOOL_NAME ": erro: unknown BPFCOV_MODE '%s', falling back to 'profraw'\n", mode);
+        config.profraw = true;
+    }
+
+    ssize_t len = readlink("/proc/self/exe", config.exe, sizeof(config.exe) - 1);
+    if (len <= 0)
+    {
+        strcpy(config.exe, "bpfcov");
+        len = strlen(config.exe);
+    }
+    config.exe[len] = '\0';
+
+    const char *output = getenv("BPFCOV_OUTPUT");
+    if (output && *output)
+    {
+        snprintf(config.output, sizeof(config.output), "%s", output);
+    }
+    else
+    {
+        snprintf(config.output, sizeof(config.output), "%s.profraw", config.exe);
+    }
+
+    const char *bpffs = getenv("BPFCOV_BPFFS");
+    snprintf(config.bpffs, sizeof(config.bpffs), "%s", bpffs && *bpffs ? bpffs : "/sys/fs/bpf");
+
+    if (config.profraw)
+    {
+        atexit(on_exit_flush);
+        install_signal(SIGINT);
+        install_signal(SIGTERM);
+        install_signal(SIGHUP);
+    }
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Tracking
+// --------------------------------------------------------------------------------------------------------------------
+
+static int get_cov_map(const char *map_name)
+{
+    const char *suffix = strchr(map_name, '.');
+    if (!suffix)
+    {
+        return -1;
+    }
+    suffix++;
+
+    for (int m = 0; m < NUM_COV_MAPS; m++)
+    {
+        if (strcmp(suffix, cov_map_suffix[m]) == 0)
+        {
+            return m;
+        }
+    }
+
+    return -1;
+}
+
+static int output_path(struct rt_object *o, int idx)
+{
+    // Expand "%o" when present, otherwise suffix all the BPF objects but the first one
+    int len;
+    char *placeholder = strstr(config.output, "%o");
+    if (placeholder)
+    {
+        len = snprintf(o->output, sizeof(o->output), "%.*s%s%s",
+                       (int)(placeholder - config.output), config.output, o->name, placeholder + 2);
+        return len < 0 || (size_t)len >= sizeof(o->output) ? -ENAMETOOLONG : 0;
+    }
+    if (idx == 0)
+    {
+        len = snprintf(o->output, sizeof(o->output), "%s", config.output);
+        return len < 0 || (size_t)len >= sizeof(o->output) ? -ENAMETOOLONG : 0;
+    }
+
+    char stem[PATH_MAX];
+    snprintf(stem, sizeof(stem), "%s", config.output);
+    char *ext = strrchr(stem, '.');
+    char *sep = strrchr(stem, '/');
+    if (ext && (!sep || ext > sep))
+    {
+        *ext = '\0';
+    }
+    len = snprintf(o->output, sizeof(o->output), "%s.%s.profraw", stem, o->name);
+    return len < 0 || (size_t)len >= sizeof(o->output) ? -ENAMETOOLONG : 0;
+}
+
+static int pin_maps(struct rt_object *o)
+{
+    char prog_root[PATH_MAX];
+    int len = snprintf(prog_root, sizeof(prog_root), "%s/cov", config.bpffs);
+    if (len >= PATH_MAX)
+    {
+        return -ENAMETOOLONG;
+    }
+    if (mkdir(prog_root, 0700) && errno != EEXIST)
+    {
+        return -errno;
+    }
+
+    // Same layout of `bpfcov run`, so that `bpfcov gen` works on top of it
+    char *exe_name = strrchr(config.exe, '/');
+    exe_name = exe_name ? exe_name + 1 : config.exe;
+    len = snprintf(prog_root, sizeof(prog_root), "%s/cov/%s", config.bpffs, exe_name);
+    if (len >= PATH_MAX)
+    {
+        return -ENAMETOOLONG;
+    }
+    replace_with(prog_root + strlen(config.bpffs), '.', '_'); // Sanitize because BPF FS doesn't accept dots
+    if (mkdir(prog_root, 0700) && errno != EEXIST)
+    {
+        return -errno;
+    }
+
+    // Every BPF object has its own directory
+    char object_root[PATH_MAX];
+    len = snprintf(object_root, sizeof(object_root), "%s/%s", prog_root, o->name);
+    if (len >= PATH_MAX)
+    {
+        return -ENAMETOOLONG;
+    }
+    if (mkdir(object_root, 0700) && errno != EEXIST)
+    {
+        return -errno;
+    }
+
+    for (int m = 0; m < NUM_COV_MAPS; m++)
+    {
+        char pin_path[PATH_MAX];
+        len = snprintf(pin_path, sizeof(pin_path), "%s/%s", object_root, cov_map_suffix[m]);
+        if (len >= PATH_MAX)
+        {
+            return -ENAMETOOLONG;
+        }
+        if (bpf_obj_pin(o->fd[m], pin_path))
+        {
+            if (errno == EEXIST)
+            {
+                log_debu("pin '%s' already exists for object '%s'\n", pin_path, o->name);
+                continue;
+            }
+            return -errno;
+        }
+        log_debu("pin map '%s.%s' to '%s'\n", o->name, cov_map_suffix[m], pin_path);
+    }
+
+    return 0;
+}
+
+static void release(struct rt_object *o)
+{
+    for (int m = 0; m < NUM_COV_MAPS; m++)
+    {
+        if (o->fd[m] >= 0)
+        {
+            close(o->fd[m]);
+        }
+        free(o->data[m]);
+    }
+    memset(o, 0, sizeof(*o));
+}
+
+int bpfcov_register(struct bpf_object *obj)
+{
+    init();
+
+    if (!obj)
+    {
+        return -EINVAL;
+    }
+
+    // Gather its maps first: a BPF object loaded after another got closed can have the same address
+    struct rt_object tracked = {};
+    struct rt_object *o = &tracked;
+    o->obj = obj;
+    for (int m = 0; m < NUM_COV_MAPS; m++)
+    {
+        o->fd[m] = -1;
+    }
+
+    int found = 0;
+    struct bpf_map *map;
+    bpf_object__for_each_map(map, obj)
+    {
+        const char *map_name = bpf_map__name(map);
+        int m = get_cov_map(map_name);
+        if (m < 0 || o->fd[m] >= 0)
+        {
+            continue;
+        }
+        if (!found)
+        {
+            snprintf(o->name, sizeof(o->name), "%.*s", (int)(strchr(map_name, '.') - map_name), map_name);
+        }
+
+        struct bpf_map_info info = {};
+        __u32 info_len = sizeof(info);
+        if (bpf_obj_get_info_by_fd(bpf_map__fd(map), &info, &info_len) || info.max_entries != 1)
+        {
+            continue;
+        }
+
+        // Keep our own reference so that the maps outlive the BPF object (eg. skeleton destroyed before exit)
+        o->fd[m] = fcntl(bpf_map__fd(map), F_DUPFD_CLOEXEC, 0);
+        if (o->fd[m] < 0)
+        {
+            continue;
+        }
+        o->id[m] = info.id;
+        o->size[m] = info.value_size;
+        o->data[m] = calloc(1, info.value_size);
+        if (!o->data[m])
+        {
+            release(o);
+            return -ENOMEM;
+        }
+        found++;
+    }
+
+    if (found != NUM_COV_MAPS)
+    {
+        // Not an object instrumented with bpfcov
+        log_debu("skipping BPF object (%d of %d coverage maps found)\n", found, NUM_COV_MAPS);
+        release(o);
+        return 0;
+    }
+
+    // Already tracked when it has the same maps, reloaded when only its address is the same (drop the stale maps)
+    int slot = num_objects;
+    for (int i = 0; i < num_objects; i++)
+    {
+        if (objects[i].id[MAP_PROFC] == o->id[MAP_PROFC])
+        {
+            release(o);
+            return 0;
+        }
+        if (objects[i].obj == obj)
+        {
+            log_debu("BPF object '%s' got reloaded, dropping its previous maps\n", objects[i].name);
+            slot = i;
+        }
+    }
+    if (slot == MAX_OBJECTS)
+    {
+        release(o);
+        return -ENOSPC;
+    }
+
+    int err = output_path(o, slot);
+    if (err)
+    {
+        fprintf(stderr, TOOL_NAME ": erro: could not track BPF object '%s': %s\n", o->name, strerror(-err));
+        release(o);
+        return err;
+    }
+    log_debu("tracking BPF object '%s' (output '%s')\n", o->name, o->output);
+
+    if (config.pin)
+    {
+        err = pin_maps(o);
+        if (err)
+        {
+            fprintf(stderr, TOOL_NAME ": erro: could not pin maps of BPF object '%s': %s\n", o->name, strerror(-err));
+        }
+    }
+
+    if (slot < num_objects)
+    {
+        release(&objects[slot]);
+    }
+    objects[slot] = tracked;
+    if (slot == num_objects)
+    {
+        num_objects++;
+    }
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Flushing
+// --------------------------------------------------------------------------------------------------------------------
+
+static int write_profraw(struct rt_object *o)
+{
+    __u32 key = 0;
+    for (int m = 0; m < NUM_COV_MAPS; m++)
+    {
+        if (bpf_map_lookup_elem(o->fd[m], &key, o->data[m]))
+        {
+            return -errno;
+        }
+    }
+
+    // Same layout `bpfcov gen` writes
+    long long int header[PROFRAW_HEADER_SIZE / sizeof(long long int)];
+    unsigned char magic[8] = {0x81, 0x72, 0x66, 0x6F, 0x72, 0x70, 0x6C, 0xFF};
+    memcpy(&header[0], magic, sizeof(magic));
+    header[1] = 0;
+    memcpy(&header[1], &((char *)o->data[MAP_COVMAP])[12], 4); // Version is the 3rd int in the coverage mapping header
+    header[1] += 1;                                            // Version is 0 indexed
+    header[2] = o->size[MAP_PROFD] / 48;                       // 5 x i64 + 2 x i32 for each function
+    header[3] = 0;                                             // Padding before counters
+    header[4] = o->size[MAP_PROFC] / 8;                        // 1 x i64 for each counter element
+    header[5] = 0;                                             // Padding after counters
+    header[6] = o->size[MAP_PROFN];                            // Names size
+    header[7] = 0;                                             // Counters delta (nulled)
+    header[8] = 0;                                             // Names delta (nulled)
+    header[9] = 1;                                             // IPVK last
+
+    static const char padding[8] = {};
+    struct iovec iov[] = {
+        {.iov_base = header, .iov_len = sizeof(header)},
+        {.iov_base = o->data[MAP_PROFD], .iov_len = o->size[MAP_PROFD]},
+        {.iov_base = o->data[MAP_PROFC], .iov_len = o->size[MAP_PROFC]},
+        {.iov_base = o->data[MAP_PROFN], .iov_len = o->size[MAP_PROFN]},
+        {.iov_base = (void *)padding, .iov_len = 7 & (16 - o->size[MAP_PROFN] % 16)}, // Align to 8 bytes
+    };
+
+    int fd = open(o->output, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        return -errno;
+    }
+    ssize_t expected = 0;
+    for (size_t i = 0; i < sizeof(iov) / sizeof(iov[0]); i++)
+    {
+        expected += iov[i].iov_len;
+    }
+    int err = writev(fd, iov, sizeof(iov) / sizeof(iov[0])) == expected ? 0 : -EIO;
+    close(fd);
+
+    return err;
+}
+
+int bpfcov_flush(void)
+{
+    int err = 0;
+    for (int i = 0; i < num_objects; i++)
+    {
+        int e = write_profraw(&objects[i]);
+        if (e)
+        {
+            err = e;
+        }
+    }
+    return err;
+}
+
+static void on_exit_flush(void)
+{
+    int err = bpfcov_flush();
+    if (err)
+    {
+        fprintf(stderr, TOOL_NAME ": erro: could not write the profraw: %s\n", strerror(-err));
+    }
+}
+
+static void on_signal(int signo, siginfo_t *info, void *ucontext)
+{
+    int saved_errno = errno;
+    bpfcov_flush();
+    errno = saved_errno;
+
+    struct sigaction *prev = &prev_actions[signo];
+    if (prev->sa_flags & SA_SIGINFO)
+    {
+        prev->sa_sigaction(signo, info, ucontext);
+    }
+    else if (prev->sa_handler == SIG_DFL)
+    {
+        // Restore the default disposition and terminate as we would have done without us
+        sigaction(signo, prev, NULL);
+        raise(signo);
+    }
+    else if (prev->sa_handler != SIG_IGN)
+    {
+        prev->sa_handler(signo);
+    }
+}
+
+// --------------------------------------------------------------------------------------------------------------------
+// Hooks
+// --------------------------------------------------------------------------------------------------------------------
+
+#ifdef BPFCOV_RT_WRAP
+
+// Static linking: -Wl,--wrap=bpf_object__load -Wl,--wrap=bpf_object__load_skeleton
+
+int __real_bpf_object__load(struct bpf_object *obj);
+int __real_bpf_object__load_skeleton(struct bpf_object_skeleton *s);
+
+int __wrap_bpf_object__load(struct bpf_object *obj)
+{
+    int err = __real_bpf_object__load(obj);
+    if (!err)
+    {
+        bpfcov_register(obj);
+    }
+    return err;
+}
+
+int __wrap_bpf_object__load_skeleton(struct bpf_object_skeleton *s)
+{
+    int err = __real_bpf_object__load_skeleton(s);
+    if (!err)
+    {
+        bpfcov_register(*s->obj);
+    }
+    return err;
+}
+
+#else
+
+// Dynamic linking: LD_PRELOAD=libbpfcov.so, the loader must use the shared libbpf
+
+int bpf_object__load(struct bpf_object *obj)
+{
+    static int (*real)(struct bpf_object *);
+    if (!real)
+    {
+        real = dlsym(RTLD_NEXT, "bpf_object__load");
+        if (!real)
+        {
+            return -ENOSYS;
+        }
+    }
+
+    int err = real(obj);
+    if (!err)
+    {
+        bpfcov_register(obj);
+    }
+    return err;
+}
+
+int bpf_object__load_skeleton(struct bpf_object_skeleton *s)
+{
+    static int (*real)(struct bpf_object_skeleton *);
+    if (!real)
+    {
+        real = dlsym(RTLD_NEXT, "bpf_object__load_skeleton");
+        if (!real)
+        {
+            return -ENOSYS;
+        }
+    }
+
+    int err = real(s);
+    if (!err)
+    {
+        bpfcov_register(*s->obj);
+    }
+    return err;
+}
+
+#endif
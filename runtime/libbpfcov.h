@@ -0,0 +1,33 @@
+#ifndef LIBBPFCOV_H
+#define LIBBPFCOV_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct bpf_object;
+
+/**
+ * Track the bpfcov maps (.profc, .profd, .profn, .covmap) of a loaded BPF object.
+ *
+ * Calling it is not needed when the loader runs with libbpfcov.so preloaded,
+ * or when it links libbpfcov.a with the --wrap flags (see the README).
+ *
+ * Returns 0 on success, a negative errno otherwise.
+ */
+int bpfcov_register(struct bpf_object *obj);
+
+/**
+ * Write the profraw file of every tracked BPF object now.
+ *
+ * It only uses async-signal-safe calls, so it can be invoked from signal handlers.
+ *
+ * Returns 0 on success, a negative errno otherwise.
+ */
+int bpfcov_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LIBBPFCOV_H